@@ -94,6 +94,131 @@ actor_commands (
         nut_agent.TTL (timeout * 2 / 1000);
         zstr_free (&polling);
     }
+    else
+    if (streq (cmd, ACTION_WORKERS)) {
+        char *workers = zmsg_popstr (message);
+        if (!workers) {
+            log_error (
+                "Expected multipart string format: WORKERS/value. "
+                "Received WORKERS/nullptr");
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        int count = atoi (workers);
+        if (count < 1) {
+            log_error ("invalid WORKERS value '%s', using one connection instead", workers);
+            count = 1;
+        }
+        nut_agent.setWorkers (count);
+        zstr_free (&workers);
+    }
+    else
+    if (streq (cmd, ACTION_POLLING_BOUNDS)) {
+        char *min_ms = zmsg_popstr (message);
+        char *max_ms = zmsg_popstr (message);
+        if (!min_ms || !max_ms) {
+            log_error (
+                "Expected multipart string format: POLLING_BOUNDS/min_ms/max_ms. "
+                "Received POLLING_BOUNDS/%s/%s", min_ms ? min_ms : "nullptr", max_ms ? max_ms : "nullptr");
+            zstr_free (&min_ms);
+            zstr_free (&max_ms);
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        int64_t lower = atoll (min_ms), upper = atoll (max_ms);
+        if (lower < 0 || upper < 0) {
+            log_error ("invalid POLLING_BOUNDS values '%s'/'%s', keeping the polling interval instead", min_ms, max_ms);
+            lower = upper = 0;
+        }
+        nut_agent.setPollingBounds (lower, upper);
+        zstr_free (&min_ms);
+        zstr_free (&max_ms);
+    }
+    else
+    if (streq (cmd, ACTION_POLLING_BUDGET)) {
+        char *budget = zmsg_popstr (message);
+        if (!budget) {
+            log_error (
+                "Expected multipart string format: POLLING_BUDGET/value. "
+                "Received POLLING_BUDGET/nullptr");
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        double value = atof (budget);
+        if (value < 0) {
+            log_error ("invalid POLLING_BUDGET value '%s', using no limit instead", budget);
+            value = 0;
+        }
+        nut_agent.setPollingBudget (value);
+        zstr_free (&budget);
+    }
+    else
+    if (streq (cmd, ACTION_HEARTBEAT)) {
+        char *heartbeat = zmsg_popstr (message);
+        if (!heartbeat) {
+            log_error (
+                "Expected multipart string format: HEARTBEAT/value. "
+                "Received HEARTBEAT/nullptr");
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        int64_t value = atoll (heartbeat);
+        if (value < 0) {
+            log_error ("invalid HEARTBEAT value '%s', publishing all metrics at every poll instead", heartbeat);
+            value = 0;
+        }
+        nut_agent.setHeartbeat (value);
+        zstr_free (&heartbeat);
+    }
+    else
+    if (streq (cmd, ACTION_BATCH)) {
+        char *batch = zmsg_popstr (message);
+        char *fanout = zmsg_popstr (message);
+        if (!batch || !fanout) {
+            log_error (
+                "Expected multipart string format: BATCH/batch/fanout. "
+                "Received BATCH/%s/%s", batch ? batch : "nullptr", fanout ? fanout : "nullptr");
+            zstr_free (&batch);
+            zstr_free (&fanout);
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        nut_agent.setBatching (streq (batch, "true"), !streq (fanout, "false"));
+        zstr_free (&batch);
+        zstr_free (&fanout);
+    }
+    else
+    if (streq (cmd, ACTION_PUBLISH_QUEUE)) {
+        char *capacity = zmsg_popstr (message);
+        char *overflow = zmsg_popstr (message);
+        if (!capacity || !overflow) {
+            log_error (
+                "Expected multipart string format: PUBLISH_QUEUE/capacity/overflow. "
+                "Received PUBLISH_QUEUE/%s/%s", capacity ? capacity : "nullptr", overflow ? overflow : "nullptr");
+            zstr_free (&capacity);
+            zstr_free (&overflow);
+            zstr_free (&cmd);
+            zmsg_destroy (message_p);
+            return 0;
+        }
+        long long value = atoll (capacity);
+        if (value < 1) {
+            log_error ("invalid PUBLISH_QUEUE capacity '%s', using %d", capacity, PUBLISH_QUEUE_CAPACITY);
+            value = PUBLISH_QUEUE_CAPACITY;
+        }
+        PublishQueue::Overflow policy = PublishQueue::COALESCE;
+        if (!PublishQueue::parseOverflow (overflow, policy))
+            log_error ("invalid PUBLISH_QUEUE overflow policy '%s', using %s", overflow,
+                    PublishQueue::overflowName (policy));
+        nut_agent.setPublishQueue (static_cast<size_t> (value), policy);
+        zstr_free (&capacity);
+        zstr_free (&overflow);
+    }
     else {
         log_warning ("Command '%s' is unknown or not implemented", cmd);
     }
@@ -263,6 +388,8 @@ actor_commands_test (bool verbose)
     assert (actor_polling == 0);
     assert (nut_agent.isMappingLoaded () == true);
     assert (nut_agent.TTL () == 60);
+    // with the deadbands
+    assert (nut_agent.publishFilter ().deadband ("voltage.input.L1-N").relative);
 
     // $TERM
     message = zmsg_new ();
@@ -287,6 +414,121 @@ actor_commands_test (bool verbose)
     assert (nut_agent.isMappingLoaded () == true);
     assert (nut_agent.TTL () == 300);
 
+    // WORKERS
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_WORKERS);
+    zmsg_addstr (message, "4");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (actor_polling == 150000);
+    assert (nut_agent.TTL () == 300);
+
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_WORKERS);
+    zmsg_addstr (message, "none");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+
+    // POLLING_BOUNDS
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_POLLING_BOUNDS);
+    zmsg_addstr (message, "500");
+    zmsg_addstr (message, "600000");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (nut_agent.scheduler ().minInterval () == 500);
+    assert (nut_agent.scheduler ().maxInterval () == 600000);
+
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_POLLING_BOUNDS);
+    zmsg_addstr (message, "500");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (nut_agent.scheduler ().minInterval () == 500);
+
+    // POLLING_BUDGET
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_POLLING_BUDGET);
+    zmsg_addstr (message, "250.5");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (nut_agent.scheduler ().budget () == 250.5);
+    assert (actor_polling == 150000);
+
+    // HEARTBEAT
+    assert (nut_agent.heartbeat () == NUT_METRICS_HEARTBEAT_MS);
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_HEARTBEAT);
+    zmsg_addstr (message, "600000");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (nut_agent.heartbeat () == 600000);
+    assert (nut_agent.TTL () == 300);
+
+    // BATCH
+    assert (!nut_agent.batching () && nut_agent.fanout ());
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_BATCH);
+    zmsg_addstr (message, "true");
+    zmsg_addstr (message, "false");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (nut_agent.batching () && !nut_agent.fanout ());
+
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_BATCH);
+    zmsg_addstr (message, "true");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (nut_agent.batching () && !nut_agent.fanout ());
+
+    STDERR_NON_EMPTY
+
+    // PUBLISH_QUEUE
+    fp = freopen ("stderr.txt", "w+", stderr);
+    assert (nut_agent.publisher ().queue ().capacity () == PUBLISH_QUEUE_CAPACITY);
+    assert (nut_agent.publisher ().queue ().overflow () == PublishQueue::COALESCE);
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_PUBLISH_QUEUE);
+    zmsg_addstr (message, "16");
+    zmsg_addstr (message, "drop_oldest");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (nut_agent.publisher ().queue ().capacity () == 16);
+    assert (nut_agent.publisher ().queue ().overflow () == PublishQueue::DROP_OLDEST);
+
+    STDERR_EMPTY
+
+    fp = freopen ("stderr.txt", "w+", stderr);
+    message = zmsg_new ();
+    assert (message);
+    zmsg_addstr (message, ACTION_PUBLISH_QUEUE);
+    zmsg_addstr (message, "0");
+    zmsg_addstr (message, "newest");
+    rv = actor_commands (client, &message, actor_polling, nut_agent);
+    assert (rv == 0);
+    assert (message == NULL);
+    assert (nut_agent.publisher ().queue ().capacity () == PUBLISH_QUEUE_CAPACITY);
+    assert (nut_agent.publisher ().queue ().overflow () == PublishQueue::COALESCE);
+
     STDERR_NON_EMPTY
 
     zmsg_destroy (&message);
@@ -124,22 +124,20 @@ alert_actor (zsock_t *pipe, void *args)
     zsock_signal (pipe, 0);
     log_debug ("alert actor started");
 
-    uint64_t last = zclock_mono ();
     while (!zsys_interrupted) {
-        void *which = zpoller_wait (poller, polling);
-        uint64_t now = zclock_mono ();
-        if (now - last >= polling) {
-            last = now;
-            log_debug ("Polling data now");
-            devices.updateDeviceList ();
-            devices.updateFromNUT ();
-            devices.publishRules (mb_client);
-            devices.publishAlerts (client);
-        }
+        // Each device is handled in its own slot of the polling interval,
+        // instead of all of them at once
+        int64_t timeout = devices.pollTimeout (zclock_mono ());
+        if (timeout < 0 || timeout > static_cast<int64_t> (polling))
+            timeout = polling;
+        void *which = zpoller_wait (poller, static_cast<int> (timeout));
+        int64_t now = zclock_mono ();
+        devices.updateDeviceList ();
+        devices.poll (client, mb_client, now);
         if (which == NULL) {
-            log_debug ("aa: alert update");
+            continue;
         }
-        else if (which == pipe) {
+        if (which == pipe) {
             zmsg_t *msg = zmsg_recv (pipe);
             if (msg) {
                 int quit = alert_actor_commands (client, mb_client, &msg, polling);
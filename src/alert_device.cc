@@ -110,17 +110,16 @@ Device::addAlert(const std::string& quantity, const std::map<std::string,std::ve
 }
 
 int
-Device::scanCapabilities (nut::TcpClient& conn)
+Device::scanCapabilities (const NutSnapshot& snapshot)
 {
     log_debug ("aa: scanning capabilities for %s", assetName().c_str());
-    if (!conn.isConnected ()) return 0;
     std::string prefix = daisychainPrefix();
 
     _alerts.clear();
     try {
-        auto nutDevice = conn.getDevice(_nutName);
-        if (! nutDevice.isOk()) { throw std::runtime_error("device " + assetName() + " is not configured in NUT yet"); }
-        auto vars = nutDevice.getVariableValues();
+        const NutSnapshot::Variables *found = snapshot.find(_nutName);
+        if (!found) { throw std::runtime_error("device " + assetName() + " has not been read from NUT yet"); }
+        const NutSnapshot::Variables& vars = *found;
         if (vars.empty ()) return 0;
         if (vars.find (prefix + "ambient.temperature.status") != vars.cend()) {
             addAlert ("ambient.temperature", vars);
@@ -322,18 +321,18 @@ Device::publishRule (mlm_client_t *client, DeviceAlert& alert)
 }
 
 void
-Device::update (nut::TcpClient& conn)
+Device::update (const NutSnapshot& snapshot)
 {
-    auto nutDevice = conn.getDevice(_nutName);
-    if (! nutDevice.isOk()) return;
+    const NutSnapshot::Variables *vars = snapshot.find(_nutName);
+    if (! vars) return;
+    NutMemberView member (*vars, chain());
     for (auto &it: _alerts) {
         try {
-            std::string prefix = daisychainPrefix();
-            auto value = nutDevice.getVariableValue (prefix + it.first + ".status");
-            if (value.empty ()) {
+            const std::string *value = member.value (it.first + ".status");
+            if (! value) {
                 log_debug ("aa: %s on %s is not present", it.first.c_str (), assetName().c_str ());
             } else {
-                std::string newStatus =  value[0];
+                const std::string& newStatus = *value;
                 log_debug ("aa: %s on %s is %s", it.first.c_str (), assetName().c_str (), newStatus.c_str());
                 if (it.second.status != newStatus) {
                     it.second.timestamp = ::time(NULL);
@@ -387,6 +386,15 @@ alert_device_test (bool verbose)
     assert(dev._alerts["ambient.temperature"].lowCritical == "5");
     assert(dev._alerts["ambient.temperature"].highWarning == "80");
     assert(dev._alerts["ambient.temperature"].highCritical == "100");
+
+    // the status of the alerts is taken from the snapshot
+    dev.nutName("ups");
+    std::string humidity = dev._alerts["ambient.humidity"].status;
+    NutSnapshot snapshot;
+    snapshot.add("ups", { { "ambient.temperature.status", { "high-warning" } } });
+    dev.update(snapshot);
+    assert(dev._alerts["ambient.temperature"].status == "high-warning");
+    assert(dev._alerts["ambient.humidity"].status == humidity);
     //  @end
     printf (" OK\n");
 }
@@ -25,8 +25,8 @@
 #include "alert_device_alert.h"
 #include "alert_actor.h"
 #include "asset_state.h"
+#include "nut_snapshot.h"
 
-#include <nutclient.h>
 #include <malamute.h>
 #include <memory>
 #include <string>
@@ -60,8 +60,8 @@ class Device {
     }
     int scanned () const { return _scanned; }
 
-    void update (nut::TcpClient &conn);
-    int scanCapabilities (nut::TcpClient &conn);
+    void update (const NutSnapshot& snapshot);
+    int scanCapabilities (const NutSnapshot& snapshot);
     void publishAlerts (mlm_client_t *client, uint64_t ttl);
     void publishRules (mlm_client_t *client);
 
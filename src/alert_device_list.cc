@@ -22,7 +22,6 @@
 #include <fty_log.h>
 
 #include <malamute.h>
-#include <nutclient.h>
 #include <exception>
 
 Devices::Devices (StateManager::Reader *reader)
@@ -32,34 +31,32 @@ Devices::Devices (StateManager::Reader *reader)
 
 void Devices::updateFromNUT ()
 {
-    try {
-        nut::TcpClient nutClient;
-        nutClient.connect ("localhost", 3493);
-        updateDeviceCapabilities (nutClient);
-        updateDevices (nutClient);
-        nutClient.disconnect();
-    } catch (std::exception& e) {
-        log_error ("reading data from NUT: %s", e.what ());
-    }
+    // The NUT actor reads the devices, take its last snapshot
+    std::shared_ptr<const NutSnapshot> snapshot = NutSnapshots.get ();
+    if (!snapshot)
+        return;
+    updateDeviceCapabilities (*snapshot);
+    updateDevices (*snapshot);
 }
 
-void Devices::updateDevices(nut::TcpClient& nutClient)
+void Devices::updateDevices(const NutSnapshot& snapshot)
 {
     for (auto& it : _devices) {
-        it.second.update (nutClient);
+        it.second.update (snapshot);
     }
 }
 
-void Devices::updateDeviceCapabilities (nut::TcpClient& nutClient)
+void Devices::updateDeviceCapabilities (const NutSnapshot& snapshot)
 {
     for (auto& it : _devices) {
-        if (! it.second.scanned ()) it.second.scanCapabilities (nutClient);
+        if (! it.second.scanned ()) it.second.scanCapabilities (snapshot);
     }
 }
 
 void Devices::addIfNotPresent (Device dev) {
     auto it = _devices.find (dev.assetName ());
     if (it == _devices.end ()) {
+        _scheduler.add (dev.assetName (), zclock_mono ());
         _devices[dev.assetName ()] = dev;
         return;
     }
@@ -74,45 +71,44 @@ void Devices::addIfNotPresent (Device dev) {
 
 void Devices::updateDeviceList()
 {
-    if (!_state_reader->refresh())
+    AssetState::ChangeSet changes;
+    if (!_state_reader->refresh(&changes))
         return;
     const AssetState& deviceState = _state_reader->getState();
     auto& devices = deviceState.getPowerDevices();
 
-    log_debug("aa: updating device list");
-    for (auto i : devices) {
-        const std::string& ip = i.second->IP();
-        if (ip.empty()) {
-            // this is strange. No IP?
-            continue;
-        }
-        const std::string& name = i.first;
-        switch(i.second->daisychain()) {
-        case 0:
-            addIfNotPresent(Device(i.second));
-            break;
-        default:
-            auto master = deviceState.ip2master(ip);
-            if (master.empty()) {
-                log_error("Daisychain host for %s not found", name.c_str());
-            } else {
-                addIfNotPresent(Device(i.second, master));
-            }
-            break;
-        }
+    log_debug("aa: updating device list (%zu added, %zu updated, %zu removed)",
+            changes.added.size(), changes.updated.size(),
+            changes.removed.size());
+    for (const auto& name : changes.removed) {
+        _devices.erase(name);
+        _scheduler.remove(name);
     }
-    // remove devices
-    auto it = _devices.begin();
-    while ( it != _devices.end ()) {
-        // XXX: Instead of doing these lookups, we could color the elements
-        // in _devices with alternating colors and simply erase elements with
-        // the old color here
-        if (devices.count(it->first) == 0) {
-            auto tbd = it;
-            ++it;
-            _devices.erase (tbd);
-        } else {
-            ++it;
+    const std::set<std::string>* modified[] = { &changes.added, &changes.updated };
+    for (auto names : modified) {
+        for (const auto& name : *names) {
+            // The change set also lists sensors
+            auto i = devices.find(name);
+            if (i == devices.end())
+                continue;
+            const std::string& ip = i->second->IP();
+            if (ip.empty()) {
+                // this is strange. No IP?
+                continue;
+            }
+            switch(i->second->daisychain()) {
+            case 0:
+                addIfNotPresent(Device(i->second));
+                break;
+            default:
+                auto master = deviceState.ip2master(ip);
+                if (master.empty()) {
+                    log_error("Daisychain host for %s not found", name.c_str());
+                } else {
+                    addIfNotPresent(Device(i->second, master));
+                }
+                break;
+            }
         }
     }
 }
@@ -133,6 +129,34 @@ void Devices::publishRules (mlm_client_t *client)
     }
 }
 
+void Devices::poll (mlm_client_t *client, mlm_client_t *mb_client, int64_t now)
+{
+    std::vector<std::string> due;
+    _scheduler.due (now, due);
+    _scheduler.report ("aa", now);
+    if (due.empty ())
+        return;
+    std::shared_ptr<const NutSnapshot> snapshot = NutSnapshots.get ();
+    for (const auto& name : due) {
+        auto it = _devices.find (name);
+        if (it == _devices.end ())
+            continue;
+        Device& device = it->second;
+        if (snapshot) {
+            if (! device.scanned ()) device.scanCapabilities (*snapshot);
+            device.update (*snapshot);
+        }
+        if (mb_client) device.publishRules (mb_client);
+        if (client) device.publishAlerts (client, (_polling_ms / 1000) * 3);
+    }
+}
+
+void Devices::setPollingMs (uint64_t polling_ms)
+{
+    _polling_ms = polling_ms;
+    _scheduler.setInterval (polling_ms, zclock_mono ());
+}
+
 
 //  --------------------------------------------------------------------------
 //  Self test of this class
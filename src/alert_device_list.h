@@ -23,6 +23,8 @@
 
 #include "state_manager.h"
 #include "alert_device.h"
+#include "nut_snapshot.h"
+#include "poll_scheduler.h"
 
 class Devices {
  public:
@@ -31,9 +33,14 @@ class Devices {
     void updateDeviceList ();
     void publishAlerts (mlm_client_t *client);
     void publishRules (mlm_client_t *client);
-    void setPollingMs (uint64_t polling_ms) {
-        _polling_ms = polling_ms;
+    // Updates the devices whose slot has come from the last NUT snapshot
+    // and publishes their rules and alerts
+    void poll (mlm_client_t *client, mlm_client_t *mb_client, int64_t now);
+    // Time until the next device is due, -1 if there are no devices
+    int64_t pollTimeout (int64_t now) const {
+        return _scheduler.timeout (now);
     }
+    void setPollingMs (uint64_t polling_ms);
 
     // friend function for unit-testing
     friend void alert_actor_test (bool verbose);
@@ -41,9 +48,10 @@ class Devices {
     uint64_t _polling_ms = 30000;
     std::map <std::string, Device>  _devices;
     std::unique_ptr<StateManager::Reader> _state_reader;
+    PollScheduler _scheduler;
 
-    void updateDeviceCapabilities (nut::TcpClient& nutClient);
-    void updateDevices (nut::TcpClient& nutClient);
+    void updateDeviceCapabilities (const NutSnapshot& snapshot);
+    void updateDevices (const NutSnapshot& snapshot);
     void addIfNotPresent (Device dev);
 };
 
@@ -0,0 +1,375 @@
+/*  =========================================================================
+    asset_snapshot - Persistent copy of the asset state for warm startup
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    asset_snapshot - Persistent copy of the asset state for warm startup
+@discuss
+@end
+*/
+
+#include "asset_snapshot.h"
+#include <fty_log.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = { 'F', 'T', 'Y', 'N', 'U', 'T', 'A', 'S' };
+// Increment whenever the layout of the header or of the records changes
+const uint32_t SNAPSHOT_VERSION = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    int32_t license_limit;
+    uint32_t checksum;
+    uint64_t payload_size;
+};
+
+enum RecordKind : uint8_t {
+    KIND_POWERDEVICE = 0,
+    KIND_SENSOR = 1,
+};
+
+enum RecordFlags : uint8_t {
+    FLAG_HAVE_UPSCONF_BLOCK = 1,
+    FLAG_UPSCONF_ENABLE_DMF = 2,
+};
+
+// FNV-1a, enough to detect a truncated or garbled file
+uint32_t checksum(const char *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void put(std::string& buf, const T& value)
+{
+    buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void putString(std::string& buf, const std::string& s)
+{
+    put(buf, static_cast<uint32_t>(s.size()));
+    buf.append(s);
+}
+
+// Bounds-checked reader of the mapped payload
+class Cursor {
+public:
+    Cursor(const char *data, size_t size)
+        : pos_(data)
+        , end_(data + size)
+    {
+    }
+    template <typename T>
+    bool get(T& value)
+    {
+        if (static_cast<size_t>(end_ - pos_) < sizeof(value))
+            return false;
+        memcpy(&value, pos_, sizeof(value));
+        pos_ += sizeof(value);
+        return true;
+    }
+    bool getString(std::string& s)
+    {
+        uint32_t len;
+        if (!get(len) || static_cast<size_t>(end_ - pos_) < len)
+            return false;
+        s.assign(pos_, len);
+        pos_ += len;
+        return true;
+    }
+    bool atEnd() const
+    {
+        return pos_ == end_;
+    }
+private:
+    const char *pos_;
+    const char *end_;
+};
+
+} // namespace
+
+bool AssetSnapshot::save(const AssetState& state, const std::string& path)
+{
+    std::string payload;
+    uint32_t count = 0;
+    auto serialize = [&](const AssetState::AssetMap& map, RecordKind kind) {
+        for (const auto& i : map) {
+            const AssetState::Asset& asset = *i.second;
+            uint8_t flags = 0;
+            if (asset.have_upsconf_block_)
+                flags |= FLAG_HAVE_UPSCONF_BLOCK;
+            if (asset.upsconf_enable_dmf_)
+                flags |= FLAG_UPSCONF_ENABLE_DMF;
+            put(payload, static_cast<uint8_t>(kind));
+            put(payload, flags);
+            put(payload, static_cast<int32_t>(asset.daisychain_));
+            put(payload, asset.max_current_);
+            put(payload, asset.max_power_);
+            putString(payload, asset.name_);
+            putString(payload, asset.IP_);
+            putString(payload, asset.port_);
+            putString(payload, asset.subtype_);
+            putString(payload, asset.location_);
+            putString(payload, asset.upsconf_block_);
+            count++;
+        }
+    };
+    serialize(state.powerdevices_, KIND_POWERDEVICE);
+    serialize(state.sensors_, KIND_SENSOR);
+
+    Header header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.count = count;
+    header.license_limit = state.license_limit_;
+    header.checksum = checksum(payload.data(), payload.size());
+    header.payload_size = payload.size();
+
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0640);
+    if (fd < 0) {
+        log_error("Cannot create asset snapshot %s: %s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = write(fd, &header, sizeof(header)) == sizeof(header) &&
+        write(fd, payload.data(), payload.size()) == static_cast<ssize_t>(payload.size()) &&
+        fsync(fd) == 0;
+    if (!ok)
+        log_error("Cannot write asset snapshot %s: %s", tmp.c_str(), strerror(errno));
+    close(fd);
+    if (ok && rename(tmp.c_str(), path.c_str()) < 0) {
+        log_error("Cannot rename asset snapshot to %s: %s", path.c_str(), strerror(errno));
+        ok = false;
+    }
+    if (!ok)
+        unlink(tmp.c_str());
+    return ok;
+}
+
+bool AssetSnapshot::load(AssetState& state, const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+        log_info("No asset snapshot %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        log_warning("Asset snapshot %s is too short", path.c_str());
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error("Cannot map asset snapshot %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    const char *data = static_cast<const char *>(map);
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    const char *payload = data + sizeof(header);
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SNAPSHOT_VERSION ||
+            header.payload_size != size - sizeof(header) ||
+            header.checksum != checksum(payload, header.payload_size)) {
+        log_warning("Ignoring incompatible or corrupt asset snapshot %s", path.c_str());
+        munmap(map, size);
+        return false;
+    }
+
+    // Parse everything before touching the state, so that a bad record
+    // leaves it unmodified
+    std::vector<std::pair<uint8_t, std::shared_ptr<AssetState::Asset> > > assets;
+    // A record takes at least 46 bytes, do not trust the count blindly
+    assets.reserve(std::min<uint64_t>(header.count, header.payload_size / 46));
+    Cursor cursor(payload, header.payload_size);
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < header.count; i++) {
+        std::shared_ptr<AssetState::Asset> asset(new AssetState::Asset());
+        uint8_t kind, flags;
+        int32_t daisychain;
+        ok = cursor.get(kind) && cursor.get(flags) && cursor.get(daisychain) &&
+            cursor.get(asset->max_current_) && cursor.get(asset->max_power_) &&
+            cursor.getString(asset->name_) && cursor.getString(asset->IP_) &&
+            cursor.getString(asset->port_) && cursor.getString(asset->subtype_) &&
+            cursor.getString(asset->location_) &&
+            cursor.getString(asset->upsconf_block_) &&
+            (kind == KIND_POWERDEVICE || kind == KIND_SENSOR);
+        asset->daisychain_ = daisychain;
+        asset->have_upsconf_block_ = flags & FLAG_HAVE_UPSCONF_BLOCK;
+        asset->upsconf_enable_dmf_ = flags & FLAG_UPSCONF_ENABLE_DMF;
+        assets.emplace_back(kind, asset);
+    }
+    munmap(map, size);
+    if (!ok || !cursor.atEnd()) {
+        log_warning("Ignoring corrupt asset snapshot %s", path.c_str());
+        return false;
+    }
+
+    state.setLicenseLimit(header.license_limit);
+    for (const auto& i : assets) {
+        const std::string& name = i.second->name();
+        if (i.first == KIND_POWERDEVICE)
+            state.updatePowerDevice(name, i.second);
+        else
+            state.sensors_.insert_or_assign(name, i.second);
+        state.touched_.insert(name);
+    }
+    log_info("Loaded %zu assets from snapshot %s", assets.size(), path.c_str());
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+asset_snapshot_test (bool verbose)
+{
+    printf (" * asset_snapshot: ");
+
+    //  @selftest
+    char path[] = "/tmp/asset_snapshot_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    AssetState state;
+    const char *names[] = { "ups-1", "epdu-2", "epdu-3", "sensor-4" };
+    for (auto name : names) {
+        fty_proto_t *msg = fty_proto_new(FTY_PROTO_ASSET);
+        assert(msg);
+        std::string subtype(name, strchr(name, '-') - name);
+        fty_proto_set_name(msg, "%s", name);
+        fty_proto_set_operation(msg, FTY_PROTO_ASSET_OP_CREATE);
+        fty_proto_aux_insert(msg, "type", "device");
+        fty_proto_aux_insert(msg, "subtype", "%s", subtype.c_str());
+        fty_proto_aux_insert(msg, "parent_name.1", "ups-1");
+        fty_proto_ext_insert(msg, "ip.1", "192.0.2.2");
+        fty_proto_ext_insert(msg, "port", "%s", name + strlen(name) - 1);
+        fty_proto_ext_insert(msg, "daisy_chain", "%s", name + strlen(name) - 1);
+        fty_proto_ext_insert(msg, "max_current", "16.5");
+        if (strcmp(name, "ups-1") == 0) {
+            fty_proto_ext_insert(msg, "upsconf_block", "\tdriver=snmp-ups\n");
+            fty_proto_ext_insert(msg, "upsconf_enable_dmf", "true");
+        }
+        assert(state.updateFromProto(msg));
+        fty_proto_destroy(&msg);
+    }
+    fty_proto_t *msg = fty_proto_new(FTY_PROTO_METRIC);
+    assert(msg);
+    fty_proto_set_name(msg, "rackcontroller-0");
+    fty_proto_set_type(msg, "power_nodes.max_active");
+    fty_proto_set_value(msg, "2");
+    assert(state.updateFromProto(msg));
+    fty_proto_destroy(&msg);
+    assert(AssetSnapshot::save(state, path));
+
+    {
+        // Round trip
+        AssetState loaded;
+        assert(AssetSnapshot::load(loaded, path));
+        assert(loaded.getAllPowerDevices().size() == 3);
+        assert(loaded.getPowerDevices().size() == 2);
+        assert(loaded.getPowerDevices().count("epdu-2") == 1);
+        assert(loaded.getPowerDevices().count("epdu-3") == 1);
+        assert(loaded.getSensors().size() == 1);
+        const AssetState::Asset& ups = *loaded.getAllPowerDevices().at("ups-1");
+        assert(ups.name() == "ups-1");
+        assert(ups.IP() == "192.0.2.2");
+        assert(ups.port() == "1");
+        assert(ups.subtype() == "ups");
+        assert(ups.location() == "ups-1");
+        assert(ups.have_upsconf_block());
+        assert(ups.upsconf_block() == "\tdriver=snmp-ups\n");
+        assert(ups.upsconf_enable_dmf());
+        assert(ups.daisychain() == 1);
+        assert(ups.maxCurrent() == 16.5);
+        assert(std::isnan(ups.maxPower()));
+        const AssetState::Asset& epdu = *loaded.getAllPowerDevices().at("epdu-3");
+        assert(!epdu.have_upsconf_block());
+        assert(!epdu.upsconf_enable_dmf());
+        assert(epdu.daisychain() == 3);
+        // ip2master is rebuilt while loading
+        assert(loaded.ip2master("192.0.2.2") == "ups-1");
+        // All loaded assets are reported by the next commit
+        AssetState empty;
+        loaded.computeChanges(empty);
+        assert(loaded.getChanges()->added.size() == 3);
+    }
+    {
+        // Corrupt file
+        fd = open(path, O_WRONLY);
+        assert(fd >= 0);
+        assert(pwrite(fd, "X", 1, sizeof(Header) + 10) == 1);
+        close(fd);
+        AssetState loaded;
+        assert(!AssetSnapshot::load(loaded, path));
+        assert(loaded.getAllPowerDevices().empty());
+        assert(loaded.getAllSensors().empty());
+    }
+    {
+        // Truncated file and unknown version
+        assert(AssetSnapshot::save(state, path));
+        assert(truncate(path, sizeof(Header) + 20) == 0);
+        AssetState loaded;
+        assert(!AssetSnapshot::load(loaded, path));
+        assert(AssetSnapshot::save(state, path));
+        fd = open(path, O_WRONLY);
+        assert(fd >= 0);
+        uint32_t version = SNAPSHOT_VERSION + 1;
+        assert(pwrite(fd, &version, sizeof(version), offsetof(Header, version)) == sizeof(version));
+        close(fd);
+        assert(!AssetSnapshot::load(loaded, path));
+        assert(loaded.getAllPowerDevices().empty());
+    }
+    {
+        // Missing file
+        unlink(path);
+        AssetState loaded;
+        assert(!AssetSnapshot::load(loaded, path));
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,57 @@
+/*  =========================================================================
+    asset_snapshot - Persistent copy of the asset state for warm startup
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef ASSET_SNAPSHOT_H_INCLUDED
+#define ASSET_SNAPSHOT_H_INCLUDED
+
+/*
+ * AssetSnapshot stores the power devices, sensors and license limit of an
+ * AssetState in a file, so that fty-nut can start polling right after a
+ * restart, before the initial ASSETS requests to fty-asset complete.
+ *
+ * The file starts with a fixed header (magic, format version, number of
+ * records, license limit, payload size and checksum) followed by one record
+ * per asset. Integers are stored in host byte order, the file is not meant
+ * to be moved to another machine. It is written to a temporary file which is
+ * then renamed, so readers never see a partial snapshot. Loading maps the
+ * file into memory and builds the assets directly from the mapping.
+ */
+
+#include <string>
+
+#include "asset_state.h"
+
+#define ASSET_SNAPSHOT_PATH "/var/lib/fty/fty-nut/assets.snapshot"
+
+class AssetSnapshot {
+public:
+    // Writes the state to path. Returns false on error
+    static bool save(const AssetState& state, const std::string& path);
+    // Adds the assets stored in path to state, which is supposed to be
+    // empty. Returns false if the file is missing, of a different version
+    // or corrupt, in which case state is left unmodified
+    static bool load(AssetState& state, const std::string& path);
+};
+
+//  Self test of this class
+void asset_snapshot_test (bool verbose);
+
+#endif
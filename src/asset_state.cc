@@ -30,6 +30,7 @@
 #include <fty_common_mlm.h>
 #include <fty_log.h>
 
+#include <algorithm>
 #include <iterator>
 #include <cmath>
 
@@ -72,7 +73,7 @@ bool AssetState::handleAssetMessage(fty_proto_t* message)
     if (operation == FTY_PROTO_ASSET_OP_DELETE ||
         operation == FTY_PROTO_ASSET_OP_RETIRE ||
         !streq(fty_proto_aux_string (message, FTY_PROTO_ASSET_STATUS, "active"), "active")) {
-        return (powerdevices_.erase(name) > 0 || sensors_.erase(name) > 0);
+        return removeAsset(name);
     }
 
     std::string type(fty_proto_aux_string (message, "type", ""));
@@ -104,7 +105,12 @@ bool AssetState::handleAssetMessage(fty_proto_t* message)
                 operation.c_str());
         return false;
     }
-    (*map)[name] = std::shared_ptr<Asset>(new Asset(message));
+    std::shared_ptr<Asset> asset(new Asset(message));
+    if (map == &powerdevices_)
+        updatePowerDevice(name, asset);
+    else
+        map->insert_or_assign(name, asset);
+    touched_.insert(name);
     return true;
 }
 
@@ -114,13 +120,27 @@ bool AssetState::handleLicensingMessage(fty_proto_t* message)
     assert (fty_proto_id(message) == FTY_PROTO_METRIC);
     if (streq (fty_proto_name(message), "rackcontroller-0") && streq (fty_proto_type(message), "power_nodes.max_active")) {
         try {
-            license_limit_ = std::stoi(fty_proto_value(message));
+            int limit = std::stoi(fty_proto_value(message));
+            // The metric is republished periodically
+            if (limit == license_limit_)
+                return false;
+            setLicenseLimit(limit);
             return true;
         } catch (...) { }
     }
     return false;
 }
 
+bool AssetState::removeAsset(const std::string& name)
+{
+    if (powerdevices_.count(name))
+        erasePowerDevice(name);
+    else if (sensors_.erase(name) == 0)
+        return false;
+    touched_.insert(name);
+    return true;
+}
+
 bool AssetState::updateFromProto(fty_proto_t* message)
 {
     // proto messages are always assumed to be asset updates
@@ -147,40 +167,221 @@ bool AssetState::updateFromProto(zmsg_t* message)
     return ret;
 }
 
-void AssetState::recompute()
+void AssetState::chainInsert(const Asset& asset)
 {
-    ip2master_.clear();
-    for (auto i : powerdevices_) {
-        const std::string& ip = i.second->IP();
-        if (ip == "") {
-            // this is strange. No IP?
-            continue;
+    if (asset.IP().empty())
+        return;
+    auto i = ip_chains_.find(asset.IP());
+    std::shared_ptr<IpChain> chain = i == ip_chains_.end() ?
+        std::make_shared<IpChain>() : std::make_shared<IpChain>(*i->second);
+    if (asset.daisychain() <= 1)
+        chain->masters.insert(asset.name());
+    else
+        chain->slaves.insert(asset.name());
+    ip_chains_.insert_or_assign(asset.IP(), chain);
+}
+
+void AssetState::chainErase(const Asset& asset)
+{
+    auto i = ip_chains_.find(asset.IP());
+    if (i == ip_chains_.end())
+        return;
+    std::shared_ptr<IpChain> chain = std::make_shared<IpChain>(*i->second);
+    chain->masters.erase(asset.name());
+    chain->slaves.erase(asset.name());
+    if (chain->masters.empty() && chain->slaves.empty())
+        ip_chains_.erase(asset.IP());
+    else
+        ip_chains_.insert_or_assign(asset.IP(), chain);
+}
+
+// The license window is only adjusted at its end, so that each update costs
+// O(log N) regardless of the number of power devices. Devices moving in or
+// out of the window are recorded in touched_
+void AssetState::updatePowerDevice(const std::string& name,
+        const std::shared_ptr<Asset>& asset)
+{
+    auto old = powerdevices_.find(name);
+    if (old != powerdevices_.end())
+        chainErase(*old->second);
+    chainInsert(*asset);
+    bool added = powerdevices_.insert_or_assign(name, asset);
+    if (license_limit_ < 0) {
+        allowed_powerdevices_ = powerdevices_;
+        return;
+    }
+    if (!added) {
+        if (allowed_powerdevices_.count(name))
+            allowed_powerdevices_.insert_or_assign(name, asset);
+        return;
+    }
+    if (allowed_powerdevices_.size() < static_cast<size_t>(license_limit_)) {
+        allowed_powerdevices_.insert_or_assign(name, asset);
+        return;
+    }
+    // The window is full, the new device pushes out the last one if it
+    // sorts before it
+    if (allowed_powerdevices_.empty() ||
+            !(name < allowed_powerdevices_.back().first))
+        return;
+    std::string last = allowed_powerdevices_.back().first;
+    allowed_powerdevices_.insert_or_assign(name, asset);
+    allowed_powerdevices_.erase(last);
+    touched_.insert(last);
+}
+
+void AssetState::erasePowerDevice(const std::string& name)
+{
+    auto old = powerdevices_.find(name);
+    chainErase(*old->second);
+    powerdevices_.erase(name);
+    if (license_limit_ < 0) {
+        allowed_powerdevices_ = powerdevices_;
+        return;
+    }
+    if (allowed_powerdevices_.erase(name) == 0 ||
+            allowed_powerdevices_.size() == powerdevices_.size())
+        return;
+    // The first device after the window moves into it
+    growLicenseWindow();
+}
+
+void AssetState::growLicenseWindow()
+{
+    auto next = allowed_powerdevices_.empty() ? powerdevices_.begin() :
+        powerdevices_.upper_bound(allowed_powerdevices_.back().first);
+    allowed_powerdevices_.insert_or_assign(next->first, next->second);
+    touched_.insert(next->first);
+}
+
+// If a limit is set, simply allow a prefix of powerdevices_. If requested, we
+// could come up with some more fancy sorting...
+void AssetState::setLicenseLimit(int limit)
+{
+    license_limit_ = limit;
+    if (license_limit_ < 0) {
+        if (!allowed_powerdevices_.sameAs(powerdevices_)) {
+            auto it = allowed_powerdevices_.empty() ? powerdevices_.begin() :
+                powerdevices_.upper_bound(allowed_powerdevices_.back().first);
+            for (; it != powerdevices_.end(); ++it)
+                touched_.insert(it->first);
         }
-        if (i.second->daisychain() <= 1) {
-            // this is master
-            ip2master_[ip] = i.first;
+        allowed_powerdevices_ = powerdevices_;
+        return;
+    }
+    size_t size = std::min(static_cast<size_t>(license_limit_), powerdevices_.size());
+    while (allowed_powerdevices_.size() > size) {
+        std::string last = allowed_powerdevices_.back().first;
+        allowed_powerdevices_.erase(last);
+        touched_.insert(last);
+    }
+    while (allowed_powerdevices_.size() < size)
+        growLicenseWindow();
+}
+
+const AssetState::Asset* AssetState::findVisible(const std::string& name) const
+{
+    auto i = allowed_powerdevices_.find(name);
+    if (i != allowed_powerdevices_.end())
+        return i->second.get();
+    i = sensors_.find(name);
+    if (i != sensors_.end())
+        return i->second.get();
+    return nullptr;
+}
+
+// Only the touched assets need to be compared, plus the slaves of a
+// daisy-chain master that changed
+void AssetState::computeChanges(const AssetState& previous)
+{
+    std::shared_ptr<ChangeSet> changes = std::make_shared<ChangeSet>();
+    auto classify = [&](const std::string& name) {
+        const Asset *before = previous.findVisible(name);
+        const Asset *after = findVisible(name);
+        if (before == after)
+            return;
+        if (!before)
+            changes->added.insert(name);
+        else if (!after)
+            changes->removed.insert(name);
+        else
+            changes->updated.insert(name);
+    };
+    std::set<std::string> master_ips;
+    for (const auto& name : touched_) {
+        classify(name);
+        const AssetMap *maps[] = { &previous.powerdevices_, &powerdevices_ };
+        for (auto map : maps) {
+            auto i = map->find(name);
+            if (i != map->end() && i->second->daisychain() <= 1 &&
+                    !i->second->IP().empty())
+                master_ips.insert(i->second->IP());
         }
     }
-    // If a limit is set, simply copy a prefix of powerdevices_ to
-    // allowed_powerdevices_ If requested, we could come up with some more
-    // fancy sorting...
-    allowed_powerdevices_.clear();
-    AssetMap::const_iterator end;
-    if (license_limit_ < 0 || static_cast<size_t>(license_limit_) >= powerdevices_.size()) {
-        end = powerdevices_.end();
-    } else {
-        end = powerdevices_.begin();
-        std::advance(end, license_limit_);
+    touched_.clear();
+    for (auto it = master_ips.begin(); it != master_ips.end(); ) {
+        if (previous.ip2master(*it) == ip2master(*it))
+            it = master_ips.erase(it);
+        else
+            ++it;
+    }
+    for (const auto& ip : master_ips) {
+        auto chain = ip_chains_.find(ip);
+        if (chain == ip_chains_.end())
+            continue;
+        for (const auto& name : chain->second->slaves) {
+            if (findVisible(name) && !changes->added.count(name))
+                changes->updated.insert(name);
+        }
+    }
+    changes_ = changes;
+}
+
+void AssetState::getAllAsAdded(ChangeSet& changes) const
+{
+    changes.clear();
+    for (const auto& i : allowed_powerdevices_)
+        changes.added.insert(i.first);
+    for (const auto& i : sensors_)
+        changes.added.insert(i.first);
+}
+
+void AssetState::ChangeSet::clear()
+{
+    added.clear();
+    removed.clear();
+    updated.clear();
+}
+
+void AssetState::ChangeSet::merge(const ChangeSet& next)
+{
+    for (const auto& name : next.added) {
+        // Removed and added again: the caller knows a different object
+        if (removed.erase(name))
+            updated.insert(name);
+        else
+            added.insert(name);
+    }
+    for (const auto& name : next.removed) {
+        // Added and removed again: the caller never saw it
+        if (added.erase(name))
+            continue;
+        updated.erase(name);
+        removed.insert(name);
+    }
+    for (const auto& name : next.updated) {
+        if (!added.count(name))
+            updated.insert(name);
     }
-    allowed_powerdevices_ = AssetMap(powerdevices_.cbegin(), end);
 }
 
 const std::string& AssetState::ip2master(const std::string& ip) const
 {
     static const std::string empty;
 
-    const auto i = ip2master_.find(ip);
-    if (i == ip2master_.cend())
+    const auto i = ip_chains_.find(ip);
+    if (i == ip_chains_.end() || i->second->masters.empty())
         return empty;
-    return i->second;
+    // With several masters on one IP, the last one by name wins
+    return *i->second->masters.rbegin();
 }
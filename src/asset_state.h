@@ -22,10 +22,12 @@
 #ifndef ASSET_STATE_H_INCLUDED
 #define ASSET_STATE_H_INCLUDED
 
-#include <unordered_map>
+#include "persistent_map.h"
+
 #include <ftyproto.h>
 #include <memory>
 #include <map>
+#include <set>
 
 class AssetState {
 public:
@@ -80,6 +82,8 @@ public:
             return daisychain_;
         }
     private:
+        // Used by AssetSnapshot, which fills in all the members
+        Asset() { }
         std::string name_;
         std::string IP_;
         std::string port_;
@@ -91,6 +95,24 @@ public:
         bool have_upsconf_block_;
         bool upsconf_enable_dmf_;
         int daisychain_;
+        friend class AssetSnapshot;
+    };
+    // Names of the assets that changed between two versions of the state.
+    // Only the assets visible via getPowerDevices() and getSensors() are
+    // considered. An asset is reported as updated if its Asset object has
+    // been replaced (even with identical contents) or if its daisy-chain
+    // master changed
+    struct ChangeSet {
+        std::set<std::string> added;
+        std::set<std::string> removed;
+        std::set<std::string> updated;
+        bool empty() const
+        {
+            return added.empty() && removed.empty() && updated.empty();
+        }
+        void clear();
+        // Append the changes that happened after this change set
+        void merge(const ChangeSet& next);
     };
     // Update the state from a received fty_proto message. Return true if an
     // update has actually been performed, false if the message was skipped
@@ -98,11 +120,22 @@ public:
     // Same for encoded proto messages or licensing messages which are not
     // proto. Note that this overload destroys the passed zmsg
     bool updateFromProto(zmsg_t* message);
-    // Build the ip2master map and the list of allowed devices
-    void recompute();
-    // Use a std::map to process the assets in a defined order each time
-    // Additions and removals do not happen _that_ often to worry about
-    typedef std::map<std::string, std::shared_ptr<Asset> > AssetMap;
+    // Remove an asset regardless of its type. Return true if it existed
+    bool removeAsset(const std::string& name);
+    // Compute the changes with respect to the previously committed state
+    void computeChanges(const AssetState& previous);
+    // Return the changes made by the commit that produced this state, or
+    // null for the initial state
+    const std::shared_ptr<const ChangeSet>& getChanges() const
+    {
+        return changes_;
+    }
+    // Fill changes with all the visible assets, as if they were just added
+    void getAllAsAdded(ChangeSet& changes) const;
+    // Use an ordered map to process the assets in a defined order each time.
+    // The map is persistent, so that the StateManager can take a snapshot of
+    // the state at each commit without copying all the assets
+    typedef PersistentMap<std::string, std::shared_ptr<Asset> > AssetMap;
     // Return a map of power devices allowed by the current license
     const AssetMap& getPowerDevices() const
     {
@@ -130,13 +163,36 @@ public:
 private:
     bool handleAssetMessage(fty_proto_t* message);
     bool handleLicensingMessage(fty_proto_t* message);
+    const Asset* findVisible(const std::string& name) const;
+    void updatePowerDevice(const std::string& name, const std::shared_ptr<Asset>& asset);
+    void erasePowerDevice(const std::string& name);
+    void chainInsert(const Asset& asset);
+    void chainErase(const Asset& asset);
+    void growLicenseWindow();
+    void setLicenseLimit(int limit);
     AssetMap powerdevices_;
-    // subset of powerdevices_ that are allowed by the license
+    // subset of powerdevices_ that are allowed by the license. This is the
+    // prefix of powerdevices_ of length license_limit_, maintained along
+    // with powerdevices_. It shares the tree of powerdevices_ if there is
+    // no limit
     AssetMap allowed_powerdevices_;
     AssetMap sensors_;
-    std::unordered_map<std::string, std::string> ip2master_;
+    // Power devices sharing an IP address: the daisy-chain master(s) and
+    // the slaves. Entries are copied on modification, since they are shared
+    // between snapshots
+    struct IpChain {
+        std::set<std::string> masters;
+        std::set<std::string> slaves;
+    };
+    typedef PersistentMap<std::string, std::shared_ptr<const IpChain> > IpChainMap;
+    IpChainMap ip_chains_;
     // -1 for no limit, otherwise number of powerdevices to allow
     int license_limit_ = -1;
+    // Names of the assets modified or moved in or out of the license window
+    // since the last commit
+    std::set<std::string> touched_;
+    std::shared_ptr<const ChangeSet> changes_;
+    friend class AssetSnapshot;
 };
 
 #endif
@@ -0,0 +1,365 @@
+/*  =========================================================================
+    fake_upsd - Stand-in NUT daemon for the selftests
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fake_upsd - Stand-in NUT daemon for the selftests
+@discuss
+@end
+*/
+
+#include "fake_upsd.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cassert>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// Quotes a value the way upsd does
+static std::string
+s_quote(const std::string& value)
+{
+    std::string result = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result + "\"";
+}
+
+static int64_t
+s_now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Writes all data to a blocking socket, returns false if the peer is gone
+static bool
+s_write(int fd, const std::string& data, size_t chunk_size)
+{
+    size_t offset = 0;
+    while (offset < data.size()) {
+        size_t size = data.size() - offset;
+        if (chunk_size && size > chunk_size)
+            size = chunk_size;
+        ssize_t n = ::send(fd, data.data() + offset, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        offset += n;
+    }
+    return true;
+}
+
+FakeUpsd::FakeUpsd()
+    : port_(0)
+    , chunk_size_(0)
+    , latency_ms_(0)
+    , silent_(false)
+    , stop_(false)
+    , drop_requested_(0)
+    , drop_handled_(0)
+    , requests_(0)
+    , connections_(0)
+{
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addrlen = sizeof(addr);
+    if (listen_fd_ < 0
+            || bind(listen_fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0
+            || listen(listen_fd_, 16) < 0
+            || getsockname(listen_fd_, reinterpret_cast<struct sockaddr *>(&addr), &addrlen) < 0
+            || pipe(wake_fd_) < 0) {
+        throw std::runtime_error(std::string("fake upsd: ") + strerror(errno));
+    }
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread(&FakeUpsd::run, this);
+}
+
+FakeUpsd::~FakeUpsd()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake();
+    thread_.join();
+    close(listen_fd_);
+    close(wake_fd_[0]);
+    close(wake_fd_[1]);
+}
+
+void FakeUpsd::wake()
+{
+    char c = 0;
+    while (write(wake_fd_[1], &c, 1) < 0 && errno == EINTR)
+        ;
+}
+
+void FakeUpsd::setDevice(const std::string& name, const NutSnapshot::Variables& variables)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    devices_[name] = variables;
+}
+
+void FakeUpsd::removeDevice(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    devices_.erase(name);
+}
+
+void FakeUpsd::setChunkSize(size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunk_size_ = size;
+}
+
+void FakeUpsd::setLatency(int latency_ms)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    latency_ms_ = latency_ms;
+}
+
+void FakeUpsd::setSilent(bool silent)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    silent_ = silent;
+}
+
+void FakeUpsd::dropConnections()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t request = ++drop_requested_;
+    wake();
+    dropped_.wait(lock, [&]() { return drop_handled_ >= request; });
+}
+
+uint64_t FakeUpsd::requests() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requests_;
+}
+
+uint64_t FakeUpsd::connections() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return connections_;
+}
+
+// Returns the reply to a line, empty if there is nothing to send. Called
+// with the mutex locked
+std::string FakeUpsd::answer(const std::string& line)
+{
+    const std::string list_var = "LIST VAR ";
+    if (line == "LIST UPS") {
+        if (silent_)
+            return std::string();
+        std::string reply = "BEGIN LIST UPS\n";
+        for (const auto& device : devices_)
+            reply += "UPS " + device.first + " \"\"\n";
+        return reply + "END LIST UPS\n";
+    }
+    if (line.compare(0, list_var.size(), list_var) != 0)
+        return "ERR UNKNOWN-COMMAND\n";
+    std::string name = line.substr(list_var.size());
+    requests_++;
+    if (silent_)
+        return std::string();
+    auto device = devices_.find(name);
+    if (device == devices_.end())
+        return "ERR UNKNOWN-UPS\n";
+    std::string reply = "BEGIN LIST VAR " + name + "\n";
+    for (const auto& variable : device->second) {
+        const std::string value = variable.second.empty() ? std::string() : variable.second[0];
+        reply += "VAR " + name + " " + variable.first + " " + s_quote(value) + "\n";
+    }
+    return reply + "END LIST VAR " + name + "\n";
+}
+
+namespace {
+struct Client {
+    // Partial input line
+    std::string input;
+    // Replies with the time they are due
+    std::deque<std::pair<int64_t, std::string>> output;
+    // Time the last queued reply is due
+    int64_t busy_until = 0;
+};
+}
+
+void FakeUpsd::run()
+{
+    std::map<int, Client> clients;
+    for (;;) {
+        int64_t now = s_now();
+        int timeout = -1;
+        std::vector<struct pollfd> items;
+        items.push_back({ wake_fd_[0], POLLIN, 0 });
+        items.push_back({ listen_fd_, POLLIN, 0 });
+        for (const auto& client : clients) {
+            items.push_back({ client.first, POLLIN, 0 });
+            if (!client.second.output.empty()) {
+                int64_t wait = std::max<int64_t>(client.second.output.front().first - now, 0);
+                if (timeout < 0 || wait < timeout)
+                    timeout = wait;
+            }
+        }
+        if (::poll(items.data(), items.size(), timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (items[0].revents) {
+            char buffer[64];
+            (void) !read(wake_fd_[0], buffer, sizeof(buffer));
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stop_)
+                break;
+            if (drop_handled_ < drop_requested_) {
+                for (const auto& client : clients)
+                    close(client.first);
+                clients.clear();
+                drop_handled_ = drop_requested_;
+                dropped_.notify_all();
+                continue;
+            }
+        }
+        if (items[1].revents) {
+            int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                clients[fd];
+                connections_++;
+            }
+        }
+        now = s_now();
+        for (size_t i = 2; i < items.size(); i++) {
+            if (!items[i].revents)
+                continue;
+            int fd = items[i].fd;
+            char buffer[4096];
+            ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                close(fd);
+                clients.erase(fd);
+                continue;
+            }
+            Client& client = clients[fd];
+            client.input.append(buffer, n);
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t end;
+            while ((end = client.input.find('\n')) != std::string::npos) {
+                std::string reply = answer(client.input.substr(0, end));
+                client.input.erase(0, end + 1);
+                if (reply.empty())
+                    continue;
+                client.busy_until = std::max(client.busy_until, now) + latency_ms_;
+                client.output.emplace_back(client.busy_until, std::move(reply));
+            }
+        }
+        size_t chunk_size;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            chunk_size = chunk_size_;
+        }
+        for (auto i = clients.begin(); i != clients.end(); ) {
+            std::string output;
+            auto& queue = i->second.output;
+            while (!queue.empty() && queue.front().first <= now) {
+                output += queue.front().second;
+                queue.pop_front();
+            }
+            if (!output.empty() && !s_write(i->first, output, chunk_size)) {
+                close(i->first);
+                i = clients.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+    for (const auto& client : clients)
+        close(client.first);
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fake_upsd_test (bool verbose)
+{
+    printf (" * fake_upsd: ");
+
+    //  @selftest
+    FakeUpsd upsd;
+    assert(upsd.port() > 0);
+    upsd.setDevice("ups", { { "ups.status", { "OL" } }, { "ups.model", { "a \"b\"" } } });
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(upsd.port());
+    assert(connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0);
+    assert(s_write(fd, "LIST VAR ups\nLIST VAR epdu\n", 0));
+
+    const std::string expected =
+        "BEGIN LIST VAR ups\n"
+        "VAR ups ups.model \"a \\\"b\\\"\"\n"
+        "VAR ups ups.status \"OL\"\n"
+        "END LIST VAR ups\n"
+        "ERR UNKNOWN-UPS\n";
+    std::string received;
+    while (received.size() < expected.size()) {
+        char buffer[256];
+        ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+        assert(n > 0);
+        received.append(buffer, n);
+    }
+    assert(received == expected);
+    assert(upsd.requests() == 2);
+    assert(upsd.connections() == 1);
+
+    // A dropped connection reads as closed
+    upsd.dropConnections();
+    char c;
+    assert(::recv(fd, &c, 1, 0) == 0);
+    close(fd);
+    //  @end
+    printf ("OK\n");
+}
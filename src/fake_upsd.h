@@ -0,0 +1,95 @@
+/*  =========================================================================
+    fake_upsd - Stand-in NUT daemon for the selftests
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FAKE_UPSD_H_INCLUDED
+#define FAKE_UPSD_H_INCLUDED
+
+/*
+ * FakeUpsd listens on an ephemeral port of the loopback interface and
+ * answers LIST VAR and LIST UPS requests from a table of devices, in a
+ * thread of its own. Unknown devices are answered with ERR UNKNOWN-UPS. It is meant for
+ * the selftests only:
+ *
+ * FakeUpsd upsd;
+ * upsd.setDevice("ups", { { "ups.status", { "OL" } } });
+ * NutConnection conn("127.0.0.1", upsd.port());
+ */
+
+#include "nut_snapshot.h"
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class FakeUpsd {
+public:
+    FakeUpsd();
+    FakeUpsd(const FakeUpsd&) = delete;
+    FakeUpsd& operator=(const FakeUpsd&) = delete;
+    ~FakeUpsd();
+    int port() const
+    {
+        return port_;
+    }
+    // Only the first value of each variable is served
+    void setDevice(const std::string& name, const NutSnapshot::Variables& variables);
+    void removeDevice(const std::string& name);
+    // Writes the replies in chunks of the given size, 0 for all at once
+    void setChunkSize(size_t size);
+    // Delays each reply by the given time. The requests of a connection
+    // are served one after another, like by upsd, while connections are
+    // served concurrently
+    void setLatency(int latency_ms);
+    // Stops answering the requests, they are still counted
+    void setSilent(bool silent);
+    // Closes all client connections, returns once they are closed
+    void dropConnections();
+    // Number of LIST VAR requests received and of connections accepted
+    uint64_t requests() const;
+    uint64_t connections() const;
+private:
+    void run();
+    void wake();
+    std::string answer(const std::string& line);
+    int port_;
+    int listen_fd_;
+    int wake_fd_[2];
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable dropped_;
+    std::map<std::string, NutSnapshot::Variables> devices_;
+    size_t chunk_size_;
+    int latency_ms_;
+    bool silent_;
+    bool stop_;
+    // Number of dropConnections() calls requested and handled
+    uint64_t drop_requested_;
+    uint64_t drop_handled_;
+    uint64_t requests_;
+    uint64_t connections_;
+};
+
+//  Self test of this class
+void fake_upsd_test (bool verbose);
+
+#endif
@@ -0,0 +1,253 @@
+/*  =========================================================================
+    file_watch - Notices changes of a configuration file without polling it
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    file_watch - Notices changes of a configuration file without polling it
+@discuss
+@end
+*/
+
+#include "file_watch.h"
+#include <fty_log.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Events of the directory that may concern the file. Files being written
+// are noticed once closed, to avoid reading them half written
+#define FILE_WATCH_EVENTS \
+    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+bool FileWatch::Stamp::operator==(const Stamp& other) const
+{
+    return exists == other.exists && inode == other.inode && size == other.size && mtime_ns == other.mtime_ns;
+}
+
+FileWatch::FileWatch()
+    : fd_(-1)
+{
+}
+
+FileWatch::~FileWatch()
+{
+    stop();
+}
+
+bool FileWatch::watch(const std::string& path)
+{
+    stop();
+    path_ = path;
+    std::string directory;
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        directory = ".";
+        name_ = path;
+    } else {
+        directory = slash ? path.substr(0, slash) : "/";
+        name_ = path.substr(slash + 1);
+    }
+    stamp_ = stamp(path_);
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0) {
+        log_warning("Cannot watch %s (%s), polling it", path_.c_str(), strerror(errno));
+        return false;
+    }
+    if (inotify_add_watch(fd_, directory.c_str(), FILE_WATCH_EVENTS) < 0) {
+        log_warning("Cannot watch %s (%s), polling it", directory.c_str(), strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+void FileWatch::stop()
+{
+    if (fd_ >= 0)
+        close(fd_);
+    fd_ = -1;
+    path_.clear();
+    name_.clear();
+    stamp_ = Stamp();
+}
+
+bool FileWatch::changed()
+{
+    if (path_.empty())
+        return false;
+    if (fd_ >= 0 && !drain()) {
+        log_warning("The directory of %s is gone, polling it", path_.c_str());
+        close(fd_);
+        fd_ = -1;
+    }
+    // The events only tell that something happened in the directory, the
+    // stamp tells whether the file itself is different
+    Stamp current = stamp(path_);
+    if (current == stamp_)
+        return false;
+    stamp_ = current;
+    return true;
+}
+
+FileWatch::Stamp FileWatch::stamp(const std::string& path)
+{
+    Stamp result;
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        return result;
+    result.exists = true;
+    result.inode = st.st_ino;
+    result.size = st.st_size;
+    result.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return result;
+}
+
+bool FileWatch::drain()
+{
+    bool alive = true;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t size;
+    while ((size = ::read(fd_, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + size;) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+            if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+                alive = false;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return alive;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+static bool
+s_readable(int fd, int timeout_ms)
+{
+    struct pollfd item = { fd, POLLIN, 0 };
+    return ::poll(&item, 1, timeout_ms) == 1;
+}
+
+static void
+s_write(const std::string& path, const char *content)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    assert(file);
+    fputs(content, file);
+    fclose(file);
+}
+
+void
+file_watch_test (bool verbose)
+{
+    printf (" * file_watch: ");
+
+    //  @selftest
+    char directory[] = "/tmp/file_watch_test_XXXXXX";
+    assert(mkdtemp(directory));
+    std::string path = std::string(directory) + "/mapping.conf";
+    std::string temporary = std::string(directory) + "/mapping.conf.new";
+    {
+        // The file does not exist yet
+        FileWatch watch;
+        assert(watch.socket() < 0);
+        assert(!watch.changed());
+        assert(watch.watch(path));
+        assert(watch.path() == path);
+        assert(watch.socket() >= 0);
+        assert(!watch.changed());
+
+        // Written
+        s_write(path, "{}");
+        assert(s_readable(watch.socket(), 1000));
+        assert(watch.changed());
+        assert(!watch.changed());
+        assert(!s_readable(watch.socket(), 0));
+
+        // Other files of the directory wake the owner up, but are no change
+        s_write(temporary, "{ \"physicsMapping\" : {} }");
+        assert(s_readable(watch.socket(), 1000));
+        assert(!watch.changed());
+
+        // Replaced by a rename
+        assert(rename(temporary.c_str(), path.c_str()) == 0);
+        assert(s_readable(watch.socket(), 1000));
+        assert(watch.changed());
+
+        // Removed
+        assert(unlink(path.c_str()) == 0);
+        assert(s_readable(watch.socket(), 1000));
+        assert(watch.changed());
+        assert(!watch.changed());
+
+        watch.stop();
+        assert(watch.socket() < 0);
+        s_write(path, "{}");
+        assert(!watch.changed());
+        assert(unlink(path.c_str()) == 0);
+    }
+    {
+        // The directory does not exist, the file is polled
+        std::string subdirectory = std::string(directory) + "/conf";
+        std::string polled = subdirectory + "/mapping.conf";
+        FileWatch watch;
+        assert(!watch.watch(polled));
+        assert(watch.socket() < 0);
+        assert(!watch.changed());
+        assert(mkdir(subdirectory.c_str(), 0700) == 0);
+        s_write(polled, "{}");
+        assert(watch.changed());
+        assert(!watch.changed());
+        s_write(polled, "{ }");
+        assert(watch.changed());
+        assert(unlink(polled.c_str()) == 0);
+        assert(watch.changed());
+        assert(rmdir(subdirectory.c_str()) == 0);
+    }
+    {
+        // The watched directory goes away, the watch falls back to polling
+        std::string subdirectory = std::string(directory) + "/conf";
+        std::string watched = subdirectory + "/mapping.conf";
+        assert(mkdir(subdirectory.c_str(), 0700) == 0);
+        FileWatch watch;
+        assert(watch.watch(watched));
+        assert(rmdir(subdirectory.c_str()) == 0);
+        assert(s_readable(watch.socket(), 1000));
+        assert(!watch.changed());
+        assert(watch.socket() < 0);
+        assert(mkdir(subdirectory.c_str(), 0700) == 0);
+        s_write(watched, "{}");
+        assert(watch.changed());
+        assert(unlink(watched.c_str()) == 0);
+        assert(rmdir(subdirectory.c_str()) == 0);
+    }
+    assert(rmdir(directory) == 0);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,91 @@
+/*  =========================================================================
+    file_watch - Notices changes of a configuration file without polling it
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FILE_WATCH_H_INCLUDED
+#define FILE_WATCH_H_INCLUDED
+
+/*
+ * FileWatch tells when a file was written, replaced or removed. It watches
+ * the directory of the file with inotify, so that editors and packages
+ * replacing the file by a rename are noticed too, and gives a descriptor
+ * that the owner adds to its zpoller:
+ *
+ * FileWatch watch;
+ * watch.watch("/etc/fty-nut/mapping.conf");
+ * ...
+ * // when watch.socket() is readable, and from time to time
+ * if (watch.changed()) {
+ *     // reload the file
+ * }
+ *
+ * Where inotify is not available, socket() is -1 and changed() compares
+ * the modification time, size and inode of the file with those seen last,
+ * like zconfig_has_changed() does; the owner then calls it periodically.
+ */
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+class FileWatch {
+public:
+    FileWatch();
+    FileWatch(const FileWatch&) = delete;
+    FileWatch& operator=(const FileWatch&) = delete;
+    ~FileWatch();
+    // Starts watching a file, which needs not exist yet. Returns false if
+    // the file can only be polled
+    bool watch(const std::string& path);
+    void stop();
+    const std::string& path() const
+    {
+        return path_;
+    }
+    // Readable when the file may have changed, -1 if it is polled
+    int socket() const
+    {
+        return fd_;
+    }
+    // Returns true if the file changed since watch() or the previous call
+    // that returned true. Never blocks
+    bool changed();
+private:
+    struct Stamp {
+        bool exists = false;
+        ino_t inode = 0;
+        off_t size = 0;
+        int64_t mtime_ns = 0;
+        bool operator==(const Stamp& other) const;
+    };
+    static Stamp stamp(const std::string& path);
+    // Reads the pending events, returns false if the watch is gone
+    bool drain();
+    std::string path_;
+    // Name of the file within its directory, as reported by inotify
+    std::string name_;
+    int fd_;
+    Stamp stamp_;
+};
+
+//  Self test of this class
+void file_watch_test (bool verbose);
+
+#endif
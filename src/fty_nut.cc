@@ -42,6 +42,12 @@
 
 #define str(x) #x
 
+// Configured intervals are in seconds, fractions allowed; the actors count in ms
+static std::string s_seconds_to_ms(const char *seconds)
+{
+    return std::to_string(static_cast<long long>(atof(seconds) * 1000 + 0.5));
+}
+
 void usage() {
     puts("fty-nut [options] ...\n"
             "  --config / -c          path to config file\n"
@@ -149,6 +155,20 @@ int main(int argc, char *argv []) {
     }
     // POLLING
     polling = zconfig_get(config, CONFIG_POLLING, "30");
+    // WORKERS
+    const char *workers = zconfig_get(config, CONFIG_WORKERS, "1");
+    // Adaptive polling of the NUT devices
+    std::string polling_min = s_seconds_to_ms(zconfig_get(config, CONFIG_POLLING_MIN, "1"));
+    std::string polling_max = s_seconds_to_ms(zconfig_get(config, CONFIG_POLLING_MAX, "120"));
+    const char *polling_budget = zconfig_get(config, CONFIG_POLLING_BUDGET, "50");
+    // Metrics published on significant changes and once per heartbeat
+    std::string heartbeat = std::to_string(atoll(zconfig_get(config, CONFIG_METRICS_HEARTBEAT, "300")) * 1000);
+    // One message per device and poll on top of or instead of one per metric
+    const char *metrics_batch = zconfig_get(config, CONFIG_METRICS_BATCH, "false");
+    const char *metrics_fanout = zconfig_get(config, CONFIG_METRICS_FANOUT, "true");
+    // Snapshots of the devices waiting for the publisher thread
+    const char *publish_queue = zconfig_get(config, CONFIG_PUBLISH_QUEUE, "64");
+    const char *publish_overflow = zconfig_get(config, CONFIG_PUBLISH_OVERFLOW, "coalesce");
 
     log_info("fty_nut - NUT (Network UPS Tools) wrapper/daemon");
 
@@ -172,6 +192,12 @@ int main(int argc, char *argv []) {
 
     zstr_sendx(nut_server, ACTION_CONFIGURE, mapping_file.c_str(), NULL);
     zstr_sendx(nut_server, ACTION_POLLING, polling, NULL);
+    zstr_sendx(nut_server, ACTION_WORKERS, workers, NULL);
+    zstr_sendx(nut_server, ACTION_POLLING_BOUNDS, polling_min.c_str(), polling_max.c_str(), NULL);
+    zstr_sendx(nut_server, ACTION_POLLING_BUDGET, polling_budget, NULL);
+    zstr_sendx(nut_server, ACTION_HEARTBEAT, heartbeat.c_str(), NULL);
+    zstr_sendx(nut_server, ACTION_BATCH, metrics_batch, metrics_fanout, NULL);
+    zstr_sendx(nut_server, ACTION_PUBLISH_QUEUE, publish_queue, publish_overflow, NULL);
 
     zstr_sendx(nut_device_alert, ACTION_POLLING, polling, NULL);
 
@@ -195,12 +221,27 @@ int main(int argc, char *argv []) {
         }
 
         if (zconfig_has_changed(config)) {
-            log_debug("Config file has changed, reload config and propagate polling value");
+            log_debug("Config file has changed, reload config and propagate polling values and workers");
             zconfig_destroy(&config);
             config = zconfig_load(config_file);
             if (config) {
                 polling = zconfig_get(config, CONFIG_POLLING, "30");
+                workers = zconfig_get(config, CONFIG_WORKERS, "1");
+                polling_min = s_seconds_to_ms(zconfig_get(config, CONFIG_POLLING_MIN, "1"));
+                polling_max = s_seconds_to_ms(zconfig_get(config, CONFIG_POLLING_MAX, "120"));
+                polling_budget = zconfig_get(config, CONFIG_POLLING_BUDGET, "50");
+                heartbeat = std::to_string(atoll(zconfig_get(config, CONFIG_METRICS_HEARTBEAT, "300")) * 1000);
+                metrics_batch = zconfig_get(config, CONFIG_METRICS_BATCH, "false");
+                metrics_fanout = zconfig_get(config, CONFIG_METRICS_FANOUT, "true");
+                publish_queue = zconfig_get(config, CONFIG_PUBLISH_QUEUE, "64");
+                publish_overflow = zconfig_get(config, CONFIG_PUBLISH_OVERFLOW, "coalesce");
                 zstr_sendx(nut_server, ACTION_POLLING, polling, NULL);
+                zstr_sendx(nut_server, ACTION_WORKERS, workers, NULL);
+                zstr_sendx(nut_server, ACTION_POLLING_BOUNDS, polling_min.c_str(), polling_max.c_str(), NULL);
+                zstr_sendx(nut_server, ACTION_POLLING_BUDGET, polling_budget, NULL);
+                zstr_sendx(nut_server, ACTION_HEARTBEAT, heartbeat.c_str(), NULL);
+                zstr_sendx(nut_server, ACTION_BATCH, metrics_batch, metrics_fanout, NULL);
+                zstr_sendx(nut_server, ACTION_PUBLISH_QUEUE, publish_queue, publish_overflow, NULL);
                 zstr_sendx(nut_device_alert, ACTION_POLLING, polling, NULL);
                 zstr_sendx(nut_sensor, ACTION_POLLING, polling, NULL);
             } else {
@@ -84,6 +84,70 @@ typedef struct _sensor_list_t sensor_list_t;
 typedef struct _state_manager_t state_manager_t;
 #define STATE_MANAGER_T_DEFINED
 #endif
+#ifndef PERSISTENT_MAP_T_DEFINED
+typedef struct _persistent_map_t persistent_map_t;
+#define PERSISTENT_MAP_T_DEFINED
+#endif
+#ifndef ASSET_SNAPSHOT_T_DEFINED
+typedef struct _asset_snapshot_t asset_snapshot_t;
+#define ASSET_SNAPSHOT_T_DEFINED
+#endif
+#ifndef NUT_CONNECTION_T_DEFINED
+typedef struct _nut_connection_t nut_connection_t;
+#define NUT_CONNECTION_T_DEFINED
+#endif
+#ifndef NUT_SNAPSHOT_T_DEFINED
+typedef struct _nut_snapshot_t nut_snapshot_t;
+#define NUT_SNAPSHOT_T_DEFINED
+#endif
+#ifndef FAKE_UPSD_T_DEFINED
+typedef struct _fake_upsd_t fake_upsd_t;
+#define FAKE_UPSD_T_DEFINED
+#endif
+#ifndef SPSC_QUEUE_T_DEFINED
+typedef struct _spsc_queue_t spsc_queue_t;
+#define SPSC_QUEUE_T_DEFINED
+#endif
+#ifndef NUT_POOL_T_DEFINED
+typedef struct _nut_pool_t nut_pool_t;
+#define NUT_POOL_T_DEFINED
+#endif
+#ifndef POLL_SCHEDULER_T_DEFINED
+typedef struct _poll_scheduler_t poll_scheduler_t;
+#define POLL_SCHEDULER_T_DEFINED
+#endif
+#ifndef NUT_MAPPING_T_DEFINED
+typedef struct _nut_mapping_t nut_mapping_t;
+#define NUT_MAPPING_T_DEFINED
+#endif
+#ifndef METRIC_STORE_T_DEFINED
+typedef struct _metric_store_t metric_store_t;
+#define METRIC_STORE_T_DEFINED
+#endif
+#ifndef PUBLISH_FILTER_T_DEFINED
+typedef struct _publish_filter_t publish_filter_t;
+#define PUBLISH_FILTER_T_DEFINED
+#endif
+#ifndef FILE_WATCH_T_DEFINED
+typedef struct _file_watch_t file_watch_t;
+#define FILE_WATCH_T_DEFINED
+#endif
+#ifndef METRIC_BATCH_T_DEFINED
+typedef struct _metric_batch_t metric_batch_t;
+#define METRIC_BATCH_T_DEFINED
+#endif
+#ifndef PUBLISH_DESCRIPTORS_T_DEFINED
+typedef struct _publish_descriptors_t publish_descriptors_t;
+#define PUBLISH_DESCRIPTORS_T_DEFINED
+#endif
+#ifndef PUBLISH_QUEUE_T_DEFINED
+typedef struct _publish_queue_t publish_queue_t;
+#define PUBLISH_QUEUE_T_DEFINED
+#endif
+#ifndef METRIC_PUBLISHER_T_DEFINED
+typedef struct _metric_publisher_t metric_publisher_t;
+#define METRIC_PUBLISHER_T_DEFINED
+#endif
 #ifndef ASSET_STATE_T_DEFINED
 typedef struct _asset_state_t asset_state_t;
 #define ASSET_STATE_T_DEFINED
@@ -103,6 +167,22 @@ typedef struct _asset_state_t asset_state_t;
 #include "sensor_device.h"
 #include "sensor_list.h"
 #include "state_manager.h"
+#include "persistent_map.h"
+#include "asset_snapshot.h"
+#include "nut_connection.h"
+#include "nut_snapshot.h"
+#include "fake_upsd.h"
+#include "spsc_queue.h"
+#include "nut_pool.h"
+#include "poll_scheduler.h"
+#include "nut_mapping.h"
+#include "metric_store.h"
+#include "publish_filter.h"
+#include "file_watch.h"
+#include "metric_batch.h"
+#include "publish_descriptors.h"
+#include "publish_queue.h"
+#include "metric_publisher.h"
 #include "asset_state.h"
 
 //  *** To avoid double-definitions, only define if building without draft ***
@@ -168,6 +248,86 @@ FTY_NUT_PRIVATE void
 FTY_NUT_PRIVATE void
     state_manager_test (bool verbose);
 
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    persistent_map_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    asset_snapshot_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    nut_connection_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    nut_snapshot_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    fake_upsd_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    spsc_queue_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    nut_pool_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    poll_scheduler_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    nut_mapping_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    metric_store_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    publish_filter_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    file_watch_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    metric_batch_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    publish_descriptors_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    publish_queue_test (bool verbose);
+
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+FTY_NUT_PRIVATE void
+    metric_publisher_test (bool verbose);
+
 //  Self test for private classes
 FTY_NUT_PRIVATE void
     fty_nut_private_selftest (bool verbose, const char *subtest);
@@ -261,25 +261,37 @@ fty_nut_configurator_server (zsock_t *pipe, void *args)
             continue;
         }
         zmsg_t *msg = mlm_client_recv(client);
-        if (is_fty_proto(msg)) {
-            fty_proto_t *proto = fty_proto_decode (&msg);
-            if (!proto) {
-                zmsg_destroy(&msg);
-            }
-            if (fty_proto_id (proto) == FTY_PROTO_ASSET) {
-                if (state_writer.getState().updateFromProto(proto))
-                    state_writer.commit();
-                agent.onUpdate();
-            } else if (fty_proto_id (proto) == FTY_PROTO_METRIC) {
-                agent.handleLimitations(&proto);
+        // Apply all the asset messages that are already pending and commit
+        // them at once
+        state_writer.beginBatch();
+        while (msg) {
+            if (is_fty_proto(msg)) {
+                fty_proto_t *proto = fty_proto_decode (&msg);
+                if (!proto) {
+                    zmsg_destroy(&msg);
+                } else if (fty_proto_id (proto) == FTY_PROTO_ASSET) {
+                    state_writer.batchAdd(state_writer.getState().updateFromProto(proto));
+                } else if (fty_proto_id (proto) == FTY_PROTO_METRIC) {
+                    // The limitations apply to the devices known so far
+                    state_writer.commitBatch();
+                    agent.onUpdate();
+                    state_writer.beginBatch();
+                    agent.handleLimitations(&proto);
+                }
+                fty_proto_destroy(&proto);
+            } else {
+                log_error ("Unhandled message (%s/%s)",
+                        mlm_client_command(client),
+                        mlm_client_subject(client));
+                zmsg_print (msg);
+                zmsg_destroy (&msg);
             }
-            continue;
+            if (state_writer.batchFull() || !client_has_pending(client))
+                break;
+            msg = mlm_client_recv(client);
         }
-        log_error ("Unhandled message (%s/%s)",
-                mlm_client_command(client),
-                mlm_client_subject(client));
-        zmsg_print (msg);
-        zmsg_destroy (&msg);
+        state_writer.commitBatch();
+        agent.onUpdate();
     }
 }
 
@@ -62,6 +62,38 @@ fty_nut_private_selftest (bool verbose, const char *subtest)
         sensor_list_test (verbose);
     if (streq (subtest, "$ALL") || streq (subtest, "state_manager_test"))
         state_manager_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "persistent_map_test"))
+        persistent_map_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "asset_snapshot_test"))
+        asset_snapshot_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "nut_connection_test"))
+        nut_connection_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "nut_snapshot_test"))
+        nut_snapshot_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fake_upsd_test"))
+        fake_upsd_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "spsc_queue_test"))
+        spsc_queue_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "nut_pool_test"))
+        nut_pool_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "poll_scheduler_test"))
+        poll_scheduler_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "nut_mapping_test"))
+        nut_mapping_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "metric_store_test"))
+        metric_store_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "publish_filter_test"))
+        publish_filter_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "file_watch_test"))
+        file_watch_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "metric_batch_test"))
+        metric_batch_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "publish_descriptors_test"))
+        publish_descriptors_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "publish_queue_test"))
+        publish_queue_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "metric_publisher_test"))
+        metric_publisher_test (verbose);
 }
 /*
 ################################################################################
@@ -70,6 +70,22 @@ all_tests [] = {
     { "sensor_device", NULL, true, false, "sensor_device_test" },
     { "sensor_list", NULL, true, false, "sensor_list_test" },
     { "state_manager", NULL, true, false, "state_manager_test" },
+    { "persistent_map", NULL, true, false, "persistent_map_test" },
+    { "asset_snapshot", NULL, true, false, "asset_snapshot_test" },
+    { "nut_connection", NULL, true, false, "nut_connection_test" },
+    { "nut_snapshot", NULL, true, false, "nut_snapshot_test" },
+    { "fake_upsd", NULL, true, false, "fake_upsd_test" },
+    { "spsc_queue", NULL, true, false, "spsc_queue_test" },
+    { "nut_pool", NULL, true, false, "nut_pool_test" },
+    { "poll_scheduler", NULL, true, false, "poll_scheduler_test" },
+    { "nut_mapping", NULL, true, false, "nut_mapping_test" },
+    { "metric_store", NULL, true, false, "metric_store_test" },
+    { "publish_filter", NULL, true, false, "publish_filter_test" },
+    { "file_watch", NULL, true, false, "file_watch_test" },
+    { "metric_batch", NULL, true, false, "metric_batch_test" },
+    { "publish_descriptors", NULL, true, false, "publish_descriptors_test" },
+    { "publish_queue", NULL, true, false, "publish_queue_test" },
+    { "metric_publisher", NULL, true, false, "metric_publisher_test" },
     { "private_classes", NULL, false, false, "$ALL" }, // compat option for older projects
 #endif // FTY_NUT_BUILD_DRAFT_API
     {NULL, NULL, 0, 0, NULL}          //  Sentinel
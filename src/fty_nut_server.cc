@@ -27,17 +27,63 @@
 */
 
 #include "actor_commands.h"
+#include "asset_snapshot.h"
 #include "fty_nut_server.h"
 #include "state_manager.h"
 #include "nut_agent.h"
 #include "nut_mlm.h"
+#include "nut_snapshot.h"
 #include <fty_log.h>
 #include <fty_common_mlm.h>
 
+#include <algorithm>
+#include <deque>
+#include <map>
+
 StateManager NutStateManager;
+NutSnapshotStore NutSnapshots;
 
+// Receives a message from the actor pipe and passes it to options.on_pipe.
+// Returns false when the actor is asked to stop
 static bool
-get_initial_licensing(StateManager::Writer& state_writer, mlm_client_t *client)
+serve_pipe(const InitialAssetsOptions& options)
+{
+    zmsg_t *message = zmsg_recv(options.pipe);
+    if (!message)
+        return false;
+    if (options.on_pipe) {
+        bool carry_on = options.on_pipe(&message);
+        zmsg_destroy(&message);
+        return carry_on;
+    }
+    ZstrGuard command(zmsg_popstr(message));
+    zmsg_destroy(&message);
+    return command && strcmp(command, "$TERM") != 0;
+}
+
+// Waits at most timeout ms for a mailbox reply, serving the actor pipe
+// meanwhile. Returns NULL on timeout or interruption, and sets stopped when
+// the actor is asked to stop
+static zmsg_t*
+recv_timeout(zpoller_t *poller, mlm_client_t *client, int timeout,
+        const InitialAssetsOptions& options, bool& stopped)
+{
+    int64_t deadline = zclock_mono() + timeout;
+    while (!stopped) {
+        int64_t now = zclock_mono();
+        void *which = zpoller_wait(poller, deadline > now ? deadline - now : 0);
+        if (!which)
+            return NULL;
+        if (which == mlm_client_msgpipe(client))
+            return mlm_client_recv(client);
+        stopped = !serve_pipe(options);
+    }
+    return NULL;
+}
+
+static bool
+get_initial_licensing(StateManager::Writer& state_writer, mlm_client_t *client,
+        zpoller_t *poller, const InitialAssetsOptions& options, bool& stopped)
 {
     ZuuidGuard uuid(zuuid_new());
     int err = mlm_client_sendtox(client, "etn-licensing", "LIMITATIONS",
@@ -46,7 +92,7 @@ get_initial_licensing(StateManager::Writer& state_writer, mlm_client_t *client)
         log_error("Sending LIMITATION_QUERY message to etn-licensing failed");
         return false;
     }
-    zmsg_t* reply = mlm_client_recv(client);
+    zmsg_t* reply = recv_timeout(poller, client, options.timeout_ms, options, stopped);
     if (!reply) {
         zmsg_destroy(&reply);
         log_error("Getting response to LIMITATION_QUERY failed");
@@ -69,111 +115,242 @@ get_initial_licensing(StateManager::Writer& state_writer, mlm_client_t *client)
     return state_writer.getState().updateFromProto(reply);
 }
 
+// Sends the ASSETS request until fty-asset answers it (it may not be running
+// yet). Returns the reply positioned at the first asset name, or NULL on
+// error, interruption or when the actor is asked to stop
+static zmsg_t*
+get_asset_list(mlm_client_t *client, zpoller_t *poller,
+        const InitialAssetsOptions& options, bool& stopped)
+{
+    int timeout = options.timeout_ms;
+    // Replies to previous attempts are just as good
+    std::set<std::string> uuids;
+    while (!zsys_interrupted && !stopped) {
+        ZuuidGuard uuid(zuuid_new());
+        if (!uuid) {
+            log_error("Creating UUID for the ASSETS message failed");
+            return NULL;
+        }
+        zmsg_t *msg = zmsg_new();
+        if (!msg) {
+            log_error("Creating ASSETS message failed");
+            return NULL;
+        }
+        uuids.emplace(zuuid_str_canonical(uuid));
+        zmsg_addstr(msg, "GET");
+        zmsg_addstr(msg, zuuid_str_canonical(uuid));
+        zmsg_addstr(msg, "ups");
+        zmsg_addstr(msg, "epdu");
+        zmsg_addstr(msg, "sts");
+        zmsg_addstr(msg, "sensor");
+        zmsg_addstr(msg, "sensorgpio");
+        if (mlm_client_sendto(client, "asset-agent", "ASSETS", NULL, 5000, &msg) < 0) {
+            log_error("Sending ASSETS message failed");
+            return NULL;
+        }
+        int64_t deadline = zclock_mono() + timeout;
+        int64_t now;
+        while ((now = zclock_mono()) < deadline) {
+            zmsg_t *reply = recv_timeout(poller, client, deadline - now, options, stopped);
+            if (!reply)
+                break;
+            ZstrGuard uuid_reply(zmsg_popstr(reply));
+            if (!uuid_reply || uuids.count(uuid_reply.get()) == 0) {
+                log_warning("Mismatching response to an ASSETS request");
+                zmsg_destroy(&reply);
+                continue;
+            }
+            ZstrGuard status(zmsg_popstr(reply));
+            if (!status || strcmp(status, "OK") != 0) {
+                log_warning("Got %s response to an ASSETS request", status.get());
+                zmsg_print(reply);
+                zmsg_destroy(&reply);
+                return NULL;
+            }
+            return reply;
+        }
+        if (!stopped)
+            log_warning("No response to an ASSETS request after %d ms, retrying", timeout);
+    }
+    return NULL;
+}
+
 // Query fty-asset about existing devices. This has to be done after
 // subscribing ourselves to the ASSETS stream, to make sure that we do not
 // miss assets created between the mailbox request and the subscription to
-// the stream.
-void
+// the stream. Assets not known to fty-asset (e.g. loaded from a snapshot)
+// are removed.
+//
+// At most options.window ASSET_DETAIL requests are in flight, so as not to
+// flood the broker, and requests without a reply are resent after
+// options.timeout_ms. The received assets are committed progressively, so
+// that the readers can start working with the first devices early.
+//
+// Meanwhile, the messages of options.pipe are passed to options.on_pipe.
+// Returns false when the actor is asked to stop, and true otherwise (even if
+// the request failed).
+bool
 get_initial_assets(StateManager::Writer& state_writer, mlm_client_t *client,
-        bool query_licensing)
+        bool query_licensing, const InitialAssetsOptions& options)
 {
-    zmsg_t *msg = zmsg_new();
-    if (!msg) {
-        log_error("Creating ASSETS message failed");
-        return;
-    }
-    ZuuidGuard uuid(zuuid_new());
-    if (!uuid) {
-        zmsg_destroy(&msg);
-        log_error("Creating UUID for the ASSETS message failed");
-        return;
+    ZpollerGuard poller(zpoller_new(mlm_client_msgpipe(client), options.pipe, NULL));
+    if (!poller) {
+        log_error("zpoller_new () failed");
+        return true;
     }
-    zmsg_addstr(msg, "GET");
-    zmsg_addstr(msg, zuuid_str_canonical(uuid));
-    zmsg_addstr(msg, "ups");
-    zmsg_addstr(msg, "epdu");
-    zmsg_addstr(msg, "sts");
-    zmsg_addstr(msg, "sensor");
-    zmsg_addstr(msg, "sensorgpio");
-    if (mlm_client_sendto(client, "asset-agent", "ASSETS", NULL, 5000, &msg) < 0) {
-        log_error("Sending ASSETS message failed");
-        return;
+    bool stopped = false;
+    ZmsgGuard reply(get_asset_list(client, poller, options, stopped));
+    if (!reply)
+        return !stopped;
+
+    struct Request {
+        std::string asset;
+        int64_t deadline;
+        int attempts;
+    };
+    // Outstanding requests by UUID, and the assets waiting to be requested
+    std::map<std::string, Request> requests;
+    std::deque<std::pair<std::string, int> > pending;
+    std::set<std::string> listed;
+    for (ZstrGuard asset(zmsg_popstr(reply)); asset; asset = zmsg_popstr(reply)) {
+        listed.emplace(asset.get());
+        pending.emplace_back(asset.get(), 0);
     }
-    ZmsgGuard reply;
-    while (reply = mlm_client_recv(client)) {
-        ZstrGuard uuid_reply(zmsg_popstr(reply));
-        if (strcmp(uuid_reply, zuuid_str_canonical(uuid)) != 0) {
-            log_warning("Mismatching response to an ASSETS request");
-            continue;
-        }
-        ZstrGuard status(zmsg_popstr(reply));
-        if (strcmp(status, "OK") != 0) {
-            log_warning("Got %s response to an ASSETS request", status.get());
-            zmsg_print(reply);
+    size_t received = 0, failed = 0;
+    int64_t first_commit = 0;
+    int64_t start = zclock_mono();
+
+    auto commit = [&]() {
+        if (!state_writer.commitBatch())
             return;
+        if (!first_commit) {
+            first_commit = zclock_mono() - start;
+            log_debug("First initial assets committed after %" PRIi64 " ms", first_commit);
         }
-        break;
-    }
+        if (options.on_commit)
+            options.on_commit();
+    };
 
-    ZstrGuard asset(zmsg_popstr(reply));
-    // Remember which UUIDs we sent
-    std::set<std::string> uuids;
-    while (asset) {
-        ZuuidGuard uuid(zuuid_new());
-        auto i = uuids.emplace(zuuid_str_canonical(uuid));
-        zmsg_t *req = zmsg_new();
-        zmsg_addstr(req, "GET");
-        zmsg_addstr(req, i.first->c_str());
-        zmsg_addstr(req, asset);
-        if (mlm_client_sendto(client, "asset-agent", "ASSET_DETAIL", NULL, 5000, &req) < 0) {
-            log_error("Sending ASSET_DETAIL message for %s failed", asset.get());
+    state_writer.beginBatch();
+    while ((!pending.empty() || !requests.empty()) && !zsys_interrupted && !stopped) {
+        if (state_writer.batchFull()) {
+            commit();
+            state_writer.beginBatch();
         }
-        asset = zmsg_popstr(reply);
-    }
-    bool changed = false;
-    while (!uuids.empty()) {
-        zmsg_t *reply = mlm_client_recv(client);
-        if (uuids.erase(ZstrGuard(zmsg_popstr(reply)).get()) == 0) {
-            log_warning("Mismatching response to an ASSET_DETAIL request");
-            zmsg_destroy(&reply);
-            continue;
+        while (!pending.empty() && requests.size() < options.window) {
+            const std::string& asset = pending.front().first;
+            ZuuidGuard uuid(zuuid_new());
+            zmsg_t *req = zmsg_new();
+            zmsg_addstr(req, "GET");
+            zmsg_addstr(req, zuuid_str_canonical(uuid));
+            zmsg_addstr(req, asset.c_str());
+            if (mlm_client_sendto(client, "asset-agent", "ASSET_DETAIL", NULL, 5000, &req) < 0) {
+                log_error("Sending ASSET_DETAIL message for %s failed", asset.c_str());
+                failed++;
+            } else {
+                requests[zuuid_str_canonical(uuid)] = Request {
+                    asset, zclock_mono() + options.timeout_ms, pending.front().second + 1 };
+            }
+            pending.pop_front();
         }
-        if (!is_fty_proto(reply)) {
-            log_warning("Response to an ASSET_DETAIL message is not fty_proto");
-            zmsg_destroy(&reply);
+        if (requests.empty())
+            break;
+
+        int64_t deadline = requests.begin()->second.deadline;
+        for (const auto& i : requests)
+            deadline = std::min(deadline, i.second.deadline);
+        int64_t now = zclock_mono();
+        zmsg_t *msg = deadline > now ?
+            recv_timeout(poller, client, deadline - now, options, stopped) : NULL;
+        if (msg) {
+            ZstrGuard uuid(zmsg_popstr(msg));
+            if (!uuid) {
+                log_warning("Empty response to an ASSET_DETAIL request");
+                zmsg_destroy(&msg);
+                continue;
+            }
+            auto i = requests.find(uuid.get());
+            if (i == requests.end()) {
+                // Possibly a late reply to a request we already resent
+                log_warning("Mismatching response to an ASSET_DETAIL request");
+                zmsg_destroy(&msg);
+                continue;
+            }
+            requests.erase(i);
+            if (!is_fty_proto(msg)) {
+                log_warning("Response to an ASSET_DETAIL message is not fty_proto");
+                zmsg_destroy(&msg);
+                failed++;
+                continue;
+            }
+            received++;
+            state_writer.batchAdd(state_writer.getState().updateFromProto(msg));
             continue;
         }
-        if (state_writer.getState().updateFromProto(reply))
-            changed = true;
+        // Resend or give up the requests past their deadline
+        now = zclock_mono();
+        for (auto i = requests.begin(); i != requests.end(); ) {
+            if (i->second.deadline > now) {
+                ++i;
+                continue;
+            }
+            if (i->second.attempts > options.retries) {
+                log_error("No response to ASSET_DETAIL request for %s, giving up",
+                        i->second.asset.c_str());
+                failed++;
+            } else {
+                log_warning("No response to ASSET_DETAIL request for %s, retrying",
+                        i->second.asset.c_str());
+                pending.emplace_front(i->second.asset, i->second.attempts);
+            }
+            i = requests.erase(i);
+        }
     }
-    if (query_licensing) {
-        if (get_initial_licensing(state_writer, client))
-            changed = true;
+
+    if (stopped) {
+        log_info("Initial ASSETS request stopped");
+        return false;
     }
-    if (changed)
-        state_writer.commit();
-    log_info("Initial ASSETS request complete (%zd/%zd powerdevices, %zd/%zd sensors)",
-		    state_writer.getState().getPowerDevices().size(),
-		    state_writer.getState().getAllPowerDevices().size(),
-		    state_writer.getState().getSensors().size(),
-		    state_writer.getState().getAllSensors().size());
+
+    std::vector<std::string> stale;
+    AssetState& state = state_writer.getState();
+    for (const auto& i : state.getAllPowerDevices()) {
+        if (!listed.count(i.first))
+            stale.push_back(i.first);
+    }
+    for (const auto& i : state.getAllSensors()) {
+        if (!listed.count(i.first))
+            stale.push_back(i.first);
+    }
+    for (const auto& name : stale) {
+        log_info("Removing asset %s unknown to fty-asset", name.c_str());
+        state_writer.batchAdd(state.removeAsset(name));
+    }
+    if (query_licensing)
+        state_writer.batchAdd(get_initial_licensing(state_writer, client, poller, options, stopped));
+    if (stopped)
+        return false;
+    commit();
+    log_info("Initial ASSETS request complete in %" PRIi64 " ms (%zu received, %zu failed; "
+            "%zd/%zd powerdevices, %zd/%zd sensors)",
+            zclock_mono() - start, received, failed,
+            state_writer.getState().getPowerDevices().size(),
+            state_writer.getState().getAllPowerDevices().size(),
+            state_writer.getState().getSensors().size(),
+            state_writer.getState().getAllSensors().size());
+    return true;
 }
 
-uint64_t
-polling_timeout(uint64_t last_poll, uint64_t polling_timeout)
+// Time to wait for the next device to poll or for the next refresh of the
+// device list, whichever comes first
+static int
+polling_timeout(uint64_t last_refresh, uint64_t interval, int64_t next_poll)
 {
-    static uint32_t too_short_poll_count = 0;
-
     uint64_t now = static_cast<uint64_t> (zclock_mono ());
-    if (last_poll + polling_timeout < now) {
-        too_short_poll_count++;
-        if (too_short_poll_count > 10) {
-            log_error("Can't handle so many devices in so short polling interval");
-        }
-        return 0;
-    }
-    too_short_poll_count = 0;
-    return last_poll + polling_timeout - now;
+    int64_t wait = last_refresh + interval > now ? last_refresh + interval - now : 0;
+    if (next_poll >= 0 && next_poll < wait)
+        wait = next_poll;
+    return static_cast<int> (wait);
 }
 
 void
@@ -235,33 +412,105 @@ fty_nut_server (zsock_t *pipe, void *args)
 
     nut_agent.setClient (client);
     nut_agent.setiClient (iclient);
+    // The metrics are sent from a thread of their own, so that the broker
+    // and upsd do not hold each other up
+    nut_agent.startPublisher (endpoint);
 
     StateManager::Writer& state_writer = NutStateManager.getWriter();
+    // Time of the last poll, zero until the first one
+    uint64_t last = 0;
+    auto initial_poll = [&]() {
+        if (last)
+            return;
+        last = zclock_mono();
+        log_debug("Initial polling");
+        nut_agent.updateDeviceList();
+        nut_agent.onPoll();
+    };
+    // Start polling the devices known before the restart right away, the
+    // initial assets request below reconciles them with fty-asset
+    if (AssetSnapshot::load(state_writer.getState(), ASSET_SNAPSHOT_PATH)) {
+        state_writer.commit();
+        initial_poll();
+    }
     // (Ab)use the iclient for the initial assets mailbox request, because it
-    // will not receive any interfering stream messages
-    get_initial_assets(state_writer, iclient, true);
-
-    uint64_t timestamp = static_cast<uint64_t> (zclock_mono ());
+    // will not receive any interfering stream messages. Poll the first
+    // devices as soon as they arrive, the others are picked up by the
+    // periodic polling.
+    // The commands of the parent are served meanwhile, so that it can stop
+    // us while fty-asset is not answering.
     uint64_t timeout = 30000;
+    InitialAssetsOptions options;
+    options.on_commit = initial_poll;
+    options.pipe = pipe;
+    options.on_pipe = [&](zmsg_t **message) {
+        if (actor_commands (client, message, timeout, nut_agent) == 1)
+            return false;
+        nut_agent.setPollingInterval (timeout);
+        return true;
+    };
+    if (!get_initial_assets(state_writer, iclient, true, options))
+        return;
+    AssetSnapshot::save(state_writer.getState(), ASSET_SNAPSHOT_PATH);
+    // Set when a commit happened since the snapshot was last saved
+    bool snapshot_dirty = false;
+
+    nut_agent.setPollingInterval (timeout);
 
-    uint64_t last = zclock_mono ();
+    // Socket of upsd, watched by the poller while its replies are awaited
+    int nut_fd = -1;
+    auto watch_nut = [&]() {
+        int fd = nut_agent.nutSocket ();
+        if (fd == nut_fd)
+            return;
+        if (nut_fd >= 0)
+            zpoller_remove (poller, &nut_fd);
+        nut_fd = fd;
+        if (nut_fd >= 0)
+            zpoller_add (poller, &nut_fd);
+    };
+
+    // Watch of the mapping file, follows its configuration
+    int mapping_fd = -1;
+    auto watch_mapping = [&]() {
+        int fd = nut_agent.mappingSocket ();
+        if (fd == mapping_fd)
+            return;
+        if (mapping_fd >= 0)
+            zpoller_remove (poller, &mapping_fd);
+        mapping_fd = fd;
+        if (mapping_fd >= 0)
+            zpoller_add (poller, &mapping_fd);
+    };
+
+    // The mapping may have been configured during the initial assets request
+    watch_mapping ();
+    if (!last)
+        last = zclock_mono ();
     while (!zsys_interrupted) {
-        void *which = zpoller_wait (poller, polling_timeout (timestamp, timeout));
+        void *which = zpoller_wait (poller,
+                polling_timeout (last, timeout, nut_agent.pollTimeout (zclock_mono ())));
         uint64_t now = zclock_mono();
         if (now - last >= timeout) {
             last = now;
-            log_debug("Periodic polling");
+            log_debug("Refreshing the device list");
             nut_agent.updateDeviceList();
-            nut_agent.onPoll();
+            // Where the mapping file cannot be watched, it is polled here
+            nut_agent.checkMapping();
+            if (snapshot_dirty) {
+                AssetSnapshot::save(state_writer.getState(), ASSET_SNAPSHOT_PATH);
+                snapshot_dirty = false;
+            }
         }
+        // Each device is polled in its own slot of the polling interval,
+        // instead of all of them at once
+        nut_agent.startPoll(now);
+        watch_nut();
         if (which == NULL) {
             if (zpoller_terminated (poller) || zsys_interrupted) {
                 log_warning ("zpoller_terminated () or zsys_interrupted");
                 break;
             }
-            if (zpoller_expired (poller)) {
-                timestamp = static_cast<uint64_t> (zclock_mono ());
-            }
             continue;
         }
 
@@ -274,6 +523,22 @@ fty_nut_server (zsock_t *pipe, void *args)
             if (actor_commands (client, &message, timeout, nut_agent) == 1) {
                 break;
             }
+            nut_agent.setPollingInterval (timeout);
+            watch_mapping ();
+            continue;
+        }
+
+        if (which == &nut_fd) {
+            nut_agent.onNutReadable ();
+            watch_nut ();
+            continue;
+        }
+
+        if (which == &mapping_fd) {
+            // Parsed and compiled right away, swapped in once the poll in
+            // progress is done
+            nut_agent.checkMapping ();
+            watch_mapping ();
             continue;
         }
 
@@ -281,7 +546,7 @@ fty_nut_server (zsock_t *pipe, void *args)
         if (which != mlm_client_msgpipe (client)) {
             log_fatal (
                     "zpoller_wait () returned address that is different from "
-                    "`pipe`, `mlm_client_msgpipe (client)`, NULL.");
+                    "`pipe`, `mlm_client_msgpipe (client)`, upsd socket, mapping watch, NULL.");
             continue;
         }
 
@@ -290,28 +555,216 @@ fty_nut_server (zsock_t *pipe, void *args)
             log_error ("Given `which == mlm_client_msgpipe (client)`, function `mlm_client_recv ()` returned NULL");
             continue;
         }
-        if (is_fty_proto(message)) {
-            if (state_writer.getState().updateFromProto(message))
-                state_writer.commit();
-            continue;
+        // Apply all the messages that are already pending and commit them
+        // at once, so that a burst of asset updates does not result in a
+        // burst of commits
+        state_writer.beginBatch();
+        while (message) {
+            if (is_fty_proto(message)) {
+                state_writer.batchAdd(state_writer.getState().updateFromProto(message));
+            } else {
+                log_error ("Unhandled message (%s/%s)",
+                        mlm_client_command(client), mlm_client_subject(client));
+                zmsg_print (message);
+                zmsg_destroy (&message);
+            }
+            if (state_writer.batchFull() || !client_has_pending(client))
+                break;
+            message = mlm_client_recv (client);
         }
-        log_error ("Unhandled message (%s/%s)",
-                mlm_client_command(client), mlm_client_subject(client));
-        zmsg_print (message);
-        zmsg_destroy (&message);
+        if (state_writer.commitBatch())
+            snapshot_dirty = true;
     } // while (!zsys_interrupted)
+    if (snapshot_dirty)
+        AssetSnapshot::save(state_writer.getState(), ASSET_SNAPSHOT_PATH);
 }
 
 
 //  --------------------------------------------------------------------------
 //  Self test of this class
 
+// Configuration of the fake fty-asset used by the selftest
+struct FakeAssetAgentArgs {
+    const char *endpoint;
+    // Number of assets to report
+    int count;
+    // The first ASSET_DETAIL request for ups-<drop> is answered with an
+    // empty message only
+    int drop;
+};
+
+static void
+s_fake_asset_agent (zsock_t *pipe, void *args)
+{
+    FakeAssetAgentArgs *cfg = static_cast<FakeAssetAgentArgs *>(args);
+    mlm_client_t *client = mlm_client_new ();
+    assert (client);
+    int rv = mlm_client_connect (client, cfg->endpoint, 1000, "asset-agent");
+    assert (rv == 0);
+    zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (client), NULL);
+    assert (poller);
+    zsock_signal (pipe, 0);
+
+    while (!zsys_interrupted) {
+        void *which = zpoller_wait (poller, -1);
+        if (which != mlm_client_msgpipe (client))
+            break;
+        zmsg_t *msg = mlm_client_recv (client);
+        char *command = zmsg_popstr (msg);
+        char *uuid = zmsg_popstr (msg);
+        zmsg_t *reply = NULL;
+        if (streq (mlm_client_subject (client), "ASSETS")) {
+            reply = zmsg_new ();
+            zmsg_addstr (reply, uuid);
+            zmsg_addstr (reply, "OK");
+            for (int i = 0; i < cfg->count; i++)
+                zmsg_addstrf (reply, "ups-%d", i);
+        }
+        else
+        if (streq (mlm_client_subject (client), "ASSET_DETAIL")) {
+            char *name = zmsg_popstr (msg);
+            if (cfg->drop >= 0 && streq (name, ("ups-" + std::to_string (cfg->drop)).c_str ())) {
+                cfg->drop = -1;
+                reply = zmsg_new ();
+            }
+            else {
+                fty_proto_t *asset = fty_proto_new (FTY_PROTO_ASSET);
+                fty_proto_set_name (asset, "%s", name);
+                fty_proto_set_operation (asset, FTY_PROTO_ASSET_OP_UPDATE);
+                fty_proto_aux_insert (asset, "type", "device");
+                fty_proto_aux_insert (asset, "subtype", "ups");
+                fty_proto_ext_insert (asset, "ip.1", "192.0.2.1");
+                reply = fty_proto_encode (&asset);
+                zmsg_pushstr (reply, uuid);
+            }
+            zstr_free (&name);
+        }
+        if (reply)
+            mlm_client_sendto (client, mlm_client_sender (client),
+                    mlm_client_subject (client), NULL, 1000, &reply);
+        zstr_free (&command);
+        zstr_free (&uuid);
+        zmsg_destroy (&msg);
+    }
+    zpoller_destroy (&poller);
+    mlm_client_destroy (&client);
+}
+
+// Runs get_initial_assets () against the fake agent, returns the time to the
+// first commit
+static int64_t
+s_initial_assets (const char *endpoint, FakeAssetAgentArgs& args, int count, int drop, bool verbose)
+{
+    static int run = 0;
+    args.count = count;
+    args.drop = drop;
+
+    StateManager manager;
+    StateManager::Writer& writer = manager.getWriter();
+    std::unique_ptr<StateManager::Reader> reader (manager.getReader ());
+    mlm_client_t *client = mlm_client_new ();
+    assert (client);
+    int rv = mlm_client_connect (client, endpoint, 1000,
+            ("fty-nut-initial-assets-" + std::to_string (run++)).c_str ());
+    assert (rv == 0);
+
+    InitialAssetsOptions options;
+    options.window = 16;
+    options.timeout_ms = 500;
+    options.retries = 1;
+    int64_t start = zclock_mono ();
+    int64_t first = -1;
+    options.on_commit = [&]() {
+        if (first >= 0)
+            return;
+        first = zclock_mono () - start;
+        // The readers see the first devices right away
+        assert (reader->refresh ());
+        assert (!reader->getState ().getPowerDevices ().empty ());
+    };
+    get_initial_assets (writer, client, false, options);
+    int64_t total = zclock_mono () - start;
+
+    assert (first >= 0);
+    reader->refresh ();
+    assert (reader->getState ().getPowerDevices ().size () == static_cast<size_t> (count));
+    if (verbose)
+        printf ("\n    %d assets: first commit after %" PRIi64 " ms, all after %" PRIi64 " ms",
+                count, first, total);
+    mlm_client_destroy (&client);
+    return first;
+}
+
+// Requests the initial assets from an asset agent that is not running,
+// until stopped by the pipe
+struct WaitingActorArgs {
+    const char *endpoint;
+    // Commands received meanwhile
+    std::vector<std::string> commands;
+    bool complete;
+};
+
+static void
+s_waiting_actor (zsock_t *pipe, void *args)
+{
+    WaitingActorArgs *self = static_cast<WaitingActorArgs*> (args);
+    StateManager manager;
+    mlm_client_t *client = mlm_client_new ();
+    assert (client);
+    int rv = mlm_client_connect (client, self->endpoint, 1000, "fty-nut-initial-assets-waiting");
+    assert (rv == 0);
+
+    InitialAssetsOptions options;
+    options.timeout_ms = 50;
+    options.pipe = pipe;
+    options.on_pipe = [&](zmsg_t **message) {
+        ZstrGuard command (zmsg_popstr (*message));
+        self->commands.emplace_back (command.get ());
+        return self->commands.back () != "$TERM";
+    };
+    zsock_signal (pipe, 0);
+    self->complete = get_initial_assets (manager.getWriter (), client, false, options);
+    mlm_client_destroy (&client);
+}
+
 void
 fty_nut_server_test (bool verbose)
 {
     printf (" * fty_nut_server: ");
 
     //  @selftest
+    static const char* endpoint = "inproc://fty_nut_server-test";
+    zactor_t *server = zactor_new (mlm_server, (void*) "Malamute");
+    assert (server);
+    zstr_sendx (server, "BIND", endpoint, NULL);
+    FakeAssetAgentArgs args = { endpoint, 0, -1 };
+    zactor_t *agent = zactor_new (s_fake_asset_agent, &args);
+    assert (agent);
+
+    // An empty reply is skipped, and the request retried after the timeout
+    s_initial_assets (endpoint, args, 50, 7, verbose);
+    if (verbose) {
+        // Time to first poll against the number of assets
+        int counts[] = { 100, 1000, 10000 };
+        for (int count : counts)
+            s_initial_assets (endpoint, args, count, -1, verbose);
+        printf ("\n");
+    }
+
+    zactor_destroy (&agent);
+
+    // Without the asset agent, the request is resent until $TERM, and the
+    // other commands are served meanwhile
+    WaitingActorArgs waiting = { endpoint, {}, true };
+    zactor_t *actor = zactor_new (s_waiting_actor, &waiting);
+    assert (actor);
+    zstr_send (actor, "CONFIGURE");
+    zclock_sleep (200);
+    zactor_destroy (&actor);
+    assert (!waiting.complete);
+    assert (waiting.commands == std::vector<std::string> ({ "CONFIGURE", "$TERM" }));
+
+    zactor_destroy (&server);
     //  @end
-    printf ("Empty test - OK\n");
+    printf ("OK\n");
 }
@@ -0,0 +1,246 @@
+/*  =========================================================================
+    metric_batch - Metrics of one device gathered into one message
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    metric_batch - Metrics of one device gathered into one message
+@discuss
+@end
+*/
+
+#include "metric_batch.h"
+#include <fty_log.h>
+#include <malamute.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <map>
+
+MetricBatch::MetricBatch()
+    : ttl_(0)
+    , aux_(zhash_new())
+{
+    assert(aux_);
+    zhash_autofree(aux_);
+}
+
+MetricBatch::~MetricBatch()
+{
+    zhash_destroy(&aux_);
+}
+
+void MetricBatch::begin(const std::string& asset, int ttl)
+{
+    asset_ = asset;
+    ttl_ = ttl;
+    zhash_purge(aux_);
+}
+
+void MetricBatch::add(const std::string& quantity, const char *value, const char *units)
+{
+    entry_.assign(value);
+    entry_ += ' ';
+    entry_ += units;
+    // The hash copies the entry
+    zhash_update(aux_, quantity.c_str(), const_cast<char *>(entry_.c_str()));
+}
+
+size_t MetricBatch::size() const
+{
+    return zhash_size(aux_);
+}
+
+zmsg_t *MetricBatch::encode(uint64_t time)
+{
+    if (zhash_size(aux_) == 0)
+        return nullptr;
+    char count[32];
+    snprintf(count, sizeof(count), "%zu", zhash_size(aux_));
+    zmsg_t *message = fty_proto_encode_metric(aux_, time, ttl_, METRIC_BATCH_TYPE, asset_.c_str(), count, "");
+    zhash_purge(aux_);
+    return message;
+}
+
+bool MetricBatch::forEach(fty_proto_t *message,
+        const std::function<void(const std::string&, const std::string&, const std::string&)>& f)
+{
+    if (!message || fty_proto_id(message) != FTY_PROTO_METRIC || !streq(fty_proto_type(message), METRIC_BATCH_TYPE))
+        return false;
+    zhash_t *aux = fty_proto_aux(message);
+    if (!aux)
+        return true;
+    std::string value, units;
+    for (const char *entry = static_cast<const char *>(zhash_first(aux)); entry;
+            entry = static_cast<const char *>(zhash_next(aux))) {
+        // Values may contain spaces, units do not
+        const char *space = strrchr(entry, ' ');
+        if (!space) {
+            log_warning("Metric %s of batch %s has no units, ignored", zhash_cursor(aux), fty_proto_name(message));
+            continue;
+        }
+        value.assign(entry, space - entry);
+        units.assign(space + 1);
+        f(zhash_cursor(aux), value, units);
+    }
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+typedef std::map<std::string, std::pair<std::string, std::string>> Metrics;
+
+static bool
+s_decode(zmsg_t **message, Metrics& metrics)
+{
+    fty_proto_t *proto = fty_proto_decode(message);
+    assert(proto);
+    bool batch = MetricBatch::forEach(proto, [&](const std::string& quantity, const std::string& value,
+            const std::string& units) {
+        metrics[quantity] = std::make_pair(value, units);
+    });
+    fty_proto_destroy(&proto);
+    return batch;
+}
+
+void
+metric_batch_test (bool verbose)
+{
+    printf (" * metric_batch: ");
+
+    //  @selftest
+    {
+        MetricBatch batch;
+        batch.begin("ups-1", 60);
+        assert(batch.size() == 0);
+        assert(!batch.encode(1000));
+        batch.add("realpower.default", "1234.5", "W");
+        batch.add("status.ups", "8", "");
+        batch.add("temperature.default", "20", "C");
+        batch.add("temperature.default", "21", "C");
+        batch.add("text.default", "on bypass", "");
+        assert(batch.size() == 4);
+        assert(batch.asset() == "ups-1");
+        assert(batch.subject() == "metrics@ups-1");
+
+        zmsg_t *message = batch.encode(1000);
+        assert(message);
+        assert(batch.size() == 0);
+        fty_proto_t *proto = fty_proto_decode(&message);
+        assert(proto);
+        assert(fty_proto_id(proto) == FTY_PROTO_METRIC);
+        assert(streq(fty_proto_type(proto), METRIC_BATCH_TYPE));
+        assert(streq(fty_proto_name(proto), "ups-1"));
+        assert(streq(fty_proto_value(proto), "4"));
+        assert(fty_proto_ttl(proto) == 60);
+        assert(fty_proto_time(proto) == 1000);
+        Metrics metrics;
+        assert(MetricBatch::forEach(proto, [&](const std::string& quantity, const std::string& value,
+                const std::string& units) {
+            metrics[quantity] = std::make_pair(value, units);
+        }));
+        fty_proto_destroy(&proto);
+        assert(metrics.size() == 4);
+        assert(metrics["realpower.default"] == std::make_pair(std::string("1234.5"), std::string("W")));
+        assert(metrics["status.ups"] == std::make_pair(std::string("8"), std::string()));
+        assert(metrics["temperature.default"] == std::make_pair(std::string("21"), std::string("C")));
+        assert(metrics["text.default"] == std::make_pair(std::string("on bypass"), std::string()));
+
+        // The batch is reused for the next device
+        batch.begin("epdu-1", 120);
+        batch.add("load.default", "20", "%");
+        message = batch.encode(2000);
+        metrics.clear();
+        assert(s_decode(&message, metrics));
+        assert(metrics.size() == 1);
+        assert(metrics["load.default"].second == "%");
+
+        // Metrics not encoded are dropped by begin()
+        batch.add("load.default", "30", "%");
+        batch.begin("epdu-2", 120);
+        assert(batch.size() == 0);
+
+        // Single metrics are not batches
+        message = fty_proto_encode_metric(NULL, 1000, 60, "realpower.default", "ups-1", "1234.5", "W");
+        assert(message);
+        metrics.clear();
+        assert(!s_decode(&message, metrics));
+        assert(metrics.empty());
+    }
+    if (verbose) {
+        // Metrics per second through a local broker, one message per
+        // metric or one per device
+        static const char *endpoint = "inproc://metric-batch-test";
+        zactor_t *malamute = zactor_new(mlm_server, (void *) "Malamute");
+        assert(malamute);
+        zstr_sendx(malamute, "BIND", endpoint, NULL);
+        mlm_client_t *producer = mlm_client_new();
+        assert(mlm_client_connect(producer, endpoint, 1000, "metric-batch-producer") == 0);
+        assert(mlm_client_set_producer(producer, FTY_PROTO_STREAM_METRICS) == 0);
+        mlm_client_t *consumer = mlm_client_new();
+        assert(mlm_client_connect(consumer, endpoint, 1000, "metric-batch-consumer") == 0);
+        assert(mlm_client_set_consumer(consumer, FTY_PROTO_STREAM_METRICS, ".*") == 0);
+        zclock_sleep(100);
+
+        const int devices = 100, count = 200;
+        MetricBatch batch;
+        for (bool batched : { false, true }) {
+            int64_t start = zclock_usecs();
+            size_t received = 0;
+            for (int d = 0; d < devices; d++) {
+                std::string asset = "epdu-" + std::to_string(d);
+                batch.begin(asset, 60);
+                for (int m = 0; m < count; m++) {
+                    std::string quantity = "realpower.outlet." + std::to_string(m + 1);
+                    if (batched) {
+                        batch.add(quantity, "123.4", "W");
+                        continue;
+                    }
+                    zmsg_t *message = fty_proto_encode_metric(NULL, time(NULL), 60, quantity.c_str(),
+                            asset.c_str(), "123.4", "W");
+                    assert(mlm_client_send(producer, (quantity + "@" + asset).c_str(), &message) == 0);
+                }
+                if (batched) {
+                    zmsg_t *message = batch.encode(time(NULL));
+                    assert(mlm_client_send(producer, batch.subject().c_str(), &message) == 0);
+                }
+                // Device by device, to stay below the high water marks
+                while (received < size_t((d + 1) * count)) {
+                    zmsg_t *message = mlm_client_recv(consumer);
+                    assert(message);
+                    Metrics metrics;
+                    received += s_decode(&message, metrics) ? metrics.size() : 1;
+                }
+            }
+            int64_t elapsed = std::max<int64_t>(zclock_usecs() - start, 1);
+            printf("\n   %d devices, %d metrics each, %s: %.0f metrics/s", devices, count,
+                    batched ? "one message per device" : "one message per metric",
+                    received * 1000000.0 / elapsed);
+        }
+        printf("\n   ");
+        mlm_client_destroy(&consumer);
+        mlm_client_destroy(&producer);
+        zactor_destroy(&malamute);
+    }
+    //  @end
+    printf ("OK\n");
+}
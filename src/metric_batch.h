@@ -0,0 +1,96 @@
+/*  =========================================================================
+    metric_batch - Metrics of one device gathered into one message
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef METRIC_BATCH_H_INCLUDED
+#define METRIC_BATCH_H_INCLUDED
+
+/*
+ * A poll of an ePDU publishes hundreds of metrics, one message each on the
+ * METRICS stream. MetricBatch gathers the metrics of one device published
+ * by one poll into a single fty_proto METRIC message, with the subject
+ * "metrics@<asset>":
+ *
+ *   type   "metrics" (METRIC_BATCH_TYPE)
+ *   name   the asset
+ *   value  the number of metrics
+ *   ttl    the TTL of all metrics
+ *   aux    one entry per metric, "<quantity>" : "<value> <unit>", the
+ *          unit being empty for metrics without one
+ *
+ * MetricBatch batch;
+ * batch.begin("ups-1", 60);
+ * batch.add("realpower.default", "1234.5", "W");
+ * batch.add("status.ups", "8", "");
+ * zmsg_t *message = batch.encode(time(NULL));
+ * if (message)
+ *     mlm_client_send(client, batch.subject().c_str(), &message);
+ *
+ * Consumers take the metrics back out with MetricBatch::forEach().
+ */
+
+#include <czmq.h>
+#include <ftyproto.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#define METRIC_BATCH_TYPE "metrics"
+
+class MetricBatch {
+public:
+    MetricBatch();
+    MetricBatch(const MetricBatch&) = delete;
+    MetricBatch& operator=(const MetricBatch&) = delete;
+    ~MetricBatch();
+    // Starts the batch of a device, dropping the metrics not encoded
+    void begin(const std::string& asset, int ttl);
+    // A metric added twice keeps the last value
+    void add(const std::string& quantity, const char *value, const char *units);
+    size_t size() const;
+    const std::string& asset() const
+    {
+        return asset_;
+    }
+    std::string subject() const
+    {
+        return METRIC_BATCH_TYPE "@" + asset_;
+    }
+    // Encodes the metrics added since begin(), nullptr if there are none.
+    // The batch is empty afterwards
+    zmsg_t *encode(uint64_t time);
+    // Calls f(quantity, value, units) for each metric of a batch, returns
+    // false if the message is not one
+    static bool forEach(fty_proto_t *message,
+            const std::function<void(const std::string&, const std::string&, const std::string&)>& f);
+private:
+    std::string asset_;
+    int ttl_;
+    // Kept between the batches, emptied by encode()
+    zhash_t *aux_;
+    // Reused to build the entries
+    std::string entry_;
+};
+
+//  Self test of this class
+void metric_batch_test (bool verbose);
+
+#endif
@@ -0,0 +1,361 @@
+/*  =========================================================================
+    metric_publisher - Thread encoding and sending the metrics of the devices
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    metric_publisher - Thread encoding and sending the metrics of the devices
+@discuss
+@end
+*/
+
+#include "metric_publisher.h"
+#include <fty_log.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <map>
+
+void MetricPublisher::Latency::record(int64_t ms)
+{
+    last_ms = ms;
+    max_ms = std::max(max_ms, ms);
+}
+
+MetricPublisher::MetricPublisher(const std::string& name, int64_t report_ms)
+    : name_(name)
+    , report_ms_(report_ms)
+    , batch_(false)
+    , fanout_(true)
+    , client_(NULL)
+    , own_client_(NULL)
+    , nextReport_(zclock_mono() + report_ms)
+{
+}
+
+MetricPublisher::~MetricPublisher()
+{
+    stop();
+}
+
+void MetricPublisher::setClient(mlm_client_t *client)
+{
+    client_ = client;
+}
+
+bool MetricPublisher::start(const std::string& endpoint)
+{
+    stop();
+    std::string name = name_ + "-publisher";
+    mlm_client_t *client = mlm_client_new();
+    if (!client
+            || mlm_client_connect(client, endpoint.c_str(), 5000, name.c_str()) < 0
+            || mlm_client_set_producer(client, FTY_PROTO_STREAM_METRICS) < 0) {
+        log_error("Client %s cannot connect to %s, publishing from the agent", name.c_str(), endpoint.c_str());
+        mlm_client_destroy(&client);
+        return false;
+    }
+    own_client_ = client;
+    thread_ = std::thread(&MetricPublisher::run, this);
+    return true;
+}
+
+void MetricPublisher::stop()
+{
+    if (!running())
+        return;
+    size_t dropped = queue_.size();
+    queue_.close();
+    thread_.join();
+    mlm_client_destroy(&own_client_);
+    queue_.open();
+    if (dropped)
+        log_warning("%zu snapshots of metrics not published", dropped);
+}
+
+std::unique_ptr<PublishQueue::Snapshot> MetricPublisher::publish(std::unique_ptr<PublishQueue::Snapshot> snapshot)
+{
+    if (!snapshot || snapshot->empty())
+        return nullptr;
+    if (running())
+        return queue_.push(std::move(snapshot));
+    if (!client_)
+        return snapshot;
+    // Through the queue all the same, for the statistics
+    queue_.push(std::move(snapshot));
+    while ((snapshot = queue_.pop(0)))
+        send(client_, *snapshot);
+    int64_t now = zclock_mono();
+    if (now >= nextReport_)
+        report(client_, now);
+    return nullptr;
+}
+
+MetricPublisher::Statistics MetricPublisher::statistics() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    return stats_;
+}
+
+void MetricPublisher::run()
+{
+    while (true) {
+        int64_t now = zclock_mono();
+        if (now >= nextReport_)
+            report(own_client_, now);
+        std::unique_ptr<PublishQueue::Snapshot> snapshot = queue_.pop(nextReport_ - now);
+        if (snapshot)
+            send(own_client_, *snapshot);
+        else
+        if (queue_.closed())
+            break;
+    }
+}
+
+void MetricPublisher::send(mlm_client_t *client, const PublishQueue::Snapshot& snapshot)
+{
+    int64_t start = zclock_mono();
+    bool batch = batch_;
+    bool fanout = !batch || fanout_;
+    const std::string& asset = snapshot.asset();
+    uint64_t failed = 0;
+    if (batch)
+        metricBatch_.begin(asset, snapshot.ttl());
+    snapshot.forEach([&](const PublishDescriptors::Metric& metric, const char *value) {
+        if (batch)
+            metricBatch_.add(*metric.quantity, value, metric.units);
+        if (!fanout)
+            return;
+        zmsg_t *msg = fty_proto_encode_metric(NULL, snapshot.time(), snapshot.ttl(), metric.quantity->c_str(),
+                asset.c_str(), value, metric.units);
+        if (!msg)
+            return;
+        log_debug("sending new measurement for element_src = '%s', type = '%s', value = '%s', units = '%s'",
+                asset.c_str(), metric.quantity->c_str(), value, metric.units);
+        if (send(client, metric.subject, &msg) != 0)
+            failed++;
+    });
+    if (batch) {
+        zmsg_t *msg = metricBatch_.encode(snapshot.time());
+        if (msg) {
+            log_debug("sending %s", metricBatch_.subject().c_str());
+            if (send(client, metricBatch_.subject(), &msg) != 0)
+                failed++;
+        }
+    }
+    int64_t now = zclock_mono();
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    stats_.snapshots++;
+    stats_.metrics += snapshot.size();
+    stats_.failed += failed;
+    stats_.poll.record(snapshot.queued() - snapshot.polled());
+    stats_.queue.record(start - snapshot.queued());
+    stats_.send.record(now - start);
+}
+
+// The message is sent as encoded by the caller, mlm_client_send () takes it
+// over on success
+int MetricPublisher::send(mlm_client_t *client, const std::string& subject, zmsg_t **message)
+{
+    int rv = mlm_client_send(client, subject.c_str(), message);
+    if (rv != 0)
+        log_error("failed to send %s result %i", subject.c_str(), rv);
+    zmsg_destroy(message);
+    return rv;
+}
+
+void MetricPublisher::report(mlm_client_t *client, int64_t now)
+{
+    nextReport_ = now + report_ms_;
+    PublishQueue::Statistics queue = queue_.statistics();
+    size_t depth = queue_.size();
+    Statistics stats;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        stats = stats_;
+        stats_.poll = stats_.queue = stats_.send = Latency();
+    }
+    log_debug("publisher: %zu snapshots queued (max %zu), %" PRIu64 " dropped, %" PRIu64 " coalesced, "
+            "%" PRIu64 " sent with %" PRIu64 " metrics, %" PRIu64 " failed; longest poll %" PRIi64 " ms, "
+            "queue %" PRIi64 " ms, send %" PRIi64 " ms",
+            depth, queue.max_depth, queue.dropped, queue.coalesced, stats.snapshots, stats.metrics,
+            stats.failed, stats.poll.max_ms, stats.queue.max_ms, stats.send.max_ms);
+    const struct {
+        const char *type;
+        uint64_t value;
+        const char *units;
+    } metrics[] = {
+        { "publisher.queue.depth", depth, "" },
+        { "publisher.queue.dropped", queue.dropped, "" },
+        { "publisher.queue.coalesced", queue.coalesced, "" },
+        { "publisher.latency.poll", uint64_t(stats.poll.max_ms), "ms" },
+        { "publisher.latency.queue", uint64_t(stats.queue.max_ms), "ms" },
+        { "publisher.latency.send", uint64_t(stats.send.max_ms), "ms" },
+    };
+    // Alive until the next report
+    int ttl = std::max<int64_t>(2 * report_ms_ / 1000, 1);
+    for (const auto& metric : metrics) {
+        char value[32];
+        snprintf(value, sizeof(value), "%" PRIu64, metric.value);
+        zmsg_t *msg = fty_proto_encode_metric(NULL, time(NULL), ttl, metric.type, name_.c_str(), value,
+                metric.units);
+        if (msg)
+            send(client, std::string(metric.type) + "@" + name_, &msg);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+typedef std::map<std::string, std::string> Received;
+
+// Receives messages until all the subjects expected are there, publisher
+// metrics are only kept if asked for
+static Received
+s_receive(mlm_client_t *consumer, size_t count, bool statistics = false)
+{
+    Received received;
+    zpoller_t *poller = zpoller_new(mlm_client_msgpipe(consumer), NULL);
+    assert(poller);
+    while (received.size() < count) {
+        assert(zpoller_wait(poller, 5000));
+        zmsg_t *message = mlm_client_recv(consumer);
+        assert(message);
+        std::string subject = mlm_client_subject(consumer);
+        fty_proto_t *proto = fty_proto_decode(&message);
+        assert(proto);
+        if (statistics || subject.compare(0, 10, "publisher.") != 0)
+            received[subject] = std::string(fty_proto_value(proto)) + " " + fty_proto_unit(proto);
+        fty_proto_destroy(&proto);
+    }
+    zpoller_destroy(&poller);
+    return received;
+}
+
+void
+metric_publisher_test (bool verbose)
+{
+    printf (" * metric_publisher: ");
+
+    //  @selftest
+    static const char *endpoint = "inproc://metric-publisher-test";
+    zactor_t *malamute = zactor_new(mlm_server, (void *) "Malamute");
+    assert(malamute);
+    zstr_sendx(malamute, "BIND", endpoint, NULL);
+    mlm_client_t *producer = mlm_client_new();
+    assert(mlm_client_connect(producer, endpoint, 1000, "metric-publisher-producer") == 0);
+    assert(mlm_client_set_producer(producer, FTY_PROTO_STREAM_METRICS) == 0);
+    mlm_client_t *consumer = mlm_client_new();
+    assert(mlm_client_connect(consumer, endpoint, 1000, "metric-publisher-consumer") == 0);
+    assert(mlm_client_set_consumer(consumer, FTY_PROTO_STREAM_METRICS, ".*") == 0);
+    zclock_sleep(100);
+
+    const std::map<std::string, std::string> units = { { "realpower", "W" } };
+    PublishDescriptors descriptors(units);
+    const std::shared_ptr<PublishDescriptors::Device>& ups = descriptors.device("ups-1");
+    const PublishDescriptors::Metric& realpower = descriptors.metric(*ups, MetricNames::intern("realpower.default"));
+    auto snapshot = [&](const char *power, const char *status) -> std::unique_ptr<PublishQueue::Snapshot> {
+        std::unique_ptr<PublishQueue::Snapshot> s(new PublishQueue::Snapshot(ups, 60, time(NULL), zclock_mono()));
+        s->add(realpower, power);
+        s->add(ups->status, status);
+        return s;
+    };
+    {
+        MetricPublisher publisher("metric-publisher-test", 200);
+        // Without a client, nothing is sent and the snapshot comes back
+        auto unsent = publisher.publish(snapshot("1", "8"));
+        assert(unsent && unsent->size() == 2);
+        assert(publisher.statistics().snapshots == 0);
+
+        // Until started, in the caller's thread
+        publisher.setClient(producer);
+        assert(!publisher.publish(snapshot("100", "8")));
+        assert(publisher.statistics().snapshots == 1);
+        Received received = s_receive(consumer, 2);
+        assert(received["realpower.default@ups-1"] == "100 W");
+        assert(received["status@ups-1"] == "8 ");
+
+        // From the thread
+        assert(publisher.start(endpoint));
+        assert(publisher.running());
+        publisher.publish(snapshot("200", "16"));
+        received = s_receive(consumer, 2);
+        assert(received["realpower.default@ups-1"] == "200 W");
+        assert(received["status@ups-1"] == "16 ");
+
+        // Batches only
+        publisher.setBatching(true, false);
+        assert(publisher.batching() && !publisher.fanout());
+        publisher.publish(snapshot("300", "8"));
+        received = s_receive(consumer, 1);
+        assert(received.count("metrics@ups-1"));
+        assert(received["metrics@ups-1"] == "2 ");
+        publisher.setBatching(false, true);
+
+        // Its own metrics
+        received = s_receive(consumer, 6, true);
+        assert(received.count("publisher.queue.depth@metric-publisher-test"));
+        assert(received["publisher.queue.dropped@metric-publisher-test"] == "0 ");
+        assert(received.count("publisher.latency.send@metric-publisher-test"));
+        assert(received["publisher.latency.poll@metric-publisher-test"].find(" ms") != std::string::npos);
+        MetricPublisher::Statistics stats = publisher.statistics();
+        assert(stats.snapshots == 3 && stats.metrics == 6 && stats.failed == 0);
+
+        // Back to the caller's thread
+        publisher.stop();
+        assert(!publisher.running());
+        publisher.publish(snapshot("400", "8"));
+        received = s_receive(consumer, 2);
+        assert(received["realpower.default@ups-1"] == "400 W");
+    }
+    if (verbose) {
+        // Time the agent spends handing the metrics of a device over,
+        // against sending them itself
+        const int devices = 100, count = 100;
+        for (bool threaded : { false, true }) {
+            MetricPublisher publisher("metric-publisher-bench");
+            publisher.setClient(producer);
+            if (threaded)
+                assert(publisher.start(endpoint));
+            int64_t spent = 0;
+            for (int d = 0; d < devices; d++) {
+                const std::shared_ptr<PublishDescriptors::Device>& device =
+                        descriptors.device("epdu-" + std::to_string(d));
+                std::unique_ptr<PublishQueue::Snapshot> s(
+                        new PublishQueue::Snapshot(device, 60, time(NULL), zclock_mono()));
+                for (int m = 1; m <= count; m++)
+                    s->add(descriptors.metric(*device, descriptors.outlet(m)), "42");
+                int64_t start = zclock_usecs();
+                publisher.publish(std::move(s));
+                spent += zclock_usecs() - start;
+                s_receive(consumer, count);
+            }
+            printf("\n   %s: %.1f us per device of %d metrics", threaded ? "publisher thread" : "agent thread",
+                    double(spent) / devices, count);
+        }
+        printf("\n   ");
+    }
+    mlm_client_destroy(&consumer);
+    mlm_client_destroy(&producer);
+    zactor_destroy(&malamute);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,153 @@
+/*  =========================================================================
+    metric_publisher - Thread encoding and sending the metrics of the devices
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef METRIC_PUBLISHER_H_INCLUDED
+#define METRIC_PUBLISHER_H_INCLUDED
+
+/*
+ * MetricPublisher sends the snapshots of the metrics of the devices to the
+ * METRICS stream. Once started, it does so from a thread of its own, with
+ * a malamute client of its own, fed through a PublishQueue; a stalled
+ * broker then no longer delays the polls, and a slow upsd no longer
+ * delays the publication of the devices already read:
+ *
+ * MetricPublisher publisher("fty-nut");
+ * publisher.setClient(client);        // until started, or if it fails
+ * publisher.start(endpoint);
+ * publisher.publish(std::move(snapshot));
+ *
+ * Until started, publish() sends in the caller's thread through the client
+ * given to setClient().
+ *
+ * Every METRIC_PUBLISHER_REPORT_MS by default, it publishes metrics of its
+ * own, named after the agent:
+ *
+ *   publisher.queue.depth      snapshots waiting
+ *   publisher.queue.dropped    snapshots dropped since the start
+ *   publisher.queue.coalesced  snapshots merged since the start
+ *   publisher.latency.poll     longest time from the start of a poll to
+ *                              the snapshot being queued, ms
+ *   publisher.latency.queue    longest time in the queue, ms
+ *   publisher.latency.send     longest time to encode and send a snapshot, ms
+ *
+ * the latencies being those of the snapshots sent since the last report.
+ */
+
+#include "metric_batch.h"
+#include "publish_queue.h"
+
+#include <malamute.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define METRIC_PUBLISHER_REPORT_MS 60000
+
+class MetricPublisher {
+public:
+    struct Latency {
+        int64_t last_ms = 0;
+        int64_t max_ms = 0;
+        void record(int64_t ms);
+    };
+    struct Statistics {
+        uint64_t snapshots = 0;
+        uint64_t metrics = 0;
+        uint64_t failed = 0;
+        // Since the last report
+        Latency poll;
+        Latency queue;
+        Latency send;
+    };
+    // name is the element of the metrics of the publisher, and the prefix
+    // of the name of its client
+    explicit MetricPublisher(const std::string& name, int64_t report_ms = METRIC_PUBLISHER_REPORT_MS);
+    MetricPublisher(const MetricPublisher&) = delete;
+    MetricPublisher& operator=(const MetricPublisher&) = delete;
+    ~MetricPublisher();
+    // Client used until started
+    void setClient(mlm_client_t *client);
+    // Starts the thread, with a client connected to the endpoint. Returns
+    // false if the client cannot connect, publishing stays in the caller's
+    // thread then
+    bool start(const std::string& endpoint);
+    // Stops the thread, the snapshots not sent yet are dropped
+    void stop();
+    bool running() const
+    {
+        return thread_.joinable();
+    }
+    void configure(size_t capacity, PublishQueue::Overflow overflow)
+    {
+        queue_.configure(capacity, overflow);
+    }
+    const PublishQueue& queue() const
+    {
+        return queue_;
+    }
+    // See MetricBatch
+    void setBatching(bool batch, bool fanout)
+    {
+        batch_ = batch;
+        fanout_ = fanout;
+    }
+    bool batching() const
+    {
+        return batch_;
+    }
+    bool fanout() const
+    {
+        return fanout_;
+    }
+    // Queues the snapshot for the thread once started, sends it otherwise.
+    // Returns the snapshot whose values will not be published, if any:
+    // one dropped from the queue (see PublishQueue::push()), or this one
+    // without a client
+    std::unique_ptr<PublishQueue::Snapshot> publish(std::unique_ptr<PublishQueue::Snapshot> snapshot);
+    Statistics statistics() const;
+private:
+    void run();
+    // In the thread sending
+    void send(mlm_client_t *client, const PublishQueue::Snapshot& snapshot);
+    int send(mlm_client_t *client, const std::string& subject, zmsg_t **message);
+    void report(mlm_client_t *client, int64_t now);
+    const std::string name_;
+    const int64_t report_ms_;
+    std::atomic<bool> batch_;
+    std::atomic<bool> fanout_;
+    PublishQueue queue_;
+    // The client of the caller, and that of the thread
+    mlm_client_t *client_;
+    mlm_client_t *own_client_;
+    std::thread thread_;
+    // Used by the thread sending
+    MetricBatch metricBatch_;
+    int64_t nextReport_;
+    mutable std::mutex statsMutex_;
+    Statistics stats_;
+};
+
+//  Self test of this class
+void metric_publisher_test (bool verbose);
+
+#endif
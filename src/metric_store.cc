@@ -0,0 +1,175 @@
+/*  =========================================================================
+    metric_store - Interned metric names and flat per-device value stores
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+
+/*
+@header
+    metric_store - Interned metric names and flat per-device value stores
+@discuss
+@end
+*/
+
+#include "metric_store.h"
+
+#include <cassert>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+struct Interner {
+    std::mutex mutex;
+    std::unordered_map<std::string, MetricNames::Id> ids;
+    // A deque does not move the names it holds
+    std::deque<std::string> names;
+};
+
+Interner& s_interner()
+{
+    static Interner interner;
+    return interner;
+}
+}
+
+const MetricNames::Id MetricNames::NONE;
+
+MetricNames::Id MetricNames::intern(const std::string& name)
+{
+    Interner& interner = s_interner();
+    std::lock_guard<std::mutex> lock(interner.mutex);
+    auto i = interner.ids.find(name);
+    if (i != interner.ids.end())
+        return i->second;
+    Id id = interner.names.size();
+    interner.names.push_back(name);
+    interner.ids.emplace(name, id);
+    return id;
+}
+
+MetricNames::Id MetricNames::find(const std::string& name)
+{
+    Interner& interner = s_interner();
+    std::lock_guard<std::mutex> lock(interner.mutex);
+    auto i = interner.ids.find(name);
+    return i == interner.ids.end() ? NONE : i->second;
+}
+
+const std::string& MetricNames::name(Id id)
+{
+    Interner& interner = s_interner();
+    std::lock_guard<std::mutex> lock(interner.mutex);
+    return interner.names.at(id);
+}
+
+size_t MetricNames::size()
+{
+    Interner& interner = s_interner();
+    std::lock_guard<std::mutex> lock(interner.mutex);
+    return interner.names.size();
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+metric_store_test (bool verbose)
+{
+    printf (" * metric_store: ");
+
+    //  @selftest
+    {
+        size_t size = MetricNames::size();
+        MetricNames::Id a = MetricNames::intern("metric_store.test.a");
+        MetricNames::Id b = MetricNames::intern("metric_store.test.b");
+        assert(a != b);
+        assert(MetricNames::intern("metric_store.test.a") == a);
+        assert(MetricNames::find("metric_store.test.b") == b);
+        assert(MetricNames::find("metric_store.test.c") == MetricNames::NONE);
+        assert(MetricNames::name(a) == "metric_store.test.a");
+        assert(MetricNames::size() == size + 2);
+        // Names stay in place while others are interned
+        const std::string *name = &MetricNames::name(a);
+        for (int i = 0; i < 1000; i++)
+            MetricNames::intern("metric_store.test." + std::to_string(i));
+        assert(&MetricNames::name(a) == name);
+    }
+    {
+        MetricStore<std::string> store;
+        bool inserted;
+        assert(store.empty());
+        assert(store.index(5) == SIZE_MAX);
+        // Indexes follow the order of the IDs whatever the order of the
+        // insertions, with the changed flags
+        for (MetricNames::Id id : { 70, 10, 30, 50, 20, 60, 40 }) {
+            size_t i = store.insert(id, inserted);
+            assert(inserted);
+            assert(!store.changed(i));
+            store.value(i) = std::to_string(id);
+            store.setChanged(i, id % 20 == 0);
+        }
+        assert(store.size() == 7);
+        assert(store.insert(30, inserted) == 2 && !inserted);
+        assert(store.value(2) == "30");
+        for (size_t i = 0; i < store.size(); i++) {
+            assert(store.id(i) == 10 * (i + 1));
+            assert(store.value(i) == std::to_string(store.id(i)));
+            assert(store.changed(i) == (store.id(i) % 20 == 0));
+        }
+        assert(store.changedCount() == 3);
+        assert(store.contains(40) && !store.contains(45));
+        store.setChanged(true);
+        assert(store.changedCount() == 7);
+        store.setChanged(false);
+        assert(store.changedCount() == 0);
+
+        // The bitset spans several words
+        MetricStore<int> large;
+        for (MetricNames::Id id = 300; id > 0; id--) {
+            size_t i = large.insert(id, inserted);
+            large.value(i) = id;
+            large.setChanged(i, id % 3 == 0);
+        }
+        assert(large.size() == 300);
+        assert(large.changedCount() == 100);
+        for (size_t i = 0; i < large.size(); i++) {
+            assert(large.id(i) == i + 1);
+            assert(large.value(i) == static_cast<int>(i + 1));
+            assert(large.changed(i) == ((i + 1) % 3 == 0));
+        }
+        // Erasing moves the following values and flags down
+        for (MetricNames::Id id = 1; id <= 300; id += 2)
+            large.erase(large.index(id));
+        assert(large.size() == 150);
+        assert(large.changedCount() == 50);
+        for (size_t i = 0; i < large.size(); i++) {
+            assert(large.id(i) == 2 * (i + 1));
+            assert(large.value(i) == static_cast<int>(2 * (i + 1)));
+            assert(large.changed(i) == (2 * (i + 1) % 3 == 0));
+        }
+        large.erase(large.size() - 1);
+        assert(large.size() == 149 && large.changedCount() == 49);
+        large.clear();
+        assert(large.empty() && large.changedCount() == 0);
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,177 @@
+/*  =========================================================================
+    metric_store - Interned metric names and flat per-device value stores
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef METRIC_STORE_H_INCLUDED
+#define METRIC_STORE_H_INCLUDED
+
+/*
+ * Thousands of devices report the same few hundred metrics. MetricNames
+ * interns the metric names once for the whole process and gives each a
+ * small integer ID, so that a device does not need a copy of every name
+ * it reports. MetricStore keeps the values of one device in flat vectors
+ * sorted by ID, with the changed flags in a bitset:
+ *
+ * MetricStore<std::string> store;
+ * bool inserted;
+ * size_t i = store.insert(MetricNames::intern("realpower.default"), inserted);
+ * store.value(i) = "100";
+ * store.setChanged(i, true);
+ * for (size_t i = 0; i < store.size(); i++) {
+ *     if (store.changed(i))
+ *         publish(MetricNames::name(store.id(i)), store.value(i));
+ * }
+ *
+ * IDs are never released; the set of metric names is bounded by the
+ * mapping.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class MetricNames {
+public:
+    typedef uint32_t Id;
+    // ID of no metric
+    static const Id NONE = UINT32_MAX;
+    // Returns the ID of a name, allocating one if needed
+    static Id intern(const std::string& name);
+    // Returns the ID of a name, NONE if it was never interned
+    static Id find(const std::string& name);
+    // Returns the name of an ID returned by intern()
+    static const std::string& name(Id id);
+    // Number of names interned
+    static size_t size();
+};
+
+template <typename Value>
+class MetricStore {
+public:
+    size_t size() const
+    {
+        return ids_.size();
+    }
+    bool empty() const
+    {
+        return ids_.empty();
+    }
+    void clear()
+    {
+        ids_.clear();
+        values_.clear();
+        changed_.clear();
+    }
+    // Returns the index of a metric, SIZE_MAX if it is not present
+    size_t index(MetricNames::Id id) const
+    {
+        auto i = std::lower_bound(ids_.begin(), ids_.end(), id);
+        if (i == ids_.end() || *i != id)
+            return SIZE_MAX;
+        return i - ids_.begin();
+    }
+    bool contains(MetricNames::Id id) const
+    {
+        return index(id) != SIZE_MAX;
+    }
+    // Returns the index of a metric, which is added with a default value
+    // and not changed if it is not present. The indexes of the following
+    // metrics move up by one
+    size_t insert(MetricNames::Id id, bool& inserted)
+    {
+        auto i = std::lower_bound(ids_.begin(), ids_.end(), id);
+        size_t index = i - ids_.begin();
+        inserted = i == ids_.end() || *i != id;
+        if (inserted) {
+            ids_.insert(i, id);
+            values_.insert(values_.begin() + index, Value());
+            changed_.resize((ids_.size() + 63) / 64, 0);
+            for (size_t j = ids_.size() - 1; j > index; j--)
+                setChanged(j, changed(j - 1));
+            setChanged(index, false);
+        }
+        return index;
+    }
+    // Removes a metric. The indexes of the following metrics move down by
+    // one
+    void erase(size_t index)
+    {
+        for (size_t j = index; j + 1 < ids_.size(); j++)
+            setChanged(j, changed(j + 1));
+        setChanged(ids_.size() - 1, false);
+        ids_.erase(ids_.begin() + index);
+        values_.erase(values_.begin() + index);
+        changed_.resize((ids_.size() + 63) / 64);
+    }
+    MetricNames::Id id(size_t index) const
+    {
+        return ids_[index];
+    }
+    const Value& value(size_t index) const
+    {
+        return values_[index];
+    }
+    Value& value(size_t index)
+    {
+        return values_[index];
+    }
+    bool changed(size_t index) const
+    {
+        return (changed_[index / 64] >> (index % 64)) & 1;
+    }
+    void setChanged(size_t index, bool changed)
+    {
+        uint64_t bit = uint64_t(1) << (index % 64);
+        if (changed)
+            changed_[index / 64] |= bit;
+        else
+            changed_[index / 64] &= ~bit;
+    }
+    // Sets or clears all changed flags
+    void setChanged(bool changed)
+    {
+        std::fill(changed_.begin(), changed_.end(), uint64_t(0));
+        if (changed) {
+            for (size_t i = 0; i < ids_.size(); i++)
+                setChanged(i, true);
+        }
+    }
+    // Number of changed metrics
+    size_t changedCount() const
+    {
+        size_t count = 0;
+        for (uint64_t word : changed_)
+            count += __builtin_popcountll(word);
+        return count;
+    }
+private:
+    // Sorted
+    std::vector<MetricNames::Id> ids_;
+    std::vector<Value> values_;
+    // Bit i is the changed flag of values_[i]
+    std::vector<uint64_t> changed_;
+};
+
+//  Self test of this class
+void metric_store_test (bool verbose);
+
+#endif
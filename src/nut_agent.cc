@@ -27,8 +27,12 @@
 */
 #include "ups_status.h"
 #include "nut_agent.h"
+#include "nut_mlm.h"
 #include <fty_log.h>
 
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
 #include <cmath>
 
 const std::map<std::string, std::string> NUTAgent::_units =
@@ -48,6 +52,7 @@ const std::map<std::string, std::string> NUTAgent::_units =
 
 NUTAgent::NUTAgent(StateManager::Reader *reader)
     : _state_reader(reader)
+    , _publisher(ACTOR_NUT_NAME)
 {
 }
 
@@ -56,8 +61,23 @@ bool NUTAgent::loadMapping (const char *path_to_file)
     if ( !path_to_file )
         return false;
     _conf = path_to_file;
-    _deviceList.load_mapping (_conf.c_str ());
-    return _deviceList.mappingLoaded ();
+    if (_mappingWatch.path () != _conf)
+        _mappingWatch.watch (_conf);
+    if (!_deviceList.load_mapping (_conf.c_str ()))
+        return false;
+    _filter.configure (_deviceList.get_mapping ("deadbandMapping"));
+    return true;
+}
+
+void NUTAgent::checkMapping ()
+{
+    if (!_mappingWatch.changed ())
+        return;
+    log_info ("Mapping file '%s' changed, reloading it", _conf.c_str ());
+    if (_deviceList.load_mapping (_conf.c_str ())) {
+        _filter.configure (_deviceList.get_mapping ("deadbandMapping"));
+        _descriptors.clear ();
+    }
 }
 
 bool NUTAgent::isMappingLoaded () const
@@ -69,6 +89,7 @@ void NUTAgent::setClient (mlm_client_t *client)
 {
     if (!_client) {
        _client = client;
+       _publisher.setClient (client);
     }
 }
 void NUTAgent::setiClient (mlm_client_t *client)
@@ -79,6 +100,90 @@ void NUTAgent::setiClient (mlm_client_t *client)
 }
 
 void NUTAgent::onPoll ()
+{
+    _polled.clear ();
+    _pollStarted = zclock_mono ();
+    _deviceList.update (true);
+    advertise ();
+}
+
+void NUTAgent::startPoll (int64_t now)
+{
+    // A read that does not complete in time is abandoned by the next one
+    if (_deviceList.updating () && now - _pollStarted < NUT_CONNECTION_TIMEOUT_MS)
+        return;
+    std::vector<std::string> due;
+    _scheduler.due (now, due);
+    _scheduler.report ("NUT", now);
+    if (due.empty ())
+        return;
+    _polled = std::set<std::string> (due.begin (), due.end ());
+    _pollStarted = now;
+    if (!_deviceList.beginPartialUpdate (due, true))
+        advertise ();
+}
+
+int64_t NUTAgent::pollTimeout (int64_t now) const
+{
+    int64_t timeout = _scheduler.timeout (now);
+    if (timeout >= 0 && _deviceList.updating ()) {
+        // The devices due meanwhile wait for the read in progress
+        timeout = std::max (timeout, _pollStarted + NUT_CONNECTION_TIMEOUT_MS - now);
+    }
+    return timeout;
+}
+
+void NUTAgent::setPollingInterval (int64_t interval_ms)
+{
+    _scheduler.setInterval (interval_ms, zclock_mono ());
+}
+
+bool NUTAgent::polled (const drivers::nut::NUTDevice& device) const
+{
+    return _polled.empty () || _polled.count (device.nutName ());
+}
+
+void NUTAgent::onNutReadable ()
+{
+    if (_deviceList.onReadable ()) {
+        adaptPolling ();
+        advertise ();
+    }
+}
+
+void NUTAgent::adaptPolling ()
+{
+    // Daisy-chained devices share the NUT device, the busiest one counts
+    std::map<std::string, PollScheduler::Activity> activities;
+    for (auto& device : _deviceList) {
+        if (!polled (device.second))
+            continue;
+        PollScheduler::Activity activity = PollScheduler::IDLE;
+        if (device.second.hasProperty ("status.ups")
+                && (upsstatus_to_int (device.second.property ("status.ups")) & (STATUS_OB | STATUS_LB | STATUS_OVER)))
+            activity = PollScheduler::URGENT;
+        else
+        if (device.second.volatility () >= NUT_POLLING_VOLATILITY)
+            activity = PollScheduler::MOVING;
+        PollScheduler::Activity& nut_activity = activities[device.second.nutName ()];
+        nut_activity = std::max (nut_activity, activity);
+    }
+    int64_t now = zclock_mono ();
+    for (const auto& activity : activities)
+        _scheduler.adapt (activity.first, activity.second, now);
+}
+
+void NUTAgent::setPollingBounds (int64_t min_ms, int64_t max_ms)
+{
+    _scheduler.setBounds (min_ms, max_ms);
+}
+
+void NUTAgent::setPollingBudget (double requests_per_second)
+{
+    _scheduler.setBudget (requests_per_second);
+}
+
+void NUTAgent::advertise ()
 {
     if (_client)
         advertisePhysics ();
@@ -88,31 +193,34 @@ void NUTAgent::onPoll ()
 
 void NUTAgent::updateDeviceList ()
 {
-    if (_state_reader->refresh())
-        _deviceList.updateDeviceList (_state_reader->getState());
-}
-
-int NUTAgent::send (const std::string& subject, zmsg_t **message_p)
-{
-    fty_proto_t *m_decoded = fty_proto_decode(message_p);
-    zmsg_destroy(message_p);
-    *message_p = fty_proto_encode(&m_decoded);
-
-    int rv = mlm_client_send (_client, subject.c_str (), message_p);
-    if (rv == -1) {
-        log_error ("mlm_client_send (subject = '%s') failed", subject.c_str ());
+    // Only the assets that changed since the last refresh are looked at
+    AssetState::ChangeSet changes;
+    if (!_state_reader->refresh (&changes) || changes.empty ())
+        return;
+    drivers::nut::NUTDeviceList::Changes listChanges;
+    _deviceList.updateDeviceList (_state_reader->getState (), changes, listChanges);
+    log_debug ("%zu assets changed, %zu NUT devices added, %zu removed",
+            changes.added.size () + changes.updated.size () + changes.removed.size (),
+            listChanges.addedNutNames.size (), listChanges.removedNutNames.size ());
+    int64_t now = zclock_mono ();
+    for (const auto& nutName : listChanges.removedNutNames) {
+        _scheduler.remove (nutName);
+        _inventoryScheduler.remove (nutName);
+    }
+    for (const auto& nutName : listChanges.addedNutNames) {
+        _scheduler.add (nutName, now);
+        _inventoryScheduler.add (nutName, now);
+    }
+    for (const auto& asset : listChanges.removedAssets) {
+        _filter.forget (asset);
+        _descriptors.forget (asset);
+        _inventoryDigests.erase (asset);
     }
-    zmsg_destroy (message_p);
-    return rv;
 }
 
 //MVY: a hack for inventory messages
 int NUTAgent::isend (const std::string& subject, zmsg_t **message_p)
 {
-    fty_proto_t *m_decoded = fty_proto_decode(message_p);
-    zmsg_destroy(message_p);
-    *message_p = fty_proto_encode(&m_decoded);
-
     int rv = mlm_client_send (_iclient, subject.c_str (), message_p);
     if (rv == -1) {
         log_error ("mlm_client_send (subject = '%s') failed", subject.c_str ());
@@ -121,210 +229,162 @@ int NUTAgent::isend (const std::string& subject, zmsg_t **message_p)
     return rv;
 }
 
-std::string NUTAgent::physicalQuantityShortName (const std::string& longName) const
+// Heartbeat of the metrics published with the given TTL, capped to half of
+// it so that unchanged metrics are published again before they expire
+static int64_t
+s_heartbeat (int64_t heartbeat_ms, int ttl)
 {
-    size_t i = longName.find ('.');
-    if (i == std::string::npos) {
-       return longName;
-    }
-    return longName.substr (0, i);
+    return std::min<int64_t> (heartbeat_ms, ttl * 1000 / 2);
 }
 
-std::string NUTAgent::physicalQuantityToUnits (const std::string& quantity) const {
-    auto it = _units.find(quantity);
-    if (it == _units.end ()) {
-        return "";
-    }
-    return it->second;
+bool NUTAgent::advertiseMetric (PublishQueue::Snapshot& snapshot, const PublishDescriptors::Metric& metric,
+        double number, const char *value, int64_t now, int64_t heartbeat)
+{
+    if (!_filter.pass (snapshot.asset (), *metric.quantity, number, value, now, heartbeat))
+        return false;
+    snapshot.add (metric, value);
+    return true;
 }
 
 void NUTAgent::advertisePhysics ()
 {
-    _deviceList.update (true);
+    static const MetricNames::Id loadDefault = MetricNames::intern ("load.default");
+    static const MetricNames::Id loadInput = MetricNames::intern ("load.input.L1");
+    static const MetricNames::Id currentInput = MetricNames::intern ("current.input.L1");
+    static const MetricNames::Id currentNominal = MetricNames::intern ("current.input.nominal");
+    static const MetricNames::Id statusUps = MetricNames::intern ("status.ups");
+    static const std::string epdu = "epdu";
+    int64_t now = zclock_mono ();
     for (auto& device : _deviceList) {
-        std::string subject;
-        auto measurements = device.second.physics (false); // take  NOT only changed
-        for (const auto& measurement : measurements) {
-            std::string type = physicalQuantityShortName (measurement.first);
-            std::string units = physicalQuantityToUnits (type);
-
-            zmsg_t *msg = fty_proto_encode_metric (
-                NULL,
-                time (NULL),
-                _ttl,
-                measurement.first.c_str (),
-                device.second.assetName ().c_str (),
-                measurement.second.c_str (),
-                units.c_str ());
-            if (msg) {
-                log_debug ("sending new measurement for element_src = '%s', type = '%s', value = '%s', units = '%s'",
-                           device.second.assetName ().c_str (),
-                           measurement.first.c_str (),
-                           measurement.second.c_str (),
-                           units.c_str ());
-
-                subject = measurement.first + "@" + device.second.assetName ();
-                int r = send(subject, &msg);
-                if( r != 0 )
-                    log_error("failed to send measurement %s result %i", subject.c_str(), r);
-                zmsg_destroy (&msg);
-                device.second.setChanged (measurement.first, false);
-            }
-        }
+        if (!polled (device.second))
+            continue;
+        // Subjects and units were computed at the first poll of the device
+        const std::shared_ptr<PublishDescriptors::Device>& shared = _descriptors.device (device.second.assetName ());
+        PublishDescriptors::Device& descriptors = *shared;
+        // Idle devices are polled less often, their metrics live longer.
+        // Unchanged metrics are published once per heartbeat, at the first
+        // poll after it, before they expire
+        int64_t interval = _scheduler.deviceInterval (device.second.nutName ());
+        int ttl = std::max<int64_t> (_ttl, 2 * interval / 1000);
+        int64_t heartbeat = s_heartbeat (_heartbeat_ms, ttl);
+        // Encoded and sent by the publisher
+        std::unique_ptr<PublishQueue::Snapshot> snapshot (
+                new PublishQueue::Snapshot (shared, ttl, time (NULL), _pollStarted));
+        // take  NOT only changed, the filter keeps the significant ones
+        device.second.forEachPhysicsId (false, [&](MetricNames::Id id, const char *value, double number) {
+            if (advertiseMetric (*snapshot, _descriptors.metric (descriptors, id), number, value, now, heartbeat))
+                device.second.setChanged (id, false);
+        });
+        char buffer [50];
         // 'load' computing
         // BIOS-1185 start
         // if it is epdu, that doesn't provide load.default,
         // but it is still could be calculated (because input.current is known) then do this
-        if (device.second.subtype() == "epdu"
-             && measurements.count ("load.default") == 0 )
+        if (device.second.subtype() == epdu
+             && !device.second.hasPhysics (loadDefault) )
         {
-            if ( measurements.count ("load.input.L1") != 0 ) {
-                std::string value = measurements.at("load.input.L1");
-                zmsg_t *msg = fty_proto_encode_metric (
-                        NULL,
-                        time (NULL),
-                        _ttl,
-                        "load.default",
-                        device.second.assetName().c_str(),
-                        value.c_str (),
-                        "%");
-                if (msg) {
-                    log_debug ("sending new measurement for element_src = '%s', type = '%s', value = '%s', units = '%s'",
-                               device.second.assetName ().c_str (), "load.default", value.c_str (), "%");
-
-                    subject = "load.default@" + device.second.assetName();
-                    int r = send (subject, &msg);
-                    if( r != 0 )
-                        log_error("failed to send measurement %s result %i", subject.c_str(), r);
-                    zmsg_destroy (&msg);
-                }
+            const PublishDescriptors::Metric& load = _descriptors.metric (descriptors, loadDefault);
+            if ( device.second.hasPhysics (loadInput) ) {
+                advertiseMetric (*snapshot, load, device.second.number (loadInput),
+                        device.second.property (loadInput, buffer, sizeof (buffer)), now, heartbeat);
             }
-            else if ( measurements.count ("current.input.L1") != 0 ) // it is a mapped value!!!!!!!!!!!
+            else if ( device.second.hasPhysics (currentInput) ) // it is a mapped value!!!!!!!!!!!
             {
                 // try to compute it
                 // 1. Determine the MAX value
                 double max_value = NAN;
-                if ( measurements.count ("current.input.nominal") == 1 ) {
-                    try {
-                        max_value = std::stof (measurements.at("current.input.nominal"));
-                        log_debug ("load.default: max_value %lf from UPS", max_value);
-                    } catch (...) {}
+                if ( device.second.hasPhysics (currentNominal) ) {
+                    max_value = device.second.number (currentNominal);
+                    log_debug ("load.default: max_value %lf from UPS", max_value);
                 } else {
                     max_value = device.second.maxCurrent();
                     log_debug ("load.default: max_value %lf from user", max_value);
                 }
                 // 2. if MAX value is known -> do work, otherwise skip
                 if (!isnan(max_value)) {
-                    double value = 0;
-                    try {
-                        value = stof (measurements.at("current.input.L1"));
-                    } catch (...) {};
-                    char buffer [50];
+                    double value = device.second.number (currentInput);
+                    if (isnan (value)) value = 0;
                     // 3. compute a real value
-                    sprintf (buffer, "%lf", value*100/max_value); // because it is %!!!!
-                    // 4. form message
-                    zmsg_t *msg = fty_proto_encode_metric (
-                            NULL,
-                            time (NULL),
-                            _ttl,
-                            "load.default",
-                            device.second.assetName().c_str(),
-                            buffer,
-                            "%");
-                    // 5. send the messsage
-                    if (msg) {
-                        log_debug ("sending new measurement for element_src = '%s', type = '%s', value = '%s', units = '%s'",
-                                device.second.assetName ().c_str (), "load.default", buffer, "%");
-
-                        subject = "load.default@" + device.second.assetName();
-                        int r = send (subject, &msg);
-                        if( r != 0 )
-                            log_error("failed to send measurement %s result %i", subject.c_str(), r);
-                        zmsg_destroy (&msg);
-                    }
+                    double load_value = value*100/max_value; // because it is %!!!!
+                    snprintf (buffer, sizeof (buffer), "%lf", load_value);
+                    // 4. send the message
+                    advertiseMetric (*snapshot, load, load_value, buffer, now, heartbeat);
                 }
             }
         }
 
         // BIOS-1185 end
         // send also status as bitmap
-        if (device.second.hasProperty ("status.ups")) {
-            std::string status_s = device.second.property ("status.ups");
+        const char *status_s = device.second.property (statusUps, buffer, sizeof (buffer));
+        if (status_s) {
             uint16_t    status_i = upsstatus_to_int (status_s);
-            zmsg_t *msg = fty_proto_encode_metric (
-                NULL,
-                time (NULL),
-                _ttl,
-                "status.ups",
-                device.second.assetName ().c_str (),
-                std::to_string (status_i).c_str (),
-                "");
-            if (msg) {
-                log_debug ("sending new status for element_src = '%s', value = '%s' (%s)",
-                           device.second.assetName().c_str (), std::to_string (status_i).c_str (), status_s.c_str ());
-                subject = "status@" + device.second.assetName ();
-                int r = send (subject, &msg);
-                if( r != 0 )
-                    log_error("failed to send measurement %s result %i", subject.c_str(), r);
-                zmsg_destroy (&msg);
-                device.second.setChanged ("status.ups", false);
-            }
+            snprintf (buffer, sizeof (buffer), "%" PRIu16, status_i);
+            if (advertiseMetric (*snapshot, descriptors.status, status_i, buffer, now, heartbeat))
+                device.second.setChanged (statusUps, false);
         }
+        // the polling interval of the device, adapted to its activity
+        snprintf (buffer, sizeof (buffer), "%g", interval / 1000.0);
+        advertiseMetric (*snapshot, descriptors.interval, interval / 1000.0, buffer, now, heartbeat);
         //MVY: send also epdu status as bitmap
         for (int i = 1; i != 100; i++) {
-            std::string property = "status.outlet." + std::to_string (i);
+            MetricNames::Id property = _descriptors.outlet (i);
+            status_s = device.second.property (property, buffer, sizeof (buffer));
             // assumption, if outlet.10 does not exists, outlet.11 does not as well
-            if (!device.second.hasProperty (property))
+            if (!status_s)
                 break;
-            std::string status_s = device.second.property (property);
-            uint16_t    status_i = status_s == "on" ? 42 : 0;
+            uint16_t    status_i = strcmp (status_s, "on") == 0 ? 42 : 0;
 
-            zmsg_t *msg = fty_proto_encode_metric (
-                NULL,
-                time (NULL),
-                _ttl,
-                property.c_str (),
-                device.second.assetName ().c_str (),
-                std::to_string (status_i).c_str (),
-                "");
-            if (msg) {
-                log_debug ("sending new status for %s %s, value %i (%s)",
-                           property.c_str (),
-                           device.second.assetName().c_str(),
-                           status_i,
-                           status_s.c_str());
-                subject = "status.outlet." + std::to_string (i) + "@" + device.second.assetName ();
-                int r = send (subject, &msg);
-                if( r != 0 )
-                    log_error("failed to send measurement %s result %i", subject.c_str(), r);
-                zmsg_destroy (&msg);
+            if (advertiseMetric (*snapshot, _descriptors.metric (descriptors, property),
+                        status_i, status_i ? "42" : "0", now, heartbeat))
                 device.second.setChanged (property, false);
-            }
+        }
+        std::unique_ptr<PublishQueue::Snapshot> lost = _publisher.publish (std::move (snapshot));
+        if (lost) {
+            // the filter took these values as published, they are to pass
+            // at the next poll
+            lost->forEach ([&](const PublishDescriptors::Metric& metric, const char *) {
+                _filter.forget (lost->asset (), *metric.quantity);
+            });
         }
     }
+    log_debug ("metrics published %" PRIu64 ", suppressed %" PRIu64,
+               _filter.passed (), _filter.suppressed ());
 }
 
 void NUTAgent::advertiseInventory()
 {
-    bool advertiseAll = false;
-    if (_inventoryTimestamp_ms + NUT_INVENTORY_REPEAT_AFTER_MS < static_cast<uint64_t> (zclock_mono ())) {
-        advertiseAll = true;
-        _inventoryTimestamp_ms = static_cast<uint64_t> (zclock_mono ());
-    }
+    static const MetricNames::Id status = MetricNames::intern ("status.ups");
+    // Each device advertises its whole inventory at its first poll after
+    // its slot in the hour
+    std::vector<std::string> due;
+    _inventoryScheduler.due (zclock_mono (), due);
+    _inventoryRefresh.insert (due.begin (), due.end ());
+    bool debug = ManageFtyLog::getInstanceFtylog ()->isLogDebug ();
     for (auto& device : _deviceList) {
+        if (!polled (device.second))
+            continue;
+        // status.ups is not advertised as inventory information
+        uint64_t digest = device.second.inventoryDigest (status);
+        auto advertised = _inventoryDigests.find (device.second.assetName ());
+        bool advertiseAll = advertised == _inventoryDigests.end ()
+            || _inventoryRefresh.count (device.second.nutName ()) != 0;
+        if (!advertiseAll && advertised->second == digest) {
+            // nothing changed since the last message, or changed back
+            continue;
+        }
         std::string log;
         zhash_t *inventory = zhash_new ();
         // !advertiseAll = advetise_Not_OnlyChanged
-        for (auto& item : device.second.inventory (!advertiseAll) ) {
-            if (item.first == "status.ups") {
-                // this value is not advertised as inventory information
-                continue;
-            }
-            zhash_insert (inventory, item.first.c_str (), (void *) item.second.c_str ()) ;
-            log += item.first + " = \"" + item.second + "\"; ";
-            device.second.setChanged (item.first, false);
-        }
+        device.second.forEachInventory (!advertiseAll, [&](const std::string& name, const std::string& value) {
+            if (name == MetricNames::name (status))
+                return;
+            zhash_insert (inventory, name.c_str (), (void *) value.c_str ()) ;
+            if (debug)
+                log += name + " = \"" + value + "\"; ";
+            device.second.setChanged (name, false);
+        });
         if (zhash_size (inventory) == 0) {
+            _inventoryDigests[device.second.assetName ()] = digest;
             zhash_destroy (&inventory);
             continue;
         }
@@ -341,10 +401,16 @@ void NUTAgent::advertiseInventory()
             int r = isend (topic, &message);
             if( r != 0 )
                 log_error ("failed to send inventory %s result %i", topic.c_str(), r);
+            else
+                _inventoryDigests[device.second.assetName ()] = digest;
             zmsg_destroy (&message);
         }
         zhash_destroy (&inventory);
     }
+    if (_polled.empty ())
+        _inventoryRefresh.clear ();
+    for (const auto& nutName : _polled)
+        _inventoryRefresh.erase (nutName);
 }
 
 //  --------------------------------------------------------------------------
@@ -356,6 +422,51 @@ nut_agent_test (bool verbose)
     printf (" * nut_agent: ");
 
     //  @selftest
+    {
+        // Unchanged metrics are published again before their TTL expires,
+        // whatever the TTL, the heartbeat and the polling interval
+        for (int configured_ttl : { 60, 600 }) {
+            for (int64_t interval : { 30000, 120000 }) {
+                for (int64_t heartbeat_ms : { 0, 30000, 300000 }) {
+                    int ttl = std::max<int64_t> (configured_ttl, 2 * interval / 1000);
+                    int64_t heartbeat = s_heartbeat (heartbeat_ms, ttl);
+                    PublishFilter filter;
+                    int64_t published = 0;
+                    for (int64_t now = 0; now < 3600000; now += interval) {
+                        assert (now - published < ttl * 1000);
+                        if (filter.pass ("ups-1", "realpower.default", 100, "100", now, heartbeat))
+                            published = now;
+                    }
+                    // A TTL longer than the heartbeat leaves it in effect
+                    if (heartbeat_ms == 300000 && configured_ttl == 600 && interval == 30000)
+                        assert (filter.passed () == 3600000 / 300000);
+                }
+            }
+        }
+    }
+    if (verbose) {
+        // Cost of encoding a metric for send (), compared with the decode
+        // and encode round trip it used to go through
+        const int count = 100000;
+        for (bool round_trip : { true, false }) {
+            int64_t start = zclock_usecs ();
+            for (int i = 0; i < count; i++) {
+                zmsg_t *message = fty_proto_encode_metric (
+                        NULL, time (NULL), 60, "realpower.default", "ups-1", "1234.5", "W");
+                assert (message);
+                if (round_trip) {
+                    fty_proto_t *decoded = fty_proto_decode (&message);
+                    zmsg_destroy (&message);
+                    message = fty_proto_encode (&decoded);
+                }
+                zmsg_destroy (&message);
+            }
+            int64_t elapsed = std::max<int64_t> (zclock_usecs () - start, 1);
+            printf ("\n   %s: %.0f messages/s", round_trip ? "with round trip" : "encoded once",
+                    count * 1000000.0 / elapsed);
+        }
+        printf ("\n   ");
+    }
     //  @end
     printf ("OK\n");
 }
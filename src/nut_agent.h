@@ -23,44 +23,129 @@
 #define NUT_FTY_H_INCLUDED
 
 #include "state_manager.h"
+#include "file_watch.h"
+#include "metric_publisher.h"
 #include "nut_device.h"
+#include "poll_scheduler.h"
+#include "publish_descriptors.h"
+#include "publish_filter.h"
+
+#include <set>
+#include <unordered_map>
 
 #define NUT_INVENTORY_REPEAT_AFTER_MS      3600000
+// Longest time an unchanged metric is not published again
+#define NUT_METRICS_HEARTBEAT_MS           300000
 
 class NUTAgent {
  public:
     explicit NUTAgent(StateManager::Reader *reader);
     bool loadMapping (const char *path_to_file);
     bool isMappingLoaded () const;
+    // Readable when the mapping file may have changed, -1 if it is polled
+    int mappingSocket () const { return _mappingWatch.socket (); };
+    // Reloads the mapping if its file changed. The new mapping is swapped
+    // in between two reads of the devices, only the values whose mapping
+    // changed are read again
+    void checkMapping ();
 
     void setClient (mlm_client_t *client);
     void setiClient (mlm_client_t *client);
+    // Publishes the metrics from a thread with a client of its own instead
+    // of the client above, see MetricPublisher
+    bool startPublisher (const std::string& endpoint) { return _publisher.start (endpoint); };
+    // Snapshots waiting for the publisher, and what to do when it falls
+    // behind, see PublishQueue
+    void setPublishQueue (size_t capacity, PublishQueue::Overflow overflow) { _publisher.configure (capacity, overflow); };
+    const MetricPublisher& publisher () const { return _publisher; };
 
     void updateDeviceList ();
+    // Reads the devices from NUT and advertises their values, blocking
+    // until all devices are read
     void onPoll ();
+    // Starts reading the devices whose slot has come from NUT, unless a
+    // read is still in progress. Their values are advertised once
+    // onNutReadable () has processed all replies
+    void startPoll (int64_t now);
+    void onNutReadable ();
+    // Socket to watch for readability while reading, -1 otherwise
+    int nutSocket () const { return _deviceList.socket (); };
+    // Time until startPoll () has something to do, -1 if there are no
+    // devices
+    int64_t pollTimeout (int64_t now) const;
+
+    // Every device is polled once per interval, in its own slot
+    void setPollingInterval (int64_t interval_ms);
+    // Bounds of the interval of a device, which is shortened while it is
+    // on battery, overloaded or its values are moving, and lengthened
+    // while it is idle
+    void setPollingBounds (int64_t min_ms, int64_t max_ms);
+    // Largest number of requests per second to upsd, 0 for no limit
+    void setPollingBudget (double requests_per_second);
+    // Slots and poll jitter of the NUT devices
+    const PollScheduler& scheduler () const { return _scheduler; };
+
+    // Number of connections used to read the devices from NUT
+    void setWorkers (size_t workers) { _deviceList.setWorkers (workers); };
 
     void TTL (int ttl) { _ttl = ttl; };
     int TTL () const { return _ttl; };
+
+    // Metrics are published when they leave their deadband (see
+    // mapping.conf) and at least once per heartbeat, which is capped to
+    // half their TTL. With 0, every metric is published at every poll
+    void setHeartbeat (int64_t heartbeat_ms) { _heartbeat_ms = heartbeat_ms; };
+    int64_t heartbeat () const { return _heartbeat_ms; };
+    const PublishFilter& publishFilter () const { return _filter; };
+
+    // With batching, the metrics of a device published by a poll also go
+    // in one message, see MetricBatch. Without fan-out, they only go there
+    void setBatching (bool batch, bool fanout) { _publisher.setBatching (batch, fanout); };
+    bool batching () const { return _publisher.batching (); };
+    bool fanout () const { return _publisher.fanout (); };
  protected:
-    std::string physicalQuantityShortName (const std::string& longName) const;
-    std::string physicalQuantityToUnits (const std::string& quantity) const;
+    void advertise ();
+    void adaptPolling ();
+    bool polled (const drivers::nut::NUTDevice& device) const;
     void advertisePhysics ();
     void advertiseInventory ();
-    int send (const std::string& subject, zmsg_t **message_p);
+    // Adds a metric to the snapshot of the device unless the filter
+    // suppresses it, returns true if added. Unchanged metrics are added
+    // again once their last publication is older than the heartbeat
+    bool advertiseMetric (PublishQueue::Snapshot& snapshot, const PublishDescriptors::Metric& metric,
+            double number, const char *value, int64_t now, int64_t heartbeat);
     int isend (const std::string& subject, zmsg_t **message_p);
 
     int _ttl = 60;
+    int64_t _heartbeat_ms = NUT_METRICS_HEARTBEAT_MS;
+    PublishFilter _filter;
     uint64_t _lastUpdate = 0;
 
     drivers::nut::NUTDeviceList _deviceList;
-    uint64_t _inventoryTimestamp_ms = 0; // [ms] it is not an actual timestamp, it is just a reference point in time, when inventory was advertised
+    // Spreads the hourly refresh of the inventory of the NUT devices over
+    // the hour, each one in a slot of its own
+    PollScheduler _inventoryScheduler { NUT_INVENTORY_REPEAT_AFTER_MS };
+    // NUT devices whose whole inventory is to be advertised at their next poll
+    std::set<std::string> _inventoryRefresh;
+    // Inventory digest last advertised, by asset
+    std::unordered_map<std::string, uint64_t> _inventoryDigests;
+
+    PollScheduler _scheduler;
+    // NUT devices read by the last poll, empty if all devices were read
+    std::set<std::string> _polled;
+    int64_t _pollStarted = 0;
 
     static const std::map <std::string, std::string> _units;
+    // Subjects and units of the metrics published, by asset
+    PublishDescriptors _descriptors{_units};
 
     std::string _conf;
+    FileWatch _mappingWatch;
     mlm_client_t *_client = NULL;
     mlm_client_t *_iclient = NULL;
     std::unique_ptr<StateManager::Reader> _state_reader;
+    // Last, so that its thread stops before the rest goes away
+    MetricPublisher _publisher;
 };
 
 //  Self test of this class
@@ -0,0 +1,564 @@
+/*  =========================================================================
+    nut_connection - Pipelined connection to the NUT daemon
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    nut_connection - Pipelined connection to the NUT daemon
+@discuss
+@end
+*/
+
+#include "nut_connection.h"
+#include "fake_upsd.h"
+#include "selftest_allocations.h"
+#include <czmq.h>
+#include <fty_log.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <tuple>
+#include <unistd.h>
+
+// Connects a non-blocking socket, waiting at most timeout ms
+static bool
+s_connect(int fd, const struct sockaddr *addr, socklen_t addrlen, int timeout, std::string& error)
+{
+    if (::connect(fd, addr, addrlen) == 0)
+        return true;
+    if (errno != EINPROGRESS) {
+        error = strerror(errno);
+        return false;
+    }
+    struct pollfd item = { fd, POLLOUT, 0 };
+    int rv = ::poll(&item, 1, timeout);
+    if (rv <= 0) {
+        error = rv == 0 ? "timeout" : strerror(errno);
+        return false;
+    }
+    int err = 0;
+    socklen_t size = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &size) < 0)
+        err = errno;
+    if (err) {
+        error = strerror(err);
+        return false;
+    }
+    return true;
+}
+
+NutConnection::NutConnection(const std::string& host, int port, size_t window)
+    : host_(host)
+    , port_(port)
+    , window_(std::max<size_t>(window, 1))
+    , fd_(-1)
+    , last_used_(0)
+    , check_idle_ms_(NUT_CONNECTION_CHECK_IDLE_MS)
+    , next_attempt_(0)
+    , backoff_ms_(NUT_CONNECTION_BACKOFF_MIN_MS)
+    , written_(0)
+    , listing_(false)
+{
+}
+
+NutConnection::~NutConnection()
+{
+    disconnect();
+}
+
+bool NutConnection::connect()
+{
+    int64_t now = zclock_mono();
+    if (fd_ >= 0) {
+        if (pending() || now - last_used_ <= check_idle_ms_ || check()) {
+            stats_.reuses++;
+            last_used_ = now;
+            return true;
+        }
+        // upsd closed the connection meanwhile, a new one is opened right
+        // away
+    }
+    if (now < next_attempt_)
+        return false;
+
+    struct addrinfo hints, *result = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string error;
+    int rv = getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &result);
+    if (rv != 0) {
+        error = gai_strerror(rv);
+    } else {
+        for (struct addrinfo *ai = result; ai && fd_ < 0; ai = ai->ai_next) {
+            int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+            if (fd < 0) {
+                error = strerror(errno);
+                continue;
+            }
+            if (s_connect(fd, ai->ai_addr, ai->ai_addrlen, NUT_CONNECTION_TIMEOUT_MS, error))
+                fd_ = fd;
+            else
+                close(fd);
+        }
+        freeaddrinfo(result);
+    }
+    if (fd_ >= 0) {
+        backoff_ms_ = NUT_CONNECTION_BACKOFF_MIN_MS;
+        last_used_ = now;
+        stats_.connects++;
+        log_debug("Connected to upsd at %s:%d (%" PRIu64 " connects, %" PRIu64 " reuses, %" PRIu64 " drops)",
+                host_.c_str(), port_, stats_.connects, stats_.reuses, stats_.drops);
+        return true;
+    }
+    log_error("Cannot connect to upsd at %s:%d: %s", host_.c_str(), port_, error.c_str());
+    stats_.connect_failures++;
+    next_attempt_ = now + backoff_ms_;
+    backoff_ms_ = std::min<int64_t>(backoff_ms_ * 2, NUT_CONNECTION_BACKOFF_MAX_MS);
+    return false;
+}
+
+// A cheap request on an idle connection, which waits for its reply, to
+// detect a connection closed by upsd before requests are pipelined on it.
+// Drops the connection on failure
+bool NutConnection::check()
+{
+    static const char request[] = "LIST UPS\n";
+    ssize_t n = ::send(fd_, request, sizeof(request) - 1, MSG_NOSIGNAL);
+    if (n != sizeof(request) - 1) {
+        fail(n < 0 ? strerror(errno) : "short write");
+        return false;
+    }
+    int64_t deadline = zclock_mono() + NUT_CONNECTION_TIMEOUT_MS;
+    char buffer[4096];
+    for (;;) {
+        size_t end;
+        while ((end = input_.find('\n')) != std::string::npos) {
+            std::string line = input_.substr(0, end);
+            input_.erase(0, end + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line == "END LIST UPS") {
+                input_.clear();
+                return true;
+            }
+            if (line.compare(0, 3, "ERR") == 0) {
+                fail(line.c_str());
+                return false;
+            }
+        }
+        if (input_.size() > NUT_CONNECTION_MAX_LINE) {
+            fail("line too long");
+            return false;
+        }
+        int64_t now = zclock_mono();
+        if (now >= deadline || !wait(static_cast<int>(deadline - now))) {
+            fail("no reply to LIST UPS");
+            return false;
+        }
+        n = ::recv(fd_, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            input_.append(buffer, n);
+        } else if (n == 0) {
+            fail("connection closed by upsd");
+            return false;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            fail(strerror(errno));
+            return false;
+        }
+    }
+}
+
+void NutConnection::request(const std::string& device)
+{
+    if (fd_ < 0)
+        return;
+    last_used_ = zclock_mono();
+    queued_.push_back(device);
+    flush();
+}
+
+// Moves queued requests to the output as far as the window allows, and
+// writes as much of the output as the socket accepts
+bool NutConnection::flush()
+{
+    while (!queued_.empty() && in_flight_.size() < window_) {
+        output_ += "LIST VAR " + queued_.front() + "\n";
+        in_flight_.push_back(std::move(queued_.front()));
+        queued_.pop_front();
+        stats_.requests++;
+    }
+    while (written_ < output_.size()) {
+        ssize_t n = ::send(fd_, output_.data() + written_, output_.size() - written_, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            fail(strerror(errno));
+            return false;
+        }
+        written_ += n;
+    }
+    output_.clear();
+    written_ = 0;
+    return true;
+}
+
+bool NutConnection::receive(std::vector<Reply>& replies)
+{
+    if (fd_ < 0)
+        return false;
+    char buffer[16384];
+    for (;;) {
+        ssize_t n = ::recv(fd_, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            input_.append(buffer, n);
+            last_used_ = zclock_mono();
+            // Each reply opens the window for another request
+            if (!parse(replies) || !flush())
+                return false;
+            continue;
+        }
+        if (n == 0) {
+            fail("connection closed by upsd");
+            return false;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+        fail(strerror(errno));
+        return false;
+    }
+}
+
+bool NutConnection::parse(std::vector<Reply>& replies)
+{
+    size_t start = 0;
+    for (;;) {
+        size_t end = input_.find('\n', start);
+        if (end == std::string::npos)
+            break;
+        size_t length = end - start;
+        if (length && input_[end - 1] == '\r')
+            length--;
+        split(&input_[start], &input_[start] + length);
+        if (!parseLine(replies)) {
+            std::string line;
+            for (const auto& token : tokens_)
+                line += (line.empty() ? "" : " ") + token.str();
+            log_error("Unexpected reply from upsd: %s", line.c_str());
+            fail("protocol error");
+            return false;
+        }
+        start = end + 1;
+    }
+    input_.erase(0, start);
+    if (input_.size() > NUT_CONNECTION_MAX_LINE) {
+        fail("line too long");
+        return false;
+    }
+    return true;
+}
+
+// Splits a line of the NUT protocol into words. Double quotes group words
+// and a backslash escapes the next character. The words are unescaped in
+// place, they are never longer than their source
+void NutConnection::split(char *begin, char *end)
+{
+    tokens_.clear();
+    char *token = begin, *out = begin;
+    bool quoted = false, present = false;
+    for (char *p = begin; p != end; ++p) {
+        if (*p == '\\' && p + 1 != end) {
+            *out++ = *++p;
+            present = true;
+        } else if (*p == '"') {
+            quoted = !quoted;
+            present = true;
+        } else if (*p == ' ' && !quoted) {
+            if (present) {
+                tokens_.push_back(Token { token, static_cast<size_t>(out - token) });
+                present = false;
+            }
+            token = out;
+        } else {
+            *out++ = *p;
+            present = true;
+        }
+    }
+    if (present)
+        tokens_.push_back(Token { token, static_cast<size_t>(out - token) });
+}
+
+bool NutConnection::parseLine(std::vector<Reply>& replies)
+{
+    const std::vector<Token>& t = tokens_;
+    if (t.empty())
+        return true;
+    // upsd answers the requests in order
+    if (in_flight_.empty())
+        return false;
+    const std::string& device = in_flight_.front();
+    if (t[0] == "ERR") {
+        Reply reply;
+        reply.device = device;
+        reply.error = t.size() > 1 ? t[1].str() : "UNKNOWN";
+        replies.push_back(std::move(reply));
+    } else if (!listing_ && t.size() == 4 && t[0] == "BEGIN" && t[1] == "LIST" && t[2] == "VAR" && t[3] == device) {
+        current_.device = device;
+        listing_ = true;
+        return true;
+    } else if (listing_ && t.size() >= 3 && t[0] == "VAR" && t[1] == device) {
+        // upsd lists the variables in order, so that they are appended in
+        // constant time. The name and the values are copied once, from the
+        // input buffer into the reply
+        NutSnapshot::Variables& variables = current_.variables;
+        auto i = variables.emplace_hint(variables.end(), std::piecewise_construct,
+                std::forward_as_tuple(t[2].data, t[2].size), std::forward_as_tuple());
+        std::vector<std::string>& values = i->second;
+        values.clear();
+        values.reserve(t.size() - 3);
+        for (size_t j = 3; j < t.size(); j++)
+            values.emplace_back(t[j].data, t[j].size);
+        return true;
+    } else if (listing_ && t.size() == 4 && t[0] == "END" && t[1] == "LIST" && t[2] == "VAR" && t[3] == device) {
+        replies.push_back(std::move(current_));
+    } else {
+        return false;
+    }
+    current_ = Reply();
+    listing_ = false;
+    in_flight_.pop_front();
+    stats_.replies++;
+    return true;
+}
+
+bool NutConnection::wait(int timeout_ms)
+{
+    if (fd_ < 0)
+        return false;
+    struct pollfd item = { fd_, POLLIN, 0 };
+    return ::poll(&item, 1, timeout_ms) > 0;
+}
+
+void NutConnection::fail(const char *reason)
+{
+    log_error("Connection to upsd at %s:%d lost: %s", host_.c_str(), port_, reason);
+    stats_.drops++;
+    disconnect();
+}
+
+void NutConnection::disconnect()
+{
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    queued_.clear();
+    in_flight_.clear();
+    output_.clear();
+    written_ = 0;
+    input_.clear();
+    current_ = Reply();
+    listing_ = false;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+// Reads until all requests are answered or the connection is lost
+static bool
+s_receive_all(NutConnection& conn, std::vector<NutConnection::Reply>& replies)
+{
+    while (conn.pending()) {
+        if (!conn.wait(5000) || !conn.receive(replies))
+            return false;
+    }
+    return true;
+}
+
+void
+nut_connection_test (bool verbose)
+{
+    printf (" * nut_connection: ");
+
+    //  @selftest
+    {
+        // Nobody listens on port 1, reconnecting is subject to a backoff
+        NutConnection conn("127.0.0.1", 1);
+        assert(!conn.connect());
+        assert(conn.getStatistics().connect_failures == 1);
+        assert(!conn.connect());
+        assert(conn.getStatistics().connect_failures == 1);
+        zclock_sleep(NUT_CONNECTION_BACKOFF_MIN_MS + 100);
+        assert(!conn.connect());
+        assert(conn.getStatistics().connect_failures == 2);
+        // The backoff doubles
+        zclock_sleep(NUT_CONNECTION_BACKOFF_MIN_MS + 100);
+        assert(!conn.connect());
+        assert(conn.getStatistics().connect_failures == 2);
+        assert(conn.getStatistics().connects == 0);
+        // Requests without a connection are ignored
+        conn.request("ups");
+        assert(conn.pending() == 0);
+        std::vector<NutConnection::Reply> replies;
+        assert(!conn.receive(replies));
+        conn.disconnect();
+        assert(conn.getStatistics().drops == 0);
+    }
+    {
+        // Many requests with a small window, the replies are written in
+        // small chunks so that lines arrive split
+        FakeUpsd upsd;
+        upsd.setChunkSize(7);
+        const size_t count = 200;
+        for (size_t i = 0; i < count; i++) {
+            upsd.setDevice("ups-" + std::to_string(i), {
+                    { "ups.status", { "OL" } },
+                    { "device.model", { "Eaton \"5PX\" \\ " + std::to_string(i) } },
+                    { "ups.test.result", { "" } } });
+        }
+        NutConnection conn("127.0.0.1", upsd.port(), 8);
+        assert(conn.connect());
+        assert(conn.socket() >= 0);
+        for (size_t i = 0; i < count; i++)
+            conn.request("ups-" + std::to_string(i));
+        conn.request("missing");
+        assert(conn.pending() == count + 1);
+
+        std::vector<NutConnection::Reply> replies;
+        assert(s_receive_all(conn, replies));
+        assert(replies.size() == count + 1);
+        for (size_t i = 0; i < count; i++) {
+            const NutConnection::Reply& reply = replies[i];
+            assert(reply.device == "ups-" + std::to_string(i));
+            assert(reply.error.empty());
+            assert(reply.variables.size() == 3);
+            assert(reply.variables.at("ups.status") == std::vector<std::string>{ "OL" });
+            assert(reply.variables.at("device.model")[0] == "Eaton \"5PX\" \\ " + std::to_string(i));
+            assert(reply.variables.at("ups.test.result")[0] == "");
+        }
+        assert(replies.back().device == "missing");
+        assert(replies.back().error == "UNKNOWN-UPS");
+        assert(replies.back().variables.empty());
+        assert(conn.getStatistics().requests == count + 1);
+        assert(conn.getStatistics().replies == count + 1);
+        assert(upsd.requests() == count + 1);
+
+        // The connection is reused
+        replies.clear();
+        conn.request("ups-1");
+        assert(s_receive_all(conn, replies));
+        assert(replies.size() == 1);
+        assert(conn.getStatistics().connects == 1);
+        assert(upsd.connections() == 1);
+
+        // An idle connection is checked before it is reused, and replaced
+        // right away if upsd closed it
+        conn.setIdleCheck(50);
+        zclock_sleep(100);
+        assert(conn.connect());
+        assert(conn.getStatistics().reuses == 1);
+        upsd.dropConnections();
+        zclock_sleep(100);
+        assert(conn.connect());
+        assert(conn.getStatistics().reuses == 1);
+        assert(conn.getStatistics().drops == 1);
+        assert(conn.getStatistics().connects == 2);
+        replies.clear();
+        conn.request("ups-1");
+        assert(s_receive_all(conn, replies));
+        assert(replies.size() == 1 && replies[0].error.empty());
+        conn.setIdleCheck(NUT_CONNECTION_CHECK_IDLE_MS);
+
+        // upsd closes the connection, the unanswered requests are dropped
+        // and the next connect() opens a new connection right away
+        upsd.setSilent(true);
+        conn.request("ups-2");
+        conn.request("ups-3");
+        upsd.dropConnections();
+        replies.clear();
+        assert(!s_receive_all(conn, replies));
+        assert(replies.empty());
+        assert(!conn.connected());
+        assert(conn.pending() == 0);
+        assert(conn.getStatistics().drops == 2);
+        upsd.setSilent(false);
+        assert(conn.connect());
+        conn.request("ups-4");
+        assert(s_receive_all(conn, replies));
+        assert(replies.size() == 1 && replies[0].device == "ups-4");
+        assert(conn.getStatistics().connects == 3);
+
+        // The words are unescaped in place, whatever their position
+        upsd.setDevice("ups-5", {
+                { "a", { "" } },
+                { "ups.alarm", { "  two  \\\"spaces\" " } },
+                { "z", { "\\" } } });
+        replies.clear();
+        conn.request("ups-5");
+        assert(s_receive_all(conn, replies));
+        assert(replies.size() == 1);
+        assert(replies[0].variables.size() == 3);
+        assert(replies[0].variables.at("a")[0] == "");
+        assert(replies[0].variables.at("ups.alarm")[0] == "  two  \\\"spaces\" ");
+        assert(replies[0].variables.at("z")[0] == "\\");
+    }
+    if (verbose) {
+        // Reading the replies of an ePDU with about 260 variables
+        FakeUpsd upsd;
+        NutSnapshot::Variables vars;
+        for (int outlet = 1; outlet <= 24; outlet++) {
+            std::string prefix = "outlet." + std::to_string(outlet) + ".";
+            for (const char *name : { "current", "current.high.warning", "current.high.critical",
+                    "desc", "id", "power", "powerfactor", "realpower", "status", "type", "voltage" })
+                vars[prefix + name] = { std::to_string(outlet * 10) + ".5" };
+        }
+        upsd.setDevice("epdu", vars);
+        NutConnection conn("127.0.0.1", upsd.port());
+        assert(conn.connect());
+        const int count = 200;
+        std::vector<NutConnection::Reply> replies;
+        for (int i = 0; i < count; i++)
+            conn.request("epdu");
+        replies.reserve(count);
+        uint64_t allocations = selftest_allocations_count();
+        int64_t start = zclock_usecs();
+        assert(s_receive_all(conn, replies));
+        int64_t end = zclock_usecs();
+        allocations = selftest_allocations_count() - allocations;
+        assert(replies.size() == count);
+        assert(replies[0].variables == vars);
+        printf("\n   %d replies of %zu variables: %.2f us, %.2f allocations per variable",
+                count, vars.size(), static_cast<double>(end - start) / (count * vars.size()),
+                static_cast<double>(allocations) / (count * vars.size()));
+        printf("\n   ");
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,191 @@
+/*  =========================================================================
+    nut_connection - Pipelined connection to the NUT daemon
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef NUT_CONNECTION_H_INCLUDED
+#define NUT_CONNECTION_H_INCLUDED
+
+/*
+ * NutConnection is a non-blocking client of the NUT network protocol. It
+ * keeps one connection to upsd open across poll cycles and pipelines the
+ * LIST VAR requests of many devices on it: up to a window of requests is
+ * in flight at once, and the replies are parsed incrementally as they
+ * stream back. It needs no thread of its own, the owner watches socket()
+ * for readability (e.g. in its zpoller) and calls receive(). If upsd
+ * cannot be reached, reconnection attempts are spaced out with an
+ * exponential backoff.
+ *
+ * An instance is not thread-safe:
+ *
+ * NutConnection nut;
+ * if (nut.connect()) {
+ *     nut.request("ups-1");
+ *     nut.request("epdu-1");
+ * }
+ * ...
+ * // when nut.socket() is readable
+ * std::vector<NutConnection::Reply> replies;
+ * if (!nut.receive(replies)) {
+ *     // connection lost, the unanswered requests are dropped
+ * }
+ * for (auto& reply : replies) {
+ *     // reply.device, reply.error, reply.variables
+ * }
+ */
+
+#include "nut_snapshot.h"
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Number of requests sent to upsd before waiting for their replies
+#define NUT_CONNECTION_WINDOW         64
+// Timeout of the connection establishment, and of a synchronous update
+#define NUT_CONNECTION_TIMEOUT_MS     10000
+// Idle time after which a connection is checked before it is reused
+#define NUT_CONNECTION_CHECK_IDLE_MS  5000
+// Reconnection backoff limits
+#define NUT_CONNECTION_BACKOFF_MIN_MS 1000
+#define NUT_CONNECTION_BACKOFF_MAX_MS 60000
+// Longest line accepted from upsd
+#define NUT_CONNECTION_MAX_LINE       65536
+
+class NutConnection {
+public:
+    struct Reply {
+        std::string device;
+        // NUT error code (e.g. UNKNOWN-UPS), empty on success
+        std::string error;
+        NutSnapshot::Variables variables;
+    };
+    struct Statistics {
+        // Number of successful and failed connection attempts
+        uint64_t connects = 0;
+        uint64_t connect_failures = 0;
+        // Number of times an open connection was reused
+        uint64_t reuses = 0;
+        // Number of connections dropped after an error
+        uint64_t drops = 0;
+        // Number of requests sent and of replies received
+        uint64_t requests = 0;
+        uint64_t replies = 0;
+    };
+
+    explicit NutConnection(const std::string& host = "localhost", int port = 3493,
+            size_t window = NUT_CONNECTION_WINDOW);
+    NutConnection(const NutConnection&) = delete;
+    NutConnection& operator=(const NutConnection&) = delete;
+    ~NutConnection();
+    // Connects to upsd unless already connected. A connection idle for
+    // longer than the idle check time is checked with a LIST UPS request
+    // first, and replaced if upsd closed it. Returns false if upsd cannot
+    // be reached, or while waiting out the backoff
+    bool connect();
+    // Idle time after which a connection is checked before it is reused,
+    // NUT_CONNECTION_CHECK_IDLE_MS by default
+    void setIdleCheck(int64_t idle_ms)
+    {
+        check_idle_ms_ = idle_ms;
+    }
+    bool connected() const
+    {
+        return fd_ >= 0;
+    }
+    // Socket to watch for readability, -1 if not connected
+    int socket() const
+    {
+        return fd_;
+    }
+    // Queues a LIST VAR request. Ignored if not connected
+    void request(const std::string& device);
+    // Number of requests not answered yet
+    size_t pending() const
+    {
+        return queued_.size() + in_flight_.size();
+    }
+    // Reads what upsd has sent without blocking and appends the complete
+    // replies, in the order of the requests. Returns false if the
+    // connection was lost, the unanswered requests are then dropped
+    bool receive(std::vector<Reply>& replies);
+    // Waits at most timeout_ms for the socket to become readable, for
+    // callers without a poller of their own
+    bool wait(int timeout_ms);
+    // Closes the connection and drops the unanswered requests
+    void disconnect();
+    const Statistics& getStatistics() const
+    {
+        return stats_;
+    }
+private:
+    // Word of a line, unescaped in place in the input buffer
+    struct Token {
+        const char *data;
+        size_t size;
+        bool operator==(const char *text) const
+        {
+            return size == strlen(text) && memcmp(data, text, size) == 0;
+        }
+        bool operator==(const std::string& text) const
+        {
+            return size == text.size() && memcmp(data, text.data(), size) == 0;
+        }
+        std::string str() const
+        {
+            return std::string(data, size);
+        }
+    };
+    void fail(const char *reason);
+    bool check();
+    bool flush();
+    bool parse(std::vector<Reply>& replies);
+    void split(char *begin, char *end);
+    bool parseLine(std::vector<Reply>& replies);
+    std::string host_;
+    int port_;
+    size_t window_;
+    int fd_;
+    // zclock_mono() of the last use of the connection
+    int64_t last_used_;
+    int64_t check_idle_ms_;
+    // zclock_mono() of the next allowed connection attempt
+    int64_t next_attempt_;
+    int64_t backoff_ms_;
+    // Requests waiting for the window, and requests sent to upsd
+    std::deque<std::string> queued_;
+    std::deque<std::string> in_flight_;
+    // Requests not written to the socket yet
+    std::string output_;
+    size_t written_;
+    // Data received but not parsed yet
+    std::string input_;
+    // Tokens of the line being parsed, they point into input_
+    std::vector<Token> tokens_;
+    // Reply being received, between BEGIN LIST VAR and END LIST VAR
+    Reply current_;
+    bool listing_;
+    Statistics stats_;
+};
+
+//  Self test of this class
+void nut_connection_test (bool verbose);
+
+#endif
@@ -27,15 +27,23 @@
 */
 
 #include "nut_device.h"
+#include "fake_upsd.h"
+#include "poll_scheduler.h"
+#include "selftest_allocations.h"
 #include <fty_common_filesystem.h>
 #include <fty_log.h>
 
 #include <cxxtools/serializationerror.h>
 #include <cxxtools/jsondeserializer.h>
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <exception>
 #include <iostream>
 #include <fstream>
+#include <poll.h>
+#include <set>
+#include <unistd.h>
 
 #define NUT_MEASUREMENT_REPEAT_AFTER    300     //!< (once in 5 minutes now (300s))
 
@@ -47,18 +55,21 @@ namespace nut
 {
 
 NUTDevice::NUTDevice() :
-    _asset(nullptr)
+    _asset(nullptr),
+    _daisyChain(0)
 {
 }
 
 NUTDevice::NUTDevice(const AssetState::Asset *asset) :
     _asset (asset),
+    _daisyChain (asset->daisychain()),
     _nutName (asset->name())
 {
 }
 
 NUTDevice::NUTDevice(const AssetState::Asset *asset, const std::string& nut_name):
     _asset (asset),
+    _daisyChain (asset->daisychain()),
     _nutName (nut_name)
 {
 }
@@ -74,25 +85,20 @@ std::string NUTDevice::daisyPrefix() const {
  * change getters
  */
 bool NUTDevice::changed() const {
-    for(auto &it : _physics ){
-        if(it.second.changed) return true;
-    }
-    for(auto &it : _inventory ){
-        if(it.second.changed) return true;
-    }
-    return false;
+    return _physics.changedCount() || _inventory.changedCount();
 }
 
 bool NUTDevice::changed(const char *name) const {
-    auto iterP = _physics.find(name);
-    if( iterP != _physics.end() ) {
+    MetricNames::Id id = MetricNames::find(name);
+    size_t i = _physics.index(id);
+    if( i != SIZE_MAX ) {
         // this is a number, value exists
-        return iterP->second.changed;
+        return _physics.changed(i);
     }
-    auto iterI = _inventory.find(name);
-    if( iterI != _inventory.end() ) {
+    i = _inventory.index(id);
+    if( i != SIZE_MAX ) {
         // this is a inventory string, value exists
-        return iterI->second.changed;
+        return _inventory.changed(i);
     }
     return false;
 }
@@ -105,24 +111,24 @@ bool NUTDevice::changed(const std::string &name) const {
  * change setters
  */
 void NUTDevice::setChanged(const bool status) {
-    for(auto &it : _physics ){
-        it.second.changed = status;
-    }
-    for(auto &it : _inventory ){
-        it.second.changed = status;
-    }
+    _physics.setChanged(status);
+    _inventory.setChanged(status);
 }
 
 void NUTDevice::setChanged(const char *name, const bool status) {
-    auto iterP = _physics.find(name);
-    if( iterP != _physics.end() ) {
+    setChanged(MetricNames::find(name), status);
+}
+
+void NUTDevice::setChanged(MetricNames::Id id, const bool status) {
+    size_t i = _physics.index(id);
+    if( i != SIZE_MAX ) {
         // this is a number, value exists
-        iterP->second.changed = status;
+        _physics.setChanged(i, status);
     }
-    auto iterI = _inventory.find(name);
-    if( iterI != _inventory.end() ) {
+    i = _inventory.index(id);
+    if( i != SIZE_MAX ) {
         // this is a inventory string, value exists
-        iterI->second.changed = status;
+        _inventory.setChanged(i, status);
     }
 }
 
@@ -130,39 +136,85 @@ void NUTDevice::setChanged(const std::string& name,const bool status){
     setChanged(name.c_str(),status);
 }
 
-void NUTDevice::updatePhysics(const std::string& varName, const std::string& newValue) {
-    if( _physics.count( varName ) == 0 ) {
+// Magnitudes below which the changes of a value are measured against the
+// floor rather than against the value, by metric type
+static const std::map<std::string, double> s_volatility_floors = {
+    { "current", 1 },
+    { "realpower", 100 },
+    { "power", 100 },
+    { "load", 5 },
+    { "voltage", 10 },
+    { "temperature", 5 },
+    { "humidity", 5 },
+};
+
+static double
+s_volatility_floor (MetricNames::Id id)
+{
+    const std::string& name = MetricNames::name (id);
+    auto i = s_volatility_floors.find (name.substr (0, name.find ('.')));
+    return i == s_volatility_floors.end () ? 1 : i->second;
+}
+
+void NUTDevice::updatePhysics(MetricNames::Id id, const std::string& newValue) {
+    bool inserted;
+    size_t i = _physics.insert(id, inserted);
+    NUTPhysicalValue& pvalue = _physics.value(i);
+    if( inserted ) {
         // this is new value
-        struct NUTPhysicalValue pvalue;
-        pvalue.changed = true;
-        pvalue.value = "0";
-        pvalue.candidate = newValue;
-        _physics[ varName ] = pvalue;
+        _physics.setChanged(i, true);
+        pvalue.floor = s_volatility_floor(id);
+    }
+    pvalue.candidate = NutSnapshot::toNumber(newValue);
+    if( std::isnan(pvalue.candidate) ) {
+        pvalue.candidateText = newValue;
     } else {
-        _physics[ varName ].candidate = newValue;
+        pvalue.candidateText.clear();
     }
 }
 
-void NUTDevice::updatePhysics(const std::string& varName, std::vector<std::string>& values) {
+void NUTDevice::updatePhysics(MetricNames::Id id, const std::vector<std::string>& values) {
     if( values.size() == 1 ) {
         // don't know how to handle multiple values
         // multiple values would be probably nonsence
         try {
-            updatePhysics(varName,values[0]);
+            updatePhysics(id,values[0]);
         } catch (...) {}
     }
 }
 
+// Relative change between two numeric values, measured against floor at
+// least, 0 if it cannot be computed
+static double
+s_relative_change (double before, double after, double floor)
+{
+    if (std::isnan (before) || std::isnan (after)) return 0;
+    return fabs (after - before) / std::max (fabs (before), floor);
+}
+
 void NUTDevice::commitChanges() {
-    for( auto & item:  _physics ) {
-        if( item.second.value != item.second.candidate ) {
-            item.second.value = item.second.candidate;
-            item.second.changed = true;
+    _volatility = 0;
+    for( size_t i = 0; i < _physics.size(); i++ ) {
+        NUTPhysicalValue& item = _physics.value(i);
+        bool same = std::isnan(item.value) ? std::isnan(item.candidate) : item.value == item.candidate;
+        if( ! same || item.text != item.candidateText ) {
+            _volatility = std::max (_volatility, s_relative_change (item.value, item.candidate, item.floor));
+            item.value = item.candidate;
+            item.text = item.candidateText;
+            _physics.setChanged(i, true);
         }
     }
 }
 
-void NUTDevice::updateInventory(const std::string& varName, std::vector<std::string>& values) {
+void NUTDevice::updateInventory(MetricNames::Id id, const std::vector<std::string>& values) {
+    static const MetricNames::Id type = MetricNames::intern("type");
+    static const std::string epdu = "epdu";
+    if( values.size() == 1 ) {
+        // the usual case, compared without a copy
+        // NUT bug type pdu => epdu
+        updateInventory(id, id == type && values[0] == "pdu" ? epdu : values[0]);
+        return;
+    }
     std::string inventory = "";
     for(size_t i = 0 ; i < values.size() ; ++i ) {
         inventory += values[i];
@@ -171,131 +223,113 @@ void NUTDevice::updateInventory(const std::string& varName, std::vector<std::str
         }
     }
     // inventory now looks like "value1, value2, value3"
-    // NUT bug type pdu => epdu
-    if( varName == "type" && inventory == "pdu" ) { inventory = "epdu"; }
-    if( _inventory.count( varName ) == 0 ) {
-        // this is new value
-        struct NUTInventoryValue ivalue;
-        ivalue.changed = true;
+    updateInventory(id, inventory);
+}
+
+// Digest of one inventory value. Those of a device are combined with XOR,
+// so that a value is replaced without going through the others
+static uint64_t
+s_inventory_digest(MetricNames::Id id, const std::string& value)
+{
+    // FNV-1a of the value, seeded with the name
+    uint64_t hash = 14695981039346656037ULL ^ (static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ULL);
+    for (unsigned char c : value) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    // splitmix64 finalizer, all bits depend on all others
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+void NUTDevice::updateInventory(MetricNames::Id id, const std::string& inventory) {
+    bool inserted;
+    size_t i = _inventory.insert(id, inserted);
+    NUTInventoryValue& ivalue = _inventory.value(i);
+    if( inserted || ivalue.value != inventory ) {
+        // this is new value or it changed
         ivalue.value = inventory;
-        _inventory[ varName ] = ivalue;
-    } else {
-        if( _inventory[ varName ].value != inventory ) {
-            _inventory[ varName ].value = inventory;
-            _inventory[ varName ].changed = true;
-        }
+        _inventory.setChanged(i, true);
+        _inventoryDigest ^= ivalue.digest;
+        ivalue.digest = s_inventory_digest(id, inventory);
+        _inventoryDigest ^= ivalue.digest;
     }
 }
 
-void NUTDevice::update (std::map <std::string, std::vector <std::string>> vars,
-                        std::function <const std::map <std::string, std::string>&(const char *)> mapping,
+uint64_t NUTDevice::inventoryDigest(MetricNames::Id except) const {
+    size_t i = _inventory.index(except);
+    return i == SIZE_MAX ? _inventoryDigest : _inventoryDigest ^ _inventory.value(i).digest;
+}
+
+void NUTDevice::update (const NutSnapshot::Variables& nutVars,
+                        const NutMapping& mapping,
                         bool forceUpdate) {
 
+    // only the variables of this member of the daisy chain, if any
+    NutMemberView vars (nutVars, daisyChainIndex());
     if( vars.empty() ) return;
     _lastUpdate = time(NULL);
-    std::string prefix = daisyPrefix();
 
     // use transformation table first
-    NUTValuesTransformation (prefix, vars);
-
-    // walk trough physics
-    for (const auto& item : mapping ("physicsMapping")) {
-        if (vars.find (prefix + item.first) != vars.end ()) {
-            // variable found in received data
-            std::vector<std::string> values = vars[prefix + item.first];
-            updatePhysics (item.second, values);
-        }
-        else {
-            // iterating numbered items in physics
-            // like outlet.1.voltage, outlet.2.voltage, ...
-            int x = item.first.find(".#."); // is always in the middle: outlet.1.realpower
-            int y = item.second.find(".#"); // can be at the end: outlet.voltage.#
-            if( x > 0 && y > 0 ) {
-                // this is something like outlet.#.realpower
-                std::string nutprefix = item.first.substr(0,x+1);
-                std::string nutsuffix = item.first.substr(x+2);
-                std::string biosprefix = item.second.substr(0,y+1);
-                std::string biossuffix = item.second.substr(y+2);
-                std::string nutname,biosname;
-                int i = 1;
-                while(true) {
-                    nutname = nutprefix + std::to_string(i) + nutsuffix;
-                    biosname = biosprefix + std::to_string(i) + biossuffix;
-                    if( vars.count(prefix + nutname) == 0 ) break; // variable out of scope
-                    // variable found
-                    std::vector<std::string> values = vars[prefix + nutname];
-                    updatePhysics (biosname, values);
-                    ++i;
+    NUTValuesTransformation (vars);
+
+    // route every variable to its physics or inventory name, numbered
+    // items like outlet.1.voltage included
+    std::string number, biosName;
+    // names fed by several variables keep the value of the last entry of
+    // the mapping, whatever the order of the variables
+    _ranks.clear();
+    vars.forEach ([&](const std::string& name, const std::vector<std::string>& values) {
+        const NutMapping::Entry *entry = mapping.match (name, number);
+        if( ! entry ) return;
+        // a variable may be both a physical value and an inventory item
+        for( NutMapping::Kind kind : { NutMapping::PHYSICS, NutMapping::INVENTORY } ) {
+            const NutMapping::Target *target = entry->target (kind);
+            if( ! target ) continue;
+            MetricNames::Id id = target->biosId (number, biosName);
+            if( target->shared ) {
+                // a handful of names at most
+                auto rank = std::find_if (_ranks.begin (), _ranks.end (), [&](const Rank& r) {
+                    return r.id == id && r.kind == kind;
+                });
+                if( rank == _ranks.end () ) {
+                    _ranks.push_back (Rank { kind, id, target->rank });
+                } else {
+                    if( rank->rank > target->rank ) continue;
+                    rank->rank = target->rank;
                 }
             }
-        }
-    }
-
-    // walk trough inventory
-    //for(size_t i = 0; i < inventoryMapping.size(); ++i) {
-    for (const auto& item : mapping ("inventoryMapping")) {
-        if( vars.find (prefix + item.first) != vars.end() ) {
-            // variable found in received data
-            std::vector<std::string> values = vars[prefix + item.first];
-            updateInventory (item.second, values);
-        } else {
-            // iterating numbered items in physics
-            // like outlet.1.voltage, outlet.2.voltage, ...
-            int x = item.first.find(".#."); // is always in the middle: outlet.1.realpower
-            int y = item.second.find(".#"); // can be at the end: outlet.voltage.#
-            if( x > 0 && y > 0 ) {
-                // this is something like outlet.#.realpower
-                std::string nutprefix = item.first.substr(0,x+1);
-                std::string nutsuffix = item.first.substr(x+2);
-                std::string biosprefix = item.second.substr(0,y+1);
-                std::string biossuffix = item.second.substr(y+2);
-                std::string nutname,biosname;
-                int i = 1;
-                while(true) {
-                    nutname = nutprefix + std::to_string(i) + nutsuffix;
-                    biosname = biosprefix + std::to_string(i) + biossuffix;
-                    if( vars.count(prefix + nutname) == 0 ) break; // variable out of scope
-                    // variable found
-                    std::vector<std::string> values = vars[prefix + nutname];
-                    updateInventory(biosname, values);
-                    ++i;
-                }
+            if( kind == NutMapping::PHYSICS ) {
+                updatePhysics (id, values);
+            } else {
+                updateInventory (id, values);
             }
         }
-    }
+    });
     commitChanges();
 }
 
-std::string NUTDevice::itof(const long int X) const {
-    std::string num,dec,sig;
-    long int AX;
-
-    if( X < 0 ) {
-        sig = "-";
-    } else {
-        sig = "";
-    }
-    AX = abs(X);
-    num = std::to_string( AX / 100 );
-    dec = std::to_string( AX % 100 );
-    if( dec.size() == 1 ) dec = "0" + dec;
-    if( dec == "00" ) {
-        return sig + num;
-    } else {
-        return sig + num + "." + dec;
-    }
+const char *NUTDevice::formatPhysics(const NUTPhysicalValue& value, char *buffer, size_t size) {
+    if( std::isnan(value.value) ) return value.text.c_str();
+    // enough digits to give back what NUT sent
+    snprintf(buffer, size, "%.15g", value.value);
+    return buffer;
 }
 
 std::string NUTDevice::toString() const {
     std::string msg = "",val;
-    for(auto it : _physics ){
-        msg += "\"" + it.first + "\":" + it.second.value + ", ";
-    }
-    for(auto it : _inventory ){
-        val = it.second.value;
+    forEachPhysics(false, [&msg](const std::string& name, const char *value, double) {
+        msg += "\"" + name + "\":" + value + ", ";
+    });
+    forEachInventory(false, [&msg, &val](const std::string& name, const std::string& value) {
+        val = value;
         std::replace(val.begin(), val.end(),'"',' ');
-        msg += "\"" + it.first + "\":\"" + val + "\", ";
-    }
+        msg += "\"" + name + "\":\"" + val + "\", ";
+    });
     if( msg.size() > 2 ) {
         msg = msg.substr(0, msg.size()-2 );
     }
@@ -303,47 +337,37 @@ std::string NUTDevice::toString() const {
 }
 
 std::map<std::string,std::string> NUTDevice::properties() const {
-    std::map<std::string,std::string> map;
-    for(auto it : _physics ){
-        map[ it.first ] = it.second.value;
-    }
-    for(auto it : _inventory ){
-        map[ it.first ] = it.second.value;
-    }
+    std::map<std::string,std::string> map = physics(false);
+    forEachInventory(false, [&map](const std::string& name, const std::string& value) {
+        map[ name ] = value;
+    });
     return map;
 }
 
 std::map<std::string,std::string> NUTDevice::physics(bool onlyChanged) const {
     std::map<std::string,std::string> map;
-    for ( const auto &it : _physics ) {
-        if( ( ! onlyChanged ) || it.second.changed ) {
-            map[ it.first ] = it.second.value;
-        }
-    }
+    forEachPhysics(onlyChanged, [&map](const std::string& name, const char *value, double) {
+        map[ name ] = value;
+    });
     return map;
 }
 
 std::map<std::string,std::string> NUTDevice::inventory(bool onlyChanged) const {
     std::map<std::string,std::string> map;
-    for ( const auto &it : _inventory ) {
-        if( ( ! onlyChanged ) || it.second.changed ) {
-            map[ it.first ] = it.second.value;
-        }
-    }
+    forEachInventory(onlyChanged, [&map](const std::string& name, const std::string& value) {
+        map[ name ] = value;
+    });
     return map;
 }
 
 
 bool NUTDevice::hasProperty(const char *name) const {
-    if( _physics.count( name ) != 0 ) {
-        // this is a number and value exists
-        return true;
-    }
-    if( _inventory.count( name ) != 0 ) {
-        // this is a inventory string, value exists
-        return true;
-    }
-    return false;
+    return hasProperty(MetricNames::find(name));
+}
+
+bool NUTDevice::hasProperty(MetricNames::Id id) const {
+    // this is a number or an inventory string and value exists
+    return _physics.contains(id) || _inventory.contains(id);
 }
 
 bool NUTDevice::hasProperty(const std::string& name) const {
@@ -351,11 +375,12 @@ bool NUTDevice::hasProperty(const std::string& name) const {
 }
 
 bool NUTDevice::hasPhysics(const char *name) const {
-    if( _physics.count( name ) != 0 ) {
-        // this is a number and value exists
-        return true;
-    }
-    return false;
+    return hasPhysics(MetricNames::find(name));
+}
+
+bool NUTDevice::hasPhysics(MetricNames::Id id) const {
+    // this is a number and value exists
+    return _physics.contains(id);
 }
 
 bool NUTDevice::hasPhysics(const std::string& name) const {
@@ -365,15 +390,17 @@ bool NUTDevice::hasPhysics(const std::string& name) const {
 
 
 std::string NUTDevice::property(const char *name) const {
-    auto iterP = _physics.find(name);
-    if( iterP != _physics.end() ) {
+    MetricNames::Id id = MetricNames::find(name);
+    size_t i = _physics.index(id);
+    if( i != SIZE_MAX ) {
         // this is a number, value exists
-        return iterP->second.value;
+        char buffer[32];
+        return formatPhysics(_physics.value(i), buffer, sizeof(buffer));
     }
-    auto iterI = _inventory.find(name);
-    if( iterI != _inventory.end() ) {
+    i = _inventory.index(id);
+    if( i != SIZE_MAX ) {
         // this is a inventory string, value exists
-        return iterI->second.value;
+        return _inventory.value(i).value;
     }
     return "";
 }
@@ -382,259 +409,347 @@ std::string NUTDevice::property(const std::string& name) const {
     return property(name.c_str());
 }
 
-void NUTDevice::NUTSetIfNotPresent (const std::string& prefix, std::map< std::string,std::vector<std::string> > &vars, const std::string &dst, const std::string &src)
+double NUTDevice::number(const char *name) const {
+    return number(MetricNames::find(name));
+}
+
+double NUTDevice::number(MetricNames::Id id) const {
+    size_t i = _physics.index(id);
+    return i == SIZE_MAX ? NAN : _physics.value(i).value;
+}
+
+const char *NUTDevice::property(MetricNames::Id id, char *buffer, size_t size) const {
+    size_t i = _physics.index(id);
+    if( i != SIZE_MAX ) {
+        return formatPhysics(_physics.value(i), buffer, size);
+    }
+    i = _inventory.index(id);
+    if( i != SIZE_MAX ) {
+        return _inventory.value(i).value.c_str();
+    }
+    return nullptr;
+}
+
+double NUTDevice::number(const std::string& name) const {
+    return number(name.c_str());
+}
+
+void NUTDevice::NUTSetIfNotPresent (NutMemberView &vars, const char *dst, const char *src)
 {
-    if (vars.find(prefix + dst) == vars.cend()) {
-        const auto &it = vars.find(prefix + src);
-        if (it != vars.cend()) vars[prefix + dst] = it->second;
+    if (! vars.contains (dst)) {
+        vars.copy (dst, src);
     }
 }
 
-void NUTDevice::NUTRealpowerFromOutput (const std::string& prefix, std::map< std::string,std::vector<std::string> > &vars) {
+// Text of a computed value, rounded to two decimals
+static std::string
+s_number_text (double value)
+{
+    char buffer[32];
+    snprintf (buffer, sizeof (buffer), "%.15g", round (value * 100) / 100);
+    return buffer;
+}
+
+void NUTDevice::NUTRealpowerFromOutput (NutMemberView &vars) {
 
     // XXX: Use the mapping info rather than hardcoding these (they both map
     // to realpower.default)
-    if (vars.find (prefix + "ups.realpower") != vars.end()) { return; }
-    if (vars.find (prefix + "input.realpower") != vars.end()) { return; }
+    if (vars.contains ("ups.realpower")) { return; }
+    if (vars.contains ("input.realpower")) { return; }
 
     // use outlet.realpower if exists
-    if (vars.find (prefix + "outlet.realpower") != vars.end()) {
-        NUTSetIfNotPresent (prefix, vars, "ups.realpower", "outlet.realpower");
+    if (vars.contains ("outlet.realpower")) {
+        NUTSetIfNotPresent (vars, "ups.realpower", "outlet.realpower");
         log_debug("realpower of %s taken from outlet.realpower", assetName().c_str ());
         return;
     }
     // sum the output.Lx.realpower
-    if (vars.find (prefix + "output.L1.realpower") != vars.end ()) {
+    if (vars.contains ("output.L1.realpower")) {
         int phases = 1;
-        if (vars.find (prefix + "output.phases") != vars.end ()) {
-            try {
-                phases = std::stoi (vars [prefix + "output.phases"][0]);
-            } catch(...) { }
+        double output_phases = vars.number ("output.phases");
+        if (!std::isnan (output_phases)) {
+            phases = static_cast<int> (output_phases);
         }
         double sum = 0.0;
+        char name[32];
         for (int i=1; i<= phases; i++) {
-            auto it = vars.find (prefix + "output.L" + std::to_string(i) + ".realpower");
+            snprintf (name, sizeof (name), "output.L%d.realpower", i);
+            double value = vars.number (name);
 
-            if (it  == vars.end ()) {
-                it = vars.find (prefix + "ups.L" + std::to_string(i) + ".realpower");
+            if (std::isnan (value)) {
+                snprintf (name, sizeof (name), "ups.L%d.realpower", i);
+                value = vars.number (name);
 
-                if (it  == vars.end ()) {
+                if (std::isnan (value)) {
                     // even output is missing, can't compute
                         break;
                 }
             }
-            try {
-                sum += std::stod (it->second[0]);
-            } catch(...) {
-                break;
-            }
+            sum += value;
         }
         // we have sum
         log_debug("realpower of %s calculated as sum of output.Lx.realpower", assetName().c_str ());
-        std::vector<std::string> value;
-        value.push_back (itof (round (sum * 100)));
-        vars[prefix + "ups.realpower"] = value;
+        vars.set ("ups.realpower", { s_number_text (sum) });
         return;
     }
 
     // if we have outlets, sum them
-    if (vars.find (prefix + "outlet.1.realpower") != vars.end()) {
+    if (vars.contains ("outlet.1.realpower")) {
         double sum = 0.0;
         int count = 100;
-        auto cntit = vars.find (prefix + "outlet.count");
-        if (cntit != vars.end()) {
-            try {
-                count = std::stoi(cntit->second[0]);
-            } catch(...) {}
+        double outlet_count = vars.number ("outlet.count");
+        if (!std::isnan (outlet_count)) {
+            count = static_cast<int> (outlet_count);
         }
+        char name[32];
         for (int outlet = 1; outlet <= count; outlet++) {
-            auto it = vars.find (prefix + "outlet." + std::to_string(outlet) + ".realpower");
-            if (it  == vars.end ()) {
+            snprintf (name, sizeof (name), "outlet.%d.realpower", outlet);
+            if (! vars.contains (name)) {
                 // end of outlets
                 break;
             }
-            try {
-                sum += std::stod (it->second[0]);
-            } catch(...) {}
+            double value = vars.number (name);
+            if (!std::isnan (value)) sum += value;
         }
         log_debug("realpower of %s calculated as sum of outlet.X.realpower", assetName().c_str ());
-        std::vector<std::string> value;
-        value.push_back (itof (round (sum * 100)));
-        vars[prefix + "ups.realpower"] = value;
+        vars.set ("ups.realpower", { s_number_text (sum) });
         return;
     }
 
     // mainly for STS/ATS - if we have output voltage and current let's multiply them
-    {
-        auto it_current = vars.find (prefix + "output.current");
-        auto it_voltage = vars.find (prefix + "output.voltage");
-        if ((it_current != vars.end ()) && (it_voltage != vars.end ())) {
-            try {
-                double power = std::stod (it_current->second[0]) * std::stod (it_voltage->second[0]);
-                std::vector<std::string> value;
-                value.push_back (itof (round (power * 100)));
-                vars[prefix + "ups.realpower"] = value;
-                log_debug ("ats, realpower");
-                return;
-            } catch(...) {
-                log_error ("Exception in power = current*voltage calculation");
-            }
+    if (vars.contains ("output.current") && vars.contains ("output.voltage")) {
+        double power = vars.number ("output.current") * vars.number ("output.voltage");
+        if (std::isnan (power)) {
+            log_error ("Exception in power = current*voltage calculation");
+            return;
         }
+        vars.set ("ups.realpower", { s_number_text (power) });
+        log_debug ("ats, realpower");
     }
 }
 
-void NUTDevice::NUTFixMissingLoad (const std::string& prefix, std::map< std::string,std::vector<std::string> > &vars) {
-    if (vars.find (prefix + "ups.load") != vars.end ()) return;
-    try {
-        if (vars [prefix + "output.phases"][0] == "1") {
-            // 1 phase ups
-            {
-                // try realpower/max_power*100
-                double max_power = maxPower();
-                if (!std::isnan(max_power)) {
-                    max_power *= 1000;
-                    const auto realpower_it = vars.find (prefix + "ups.realpower");
-                    if (realpower_it != vars.cend ()) {
-                        double realpower = std::stod (realpower_it->second[0]);
-                        if (max_power > 0.1) {
-                            std::string load = std::to_string (round ((realpower / max_power) * 100.0));
-                            vars["ups.load"] = { load };
-                            return;
-                        }
-                    }
-                }
-            }
-        } else {
-            // 3 phase ups
-            {
-                // try ups.LX.load
-                const auto it1 = vars.find (prefix + "ups.L1.load");
-                const auto it2 = vars.find (prefix + "ups.L2.load");
-                const auto it3 = vars.find (prefix + "ups.L3.load");
-                if ((it1 != vars.cend ()) && (it2 != vars.cend ()) && (it2 != vars.cend ())) {
-                    std::string load = std::to_string(
-                        (std::stod (it1->second[0]) + std::stod (it2->second[0]) + std::stod (it3->second[0]))/3.0
-                    );
-                    vars["ups.load"] = { load };
+void NUTDevice::NUTFixMissingLoad (NutMemberView &vars) {
+    if (vars.contains ("ups.load")) return;
+    if (vars.number ("output.phases") == 1) {
+        // 1 phase ups
+        {
+            // try realpower/max_power*100
+            double max_power = maxPower();
+            if (!std::isnan(max_power)) {
+                max_power *= 1000;
+                double realpower = vars.number ("ups.realpower");
+                if (!std::isnan (realpower) && max_power > 0.1) {
+                    vars.set ("ups.load", { s_number_text (round ((realpower / max_power) * 100.0)) });
                     return;
                 }
             }
-            {
-                // try sum(realpower_i)/max_power*100
-                double max_power = maxPower();
-                if (!std::isnan(max_power)) {
-                    max_power *= 1000;
-                    if (max_power > 0.1) {
-                        const auto it1 = vars.find (prefix + "output.L1.realpower");
-                        const auto it2 = vars.find (prefix + "output.L2.realpower");
-                        const auto it3 = vars.find (prefix + "output.L3.realpower");
-                        if ((it1 != vars.cend ()) && (it2 != vars.cend ()) && (it2 != vars.cend ())) {
-                            std::string load = std::to_string(
-                                round ((std::stod (it1->second[0]) + std::stod (it2->second[0]) + std::stod (it3->second[0]))/max_power*100.0)
-                            );
-                            vars["ups.load"] = { load };
-                            return;
-                        }
+        }
+    } else {
+        // 3 phase ups
+        {
+            // try ups.LX.load
+            double load = (vars.number ("ups.L1.load") + vars.number ("ups.L2.load") + vars.number ("ups.L3.load")) / 3.0;
+            if (!std::isnan (load)) {
+                vars.set ("ups.load", { s_number_text (load) });
+                return;
+            }
+        }
+        {
+            // try sum(realpower_i)/max_power*100
+            double max_power = maxPower();
+            if (!std::isnan(max_power)) {
+                max_power *= 1000;
+                if (max_power > 0.1) {
+                    double realpower = vars.number ("output.L1.realpower") + vars.number ("output.L2.realpower") + vars.number ("output.L3.realpower");
+                    if (!std::isnan (realpower)) {
+                        vars.set ("ups.load", { s_number_text (round (realpower / max_power * 100.0)) });
+                        return;
                     }
                 }
             }
         }
-    } catch (...) {
-        log_error ("failed to calculate load for %s", assetName().c_str ());
     }
 }
 
-void NUTDevice::NUTValuesTransformation (const std::string &prefix, std::map< std::string,std::vector<std::string> > &vars ) {
+void NUTDevice::NUTValuesTransformation (NutMemberView &vars) {
     if( vars.empty() ) return ;
 
     // number of input phases
-    if (vars.find (prefix + "input.phases") == vars.end ()) {
-        if ( vars.find (prefix + "input.L3-N.voltage") != vars.end () || vars.find (prefix + "input.L3.current") != vars.end () ) {
-            vars [prefix + "input.phases"] = { "3" };
+    if (! vars.contains ("input.phases")) {
+        if ( vars.contains ("input.L3-N.voltage") || vars.contains ("input.L3.current") ) {
+            vars.set ("input.phases", { "3" });
         } else {
-            vars [prefix + "input.phases"] = { "1" };
+            vars.set ("input.phases", { "1" });
         }
     }
 
     // number of output phases
-    if (vars.find (prefix + "output.phases") == vars.end ()) {
-        if ( vars.find (prefix + "output.L3-N.voltage") != vars.end () || vars.find (prefix + "output.L3.current") != vars.end () ) {
-            vars [prefix + "output.phases"] = { "3" };
+    if (! vars.contains ("output.phases")) {
+        if ( vars.contains ("output.L3-N.voltage") || vars.contains ("output.L3.current") ) {
+            vars.set ("output.phases", { "3" });
         } else {
-            vars [prefix + "output.phases"] = { "1" };
+            vars.set ("output.phases", { "1" });
         }
     }
     {
         // pdu replace with epdu
-        auto it = vars.find (prefix + "device.type");
-        if( it != vars.end() ) {
-            if( ! it->second.empty() && it->second[0] == "pdu" ) it->second[0] = "epdu";
+        const std::vector<std::string> *type = vars.find ("device.type");
+        if( type && ! type->empty() && (*type)[0] == "pdu" ) {
+            std::vector<std::string> values = *type;
+            values[0] = "epdu";
+            vars.set ("device.type", values);
         }
     }
     // sum the realpower from output information
-    NUTRealpowerFromOutput (prefix, vars);
+    NUTRealpowerFromOutput (vars);
     // variables, that differs from ups to ups
-    NUTSetIfNotPresent (prefix, vars, "ups.realpower", "input.realpower");
-    NUTSetIfNotPresent (prefix, vars, "input.L1.realpower", "input.realpower");
-    NUTSetIfNotPresent (prefix, vars, "input.L1.realpower", "ups.realpower");
-    NUTSetIfNotPresent (prefix, vars, "output.L1.realpower", "output.realpower");
+    NUTSetIfNotPresent (vars, "ups.realpower", "input.realpower");
+    NUTSetIfNotPresent (vars, "input.L1.realpower", "input.realpower");
+    NUTSetIfNotPresent (vars, "input.L1.realpower", "ups.realpower");
+    NUTSetIfNotPresent (vars, "output.L1.realpower", "output.realpower");
     // take input realpower and present it as output if output is not present
     // and also the opposite way
-    for( const auto &variable: {"realpower", "L1.realpower", "L2.realpower", "L3.realpower"} ) {
-        std::string outvar = "output."; outvar.append (variable);
-        std::string invar = "input."; invar.append(variable);
-        NUTSetIfNotPresent (prefix, vars, outvar, invar);
-        NUTSetIfNotPresent (prefix, vars, invar, outvar);
+    static const char *realpowers[][2] = {
+        { "output.realpower", "input.realpower" },
+        { "output.L1.realpower", "input.L1.realpower" },
+        { "output.L2.realpower", "input.L2.realpower" },
+        { "output.L3.realpower", "input.L3.realpower" },
+    };
+    for( const auto &variable: realpowers ) {
+        NUTSetIfNotPresent (vars, variable[0], variable[1]);
+        NUTSetIfNotPresent (vars, variable[1], variable[0]);
     }
     // sum the realpower again if still not present
     // hope that missing output values have been filled
     // from input values
-    NUTRealpowerFromOutput (prefix, vars);
+    NUTRealpowerFromOutput (vars);
     // ups load
-    NUTFixMissingLoad (prefix, vars);
+    NUTFixMissingLoad (vars);
 }
 
 void NUTDevice::clear() {
     if( ! _inventory.empty() || ! _physics.empty() ) {
         _inventory.clear();
+        _inventoryDigest = 0;
         _physics.clear();
         log_error("Dropping all measurement/inventory data for %s", assetName().c_str() );
     }
 }
 
-NUTDevice::~NUTDevice() {
+size_t NUTDevice::forget(const std::set<std::string>& biosNames) {
+    if( biosNames.empty() ) return 0;
+    size_t forgotten = 0;
+    for( size_t i = _physics.size(); i-- > 0; ) {
+        if( NutMapping::covers(biosNames, MetricNames::name(_physics.id(i))) ) {
+            _physics.erase(i);
+            forgotten++;
+        }
+    }
+    for( size_t i = _inventory.size(); i-- > 0; ) {
+        if( NutMapping::covers(biosNames, MetricNames::name(_inventory.id(i))) ) {
+            _inventoryDigest ^= _inventory.value(i).digest;
+            _inventory.erase(i);
+            forgotten++;
+        }
+    }
+    return forgotten;
+}
 
+const std::string& NUTDevice::s_none() {
+    static const std::string none;
+    return none;
 }
 
-NUTDeviceList::NUTDeviceList() {
+NUTDeviceList::NUTDeviceList(const std::string& host, int port)
+    : _host(host)
+    , _port(port)
+    , _connection(host, port)
+{
+}
 
+void NUTDeviceList::addDevice(const std::string& name, NUTDevice device, Changes& listChanges) {
+    const std::string nutName = device.nutName();
+    _devices[name] = std::move(device);
+    listChanges.removedAssets.erase(name);
+    if (++_nutNameUsers[nutName] == 1 && !listChanges.removedNutNames.erase(nutName)) {
+        listChanges.addedNutNames.insert(nutName);
+    }
+}
+
+void NUTDeviceList::removeDevice(const std::string& name, Changes& listChanges) {
+    auto device = _devices.find(name);
+    if (device == _devices.end()) return;
+    const std::string nutName = device->second.nutName();
+    _devices.erase(device);
+    listChanges.removedAssets.insert(name);
+    auto users = _nutNameUsers.find(nutName);
+    if (users != _nutNameUsers.end() && --users->second == 0) {
+        _nutNameUsers.erase(users);
+        if (!listChanges.addedNutNames.erase(nutName)) {
+            listChanges.removedNutNames.insert(nutName);
+        }
+    }
 }
 
 void NUTDeviceList::updateDeviceList(const AssetState& deviceState) {
+    // Every power device as changed, and the devices no longer listed as
+    // removed
+    AssetState::ChangeSet changes;
+    auto& devices = deviceState.getPowerDevices();
+    for (const auto& i : devices) {
+        changes.updated.insert(i.first);
+    }
+    for (const auto& device : _devices) {
+        if (devices.find(device.first) == devices.end()) {
+            changes.removed.insert(device.first);
+        }
+    }
+    Changes listChanges;
+    updateDeviceList(deviceState, changes, listChanges);
+}
+
+void NUTDeviceList::updateDeviceList(const AssetState& deviceState, const AssetState::ChangeSet& changes,
+        Changes& listChanges) {
     try {
         auto& devices = deviceState.getPowerDevices();
-
-        _devices.clear();
-        for (auto i : devices) {
-            const std::string& ip = i.second->IP();
-            if (ip.empty()) {
-                // this is strange. No IP?
-                continue;
-            }
-            const std::string& name = i.first;
-            switch(i.second->daisychain()) {
-            case 0:
-            case 1:
-                _devices[name] = NUTDevice(i.second.get());
-                break;
-            default:
-                auto master = deviceState.ip2master(ip);
-                if (master.empty()) {
-                    log_error("Daisychain host for %s not found", name.c_str());
+        for (const auto& name : changes.removed) {
+            removeDevice(name, listChanges);
+        }
+        // Devices still read from the same NUT device keep their values and
+        // changed flags, only the asset pointer is replaced: the old asset
+        // may be gone with the old state. The change set also lists sensors
+        const std::set<std::string>* modified[] = { &changes.added, &changes.updated };
+        for (auto names : modified) {
+            for (const auto& name : *names) {
+                auto i = devices.find(name);
+                if (i == devices.end()) {
+                    removeDevice(name, listChanges);
+                    continue;
+                }
+                const std::string& ip = i->second->IP();
+                if (ip.empty()) {
+                    // this is strange. No IP?
+                    removeDevice(name, listChanges);
+                    continue;
+                }
+                std::string nutName = name;
+                if (i->second->daisychain() > 1) {
+                    nutName = deviceState.ip2master(ip);
+                    if (nutName.empty()) {
+                        log_error("Daisychain host for %s not found", name.c_str());
+                        removeDevice(name, listChanges);
+                        continue;
+                    }
+                }
+                auto device = _devices.find(name);
+                if (device != _devices.end()
+                        && device->second.nutName() == nutName
+                        && device->second.daisyChainIndex() == i->second->daisychain()) {
+                    device->second.assetPtr(i->second.get());
                 } else {
-                    _devices[name] = NUTDevice(i.second.get(), master);
+                    removeDevice(name, listChanges);
+                    addDevice(name, NUTDevice(i->second.get(), nutName), listChanges);
                 }
-                break;
             }
         }
     } catch (const std::exception& e) {
@@ -642,44 +757,195 @@ void NUTDeviceList::updateDeviceList(const AssetState& deviceState) {
     }
 }
 
-
-void NUTDeviceList::updateDeviceStatus( bool forceUpdate ) {
-    for(auto &device : _devices ) {
+void NUTDeviceList::updateDeviceStatus( NutConnection::Reply& reply ) {
+    auto pending = _pending.find(reply.device);
+    if (pending == _pending.end()) return;
+    if (reply.error == NUT_POOL_CONNECTION_LOST) {
+        // Like for a single connection, keep the values and the previous
+        // snapshot until the next cycle
+        _connectionLost = true;
+        _pending.erase(pending);
+        return;
+    }
+    for (const auto& name : pending->second) {
+        auto device = _devices.find(name);
+        if (device == _devices.end()) {
+            // removed since the update started
+            continue;
+        }
         try {
-            nutclient::Device nutDevice = nutClient.getDevice(device.second.nutName());
-            if (! nutDevice.isOk()) { throw std::runtime_error ("device " + device.second.assetName() + " is not configured in NUT yet"); }
-            std::function <const std::map <std::string, std::string>&(const char *)> x = std::bind (&NUTDeviceList::get_mapping, this, std::placeholders::_1);
-            device.second.update( nutDevice.getVariableValues(), x, forceUpdate );
+            if (reply.error == "UNKNOWN-UPS") { throw std::runtime_error ("device " + name + " is not configured in NUT yet"); }
+            if (! reply.error.empty()) { throw std::runtime_error (reply.error); }
+            device->second.update( reply.variables, _mapping, _forceUpdate );
         } catch ( std::exception &e ) {
-            log_error("Communication problem with %s (%s)", device.first.c_str(), e.what() );
-            if( time(NULL) - device.second.lastUpdate() > NUT_MEASUREMENT_REPEAT_AFTER/2 ) {
+            log_error("Communication problem with %s (%s)", name.c_str(), e.what() );
+            if( time(NULL) - device->second.lastUpdate() > NUT_MEASUREMENT_REPEAT_AFTER/2 ) {
                 // we are not communicating for a while. Let's drop the values.
-                device.second.clear();
+                device->second.clear();
             }
         }
     }
+    if (reply.error.empty()) {
+        _snapshot->add(reply.device, std::move(reply.variables));
+    } else {
+        _snapshot->remove(reply.device);
+    }
+    _pending.erase(pending);
 }
 
-bool NUTDeviceList::connect() {
-    try {
-        nutClient.connect("localhost",3493);
-    } catch (...) {}
-    return nutClient.isConnected();
+bool NUTDeviceList::beginUpdate( bool forceUpdate ) {
+    return startUpdate(nutNames(), std::make_shared<NutSnapshot>(), forceUpdate);
 }
 
-void NUTDeviceList::disconnect() {
-    try {
-        nutClient.disconnect();
-    } catch (...) {}
+bool NUTDeviceList::beginPartialUpdate( const std::vector<std::string>& nutNames, bool forceUpdate ) {
+    // The snapshot published last is ours, keep the devices not read now
+    return startUpdate(nutNames, std::make_shared<NutSnapshot>(NutSnapshots.get()), forceUpdate);
+}
+
+bool NUTDeviceList::startUpdate( const std::vector<std::string>& nutNames, std::shared_ptr<NutSnapshot> snapshot, bool forceUpdate ) {
+    if (updating()) {
+        log_warning("Update of NUT devices did not complete in time, %zu devices left", _pending.size());
+        if (! _pool) {
+            _connection.disconnect();
+        }
+        finishUpdate(false);
+    }
+    _snapshot = snapshot;
+    _forceUpdate = forceUpdate;
+    _connectionLost = false;
+    for (const auto& nutName : nutNames) {
+        _pending[nutName];
+    }
+    // Daisy-chained devices share one NUT device, it is read only once
+    for (const auto& device : _devices) {
+        auto pending = _pending.find(device.second.nutName());
+        if (pending != _pending.end()) {
+            pending->second.push_back(device.first);
+        }
+    }
+    std::vector<std::string> requests;
+    for (auto pending = _pending.begin(); pending != _pending.end(); ) {
+        if (pending->second.empty()) {
+            // not in the device list (anymore)
+            _snapshot->remove(pending->first);
+            pending = _pending.erase(pending);
+            continue;
+        }
+        requests.push_back(pending->first);
+        ++pending;
+    }
+    if (requests.empty()) {
+        finishUpdate(true);
+        return false;
+    }
+    if (_pool) {
+        // the pool abandons the previous request, if any
+        _pool->request(requests);
+        return true;
+    }
+    if (! _connection.connect()) {
+        finishUpdate(false);
+        return false;
+    }
+    for (const auto& nutName : requests) {
+        _connection.request(nutName);
+    }
+    if (! _connection.connected()) {
+        finishUpdate(false);
+        return false;
+    }
+    return true;
+}
+
+bool NUTDeviceList::onReadable() {
+    if (! updating()) return true;
+    std::vector<NutConnection::Reply> replies;
+    if (_pool) {
+        _pool->receive(replies);
+        for (auto& reply : replies) {
+            updateDeviceStatus(reply);
+        }
+        if (! _pending.empty()) return false;
+        finishUpdate(! _connectionLost);
+        return true;
+    }
+    bool connected = _connection.receive(replies);
+    for (auto& reply : replies) {
+        updateDeviceStatus(reply);
+    }
+    if (! connected) {
+        // The connection is broken, try again in the next cycle. The other
+        // actors keep the previous snapshot meanwhile
+        finishUpdate(false);
+        return true;
+    }
+    if (_pending.empty()) {
+        finishUpdate(true);
+        return true;
+    }
+    return false;
+}
+
+void NUTDeviceList::finishUpdate( bool publish ) {
+    if (publish) {
+        // Share what has been read with the alert and sensor actors
+        NutSnapshots.publish(_snapshot);
+    }
+    _snapshot.reset();
+    _pending.clear();
+    // a mapping loaded meanwhile applies from the next update on
+    applyMapping();
+}
+
+bool NUTDeviceList::updating() const {
+    return _snapshot != nullptr;
+}
+
+int NUTDeviceList::socket() const {
+    if (! updating()) return -1;
+    return _pool ? _pool->socket() : _connection.socket();
+}
+
+void NUTDeviceList::setWorkers( size_t workers ) {
+    workers = std::min<size_t>(std::max<size_t>(workers, 1), NUT_POOL_MAX_WORKERS);
+    if (workers == (_pool ? _pool->size() : 1)) return;
+    if (updating()) {
+        if (! _pool) {
+            _connection.disconnect();
+        }
+        finishUpdate(false);
+    }
+    _pool.reset();
+    if (workers > 1) {
+        _connection.disconnect();
+        _pool.reset(new NutPool(workers, _host, _port));
+    }
+    log_info("Reading NUT devices over %zu connections", workers);
 }
 
 void NUTDeviceList::update( bool forceUpdate ) {
-    if( connect() ) {
-        updateDeviceStatus(forceUpdate);
-        disconnect();
+    if (! beginUpdate(forceUpdate)) return;
+    while (! onReadable()) {
+        struct pollfd item = { socket(), POLLIN, 0 };
+        if (::poll(&item, 1, NUT_CONNECTION_TIMEOUT_MS) != 1) {
+            log_error("Timeout while reading NUT devices, %zu devices left", _pending.size());
+            if (! _pool) {
+                _connection.disconnect();
+            }
+            finishUpdate(false);
+            return;
+        }
     }
 }
 
+std::vector<std::string> NUTDeviceList::nutNames() const {
+    std::set<std::string> names;
+    for (const auto& device : _devices) {
+        names.insert(device.second.nutName());
+    }
+    return std::vector<std::string>(names.begin(), names.end());
+}
+
 size_t NUTDeviceList::size() const {
     return _devices.size();
 }
@@ -722,17 +988,16 @@ s_deserialize_to_map (cxxtools::SerializationInfo& si, std::map <std::string, st
     }
 }
 
-void NUTDeviceList::load_mapping (const char *path_to_file)
+bool NUTDeviceList::load_mapping (const char *path_to_file)
 {
-    _mappingLoaded = false;
     if (!shared::is_file (path_to_file)) {
         log_error ("'%s' is not a file", path_to_file);
-        return;
+        return false;
     }
     std::ifstream input (path_to_file);
     if (!input) {
         log_error ("Error opening file '%s'", path_to_file);
-        return;
+        return false;
     }
 
     cxxtools::SerializationInfo si;
@@ -742,29 +1007,64 @@ void NUTDeviceList::load_mapping (const char *path_to_file)
     }
     catch (const std::exception& e) {
         log_error ("Error deserializing file '%s' to json", path_to_file);
-        return;
+        return false;
     }
 
+    // read and compile aside, the mapping in use stays untouched until
+    // applyMapping ()
+    std::unique_ptr<Mapping> next (new Mapping ());
     cxxtools::SerializationInfo *physicsMappingMember = si.findMember ("physicsMapping");
     if (physicsMappingMember == NULL) {
         log_error ("Configuration file for mapping '%s' does not contain property 'physicsMapping'", path_to_file);
+        next->physics = _nextMapping ? _nextMapping->physics : _physicsMapping;
     }
     else {
-        _physicsMapping.clear ();
-        s_deserialize_to_map (*physicsMappingMember, _physicsMapping);
+        s_deserialize_to_map (*physicsMappingMember, next->physics);
     }
 
     cxxtools::SerializationInfo *inventoryMappingMember = si.findMember ("inventoryMapping");
     if (inventoryMappingMember == NULL) {
         log_error ("Configuration file for mapping '%s' does not contain property 'inventoryMapping'", path_to_file);
+        next->inventory = _nextMapping ? _nextMapping->inventory : _inventoryMapping;
     }
     else {
-        _inventoryMapping.clear ();
-        s_deserialize_to_map (*inventoryMappingMember, _inventoryMapping);
+        s_deserialize_to_map (*inventoryMappingMember, next->inventory);
+    }
+
+    _deadbandMapping.clear ();
+    cxxtools::SerializationInfo *deadbandMappingMember = si.findMember ("deadbandMapping");
+    if (deadbandMappingMember != NULL) {
+        s_deserialize_to_map (*deadbandMappingMember, _deadbandMapping);
     }
 
-    log_debug ("Number of entries loaded for physicsMapping '%zu'", _physicsMapping.size ());
-    log_debug ("Number of entries loaded for inventoryMapping '%zu'", _inventoryMapping.size ());
+    log_debug ("Number of entries loaded for physicsMapping '%zu'", next->physics.size ());
+    log_debug ("Number of entries loaded for inventoryMapping '%zu'", next->inventory.size ());
+    log_debug ("Number of entries loaded for deadbandMapping '%zu'", _deadbandMapping.size ());
+    next->compiled.compile (next->physics, next->inventory);
+    _nextMapping = std::move (next);
+    if (!updating ())
+        applyMapping ();
+    return true;
+}
+
+void NUTDeviceList::applyMapping ()
+{
+    if (!_nextMapping)
+        return;
+    std::set<std::string> changed;
+    NutMapping::changes (_physicsMapping, _nextMapping->physics, changed);
+    NutMapping::changes (_inventoryMapping, _nextMapping->inventory, changed);
+    _physicsMapping.swap (_nextMapping->physics);
+    _inventoryMapping.swap (_nextMapping->inventory);
+    _mapping = std::move (_nextMapping->compiled);
+    _nextMapping.reset ();
+    size_t forgotten = 0;
+    for (auto& device : _devices) {
+        forgotten += device.second.forget (changed);
+    }
+    if (_mappingLoaded) {
+        log_info ("Mapping reloaded, %zu BIOS names changed, %zu values to read again", changed.size (), forgotten);
+    }
     _mappingLoaded = true;
 }
 
@@ -783,19 +1083,69 @@ const std::map <std::string, std::string>& NUTDeviceList::get_mapping (const cha
     else if (strcmp (mapping, "inventoryMapping") == 0) {
         return _inventoryMapping;
     }
+    else if (strcmp (mapping, "deadbandMapping") == 0) {
+        return _deadbandMapping;
+    }
     throw std::invalid_argument ("mapping");
 }
 
-NUTDeviceList::~NUTDeviceList() {
-    disconnect();
-}
-
 } // namespace drivers::nut
 } // namespace drivers
 
 //  --------------------------------------------------------------------------
 //  Self test of this class
 
+// Variables of a daisy chain member, like those of an ePDU with 24
+// outlets in 6 groups, about 300 variables
+static void
+s_epdu_variables (NutSnapshot::Variables& vars, int index, int sample)
+{
+    std::string prefix = index ? "device." + std::to_string (index) + "." : "";
+    auto set = [&](const std::string& name, const std::string& value) {
+        vars[prefix + name] = { value };
+    };
+    set ("device.mfr", "EATON");
+    set ("device.model", "ePDU MANAGED 0U");
+    set ("device.serial", "G" + std::to_string (1000 + index));
+    set ("device.type", "pdu");
+    set ("outlet.count", "24");
+    set ("outlet.group.count", "6");
+    set ("input.frequency", "50.0");
+    set ("input.voltage", "230.0");
+    set ("input.current", std::to_string (10 + sample % 3));
+    set ("input.realpower", std::to_string (2300 + sample % 7));
+    for (int phase = 1; phase <= 3; phase++) {
+        std::string l = "input.L" + std::to_string (phase) + ".";
+        set (l + "current", "3.3");
+        set (l + "voltage", "230.0");
+        set (l + "realpower", "766");
+        set (l + "load", "20");
+    }
+    for (int group = 1; group <= 6; group++) {
+        std::string g = "outlet.group." + std::to_string (group) + ".";
+        set (g + "id", std::to_string (group));
+        set (g + "name", "Group " + std::to_string (group));
+        set (g + "current", "1.6");
+        set (g + "voltage", "230.0");
+        set (g + "realpower", std::to_string (380 + sample % 5));
+    }
+    for (int outlet = 1; outlet <= 24; outlet++) {
+        std::string o = "outlet." + std::to_string (outlet) + ".";
+        set (o + "id", std::to_string (outlet));
+        set (o + "name", "A" + std::to_string (outlet));
+        set (o + "desc", "Outlet A" + std::to_string (outlet));
+        set (o + "type", "iec-320-c13");
+        set (o + "status", "on");
+        set (o + "switchable", "yes");
+        set (o + "current", "0.4");
+        set (o + "realpower", std::to_string (90 + (sample + outlet) % 11));
+        set (o + "power", "100");
+        set (o + "current.status", "good");
+        set (o + "current.high.warning", "8");
+        set (o + "current.high.critical", "10");
+    }
+}
+
 void
 nut_device_test (bool verbose)
 {
@@ -811,6 +1161,459 @@ nut_device_test (bool verbose)
 
     self.load_mapping (path);
 
+    // test case: route the variables of a daisy chain member with the
+    // compiled mapping
+    {
+        NutMapping mapping;
+        mapping.compile (self.get_mapping ("physicsMapping"), self.get_mapping ("inventoryMapping"));
+        NutSnapshot::Variables vars;
+        s_epdu_variables (vars, 1, 0);
+        s_epdu_variables (vars, 2, 1);
+        vars["device.2.ups.realpower"] = { "2000" };
+
+        fty_proto_t *proto = fty_proto_new (FTY_PROTO_ASSET);
+        fty_proto_set_name (proto, "epdu-2");
+        fty_proto_aux_insert (proto, "type", "device");
+        fty_proto_aux_insert (proto, "subtype", "epdu");
+        fty_proto_ext_insert (proto, "daisy_chain", "2");
+        AssetState::Asset asset (proto);
+        fty_proto_destroy (&proto);
+        drivers::nut::NUTDevice device (&asset, "epdu-1");
+        device.update (vars, mapping);
+        assert (device.property ("realpower.outlet.3") == "94");
+        assert (device.property ("load.outlet.group.2") == "");
+        assert (device.property ("realpower.outlet.group.2") == "381");
+        assert (device.property ("current.outlet.24") == "0.4");
+        assert (device.property ("outlet.5.label") == "Outlet A5");
+        assert (device.property ("delay.outlet.5.shutdown") == "");
+        assert (device.property ("serial_no") == "G1002");
+        assert (device.property ("device.type") == "epdu");
+        // ups.realpower comes after input.realpower in the mapping
+        assert (device.property ("realpower.default") == "2000");
+
+        // the changed flags follow the values
+        assert (device.changed ());
+        assert (device.changed ("realpower.outlet.3"));
+        assert (device.hasPhysics ("realpower.outlet.3"));
+        assert (!device.hasPhysics ("serial_no"));
+        assert (device.hasProperty ("serial_no"));
+        assert (!device.hasProperty ("unknown.metric"));
+        device.setChanged (false);
+        assert (!device.changed ());
+        s_epdu_variables (vars, 2, 2);
+        device.update (vars, mapping);
+        assert (device.changed ("realpower.outlet.3"));
+        assert (!device.changed ("current.outlet.24"));
+        assert (device.physics (true).count ("realpower.outlet.3") == 1);
+        assert (device.physics (true).count ("current.outlet.24") == 0);
+        assert (device.inventory (true).empty ());
+        assert (device.physics (false).count ("current.outlet.24") == 1);
+        device.setChanged ("realpower.outlet.3", false);
+        assert (!device.changed ("realpower.outlet.3"));
+
+        // numbers are parsed once and formatted back, other values are
+        // kept as text
+        assert (device.number ("current.outlet.24") == 0.4);
+        assert (device.number ("realpower.default") == 2000);
+        assert (std::isnan (device.number ("serial_no")));
+        assert (std::isnan (device.number ("unknown.metric")));
+        vars["device.2.input.source"] = { "B" };
+        vars["device.2.outlet.24.current"] = { "0.40" };
+        device.setChanged (false);
+        device.update (vars, mapping);
+        assert (device.property ("input.source") == "B");
+        assert (std::isnan (device.number ("input.source")));
+        assert (device.changed ("input.source"));
+        // the same number written differently is not a change
+        assert (!device.changed ("current.outlet.24"));
+        assert (device.property ("current.outlet.24") == "0.4");
+        vars["device.2.input.source"] = { "A" };
+        device.setChanged (false);
+        device.update (vars, mapping);
+        assert (device.changed ("input.source"));
+        assert (device.physics (true)["input.source"] == "A");
+
+        // the same by ID, without copies
+        {
+            char buffer[32];
+            MetricNames::Id current = MetricNames::find ("current.outlet.24");
+            MetricNames::Id source = MetricNames::find ("input.source");
+            MetricNames::Id serial = MetricNames::find ("serial_no");
+            assert (device.hasPhysics (current) && device.hasProperty (current));
+            assert (!device.hasPhysics (serial) && device.hasProperty (serial));
+            assert (!device.hasProperty (MetricNames::intern ("unknown.metric")));
+            assert (device.number (current) == 0.4);
+            assert (strcmp (device.property (current, buffer, sizeof (buffer)), "0.4") == 0);
+            assert (strcmp (device.property (serial, buffer, sizeof (buffer)), device.property ("serial_no").c_str ()) == 0);
+            assert (!device.property (MetricNames::find ("unknown.metric"), buffer, sizeof (buffer)));
+            assert (device.changed ("input.source"));
+            device.setChanged (source, false);
+            assert (!device.changed ("input.source"));
+            size_t count = 0;
+            device.forEachPhysicsId (false, [&](MetricNames::Id id, const char *value, double number) {
+                assert (device.property (MetricNames::name (id)) == value);
+                count++;
+            });
+            assert (count == device.physics (false).size ());
+        }
+
+        // the digest of the inventory follows its values
+        {
+            drivers::nut::NUTDevice a, b;
+            MetricNames::Id model = MetricNames::intern ("model");
+            MetricNames::Id serial = MetricNames::intern ("serial_no");
+            MetricNames::Id status = MetricNames::intern ("status.ups");
+            assert (a.inventoryDigest () == 0);
+            a.updateInventory (model, std::string ("ePDU"));
+            a.updateInventory (serial, std::string ("1234"));
+            b.updateInventory (serial, std::string ("1234"));
+            b.updateInventory (model, std::string ("ePDU"));
+            uint64_t digest = a.inventoryDigest ();
+            assert (digest != 0 && digest == b.inventoryDigest ());
+            // the same value under another name is another inventory
+            b.updateInventory (serial, std::string ("ePDU"));
+            b.updateInventory (model, std::string ("1234"));
+            assert (b.inventoryDigest () != digest);
+            a.updateInventory (serial, std::string ("1235"));
+            assert (a.inventoryDigest () != digest);
+            a.updateInventory (serial, std::string ("1234"));
+            assert (a.inventoryDigest () == digest);
+            // a value left out does not count
+            a.updateInventory (status, std::string ("OL"));
+            assert (a.inventoryDigest () != digest);
+            assert (a.inventoryDigest (status) == digest);
+            a.updateInventory (status, std::string ("OB"));
+            assert (a.inventoryDigest (status) == digest);
+            assert (a.forget ({ "status.ups" }) == 1);
+            assert (a.inventoryDigest () == digest);
+            a.clear ();
+            assert (a.inventoryDigest () == 0);
+        }
+
+        // the nominal values are both physical values and inventory items
+        // in the shipped mapping, max_current and max_power come back in
+        // the asset as maxCurrent() and maxPower()
+        {
+            drivers::nut::NUTDevice nominal;
+            nominal.update ({
+                { "input.current.nominal", { "16" } },
+                { "ups.realpower.nominal", { "3.6" } } }, mapping);
+            assert (nominal.physics (false)["current.input.nominal"] == "16");
+            assert (nominal.physics (false)["realpower.nominal"] == "3.6");
+            assert (nominal.inventory (false)["max_current"] == "16");
+            assert (nominal.inventory (false)["max_power"] == "3.6");
+        }
+
+        // noise on values close to zero, such as the currents of idle
+        // outlets, does not make the device be polled more often
+        {
+            drivers::nut::NUTDevice idle;
+            PollScheduler scheduler (30000);
+            scheduler.setBounds (1000, 0);
+            scheduler.add ("epdu-1", 0);
+            for (int i = 0; i < 20; i++) {
+                NutSnapshot::Variables noisy;
+                // the totals computed from the outlets move less
+                for (int outlet = 1; outlet <= 24; outlet++) {
+                    std::string prefix = "outlet." + std::to_string (outlet) + ".";
+                    noisy[prefix + "current"] = { (i + outlet) % 2 ? "0.02" : "0.01" };
+                    noisy[prefix + "realpower"] = { (i + outlet) % 2 ? "4" : "1" };
+                }
+                noisy["input.voltage"] = { i % 2 ? "230.4" : "229.8" };
+                idle.update (noisy, mapping);
+                assert (idle.volatility () < NUT_POLLING_VOLATILITY);
+                scheduler.adapt ("epdu-1", idle.volatility () >= NUT_POLLING_VOLATILITY ?
+                        PollScheduler::MOVING : PollScheduler::IDLE, i * 30000);
+            }
+            assert (scheduler.deviceInterval ("epdu-1") == 30000);
+            // a load switched on does
+            NutSnapshot::Variables loaded = { { "outlet.3.current", { "4.5" } } };
+            idle.update (loaded, mapping);
+            assert (idle.volatility () >= NUT_POLLING_VOLATILITY);
+        }
+
+        // values derived from others are computed on numbers
+        drivers::nut::NUTDevice ups;
+        ups.update ({
+            { "output.phases", { "3" } },
+            { "output.L1.realpower", { "100.5" } },
+            { "output.L2.realpower", { "200" } },
+            { "output.L3.realpower", { "300.25" } },
+            { "ups.L1.load", { "10" } },
+            { "ups.L2.load", { "20" } },
+            { "ups.L3.load", { "31" } } }, mapping);
+        assert (ups.property ("realpower.default") == "600.75");
+        assert (ups.number ("load.default") == 20.33);
+
+        if (verbose) {
+            // the time and the allocations of filling the variables are
+            // taken out
+            const int count = 1000;
+            uint64_t allocations = selftest_allocations_count();
+            int64_t start = zclock_usecs ();
+            for (int i = 0; i < count; i++) {
+                s_epdu_variables (vars, 2, i);
+                device.update (vars, mapping);
+            }
+            int64_t fill = zclock_usecs ();
+            uint64_t fill_allocations = selftest_allocations_count();
+            for (int i = 0; i < count; i++)
+                s_epdu_variables (vars, 2, i);
+            int64_t end = zclock_usecs ();
+            double per_update = static_cast<double> ((fill_allocations - allocations)
+                    - (selftest_allocations_count() - fill_allocations)) / count;
+            printf ("\n   update of an ePDU with %zu variables: %.1f us, %.1f allocations (%.2f per variable)",
+                    vars.size () / 2, static_cast<double> ((fill - start) - (end - fill)) / count,
+                    per_update, per_update / (vars.size () / 2));
+            printf ("\n   ");
+        }
+    }
+
+    // test case: read the devices from a fake upsd
+    {
+        FakeUpsd upsd;
+        upsd.setDevice ("ups-1", { { "ups.status", { "OL" } }, { "ups.load", { "10" } } });
+        upsd.setDevice ("epdu-1", {
+                { "device.1.outlet.count", { "24" } },
+                { "device.1.outlet.realpower", { "100" } },
+                { "device.2.outlet.count", { "16" } },
+                { "device.2.outlet.realpower", { "200" } },
+                { "device.2.device.type", { "pdu" } } });
+
+        AssetState state;
+        const char *assets[][4] = {
+            // name, subtype, ip, daisy_chain
+            { "ups-1", "ups", "10.0.0.1", "" },
+            { "ups-2", "ups", "10.0.0.2", "" },
+            { "epdu-1", "epdu", "10.0.0.3", "1" },
+            { "epdu-2", "epdu", "10.0.0.3", "2" },
+        };
+        for (const auto& a : assets) {
+            fty_proto_t *asset = fty_proto_new (FTY_PROTO_ASSET);
+            fty_proto_set_name (asset, "%s", a[0]);
+            fty_proto_set_operation (asset, FTY_PROTO_ASSET_OP_CREATE);
+            fty_proto_aux_insert (asset, "type", "device");
+            fty_proto_aux_insert (asset, "subtype", "%s", a[1]);
+            fty_proto_ext_insert (asset, "ip.1", "%s", a[2]);
+            if (*a[3])
+                fty_proto_ext_insert (asset, "daisy_chain", "%s", a[3]);
+            state.updateFromProto (asset);
+            fty_proto_destroy (&asset);
+        }
+
+        drivers::nut::NUTDeviceList list ("127.0.0.1", upsd.port ());
+        list.load_mapping (path);
+        list.updateDeviceList (state);
+        assert (list.size () == 4);
+        assert (list["epdu-2"].nutName () == "epdu-1");
+
+        // blocking update, the shared NUT device of the daisy chain is read
+        // once, ups-2 is unknown to upsd
+        list.update ();
+        assert (!list.updating ());
+        assert (upsd.requests () == 3);
+        assert (list["ups-1"].volatility () == 0);
+        std::shared_ptr<const NutSnapshot> snapshot = NutSnapshots.get ();
+        assert (snapshot && snapshot->size () == 2);
+        assert (*snapshot->value ("ups-1", "ups.status") == "OL");
+        assert (*snapshot->value ("epdu-1", "device.2.outlet.count") == "16");
+        assert (!snapshot->find ("ups-2"));
+        // each member of the daisy chain takes its own variables, the values
+        // computed for it do not end up in the snapshot
+        assert (list["epdu-1"].property ("outlet.count") == "24");
+        assert (list["epdu-2"].property ("outlet.count") == "16");
+        assert (list["epdu-1"].property ("realpower.default") == "100");
+        assert (list["epdu-2"].property ("realpower.default") == "200");
+        assert (list["epdu-2"].property ("device.type") == "epdu");
+        assert (*snapshot->value ("epdu-1", "device.2.device.type") == "pdu");
+        assert (!snapshot->value ("epdu-1", "device.2.ups.realpower"));
+
+        // non-blocking update, driven by the readability of the socket
+        upsd.setDevice ("ups-1", { { "ups.status", { "OB" } } });
+        assert (list.socket () == -1);
+        assert (list.beginUpdate ());
+        assert (list.updating ());
+        assert (list.socket () >= 0);
+        bool done = false;
+        while (!done) {
+            struct pollfd item = { list.socket (), POLLIN, 0 };
+            assert (::poll (&item, 1, 5000) == 1);
+            done = list.onReadable ();
+        }
+        assert (!list.updating ());
+        assert (list.socket () == -1);
+        assert (upsd.requests () == 6);
+        assert (NutSnapshots.get () != snapshot);
+        assert (*NutSnapshots.get ()->value ("ups-1", "ups.status") == "OB");
+
+        // a lost connection leaves the previous snapshot in place
+        snapshot = NutSnapshots.get ();
+        upsd.setSilent (true);
+        assert (list.beginUpdate ());
+        upsd.dropConnections ();
+        done = false;
+        while (!done) {
+            struct pollfd item = { list.socket (), POLLIN, 0 };
+            assert (::poll (&item, 1, 5000) == 1);
+            done = list.onReadable ();
+        }
+        assert (NutSnapshots.get () == snapshot);
+
+        // reading some devices keeps the others in the snapshot, devices
+        // failing to read are dropped from it
+        upsd.setSilent (false);
+        upsd.setDevice ("ups-1", { { "ups.status", { "OL" } } });
+        upsd.removeDevice ("epdu-1");
+        snapshot = NutSnapshots.get ();
+        uint64_t requests = upsd.requests ();
+        assert (list.beginPartialUpdate ({ "ups-1" }));
+        done = false;
+        while (!done) {
+            struct pollfd item = { list.socket (), POLLIN, 0 };
+            assert (::poll (&item, 1, 5000) == 1);
+            done = list.onReadable ();
+        }
+        assert (upsd.requests () == requests + 1);
+        assert (*NutSnapshots.get ()->value ("ups-1", "ups.status") == "OL");
+        assert (*NutSnapshots.get ()->value ("epdu-1", "device.2.outlet.count") == "16");
+        assert (*snapshot->value ("ups-1", "ups.status") == "OB");
+        list.update ();
+        assert (!list.beginPartialUpdate ({ "unknown" }));
+        assert (list.nutNames ().size () == 3);
+        assert (!NutSnapshots.get ()->find ("epdu-1"));
+        upsd.setDevice ("epdu-1", {
+                { "device.1.outlet.count", { "24" } },
+                { "device.2.outlet.count", { "16" } } });
+
+        // the same over parallel connections
+        list.setWorkers (3);
+        requests = upsd.requests ();
+        list.update ();
+        assert (upsd.requests () == requests + 3);
+        assert (NutSnapshots.get () != snapshot);
+        assert (NutSnapshots.get ()->size () == 2);
+        assert (*NutSnapshots.get ()->value ("epdu-1", "device.1.outlet.count") == "24");
+
+        // an update of the assets keeps the devices still read from the
+        // same NUT device, with their values and changed flags
+        list["epdu-1"].setChanged (false);
+        const drivers::nut::NUTDevice *epdu1 = &list["epdu-1"];
+        const char *updates[][5] = {
+            // name, subtype, ip, daisy_chain, operation
+            { "ups-1", "ups", "10.0.0.1", "", FTY_PROTO_ASSET_OP_UPDATE },
+            { "ups-2", "ups", "10.0.0.2", "", FTY_PROTO_ASSET_OP_DELETE },
+            { "epdu-2", "epdu", "10.0.0.3", "3", FTY_PROTO_ASSET_OP_UPDATE },
+        };
+        for (const auto& a : updates) {
+            fty_proto_t *asset = fty_proto_new (FTY_PROTO_ASSET);
+            fty_proto_set_name (asset, "%s", a[0]);
+            fty_proto_set_operation (asset, "%s", a[4]);
+            fty_proto_aux_insert (asset, "type", "device");
+            fty_proto_aux_insert (asset, "subtype", "%s", a[1]);
+            fty_proto_ext_insert (asset, "ip.1", "%s", a[2]);
+            fty_proto_ext_insert (asset, "max_current", "16");
+            if (*a[3])
+                fty_proto_ext_insert (asset, "daisy_chain", "%s", a[3]);
+            state.updateFromProto (asset);
+            fty_proto_destroy (&asset);
+        }
+        // only the assets of the change set are looked at
+        AssetState::ChangeSet changes;
+        changes.updated = { "ups-1", "epdu-2" };
+        changes.removed = { "ups-2" };
+        drivers::nut::NUTDeviceList::Changes listChanges;
+        list.updateDeviceList (state, changes, listChanges);
+        assert (listChanges.removedAssets == std::set<std::string> { "ups-2" });
+        assert (listChanges.removedNutNames == std::set<std::string> { "ups-2" });
+        assert (listChanges.addedNutNames.empty ());
+        assert (list.size () == 3);
+        assert (&list["epdu-1"] == epdu1);
+        assert (list["epdu-1"].property ("outlet.count") == "24");
+        assert (!list["epdu-1"].changed ());
+        assert (list["ups-1"].maxCurrent () == 16);
+        assert (list["ups-1"].property ("status.ups") == "OL");
+        // a member moved in the daisy chain starts over
+        assert (list["epdu-2"].daisyChainIndex () == 3);
+        assert (!list["epdu-2"].hasProperty ("outlet.count"));
+
+        // a new mapping is swapped in once the update in progress is done,
+        // only the values whose mapping changed are read again
+        upsd.setDevice ("epdu-1", {
+                { "device.1.outlet.count", { "24" } },
+                { "device.1.outlet.realpower", { "100" } } });
+        list.update ();
+        list["epdu-1"].setChanged (false);
+        char mapping_path[] = "/tmp/nut_device_test_XXXXXX";
+        int fd = mkstemp (mapping_path);
+        assert (fd >= 0);
+        close (fd);
+        const std::map<std::string, std::string> physics = list.get_mapping ("physicsMapping");
+        const std::map<std::string, std::string> inventory = list.get_mapping ("inventoryMapping");
+        auto write_mapping = [&](const std::map<std::string, std::string>& physics_mapping, const char *deadbands) {
+            FILE *file = fopen (mapping_path, "w");
+            assert (file);
+            fprintf (file, "{\n    \"physicsMapping\" : {");
+            const char *separator = "\n";
+            for (const auto& i : physics_mapping) {
+                fprintf (file, "%s        \"%s\" : \"%s\"", separator, i.first.c_str (), i.second.c_str ());
+                separator = ",\n";
+            }
+            fprintf (file, "\n    },\n    \"inventoryMapping\" : {");
+            separator = "\n";
+            for (const auto& i : inventory) {
+                fprintf (file, "%s        \"%s\" : \"%s\"", separator, i.first.c_str (), i.second.c_str ());
+                separator = ",\n";
+            }
+            fprintf (file, "\n    },\n    \"deadbandMapping\" : {\n        %s\n    }\n}\n", deadbands);
+            fclose (file);
+        };
+        std::map<std::string, std::string> changed_physics = physics;
+        for (auto i = changed_physics.begin (); i != changed_physics.end ();) {
+            if (i->second == "realpower.default")
+                i = changed_physics.erase (i);
+            else
+                ++i;
+        }
+        assert (changed_physics.size () < physics.size ());
+        write_mapping (changed_physics, "\"load\" : \"5\"");
+        assert (list.beginUpdate ());
+        assert (list.load_mapping (mapping_path));
+        assert (list.get_mapping ("physicsMapping") == physics);
+        assert (list.get_mapping ("deadbandMapping").at ("load") == "5");
+        assert (list["epdu-1"].property ("realpower.default") == "100");
+        while (!list.onReadable ()) {
+            struct pollfd item = { list.socket (), POLLIN, 0 };
+            assert (::poll (&item, 1, 5000) == 1);
+        }
+        assert (list.get_mapping ("physicsMapping") == changed_physics);
+        assert (!list["epdu-1"].hasProperty ("realpower.default"));
+        assert (list["epdu-1"].property ("outlet.count") == "24");
+        assert (!list["epdu-1"].changed ());
+        list.update ();
+        assert (!list["epdu-1"].hasProperty ("realpower.default"));
+
+        // and come back with the original mapping
+        write_mapping (physics, "");
+        assert (list.load_mapping (mapping_path));
+        assert (list.get_mapping ("physicsMapping") == physics);
+        assert (list.get_mapping ("deadbandMapping").empty ());
+        list.update ();
+        assert (list["epdu-1"].property ("realpower.default") == "100");
+        assert (list["epdu-1"].changed ("realpower.default"));
+        assert (!list["epdu-1"].changed ("outlet.count"));
+
+        // a broken file leaves the mapping alone
+        FILE *file = fopen (mapping_path, "w");
+        assert (file);
+        fprintf (file, "{ \"physicsMapping\" : {");
+        fclose (file);
+        assert (!list.load_mapping (mapping_path));
+        assert (list.mappingLoaded ());
+        assert (list.get_mapping ("physicsMapping") == physics);
+        unlink (mapping_path);
+        NutSnapshots.publish (nullptr);
+    }
+
     //  @end
     printf ("OK\n");
 }
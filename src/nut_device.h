@@ -26,34 +26,56 @@
 // Original authors: Tomas Halman, Karol Hrdina, Alena Chernikava
 
 #include "asset_state.h"
+#include "metric_store.h"
 
+#include <cmath>
 #include <map>
+#include <set>
 #include <vector>
 #include <functional>
-#include <nutclient.h>
+#include "nut_connection.h"
+#include "nut_mapping.h"
+#include "nut_pool.h"
+#include "nut_snapshot.h"
 
-namespace nutclient = nut;
+void nut_device_test (bool verbose);
+
+// Volatility of a device that makes it be polled more often, see
+// NUTDevice::volatility()
+#define NUT_POLLING_VOLATILITY 0.05
 
 namespace drivers
 {
 namespace nut
 {
 
+// The changed flags are kept by the MetricStore
 struct NUTInventoryValue {
-    bool changed;
     std::string value;
+    // of the name and the value, see NUTDevice::inventoryDigest()
+    uint64_t digest = 0;
 };
 
+// Numbers are parsed once when read from NUT and only formatted again
+// when published. The few values that are not numbers (like status.ups)
+// are kept as text, with NAN as number
 struct NUTPhysicalValue {
-    bool changed;
-    std::string value;
-    std::string candidate;
+    // NAN until the first update, so that it does not count as a change
+    double value = NAN;
+    double candidate = NAN;
+    std::string text;
+    std::string candidateText;
+    // magnitude below which changes are measured against it, see
+    // NUTDevice::volatility()
+    double floor = 1;
 };
 
 // Class for keeping status information of one UPS/ePDU/...
 // Keeps inventory, status and measurement values of one device as it is presented by NUT.
 class NUTDevice {
     friend class NUTDeviceList;
+    // friend function for unit-testing
+    friend void ::nut_device_test (bool verbose);
  public:
     // Creates new NUTDevice with empty set of values without name and no
     // asset information
@@ -77,6 +99,7 @@ class NUTDevice {
     // Set status of particular property
     void setChanged(const char *name, const bool status);
     void setChanged(const std::string& name,const bool status);
+    void setChanged(MetricNames::Id id, const bool status);
 
     /**
      * \brief Produces a std::string with device status in JSON format.
@@ -97,11 +120,13 @@ class NUTDevice {
     // (i.e. property exists for this device)
     bool hasProperty(const char *name) const;
     bool hasProperty(const std::string& name) const;
+    bool hasProperty(MetricNames::Id id) const;
 
     // Returns true if this device reports particular physical (measurement) property.
     // (i.e. physical (measurement) property exists for this device)
     bool hasPhysics(const char *name) const;
     bool hasPhysics(const std::string& name) const;
+    bool hasPhysics(MetricNames::Id id) const;
 
     /**
      * \brief Method returns list of physical properties. If the parameter
@@ -119,6 +144,58 @@ class NUTDevice {
      */
     std::map<std::string,std::string> inventory(bool onlyChanged) const;
 
+    /**
+     * \brief Calls f(name, value, number) for each physical property, or
+     *        only for the changed ones, like physics() without copying them.
+     *        The value is a C string only valid during the call, the number
+     *        is NAN for values that are not numbers.
+     */
+    template <typename F>
+    void forEachPhysics(bool onlyChanged, F f) const
+    {
+        char buffer[32];
+        for (size_t i = 0; i < _physics.size (); i++) {
+            if (! onlyChanged || _physics.changed (i))
+                f (MetricNames::name (_physics.id (i)), formatPhysics (_physics.value (i), buffer, sizeof (buffer)),
+                        _physics.value (i).value);
+        }
+    }
+
+    /**
+     * \brief Like forEachPhysics(), calls f(id, value, number) with the ID
+     *        of the name instead.
+     */
+    template <typename F>
+    void forEachPhysicsId(bool onlyChanged, F f) const
+    {
+        char buffer[32];
+        for (size_t i = 0; i < _physics.size (); i++) {
+            if (! onlyChanged || _physics.changed (i))
+                f (_physics.id (i), formatPhysics (_physics.value (i), buffer, sizeof (buffer)),
+                        _physics.value (i).value);
+        }
+    }
+
+    /**
+     * \brief Calls f(name, value) for each inventory property, or only for
+     *        the changed ones, like inventory() without copying them.
+     */
+    template <typename F>
+    void forEachInventory(bool onlyChanged, F f) const
+    {
+        for (size_t i = 0; i < _inventory.size (); i++) {
+            if (! onlyChanged || _inventory.changed (i))
+                f (MetricNames::name (_inventory.id (i)), _inventory.value (i).value);
+        }
+    }
+
+    /**
+     * \brief 64-bit digest of the inventory, kept up to date as values
+     *        change, so that an unchanged inventory is recognized without
+     *        reading it. The value of except, if any, is left out.
+     */
+    uint64_t inventoryDigest(MetricNames::Id except = MetricNames::NONE) const;
+
     /**
      * \brief method returns particular device property.
      * \return std::string, property value as a string or empty
@@ -133,12 +210,33 @@ class NUTDevice {
     std::string property(const char *name) const;
     std::string property(const std::string& name) const;
 
+    /**
+     * \brief method returns a physical property as a number.
+     * \return double, NAN if the property doesn't exist or is not a number
+     */
+    double number(const char *name) const;
+    double number(const std::string& name) const;
+    double number(MetricNames::Id id) const;
+
+    /**
+     * \brief Text of a property like property(), without a copy; physical
+     * values are formatted into buffer. Returns nullptr if the property does
+     * not exist
+     */
+    const char *property(MetricNames::Id id, char *buffer, size_t size) const;
+
+    /**
+     * \brief Returns the text of a physical value, numbers are formatted
+     *        into buffer (at least 32 bytes).
+     */
+    static const char *formatPhysics(const NUTPhysicalValue& value, char *buffer, size_t size);
+
     /**
      * \brief method returns all discovered properties of device.
      * \return std::map<std::string,std::string> property values
      *
      * Method transforms all properties (physical and inventory) to
-     * map. Numeric values are converted to strings using itof() method.
+     * map. Numeric values are converted to strings using formatPhysics().
      */
     std::map<std::string,std::string> properties() const;
 
@@ -147,6 +245,24 @@ class NUTDevice {
      */
     void clear();
 
+    /**
+     * \brief Forgets the values of the BIOS names covered by the entries of
+     * the mapping that changed (see NutMapping::changes()), they are read
+     * again at the next update. Returns the number of values forgotten
+     */
+    size_t forget(const std::set<std::string>& biosNames);
+
+    /**
+     * \brief Largest relative change of a physical value in the last update
+     *
+     * 0.1 means that some value moved by 10 %. Values are compared with a
+     * floor that depends on their type (1 A for currents, 100 W for powers,
+     * ...), so that the noise of values close to zero, such as the
+     * current of an idle outlet, does not count. Values that are not
+     * numbers are not taken into account.
+     */
+    double volatility() const { return _volatility; }
+
     /**
      * \brief Return the timestamp of last succesfull update (i. e. response from device)
      */
@@ -155,9 +271,9 @@ class NUTDevice {
     /**
      * \brief get the device name like it is in assets
      */
-    std::string assetName () const
+    const std::string& assetName () const
     {
-        return  _asset ? _asset->name() : std::string();
+        return  _asset ? _asset->name() : s_none();
     }
 
     /**
@@ -168,9 +284,9 @@ class NUTDevice {
     /**
      * \brief get the asset subtype
      */
-    std::string subtype () const
+    const std::string& subtype () const
     {
-        return _asset ? _asset->subtype() : std::string();
+        return _asset ? _asset->subtype() : s_none();
     }
 
     /**
@@ -178,7 +294,16 @@ class NUTDevice {
      */
     int daisyChainIndex() const
     {
-        return _asset ? _asset->daisychain() : 0;
+        return _daisyChain;
+    }
+
+    /**
+     * \brief Points to the new version of the asset, after an update of the
+     * assets that kept its NUT name and daisy-chain index
+     */
+    void assetPtr(const AssetState::Asset *asset)
+    {
+        _asset = asset;
     }
 
     /**
@@ -196,8 +321,6 @@ class NUTDevice {
     {
         return _asset ? _asset->maxPower() : NAN;
     }
-
-    ~NUTDevice();
  private:
     /**
      * \brief the respective asset element, if known (owned by the state
@@ -205,13 +328,22 @@ class NUTDevice {
      */
     const AssetState::Asset *_asset;
 
+    /**
+     * \brief daisy-chain index of the asset, kept apart so that it can be
+     * compared with that of a new version of the asset
+     */
+    int _daisyChain;
+
+    //! \brief name or subtype of a device without asset
+    static const std::string& s_none();
+
     /**
      * \brief Updates physical or measurement value (like current or load) from float.
      *
      * Updates the value if new value is significantly differen (> threshold%). Flag _change is
      * set if new value is saved.
      */
-    void updatePhysics(const std::string& varName, const std::string& newValue);
+    void updatePhysics(MetricNames::Id id, const std::string& newValue);
 
     /**
      * \brief Updates physical or measurement value from vector.
@@ -219,7 +351,7 @@ class NUTDevice {
      * Calculates the value with first value from vector (NUT returns vectors of
      * values).
      */
-    void updatePhysics(const std::string& varName, std::vector<std::string>& values);
+    void updatePhysics(MetricNames::Id id, const std::vector<std::string>& values);
 
     /**
      * \brief Updates inventory value.
@@ -228,13 +360,18 @@ class NUTDevice {
      * values). values are connected like "value1, value2, value3". Flag _change is
      * set if new value is different from old one.
      */
-    void updateInventory(const std::string& varName, std::vector<std::string>& values);
+    void updateInventory(MetricNames::Id id, const std::vector<std::string>& values);
+    void updateInventory(MetricNames::Id id, const std::string& inventory);
 
     /**
      * \brief Updates all values from NUT.
+     *
+     * The variables are those of the NUT device, shared by all members of
+     * a daisy chain; each member only looks at its own, and routes each of
+     * them to its physics or inventory name with the compiled mapping.
      */
-    void update (std::map<std::string,std::vector<std::string>> vars,
-                 std::function <const std::map <std::string, std::string>&(const char *)> mapping,
+    void update (const NutSnapshot::Variables& vars,
+                 const NutMapping& mapping,
                  bool forceUpdate = false );
 
     /**
@@ -242,7 +379,7 @@ class NUTDevice {
      *
      * This method is used to normalize the NUT output from different drivers/devices.
      */
-    void NUTSetIfNotPresent (const std::string& prefix, std::map< std::string,std::vector<std::string> > &vars, const std::string &dst, const std::string &src);
+    void NUTSetIfNotPresent (NutMemberView &vars, const char *dst, const char *src);
 
     /**
      * \brief Commit chages for changed calculated by updatePhysics.
@@ -257,27 +394,35 @@ class NUTDevice {
     std::string daisyPrefix() const;
 
     /**
-     * \brief map of physical values.
-     *
-     * Values are multiplied by 100 and stored as integer
+     * \brief physical values, by interned name.
      */
-    std::map<std::string, NUTPhysicalValue> _physics;
-    //! \brief map of inventory values
-    std::map<std::string, NUTInventoryValue> _inventory;
+    MetricStore<NUTPhysicalValue> _physics;
+    //! \brief inventory values, by interned name
+    MetricStore<NUTInventoryValue> _inventory;
+    //! \brief digests of all inventory values combined with XOR
+    uint64_t _inventoryDigest = 0;
 
     //! \brief device name in nut
     std::string _nutName;
 
-    //! \brief Transformation of our integer (x100) back
-    std::string itof(const long int) const;
     //! \brief calculate ups.load if not present
-    void NUTFixMissingLoad (const std::string& prefix, std::map< std::string,std::vector<std::string> > &vars);
+    void NUTFixMissingLoad (NutMemberView &vars);
     //! \brief calculate ups.realpower from output.Lx.realpower if not present
-    void NUTRealpowerFromOutput (const std::string& prefix,  std::map< std::string,std::vector<std::string> > &vars);
+    void NUTRealpowerFromOutput (NutMemberView &vars);
     //! \brief NUT values transformation function
-    void NUTValuesTransformation (const std::string& prefix, std::map< std::string,std::vector<std::string> > &vars);
+    void NUTValuesTransformation (NutMemberView &vars);
     //! \brief last succesfull communication timestamp
     time_t _lastUpdate = 0;
+    //! \brief see volatility()
+    double _volatility = 0;
+    //! \brief rank of the mapping entry that set a shared name, reused by
+    //! update() so that it does not allocate
+    struct Rank {
+        NutMapping::Kind kind;
+        MetricNames::Id id;
+        size_t rank;
+    };
+    std::vector<Rank> _ranks;
 };
 
 /**
@@ -285,19 +430,25 @@ class NUTDevice {
  */
 class NUTDeviceList {
  public:
-    NUTDeviceList();
+    explicit NUTDeviceList(const std::string& host = "localhost", int port = 3493);
 
     /**
      * \brief Loads mapping from configuration file 'path_to_file'
      *
-     * Overwrites old values on successfull deserialization from json configuration file
+     * Overwrites old values on successfull deserialization from json configuration file,
+     * keeps them otherwise. The mapping is compiled right away, but only swapped in once
+     * the update in progress, if any, is finished; the values of the devices whose
+     * mapping changed are then read again. The deadbands apply immediately.
+     * Returns false if the file cannot be read.
      */
-    void load_mapping (const char *path_to_file);
+    bool load_mapping (const char *path_to_file);
 
     bool mappingLoaded () const;
 
     /**
-     * \brief Returns requested mapping
+     * \brief Returns requested mapping: physicsMapping, inventoryMapping
+     *        or deadbandMapping (the deadbands by metric type, see
+     *        PublishFilter)
      */
     const std::map <std::string, std::string>& get_mapping (const char *mapping) const;
 
@@ -305,11 +456,50 @@ class NUTDeviceList {
      * \brief Reads status information from NUT daemon.
      *
      * Method reads values from NUT and updates information of particular
-     * devices. Newly discovered davices are added to list, removed devices
-     * are also removed from list.
+     * devices. It blocks until all devices are read, see beginUpdate() for
+     * the non-blocking variant.
      */
     void update( bool forceUpdate = false );
 
+    /**
+     * \brief Starts reading status information from NUT daemon.
+     *
+     * The requests for all devices are pipelined on one connection and the
+     * replies are processed by onReadable() as they arrive. Returns false if
+     * there is nothing to wait for (no devices or upsd cannot be reached).
+     * An update still in progress is abandoned.
+     */
+    bool beginUpdate( bool forceUpdate = false );
+
+    /**
+     * \brief Starts reading only the given NUT devices.
+     *
+     * Like beginUpdate(), the published snapshot keeps the variables of
+     * the other NUT devices from the previous one.
+     */
+    bool beginPartialUpdate( const std::vector<std::string>& nutNames, bool forceUpdate = false );
+
+    /**
+     * \brief Processes the replies available on the NUT socket.
+     *
+     * Returns true when the update started by beginUpdate() is complete.
+     */
+    bool onReadable();
+
+    //! \brief Returns true while an update is in progress
+    bool updating() const;
+
+    //! \brief Socket to watch for readability while updating, -1 otherwise
+    int socket() const;
+
+    /**
+     * \brief Sets the number of connections to NUT daemon.
+     *
+     * With more than one, the devices are read in parallel by as many
+     * worker threads, each with its own connection (see NutPool).
+     */
+    void setWorkers( size_t workers );
+
     /**
      * \brief Returns true if there is at least one device claiming change.
      */
@@ -323,34 +513,85 @@ class NUTDeviceList {
     //! \brief get the NUTDevice object by name
     NUTDevice& operator[](const std::string &name);
 
+    //! \brief names of the NUT devices to read, daisy chains share one
+    std::vector<std::string> nutNames() const;
+
     //! \brief get the iterators, to be able to go trough list of devices
     std::map<std::string, NUTDevice>::iterator begin();
     std::map<std::string, NUTDevice>::iterator end();
 
-    //! \brief update list of NUT devices
+    //! \brief assets and NUT devices that came or went in updateDeviceList()
+    struct Changes {
+        std::set<std::string> removedAssets;
+        std::set<std::string> addedNutNames;
+        std::set<std::string> removedNutNames;
+    };
+
+    //! \brief update list of NUT devices, walking all the power devices
     void updateDeviceList(const AssetState& state);
 
-    ~NUTDeviceList();
+    //! \brief update only the devices of the assets in the change set, see
+    //! StateManager::Reader::refresh(), and report what changed in the list
+    void updateDeviceList(const AssetState& state, const AssetState::ChangeSet& changes,
+            Changes& listChanges);
 
  private:
     // see http://www.networkupstools.org/docs/user-manual.chunked/apcs01.html
     std::map <std::string, std::string> _physicsMapping; //!< physics mapping
     std::map <std::string, std::string> _inventoryMapping; //!< inventory mapping
+    std::map <std::string, std::string> _deadbandMapping; //!< deadbands, optional
+    NutMapping _mapping; //!< both mappings, compiled for NUTDevice::update()
+
+    //! \brief physics and inventory mappings waiting for the end of an update
+    struct Mapping {
+        std::map <std::string, std::string> physics;
+        std::map <std::string, std::string> inventory;
+        NutMapping compiled;
+    };
+    std::unique_ptr<Mapping> _nextMapping;
 
-    //! \brief Connection to NUT daemon
-    nutclient::TcpClient nutClient;
+    //! \brief swap in the next mapping, forgetting the values it changes
+    void applyMapping();
+
+    //! \brief NUT daemon address
+    std::string _host;
+    int _port;
+
+    //! \brief Connection to NUT daemon, kept open between updates
+    NutConnection _connection;
+
+    //! \brief Worker threads used instead of _connection, if configured
+    std::unique_ptr<NutPool> _pool;
+
+    //! \brief set if a worker lost its connection during the update
+    bool _connectionLost = false;
 
     //! \brief list of NUT devices
     std::map<std::string, NUTDevice> _devices;
 
-    //! \brief connect to NUT daemon
-    bool connect();
+    //! \brief number of devices read from each NUT device
+    std::map<std::string, size_t> _nutNameUsers;
+
+    //! \brief add or remove a device, keeping _nutNameUsers up to date
+    void addDevice(const std::string& name, NUTDevice device, Changes& listChanges);
+    void removeDevice(const std::string& name, Changes& listChanges);
+
+    //! \brief snapshot filled by the update in progress, null if none
+    std::shared_ptr<NutSnapshot> _snapshot;
+
+    //! \brief NUT devices not read yet, with the assets read from them
+    std::map<std::string, std::vector<std::string>> _pending;
+
+    bool _forceUpdate = false;
+
+    //! \brief update status of the NUT devices read from a NUT device
+    void updateDeviceStatus( NutConnection::Reply& reply );
 
-    //! \brief disconnect from NUT daemon
-    void disconnect();
+    //! \brief start reading the NUT devices into the snapshot
+    bool startUpdate( const std::vector<std::string>& nutNames, std::shared_ptr<NutSnapshot> snapshot, bool forceUpdate );
 
-    //! \brief update status of NUT devices
-    void updateDeviceStatus( bool forceUpdate = false );
+    //! \brief end the update in progress, publishing the snapshot or not
+    void finishUpdate( bool publish );
 
     bool _mappingLoaded = false;
 };
@@ -0,0 +1,333 @@
+/*  =========================================================================
+    nut_mapping - Mapping of NUT variable names to BIOS names, compiled for lookups
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+
+/*
+@header
+    nut_mapping - Mapping of NUT variable names to BIOS names, compiled for lookups
+@discuss
+@end
+*/
+
+#include "nut_mapping.h"
+#include <fty_log.h>
+
+#include <cassert>
+#include <cctype>
+#include <utility>
+
+void NutMapping::Target::biosName(const std::string& number, std::string& name) const
+{
+    name = bios;
+    if (numbered) {
+        name += number;
+        name += suffix;
+    }
+}
+
+MetricNames::Id NutMapping::Target::biosId(const std::string& number, std::string& name) const
+{
+    if (!numbered)
+        return id;
+    biosName(number, name);
+    return MetricNames::intern(name);
+}
+
+void NutMapping::compile(const std::map<std::string, std::string>& physics,
+        const std::map<std::string, std::string>& inventory)
+{
+    clear();
+    add(PHYSICS, physics);
+    add(INVENTORY, inventory);
+    // Mark the BIOS names fed by more than one entry
+    std::map<std::pair<Kind, std::string>, size_t> feeds;
+    for (auto *table : { &exact_, &numbered_ }) {
+        for (const auto& i : *table) {
+            for (Kind kind : { PHYSICS, INVENTORY }) {
+                const Target *target = i.second.target(kind);
+                if (target)
+                    feeds[std::make_pair(kind, target->numbered ? target->bios + "#" + target->suffix : target->bios)]++;
+            }
+        }
+    }
+    for (auto *table : { &exact_, &numbered_ }) {
+        for (auto& i : *table) {
+            for (Kind kind : { PHYSICS, INVENTORY }) {
+                if (!i.second.mapped[kind])
+                    continue;
+                Target& target = i.second.targets[kind];
+                target.shared = feeds[std::make_pair(kind, target.numbered ? target.bios + "#" + target.suffix : target.bios)] > 1;
+            }
+        }
+    }
+}
+
+void NutMapping::add(Kind kind, const std::map<std::string, std::string>& mapping)
+{
+    size_t rank = 0;
+    for (const auto& item : mapping) {
+        Target target;
+        target.kind = kind;
+        target.rank = rank++;
+        target.shared = false;
+        size_t x = item.first.find(".#."); // is always in the middle: outlet.#.realpower
+        if (x != std::string::npos && x > 0) {
+            size_t y = item.second.find(".#"); // can be at the end: outlet.voltage.#
+            if (y == std::string::npos || y == 0) {
+                log_warning("Mapping of numbered %s to %s without a number, ignored",
+                        item.first.c_str(), item.second.c_str());
+                continue;
+            }
+            target.bios = item.second.substr(0, y + 1);
+            target.suffix = item.second.substr(y + 2);
+            target.numbered = true;
+            target.id = MetricNames::NONE;
+            Entry& entry = numbered_[item.first];
+            entry.targets[kind] = std::move(target);
+            entry.mapped[kind] = true;
+        } else {
+            target.bios = item.second;
+            target.numbered = false;
+            target.id = MetricNames::intern(target.bios);
+            Entry& entry = exact_[item.first];
+            entry.targets[kind] = std::move(target);
+            entry.mapped[kind] = true;
+        }
+        size_++;
+    }
+}
+
+void NutMapping::clear()
+{
+    exact_.clear();
+    numbered_.clear();
+    size_ = 0;
+}
+
+const NutMapping::Entry* NutMapping::match(const std::string& name, std::string& number) const
+{
+    auto i = exact_.find(name);
+    if (i != exact_.end())
+        return &i->second;
+    if (numbered_.empty())
+        return nullptr;
+    // Try each numbered segment in turn, it cannot be the first one
+    for (size_t dot = name.find('.'); dot != std::string::npos; dot = name.find('.', dot + 1)) {
+        size_t begin = dot + 1;
+        size_t end = begin;
+        while (end < name.size() && isdigit(static_cast<unsigned char>(name[end])))
+            end++;
+        // Numbers start at 1, without leading zeros
+        if (end == begin || end == name.size() || name[end] != '.' || name[begin] == '0')
+            continue;
+        key_.assign(name, 0, begin);
+        key_ += '#';
+        key_.append(name, end, std::string::npos);
+        auto j = numbered_.find(key_);
+        if (j != numbered_.end()) {
+            number.assign(name, begin, end - begin);
+            return &j->second;
+        }
+    }
+    return nullptr;
+}
+
+void NutMapping::changes(const std::map<std::string, std::string>& before,
+        const std::map<std::string, std::string>& after, std::set<std::string>& bios)
+{
+    for (const auto& item : before) {
+        auto i = after.find(item.first);
+        if (i == after.end() || i->second != item.second)
+            bios.insert(item.second);
+    }
+    for (const auto& item : after) {
+        auto i = before.find(item.first);
+        if (i == before.end() || i->second != item.second)
+            bios.insert(item.second);
+    }
+}
+
+bool NutMapping::covers(const std::set<std::string>& bios, const std::string& name)
+{
+    if (bios.count(name))
+        return true;
+    for (const auto& pattern : bios) {
+        size_t x = pattern.find('#');
+        if (x == std::string::npos)
+            continue;
+        size_t suffix = pattern.size() - x - 1;
+        if (name.size() <= x + suffix || name.compare(0, x, pattern, 0, x) != 0 ||
+                name.compare(name.size() - suffix, suffix, pattern, x + 1, suffix) != 0)
+            continue;
+        size_t end = name.size() - suffix;
+        while (x < end && isdigit(static_cast<unsigned char>(name[x])))
+            x++;
+        if (x == end)
+            return true;
+    }
+    return false;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+// BIOS name of a NUT variable, empty if it is not mapped
+static std::string
+s_bios(const NutMapping& mapping, const std::string& name, NutMapping::Kind kind)
+{
+    std::string number;
+    std::string bios;
+    const NutMapping::Entry *entry = mapping.match(name, number);
+    if (entry && entry->target(kind))
+        entry->target(kind)->biosName(number, bios);
+    return bios;
+}
+
+void
+nut_mapping_test (bool verbose)
+{
+    printf (" * nut_mapping: ");
+
+    //  @selftest
+    NutMapping mapping;
+    std::string number;
+    assert(mapping.size() == 0);
+    assert(!mapping.match("ups.realpower", number));
+
+    mapping.compile({
+            { "ups.realpower", "realpower.default" },
+            { "input.realpower", "realpower.default" },
+            { "ups.load", "load.default" },
+            { "outlet.#.realpower", "realpower.outlet.#" },
+            { "outlet.#.voltage", "outlet.voltage.#" },
+            { "outlet.#.current", "current.outlet" } },
+        {
+            { "device.model", "model" },
+            { "outlet.#.delay.shutdown", "delay.outlet.#.shutdown" },
+            { "outlet.group.#.name", "outlet.group.#.label" } });
+    // The entry without a number in the BIOS name is dropped
+    assert(mapping.size() == 8);
+
+    assert(s_bios(mapping, "ups.load", NutMapping::PHYSICS) == "load.default");
+    assert(s_bios(mapping, "device.model", NutMapping::INVENTORY) == "model");
+    assert(s_bios(mapping, "ups.model", NutMapping::INVENTORY).empty());
+    assert(s_bios(mapping, "outlet.3.realpower", NutMapping::PHYSICS) == "realpower.outlet.3");
+    assert(s_bios(mapping, "outlet.12.voltage", NutMapping::PHYSICS) == "outlet.voltage.12");
+    assert(s_bios(mapping, "outlet.2.delay.shutdown", NutMapping::INVENTORY) == "delay.outlet.2.shutdown");
+    assert(s_bios(mapping, "outlet.group.4.name", NutMapping::INVENTORY) == "outlet.group.4.label");
+    assert(s_bios(mapping, "outlet.2.current", NutMapping::PHYSICS).empty());
+    // Only whole segments numbered from 1 match
+    assert(!mapping.match("outlet.0.realpower", number));
+    assert(!mapping.match("outlet.01.realpower", number));
+    assert(!mapping.match("outlet.1a.realpower", number));
+    assert(!mapping.match("outlet.#.realpower", number));
+    assert(!mapping.match("outlet.1.realpower.x", number));
+    // The variables of a daisy chain member must be matched without their
+    // prefix
+    assert(!mapping.match("device.2.outlet.1.realpower", number));
+    assert(!mapping.match("device.2.ups.load", number));
+
+    // Entries feeding the same BIOS name are ranked in the order of the
+    // NUT names
+    const NutMapping::Target *input = mapping.match("input.realpower", number)->target(NutMapping::PHYSICS);
+    const NutMapping::Target *ups = mapping.match("ups.realpower", number)->target(NutMapping::PHYSICS);
+    assert(input && ups);
+    assert(input->shared && ups->shared);
+    assert(input->rank < ups->rank);
+    const NutMapping::Target *load = mapping.match("ups.load", number)->target(NutMapping::PHYSICS);
+    assert(!load->shared);
+    assert(!mapping.match("outlet.1.realpower", number)->target(NutMapping::PHYSICS)->shared);
+    assert(!mapping.match("ups.load", number)->target(NutMapping::INVENTORY));
+
+    // Exact entries carry the ID of their BIOS name, numbered ones intern
+    // it for each number
+    std::string name;
+    assert(load->id == MetricNames::find("load.default"));
+    assert(load->biosId(number, name) == MetricNames::find("load.default"));
+    const NutMapping::Target *outlet = mapping.match("outlet.7.realpower", number)->target(NutMapping::PHYSICS);
+    assert(outlet->id == MetricNames::NONE);
+    assert(MetricNames::name(outlet->biosId(number, name)) == "realpower.outlet.7");
+    assert(name == "realpower.outlet.7");
+
+    // A NUT name mapped in both sections has a target in each, as the
+    // nominal values of the shipped mapping.conf
+    mapping.compile({
+            { "input.current.nominal", "current.input.nominal" },
+            { "ups.realpower.nominal", "realpower.nominal" },
+            { "ups.realpower", "realpower.default" } },
+        {
+            { "input.current.nominal", "max_current" },
+            { "ups.realpower.nominal", "max_power" },
+            { "ups.model", "model" } });
+    assert(mapping.size() == 6);
+    assert(s_bios(mapping, "input.current.nominal", NutMapping::PHYSICS) == "current.input.nominal");
+    assert(s_bios(mapping, "input.current.nominal", NutMapping::INVENTORY) == "max_current");
+    assert(s_bios(mapping, "ups.realpower.nominal", NutMapping::PHYSICS) == "realpower.nominal");
+    assert(s_bios(mapping, "ups.realpower.nominal", NutMapping::INVENTORY) == "max_power");
+    assert(s_bios(mapping, "ups.realpower", NutMapping::INVENTORY).empty());
+    assert(s_bios(mapping, "ups.model", NutMapping::PHYSICS).empty());
+    {
+        const NutMapping::Entry *nominal = mapping.match("ups.realpower.nominal", number);
+        assert(nominal->target(NutMapping::PHYSICS)->kind == NutMapping::PHYSICS);
+        assert(nominal->target(NutMapping::INVENTORY)->kind == NutMapping::INVENTORY);
+        assert(!nominal->target(NutMapping::PHYSICS)->shared);
+        assert(!nominal->target(NutMapping::INVENTORY)->shared);
+    }
+
+    // Compiling again replaces the mapping
+    mapping.compile({ { "ups.load", "load.default" } }, {});
+    assert(mapping.size() == 1);
+    assert(!mapping.match("outlet.1.realpower", number));
+    mapping.clear();
+    assert(mapping.size() == 0);
+
+    // Only the BIOS names of the entries that differ between two versions
+    // are collected
+    {
+        std::map<std::string, std::string> before = {
+            { "input.realpower", "realpower.default" },
+            { "ups.load", "load.default" },
+            { "ups.temperature", "temperature.default" },
+            { "outlet.#.realpower", "realpower.outlet.#" },
+            { "outlet.#.current", "current.outlet.#" },
+        };
+        std::map<std::string, std::string> after = before;
+        std::set<std::string> bios;
+        NutMapping::changes(before, after, bios);
+        assert(bios.empty());
+        after.erase("ups.temperature");
+        after["ups.realpower"] = "realpower.default";
+        after["outlet.#.current"] = "current.output.#.L1";
+        NutMapping::changes(before, after, bios);
+        assert(bios == std::set<std::string>({ "temperature.default", "realpower.default",
+                "current.outlet.#", "current.output.#.L1" }));
+        assert(NutMapping::covers(bios, "realpower.default"));
+        assert(!NutMapping::covers(bios, "load.default"));
+        assert(NutMapping::covers(bios, "current.outlet.12"));
+        assert(NutMapping::covers(bios, "current.output.3.L1"));
+        assert(!NutMapping::covers(bios, "current.output.3.L2"));
+        assert(!NutMapping::covers(bios, "current.outlet."));
+        assert(!NutMapping::covers(bios, "current.outlet.1x"));
+        assert(!NutMapping::covers(bios, "realpower.outlet.1"));
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,129 @@
+/*  =========================================================================
+    nut_mapping - Mapping of NUT variable names to BIOS names, compiled for lookups
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef NUT_MAPPING_H_INCLUDED
+#define NUT_MAPPING_H_INCLUDED
+
+/*
+ * mapping.conf maps NUT variable names to BIOS names, in a physicsMapping
+ * and an inventoryMapping section. Entries with a numbered segment such as
+ * "outlet.#.realpower" : "realpower.outlet.#" cover every outlet. Instead
+ * of probing the variables of a device for every entry, NutMapping
+ * compiles both sections into hash tables keyed by NUT name, so that each
+ * variable received is routed to its BIOS name with one or two lookups:
+ *
+ * NutMapping mapping;
+ * mapping.compile(physicsMapping, inventoryMapping);
+ * std::string number;
+ * const NutMapping::Entry *entry = mapping.match("outlet.3.realpower", number);
+ * if (entry && entry->target(NutMapping::PHYSICS)) {
+ *     std::string bios;
+ *     entry->target(NutMapping::PHYSICS)->biosName(number, bios);    // "realpower.outlet.3"
+ * }
+ *
+ * A NUT name may be mapped in both sections (ups.realpower.nominal is both
+ * the physical realpower.nominal and the inventory max_power), its entry
+ * then has a target in each.
+ *
+ * Several entries may feed the same BIOS name (ups.realpower and
+ * input.realpower both go to realpower.default). Such targets are marked
+ * shared; the value to keep is that of the entry with the highest rank,
+ * the last one in the order of the NUT names.
+ */
+
+#include "metric_store.h"
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+class NutMapping {
+public:
+    enum Kind {
+        PHYSICS,
+        INVENTORY
+    };
+
+    struct Target {
+        Kind kind;
+        // BIOS name, for numbered entries the part before the number
+        std::string bios;
+        // Part of the BIOS name after the number
+        std::string suffix;
+        bool numbered;
+        // Interned BIOS name, NONE for numbered entries
+        MetricNames::Id id;
+        // Position of the entry within its section
+        size_t rank;
+        // Set if other entries of the section feed the same BIOS name
+        bool shared;
+        // Builds the BIOS name, with the number captured by match()
+        void biosName(const std::string& number, std::string& name) const;
+        // Returns the ID of the BIOS name, interning it for numbered
+        // entries
+        MetricNames::Id biosId(const std::string& number, std::string& name) const;
+    };
+
+    // Targets of a NUT name, at most one per section
+    struct Entry {
+        Target targets[2];
+        bool mapped[2] = { false, false };
+        const Target* target(Kind kind) const
+        {
+            return mapped[kind] ? &targets[kind] : nullptr;
+        }
+    };
+
+    // Replaces the compiled mapping
+    void compile(const std::map<std::string, std::string>& physics,
+            const std::map<std::string, std::string>& inventory);
+    void clear();
+    // Number of targets compiled, over both sections
+    size_t size() const
+    {
+        return size_;
+    }
+    // Returns the entry for a NUT variable name, nullptr if there is none.
+    // For a numbered entry, number receives the number of the variable
+    const Entry* match(const std::string& name, std::string& number) const;
+    // Collects the BIOS names of the entries added, removed or changed
+    // between two versions of a section, with '#' standing for the number
+    // of numbered entries
+    static void changes(const std::map<std::string, std::string>& before,
+            const std::map<std::string, std::string>& after, std::set<std::string>& bios);
+    // Returns true if a BIOS name is one of those collected by changes()
+    static bool covers(const std::set<std::string>& bios, const std::string& name);
+private:
+    void add(Kind kind, const std::map<std::string, std::string>& mapping);
+    std::unordered_map<std::string, Entry> exact_;
+    // Keyed by the NUT name with the number replaced by '#'
+    std::unordered_map<std::string, Entry> numbered_;
+    size_t size_ = 0;
+    // Reused to build the keys of numbered_
+    mutable std::string key_;
+};
+
+//  Self test of this class
+void nut_mapping_test (bool verbose);
+
+#endif
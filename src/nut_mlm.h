@@ -35,7 +35,29 @@
 #define ACTOR_CONFIGURATOR_MB_NAME ACTOR_CONFIGURATOR_NAME "-mb"
 
 #define CONFIG_POLLING "nut/polling_interval"
+#define CONFIG_WORKERS "nut/workers"
+#define CONFIG_POLLING_MIN "nut/polling_min_interval"
+#define CONFIG_POLLING_MAX "nut/polling_max_interval"
+#define CONFIG_POLLING_BUDGET "nut/polling_budget"
+#define CONFIG_METRICS_HEARTBEAT "nut/metrics_heartbeat"
+#define CONFIG_METRICS_BATCH "nut/metrics_batch"
+#define CONFIG_METRICS_FANOUT "nut/metrics_fanout"
+#define CONFIG_PUBLISH_QUEUE "nut/publish_queue"
+#define CONFIG_PUBLISH_OVERFLOW "nut/publish_overflow"
 #define ACTION_POLLING "POLLING"
 #define ACTION_CONFIGURE "CONFIGURE"
+#define ACTION_WORKERS "WORKERS"
+#define ACTION_POLLING_BOUNDS "POLLING_BOUNDS"
+#define ACTION_POLLING_BUDGET "POLLING_BUDGET"
+#define ACTION_HEARTBEAT "HEARTBEAT"
+#define ACTION_BATCH "BATCH"
+#define ACTION_PUBLISH_QUEUE "PUBLISH_QUEUE"
+
+// Returns true if a message can be received from the client without blocking
+inline bool
+client_has_pending (mlm_client_t *client)
+{
+    return (zsock_events (mlm_client_msgpipe (client)) & ZMQ_POLLIN) != 0;
+}
 
 #endif
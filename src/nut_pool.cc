@@ -0,0 +1,318 @@
+/*  =========================================================================
+    nut_pool - Worker threads reading NUT devices on parallel connections
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    nut_pool - Worker threads reading NUT devices on parallel connections
+@discuss
+@end
+*/
+
+#include "nut_pool.h"
+#include "fake_upsd.h"
+#include <czmq.h>
+#include <fty_log.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <poll.h>
+#include <stdexcept>
+#include <unistd.h>
+
+// How often a worker waiting for replies checks whether its request has
+// been abandoned
+#define NUT_POOL_WAIT_MS 100
+
+NutPool::NutPool(size_t workers, const std::string& host, int port)
+    : generation_(0)
+    , stop_(false)
+    , pending_(0)
+{
+    if (pipe2(notify_fd_, O_NONBLOCK | O_CLOEXEC) < 0)
+        throw std::runtime_error(std::string("NUT pool: ") + strerror(errno));
+    workers = std::min<size_t>(std::max<size_t>(workers, 1), NUT_POOL_MAX_WORKERS);
+    for (size_t i = 0; i < workers; i++)
+        workers_.emplace_back(new Worker(host, port));
+    for (auto& worker : workers_)
+        worker->thread = std::thread(&NutPool::run, this, std::ref(*worker));
+}
+
+NutPool::~NutPool()
+{
+    stop_ = true;
+    for (auto& worker : workers_) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->wakeup.notify_one();
+        }
+        worker->thread.join();
+    }
+    close(notify_fd_[0]);
+    close(notify_fd_[1]);
+}
+
+void NutPool::request(const std::vector<std::string>& devices)
+{
+    uint64_t generation = ++generation_;
+    std::vector<std::vector<std::string>> shards(workers_.size());
+    std::hash<std::string> hash;
+    for (const auto& device : devices)
+        shards[hash(device) % shards.size()].push_back(device);
+    for (size_t i = 0; i < workers_.size(); i++) {
+        Worker& worker = *workers_[i];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.devices.swap(shards[i]);
+        worker.generation = generation;
+        worker.wakeup.notify_one();
+    }
+    pending_ = devices.size();
+}
+
+void NutPool::receive(std::vector<NutConnection::Reply>& replies)
+{
+    char buffer[256];
+    while (::read(notify_fd_[0], buffer, sizeof(buffer)) > 0)
+        ;
+    uint64_t generation = generation_;
+    Result result;
+    for (auto& worker : workers_) {
+        while (worker->results.pop(result)) {
+            // Left over from an abandoned request
+            if (result.generation != generation)
+                continue;
+            replies.push_back(std::move(result.reply));
+            if (pending_)
+                pending_--;
+        }
+    }
+}
+
+bool NutPool::current(uint64_t generation) const
+{
+    return !stop_ && generation_ == generation;
+}
+
+void NutPool::run(Worker& worker)
+{
+    uint64_t handled = 0;
+    for (;;) {
+        std::vector<std::string> devices;
+        uint64_t generation;
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.wakeup.wait(lock, [&]() { return stop_ || worker.generation != handled; });
+            if (stop_)
+                return;
+            devices.swap(worker.devices);
+            generation = handled = worker.generation;
+        }
+        read(worker, devices, generation);
+    }
+}
+
+void NutPool::read(Worker& worker, const std::vector<std::string>& devices, uint64_t generation)
+{
+    if (devices.empty())
+        return;
+    NutConnection& connection = worker.connection;
+    std::vector<NutConnection::Reply> replies;
+    // upsd answers in the order of the requests
+    size_t answered = 0;
+    if (connection.connect()) {
+        for (const auto& device : devices)
+            connection.request(device);
+        int64_t deadline = zclock_mono() + NUT_CONNECTION_TIMEOUT_MS;
+        while (answered < devices.size() && connection.connected()) {
+            if (!current(generation)) {
+                // The replies in flight would be taken for those of the
+                // next request
+                connection.disconnect();
+                return;
+            }
+            if (!connection.wait(NUT_POOL_WAIT_MS)) {
+                if (zclock_mono() > deadline) {
+                    log_error("Timeout while reading %zu NUT devices", devices.size() - answered);
+                    connection.disconnect();
+                }
+                continue;
+            }
+            bool connected = connection.receive(replies);
+            if (!replies.empty())
+                deadline = zclock_mono() + NUT_CONNECTION_TIMEOUT_MS;
+            answered += replies.size();
+            publish(worker, replies, generation);
+            if (!connected)
+                break;
+        }
+    }
+    for (size_t i = answered; i < devices.size(); i++) {
+        NutConnection::Reply reply;
+        reply.device = devices[i];
+        reply.error = NUT_POOL_CONNECTION_LOST;
+        replies.push_back(std::move(reply));
+    }
+    publish(worker, replies, generation);
+}
+
+void NutPool::publish(Worker& worker, std::vector<NutConnection::Reply>& replies, uint64_t generation)
+{
+    if (replies.empty())
+        return;
+    for (auto& reply : replies)
+        worker.results.push(Result { generation, std::move(reply) });
+    replies.clear();
+    // A full pipe is readable anyway
+    char c = 0;
+    (void) !write(notify_fd_[1], &c, 1);
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+// Collects replies until all devices are answered
+static bool
+s_receive_all(NutPool& pool, std::vector<NutConnection::Reply>& replies)
+{
+    while (pool.pending()) {
+        struct pollfd item = { pool.socket(), POLLIN, 0 };
+        if (::poll(&item, 1, 5000) != 1)
+            return false;
+        pool.receive(replies);
+    }
+    return true;
+}
+
+static std::vector<std::string>
+s_devices(size_t count)
+{
+    std::vector<std::string> devices;
+    for (size_t i = 0; i < count; i++)
+        devices.push_back("ups-" + std::to_string(i));
+    return devices;
+}
+
+void
+nut_pool_test (bool verbose)
+{
+    printf (" * nut_pool: ");
+
+    //  @selftest
+    {
+        FakeUpsd upsd;
+        const size_t count = 100;
+        std::vector<std::string> devices = s_devices(count);
+        for (const auto& device : devices)
+            upsd.setDevice(device, { { "ups.status", { "OL" } }, { "device.name", { device } } });
+        devices.push_back("missing");
+
+        NutPool pool(4, "127.0.0.1", upsd.port());
+        assert(pool.size() == 4);
+        assert(pool.socket() >= 0);
+        assert(pool.pending() == 0);
+        pool.request(devices);
+        assert(pool.pending() == count + 1);
+        std::vector<NutConnection::Reply> replies;
+        assert(s_receive_all(pool, replies));
+        assert(replies.size() == count + 1);
+        std::map<std::string, NutConnection::Reply> by_device;
+        for (auto& reply : replies)
+            by_device[reply.device] = reply;
+        assert(by_device.size() == count + 1);
+        for (size_t i = 0; i < count; i++) {
+            const NutConnection::Reply& reply = by_device.at(devices[i]);
+            assert(reply.error.empty());
+            assert(reply.variables.at("device.name")[0] == devices[i]);
+        }
+        assert(by_device.at("missing").error == "UNKNOWN-UPS");
+        assert(upsd.connections() == 4);
+
+        // A worker abandoning a request closes its connection, so that the
+        // replies still in flight are not taken for those of the next
+        // request, and connects again for it
+        upsd.setLatency(5);
+        pool.request(devices);
+        zclock_sleep(20);
+        pool.request({ "ups-1", "ups-2" });
+        replies.clear();
+        assert(s_receive_all(pool, replies));
+        assert(replies.size() == 2);
+        assert(replies[0].device != replies[1].device);
+        for (const auto& reply : replies)
+            assert(reply.device == "ups-1" || reply.device == "ups-2");
+        assert(upsd.connections() > 4);
+        upsd.setLatency(0);
+
+        // Requests interrupted by a lost connection are answered with an
+        // error
+        upsd.setSilent(true);
+        pool.request(s_devices(10));
+        zclock_sleep(100);
+        upsd.dropConnections();
+        replies.clear();
+        assert(s_receive_all(pool, replies));
+        assert(replies.size() == 10);
+        for (const auto& reply : replies)
+            assert(reply.error == NUT_POOL_CONNECTION_LOST);
+        upsd.setSilent(false);
+        pool.request({ "ups-3" });
+        replies.clear();
+        assert(s_receive_all(pool, replies));
+        assert(replies.size() == 1 && replies[0].error.empty());
+    }
+    {
+        // upsd cannot be reached
+        NutPool pool(2, "127.0.0.1", 1);
+        pool.request(s_devices(3));
+        std::vector<NutConnection::Reply> replies;
+        assert(s_receive_all(pool, replies));
+        assert(replies.size() == 3);
+        for (const auto& reply : replies)
+            assert(reply.error == NUT_POOL_CONNECTION_LOST);
+    }
+    if (verbose) {
+        // Scaling with the number of workers, when each request takes a
+        // while on the upsd side
+        FakeUpsd upsd;
+        const size_t count = 400;
+        std::vector<std::string> devices = s_devices(count);
+        for (const auto& device : devices)
+            upsd.setDevice(device, { { "ups.status", { "OL" } } });
+        upsd.setLatency(1);
+        for (size_t workers : { 1, 2, 4, 8 }) {
+            NutPool pool(workers, "127.0.0.1", upsd.port());
+            std::vector<NutConnection::Reply> replies;
+            int64_t start = zclock_mono();
+            pool.request(devices);
+            assert(s_receive_all(pool, replies));
+            assert(replies.size() == count);
+            printf("\n   %zu devices, 1 ms per request, %zu workers: %" PRIi64 " ms",
+                    count, workers, zclock_mono() - start);
+        }
+        printf("\n   ");
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,122 @@
+/*  =========================================================================
+    nut_pool - Worker threads reading NUT devices on parallel connections
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef NUT_POOL_H_INCLUDED
+#define NUT_POOL_H_INCLUDED
+
+/*
+ * upsd serves the requests of one connection one after another. NutPool
+ * shards the NUT devices over a number of worker threads, each with a
+ * NutConnection of its own. A device always goes to the same worker. The
+ * workers pass their replies to the owner's thread through one SpscQueue
+ * each, and signal them on a pipe that the owner watches in its zpoller:
+ *
+ * NutPool pool(4);
+ * pool.request({ "ups-1", "ups-2", "epdu-1" });
+ * ...
+ * // when pool.socket() is readable
+ * std::vector<NutConnection::Reply> replies;
+ * pool.receive(replies);
+ * if (!pool.pending()) {
+ *     // all devices answered
+ * }
+ *
+ * Every requested device gets exactly one reply. If its worker cannot
+ * reach upsd or loses the connection, the reply has the error
+ * NUT_POOL_CONNECTION_LOST.
+ */
+
+#include "nut_connection.h"
+#include "spsc_queue.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NUT_POOL_CONNECTION_LOST "CONNECTION-LOST"
+// Largest number of workers accepted
+#define NUT_POOL_MAX_WORKERS     64
+
+class NutPool {
+public:
+    explicit NutPool(size_t workers, const std::string& host = "localhost", int port = 3493);
+    NutPool(const NutPool&) = delete;
+    NutPool& operator=(const NutPool&) = delete;
+    ~NutPool();
+    size_t size() const
+    {
+        return workers_.size();
+    }
+    // Distributes the devices over the workers. The replies to a previous
+    // request still in progress are dropped
+    void request(const std::vector<std::string>& devices);
+    // Becomes readable when replies are available
+    int socket() const
+    {
+        return notify_fd_[0];
+    }
+    // Appends the available replies without blocking
+    void receive(std::vector<NutConnection::Reply>& replies);
+    // Number of requested devices not answered yet
+    size_t pending() const
+    {
+        return pending_;
+    }
+private:
+    struct Result {
+        uint64_t generation;
+        NutConnection::Reply reply;
+    };
+    struct Worker {
+        Worker(const std::string& host, int port)
+            : connection(host, port)
+        {
+        }
+        // Used by the worker thread only
+        NutConnection connection;
+        std::thread thread;
+        // Job handed over by the owner
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::vector<std::string> devices;
+        uint64_t generation = 0;
+        // Replies passed back to the owner
+        SpscQueue<Result> results;
+    };
+    void run(Worker& worker);
+    void read(Worker& worker, const std::vector<std::string>& devices, uint64_t generation);
+    void publish(Worker& worker, std::vector<NutConnection::Reply>& replies, uint64_t generation);
+    bool current(uint64_t generation) const;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    int notify_fd_[2];
+    // Generation of the last request, bumped to abandon the previous one
+    std::atomic<uint64_t> generation_;
+    std::atomic<bool> stop_;
+    size_t pending_;
+};
+
+//  Self test of this class
+void nut_pool_test (bool verbose);
+
+#endif
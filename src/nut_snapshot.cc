@@ -0,0 +1,328 @@
+/*  =========================================================================
+    nut_snapshot - Variables of all NUT devices read in one poll cycle
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    nut_snapshot - Variables of all NUT devices read in one poll cycle
+@discuss
+@end
+*/
+
+#include "nut_snapshot.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+
+NutSnapshot::NutSnapshot()
+{
+}
+
+NutSnapshot::NutSnapshot(const std::shared_ptr<const NutSnapshot>& previous)
+{
+    if (previous)
+        devices_ = previous->devices_;
+}
+
+void NutSnapshot::add(const std::string& device, Variables vars)
+{
+    devices_.insert_or_assign(device, std::make_shared<const Variables>(std::move(vars)));
+}
+
+void NutSnapshot::remove(const std::string& device)
+{
+    devices_.erase(device);
+}
+
+const NutSnapshot::Variables* NutSnapshot::find(const std::string& device) const
+{
+    auto i = devices_.find(device);
+    if (i == devices_.end())
+        return nullptr;
+    return i->second.get();
+}
+
+double NutSnapshot::toNumber(const std::string& text)
+{
+    // NUT formats the numbers in the C locale, as strtod() reads them here
+    char *end;
+    double number = strtod(text.c_str(), &end);
+    if (end == text.c_str() || *end || !std::isfinite(number))
+        return NAN;
+    return number;
+}
+
+const std::string* NutSnapshot::value(const std::string& device,
+        const std::string& name) const
+{
+    const Variables *vars = find(device);
+    if (!vars)
+        return nullptr;
+    auto i = vars->find(name);
+    if (i == vars->end() || i->second.empty())
+        return nullptr;
+    return &i->second[0];
+}
+
+NutMemberView::NutMemberView(const NutSnapshot::Variables& vars, int index)
+    : vars_(vars)
+{
+    if (index)
+        prefix_ = "device." + std::to_string(index) + ".";
+    key_ = prefix_;
+}
+
+const std::vector<std::string>* NutMemberView::overridden(const char *name) const
+{
+    for (const auto& i : overrides_) {
+        if (i.name == name)
+            return &i.get();
+    }
+    return nullptr;
+}
+
+const std::vector<std::string>* NutMemberView::find(const char *name) const
+{
+    if (!overrides_.empty()) {
+        const std::vector<std::string> *values = overridden(name);
+        if (values)
+            return values;
+    }
+    key_.resize(prefix_.size());
+    key_ += name;
+    auto i = vars_.find(key_);
+    if (i == vars_.end())
+        return nullptr;
+    return &i->second;
+}
+
+const std::string* NutMemberView::value(const char *name) const
+{
+    const std::vector<std::string> *values = find(name);
+    if (!values || values->empty())
+        return nullptr;
+    return &(*values)[0];
+}
+
+double NutMemberView::number(const char *name) const
+{
+    const std::string *text = value(name);
+    return text ? NutSnapshot::toNumber(*text) : NAN;
+}
+
+NutMemberView::Override& NutMemberView::add(const char *name)
+{
+    for (auto& i : overrides_) {
+        if (i.name == name)
+            return i;
+    }
+    // A few are set on most devices
+    if (overrides_.empty())
+        overrides_.reserve(8);
+    overrides_.emplace_back();
+    overrides_.back().name = name;
+    return overrides_.back();
+}
+
+void NutMemberView::set(const std::string& name, std::vector<std::string> values)
+{
+    Override& entry = add(name.c_str());
+    entry.values = std::move(values);
+    entry.borrowed = nullptr;
+}
+
+bool NutMemberView::copy(const char *name, const char *source)
+{
+    const std::vector<std::string> *borrowed = nullptr;
+    for (const auto& i : overrides_) {
+        if (i.name == source) {
+            if (!i.borrowed) {
+                // the values of another entry move with the entries
+                std::vector<std::string> values = i.values;
+                set(name, std::move(values));
+                return true;
+            }
+            borrowed = i.borrowed;
+            break;
+        }
+    }
+    if (!borrowed) {
+        key_.resize(prefix_.size());
+        key_ += source;
+        auto i = vars_.find(key_);
+        if (i == vars_.end())
+            return false;
+        borrowed = &i->second;
+    }
+    Override& entry = add(name);
+    entry.values.clear();
+    entry.borrowed = borrowed;
+    return true;
+}
+
+bool NutMemberView::empty() const
+{
+    if (!overrides_.empty())
+        return false;
+    // The variables of the member are sorted right after the prefix
+    auto i = vars_.lower_bound(prefix_);
+    return i == vars_.end() || i->first.compare(0, prefix_.size(), prefix_) != 0;
+}
+
+void NutSnapshotStore::publish(std::shared_ptr<const NutSnapshot> snapshot)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshot_.swap(snapshot);
+    // The previous snapshot is released outside of the lock, unless a
+    // consumer still holds it
+}
+
+std::shared_ptr<const NutSnapshot> NutSnapshotStore::get() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return snapshot_;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+nut_snapshot_test (bool verbose)
+{
+    printf (" * nut_snapshot: ");
+
+    //  @selftest
+    NutSnapshotStore store;
+    assert(!store.get());
+
+    std::shared_ptr<NutSnapshot> snapshot = std::make_shared<NutSnapshot>();
+    snapshot->add("ups", {
+            { "ups.status", { "OL" } },
+            { "device.1.ambient.temperature", { "25.0" } },
+            { "empty", { } } });
+    assert(snapshot->size() == 1);
+    assert(snapshot->find("ups")->size() == 3);
+    assert(snapshot->find("epdu") == nullptr);
+    assert(*snapshot->value("ups", "ups.status") == "OL");
+    assert(*snapshot->value("ups", "device.1.ambient.temperature") == "25.0");
+    assert(snapshot->value("ups", "empty") == nullptr);
+    assert(snapshot->value("ups", "missing") == nullptr);
+    assert(snapshot->value("epdu", "ups.status") == nullptr);
+    store.publish(snapshot);
+
+    // Consumers keep their snapshot even if a new one is published
+    std::shared_ptr<const NutSnapshot> old = store.get();
+    assert(old == snapshot);
+    snapshot = std::make_shared<NutSnapshot>();
+    snapshot->add("epdu", { { "ups.status", { "OB" } } });
+    store.publish(snapshot);
+    assert(store.get() == snapshot);
+    assert(*old->value("ups", "ups.status") == "OL");
+    assert(old->find("epdu") == nullptr);
+    assert(*store.get()->value("epdu", "ups.status") == "OB");
+
+    // A snapshot derived from the previous one shares its devices, the
+    // previous one is not modified
+    std::shared_ptr<NutSnapshot> next = std::make_shared<NutSnapshot>(store.get());
+    next->add("ups", { { "ups.status", { "OB" } } });
+    next->remove("epdu");
+    assert(next->size() == 1);
+    assert(*next->value("ups", "ups.status") == "OB");
+    assert(next->find("epdu") == nullptr);
+    assert(*store.get()->value("epdu", "ups.status") == "OB");
+    assert(store.get()->find("ups") == nullptr);
+    next = std::make_shared<NutSnapshot>(nullptr);
+    assert(next->size() == 0);
+
+    assert(NutSnapshot::toNumber("230.5") == 230.5);
+    assert(NutSnapshot::toNumber("-1e3") == -1000);
+    assert(std::isnan(NutSnapshot::toNumber("")));
+    assert(std::isnan(NutSnapshot::toNumber("12 V")));
+    assert(std::isnan(NutSnapshot::toNumber("OL CHRG")));
+    assert(std::isnan(NutSnapshot::toNumber("nan")));
+    assert(std::isnan(NutSnapshot::toNumber("inf")));
+
+    // Members of a daisy chain see their own variables without the prefix
+    {
+        NutSnapshot::Variables vars = {
+            { "device.count", { "2" } },
+            { "device.1.ups.status", { "OL" } },
+            { "device.2.outlet.count", { "8" } },
+            { "device.2.empty", { } } };
+        NutMemberView master(vars, 0);
+        NutMemberView first(vars, 1);
+        NutMemberView second(vars, 2);
+        NutMemberView third(vars, 3);
+        assert(master.prefix().empty());
+        assert(first.prefix() == "device.1.");
+        assert(*master.value("device.count") == "2");
+        assert(master.value("ups.status") == nullptr);
+        assert(*first.value("ups.status") == "OL");
+        assert(first.value("outlet.count") == nullptr);
+        assert(*second.value("outlet.count") == "8");
+        assert(second.contains("empty"));
+        assert(second.value("empty") == nullptr);
+        assert(second.number("outlet.count") == 8);
+        assert(std::isnan(second.number("empty")));
+        assert(std::isnan(first.number("ups.status")));
+        assert(std::isnan(first.number("missing")));
+        // No copy of the values
+        assert(first.find("ups.status") == &vars.at("device.1.ups.status"));
+        assert(!master.empty() && !first.empty() && !second.empty());
+        assert(third.empty());
+
+        // Values set on a view hide those of the master and are not seen
+        // by the other views
+        first.set("ups.status", { "OB" });
+        first.set("ups.load", { "10" });
+        assert(*first.value("ups.status") == "OB");
+        assert(*first.value("ups.load") == "10");
+        assert(vars.at("device.1.ups.status")[0] == "OL");
+        assert(vars.count("device.1.ups.load") == 0);
+        assert(second.value("ups.load") == nullptr);
+        third.set("ups.load", { "0" });
+        assert(!third.empty());
+
+        // Iteration sees the variables of the member only, with the values
+        // set on the view
+        std::map<std::string, std::string> seen;
+        first.forEach([&seen](const std::string& name, const std::vector<std::string>& values) {
+            seen[name] = values.empty() ? "" : values[0];
+        });
+        assert(seen.size() == 2);
+        assert(seen["ups.status"] == "OB");
+        assert(seen["ups.load"] == "10");
+        seen.clear();
+        second.forEach([&seen](const std::string& name, const std::vector<std::string>& values) {
+            seen[name] = values.empty() ? "" : values[0];
+        });
+        assert(seen.size() == 2);
+        assert(seen["outlet.count"] == "8");
+        seen.clear();
+        master.forEach([&seen](const std::string& name, const std::vector<std::string>&) {
+            seen[name];
+        });
+        assert(seen.size() == vars.size());
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,207 @@
+/*  =========================================================================
+    nut_snapshot - Variables of all NUT devices read in one poll cycle
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef NUT_SNAPSHOT_H_INCLUDED
+#define NUT_SNAPSHOT_H_INCLUDED
+
+/*
+ * The NUT actor (NUTDeviceList) is the only one reading device variables
+ * from upsd, with one LIST VAR request per NUT device and poll. The result
+ * is published as an immutable NutSnapshot in a NutSnapshotStore, from
+ * which the alert and sensor actors take the latest snapshot instead of
+ * querying upsd themselves. The devices are polled in slots spread over
+ * the polling interval, so each snapshot is derived from the previous one
+ * with the devices just read replaced; the devices are kept in a
+ * PersistentMap, which makes this cheap:
+ *
+ * Acquisition (NUT actor), with the replies of a NutConnection:
+ * auto snapshot = std::make_shared<NutSnapshot>(NutSnapshots.get());
+ * connection.request("ups");
+ * connection.request("epdu");
+ * ...
+ * std::vector<NutConnection::Reply> replies;
+ * connection.receive(replies);
+ * for (auto& reply : replies) {
+ *     if (reply.error.empty())
+ *         snapshot->add(reply.device, std::move(reply.variables));
+ *     else
+ *         snapshot->remove(reply.device);
+ * }
+ * ...
+ * NutSnapshots.publish(snapshot);
+ *
+ * Consumers (other actors):
+ * std::shared_ptr<const NutSnapshot> snapshot = NutSnapshots.get();
+ * if (snapshot) {
+ *     const std::string *status = snapshot->value("ups", "ups.status");
+ *     ...
+ * }
+ *
+ * The members of a daisy chain share the NUT device of the chain master,
+ * which is read once for all of them; member N finds its variables under
+ * the "device.N." prefix. NutMemberView gives one member access to them
+ * without copying the variables of the master.
+ */
+
+#include "persistent_map.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class NutSnapshot {
+public:
+    typedef std::map<std::string, std::vector<std::string> > Variables;
+
+    NutSnapshot();
+    // Starts with the devices of a previous snapshot, which may be null
+    explicit NutSnapshot(const std::shared_ptr<const NutSnapshot>& previous);
+    // Stores the variables of a NUT device. Only to be called before the
+    // snapshot is published
+    void add(const std::string& device, Variables vars);
+    // Drops a NUT device that could not be read. Only to be called before
+    // the snapshot is published
+    void remove(const std::string& device);
+    // Returns the variables of a NUT device, or nullptr if the device was
+    // not read successfully in its last poll
+    const Variables* find(const std::string& device) const;
+    // Returns the first value of a variable, or nullptr if the device or
+    // the variable is not present
+    const std::string* value(const std::string& device, const std::string& name) const;
+    // Parses a value as a number, NAN if it is not a (finite) number
+    static double toNumber(const std::string& text);
+    size_t size() const
+    {
+        return devices_.size();
+    }
+private:
+    PersistentMap<std::string, std::shared_ptr<const Variables> > devices_;
+};
+
+class NutMemberView {
+public:
+    // Variables of the daisy chain member with the given index within the
+    // variables of its master, all of them for index 0. The variables must
+    // outlive the view
+    NutMemberView(const NutSnapshot::Variables& vars, int index);
+    // Returns the values of a variable, the name without the prefix of the
+    // member, or nullptr if it is not present. The lookups do not allocate
+    const std::vector<std::string>* find(const char *name) const;
+    const std::vector<std::string>* find(const std::string& name) const
+    {
+        return find(name.c_str());
+    }
+    bool contains(const char *name) const
+    {
+        return find(name) != nullptr;
+    }
+    bool contains(const std::string& name) const
+    {
+        return find(name.c_str()) != nullptr;
+    }
+    // Returns the first value of a variable, or nullptr if it is not
+    // present or has no value
+    const std::string* value(const char *name) const;
+    const std::string* value(const std::string& name) const
+    {
+        return value(name.c_str());
+    }
+    // Returns the first value of a variable as a number, NAN if it is not
+    // present or not a number
+    double number(const char *name) const;
+    double number(const std::string& name) const
+    {
+        return number(name.c_str());
+    }
+    // Sets a variable for this view only, the variables of the master are
+    // not modified
+    void set(const std::string& name, std::vector<std::string> values);
+    // Sets a variable to the values of another one, without copying those
+    // of the master. Returns false if the source is not present
+    bool copy(const char *name, const char *source);
+    // True if the master has no variables for this member
+    bool empty() const;
+    // Calls f(name, values) for every variable of the member, the name
+    // without the prefix. Those set on the view come last, in the order
+    // they were set
+    template <typename F>
+    void forEach(F f) const
+    {
+        std::string name;
+        for (auto i = vars_.lower_bound(prefix_); i != vars_.end(); ++i) {
+            if (i->first.compare(0, prefix_.size(), prefix_) != 0)
+                break;
+            name.assign(i->first, prefix_.size(), std::string::npos);
+            if (!overrides_.empty() && overridden(name.c_str()))
+                continue;
+            f(name, i->second);
+        }
+        for (const auto& i : overrides_)
+            f(i.name, i.get());
+    }
+    const std::string& prefix() const
+    {
+        return prefix_;
+    }
+private:
+    struct Override {
+        std::string name;
+        std::vector<std::string> values;
+        // Values of a variable of the master, instead of values
+        const std::vector<std::string> *borrowed = nullptr;
+        const std::vector<std::string>& get() const
+        {
+            return borrowed ? *borrowed : values;
+        }
+    };
+    typedef std::vector<Override> Overrides;
+    Override& add(const char *name);
+    const std::vector<std::string>* overridden(const char *name) const;
+    const NutSnapshot::Variables& vars_;
+    std::string prefix_;
+    // Variables set on the view, they hide those of the master. Only a few,
+    // searched in order
+    Overrides overrides_;
+    // Reused to build the prefixed names
+    mutable std::string key_;
+};
+
+class NutSnapshotStore {
+public:
+    void publish(std::shared_ptr<const NutSnapshot> snapshot);
+    // Returns the last published snapshot, or null if none has been
+    // published yet
+    std::shared_ptr<const NutSnapshot> get() const;
+private:
+    mutable std::mutex mutex_;
+    std::shared_ptr<const NutSnapshot> snapshot_;
+};
+
+// fty_nut_server.cc
+extern NutSnapshotStore NutSnapshots;
+
+//  Self test of this class
+void nut_snapshot_test (bool verbose);
+
+#endif
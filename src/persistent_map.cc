@@ -0,0 +1,152 @@
+/*  =========================================================================
+    persistent_map - Immutable ordered map with structural sharing
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    persistent_map - Immutable ordered map with structural sharing
+@discuss
+    The implementation is header-only, this file only contains the selftest.
+@end
+*/
+
+#include "persistent_map.h"
+
+#include <cassert>
+#include <cstdio>
+#include <map>
+#include <string>
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+persistent_map_test (bool verbose)
+{
+    printf (" * persistent_map: ");
+
+    //  @selftest
+    typedef PersistentMap<std::string, int> Map;
+    {
+        // Empty map
+        Map m;
+        assert(m.empty());
+        assert(m.size() == 0);
+        assert(m.begin() == m.end());
+        assert(m.find("a") == m.end());
+        assert(m.count("a") == 0);
+        assert(m.erase("a") == 0);
+    }
+    {
+        // Insert, replace, lookup and erase, compared against std::map
+        Map m;
+        std::map<std::string, int> ref;
+        for (int i = 0; i < 1000; i++) {
+            std::string key = "asset-" + std::to_string((i * 7919) % 1000);
+            assert(m.insert_or_assign(key, i) == (ref.count(key) == 0));
+            ref[key] = i;
+        }
+        assert(m.insert_or_assign("asset-1", -1) == false);
+        ref["asset-1"] = -1;
+        for (int i = 0; i < 1000; i += 3) {
+            std::string key = "asset-" + std::to_string(i);
+            assert(m.erase(key) == ref.erase(key));
+        }
+        assert(m.size() == ref.size());
+        auto it = m.begin();
+        for (const auto& i : ref) {
+            assert(it != m.end());
+            assert(it->first == i.first);
+            assert(it->second == i.second);
+            assert(m.at(i.first) == i.second);
+            assert(m.find(i.first)->second == i.second);
+            ++it;
+        }
+        assert(it == m.end());
+        assert(m.count("asset-0") == 0);
+        assert(m.find("asset-0") == m.end());
+        bool thrown = false;
+        try {
+            m.at("asset-0");
+        } catch (const std::out_of_range&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    {
+        // Copies are snapshots that share the unmodified nodes
+        Map m1;
+        m1.insert_or_assign("ups-1", 1);
+        m1.insert_or_assign("epdu-2", 2);
+        Map m2(m1);
+        assert(m2.sameAs(m1));
+        m2.insert_or_assign("sts-3", 3);
+        m2.erase("ups-1");
+        m2.insert_or_assign("epdu-2", 20);
+        assert(!m2.sameAs(m1));
+        assert(m1.size() == 2);
+        assert(m1.at("ups-1") == 1);
+        assert(m1.at("epdu-2") == 2);
+        assert(m1.count("sts-3") == 0);
+        assert(m2.size() == 2);
+        assert(m2.count("ups-1") == 0);
+        assert(m2.at("epdu-2") == 20);
+        assert(m2.at("sts-3") == 3);
+        // Erasing a missing key does not copy anything
+        Map m3(m1);
+        assert(m3.erase("nothing") == 0);
+        assert(m3.sameAs(m1));
+    }
+    {
+        // Building from a sorted range, iterating a prefix
+        std::map<std::string, int> ref;
+        for (int i = 0; i < 100; i++)
+            ref["k" + std::to_string(i)] = i;
+        auto end = ref.begin();
+        std::advance(end, 42);
+        Map m(ref.begin(), end);
+        assert(m.size() == 42);
+        auto it = m.begin();
+        for (auto i = ref.begin(); i != end; ++i, ++it)
+            assert(it->first == i->first);
+        assert(it == m.end());
+        assert(m.count(std::prev(end)->first) == 1);
+        assert(m.count(end->first) == 0);
+        // Ordered lookups
+        assert(m.back().first == std::prev(end)->first);
+        assert(m.lower_bound("k1")->first == "k1");
+        assert(m.upper_bound("k1")->first == "k10");
+        assert(m.lower_bound("k10a")->first == "k11");
+        assert(m.upper_bound(m.back().first) == m.end());
+        assert(m.lower_bound("a") == m.begin());
+        it = m.upper_bound("k2");
+        for (auto i = ref.upper_bound("k2"); i != end; ++i, ++it)
+            assert(it->first == i->first);
+        assert(it == m.end());
+        m.insert_or_assign("zzz", 0);
+        assert(m.back().first == "zzz");
+        assert(m.size() == 43);
+        m.clear();
+        assert(m.empty());
+        assert(m.begin() == m.end());
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,377 @@
+/*  =========================================================================
+    persistent_map - Immutable ordered map with structural sharing
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef PERSISTENT_MAP_H_INCLUDED
+#define PERSISTENT_MAP_H_INCLUDED
+
+/*
+ * PersistentMap is an ordered associative container with the read-only part
+ * of the std::map interface. It is implemented as an AVL tree whose nodes are
+ * never modified after creation. Insertions and removals copy only the
+ * O(log N) nodes on the path from the root to the modified key, all other
+ * nodes are shared with the previous version of the map. Copying a map is
+ * therefore O(1) and the copy is unaffected by subsequent modifications of
+ * the original (and vice versa).
+ *
+ * This makes it suitable for the StateManager, which keeps a queue of asset
+ * snapshots: each commit only costs O(log N) time and memory per modified
+ * asset, independently of the number of assets.
+ *
+ * The nodes are reference counted via std::shared_ptr, so a map (or a
+ * snapshot) can be destroyed from any thread, as long as every individual
+ * map instance is only modified by one thread at a time. Iterators are
+ * invalidated when the map instance they were obtained from is modified or
+ * destroyed.
+ */
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+template <typename Key, typename T, typename Compare = std::less<Key> >
+class PersistentMap {
+public:
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef std::pair<const Key, T> value_type;
+    typedef size_t size_type;
+private:
+    struct Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+    struct Node {
+        Node(const value_type& v, const NodePtr& l, const NodePtr& r)
+            : value(v)
+            , left(l)
+            , right(r)
+            , height(1 + std::max(heightOf(l), heightOf(r)))
+        {
+        }
+        value_type value;
+        NodePtr left, right;
+        int height;
+    };
+public:
+    // In-order iterator. It keeps the path from the root to the current
+    // node, since the nodes are shared and cannot point to their parent.
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef const std::pair<const Key, T> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        const_iterator() { }
+        reference operator*() const
+        {
+            return path_.back()->value;
+        }
+        pointer operator->() const
+        {
+            return &path_.back()->value;
+        }
+        const_iterator& operator++()
+        {
+            const Node *n = path_.back();
+            if (n->right) {
+                pushLeftmost(n->right.get());
+                return *this;
+            }
+            // Climb up until we leave a left subtree
+            path_.pop_back();
+            while (!path_.empty() && path_.back()->right.get() == n) {
+                n = path_.back();
+                path_.pop_back();
+            }
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator ret(*this);
+            ++*this;
+            return ret;
+        }
+        bool operator==(const const_iterator& other) const
+        {
+            if (path_.empty() || other.path_.empty())
+                return path_.empty() && other.path_.empty();
+            return path_.back() == other.path_.back();
+        }
+        bool operator!=(const const_iterator& other) const
+        {
+            return !(*this == other);
+        }
+    private:
+        void pushLeftmost(const Node *n)
+        {
+            for (; n; n = n->left.get())
+                path_.push_back(n);
+        }
+        std::vector<const Node*> path_;
+        friend class PersistentMap;
+    };
+    typedef const_iterator iterator;
+
+    PersistentMap()
+        : size_(0)
+    {
+    }
+
+    // Builds the map from a range sorted by key, without duplicates, in O(N)
+    template <typename ForwardIt>
+    PersistentMap(ForwardIt first, ForwardIt last)
+        : size_(std::distance(first, last))
+    {
+        root_ = buildSorted(first, size_);
+    }
+
+    size_type size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    const_iterator begin() const
+    {
+        const_iterator it;
+        it.pushLeftmost(root_.get());
+        return it;
+    }
+    const_iterator end() const
+    {
+        return const_iterator();
+    }
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+    const_iterator cend() const
+    {
+        return end();
+    }
+    const_iterator find(const Key& key) const
+    {
+        const_iterator it;
+        const Node *n = root_.get();
+        while (n) {
+            it.path_.push_back(n);
+            if (Compare()(key, n->value.first))
+                n = n->left.get();
+            else if (Compare()(n->value.first, key))
+                n = n->right.get();
+            else
+                return it;
+        }
+        return end();
+    }
+    // First element whose key is not less than key
+    const_iterator lower_bound(const Key& key) const
+    {
+        return bound(key, false);
+    }
+    // First element whose key is greater than key
+    const_iterator upper_bound(const Key& key) const
+    {
+        return bound(key, true);
+    }
+    // Element with the greatest key, the map must not be empty
+    const value_type& back() const
+    {
+        const Node *n = root_.get();
+        while (n->right)
+            n = n->right.get();
+        return n->value;
+    }
+    size_type count(const Key& key) const
+    {
+        return lookup(key) ? 1 : 0;
+    }
+    const T& at(const Key& key) const
+    {
+        const Node *n = lookup(key);
+        if (!n)
+            throw std::out_of_range("PersistentMap::at");
+        return n->value.second;
+    }
+    // Returns true if the key was inserted, false if an existing value was
+    // replaced
+    bool insert_or_assign(const Key& key, const T& value)
+    {
+        bool added = false;
+        root_ = insert(root_, key, value, added);
+        if (added)
+            ++size_;
+        return added;
+    }
+    size_type erase(const Key& key)
+    {
+        bool removed = false;
+        root_ = erase(root_, key, removed);
+        if (!removed)
+            return 0;
+        --size_;
+        return 1;
+    }
+    void clear()
+    {
+        root_.reset();
+        size_ = 0;
+    }
+    // True if both maps share the same tree, i.e. one is an unmodified copy
+    // of the other
+    bool sameAs(const PersistentMap& other) const
+    {
+        return root_ == other.root_;
+    }
+private:
+    static int heightOf(const NodePtr& n)
+    {
+        return n ? n->height : 0;
+    }
+    static NodePtr makeNode(const value_type& v, const NodePtr& l,
+            const NodePtr& r)
+    {
+        return std::make_shared<const Node>(v, l, r);
+    }
+    // Creates a node from a value and two subtrees whose heights differ by
+    // at most two, restoring the AVL invariant by rotation
+    static NodePtr balance(const value_type& v, const NodePtr& l,
+            const NodePtr& r)
+    {
+        int hl = heightOf(l), hr = heightOf(r);
+        if (hl > hr + 1) {
+            if (heightOf(l->left) >= heightOf(l->right))
+                return makeNode(l->value, l->left, makeNode(v, l->right, r));
+            return makeNode(l->right->value,
+                    makeNode(l->value, l->left, l->right->left),
+                    makeNode(v, l->right->right, r));
+        }
+        if (hr > hl + 1) {
+            if (heightOf(r->right) >= heightOf(r->left))
+                return makeNode(r->value, makeNode(v, l, r->left), r->right);
+            return makeNode(r->left->value,
+                    makeNode(v, l, r->left->left),
+                    makeNode(r->value, r->left->right, r->right));
+        }
+        return makeNode(v, l, r);
+    }
+    static NodePtr insert(const NodePtr& n, const Key& key, const T& value,
+            bool& added)
+    {
+        if (!n) {
+            added = true;
+            return makeNode(value_type(key, value), NodePtr(), NodePtr());
+        }
+        if (Compare()(key, n->value.first))
+            return balance(n->value, insert(n->left, key, value, added), n->right);
+        if (Compare()(n->value.first, key))
+            return balance(n->value, n->left, insert(n->right, key, value, added));
+        return makeNode(value_type(key, value), n->left, n->right);
+    }
+    static NodePtr eraseMin(const NodePtr& n)
+    {
+        if (!n->left)
+            return n->right;
+        return balance(n->value, eraseMin(n->left), n->right);
+    }
+    static NodePtr erase(const NodePtr& n, const Key& key, bool& removed)
+    {
+        if (!n)
+            return n;
+        if (Compare()(key, n->value.first)) {
+            NodePtr l = erase(n->left, key, removed);
+            return removed ? balance(n->value, l, n->right) : n;
+        }
+        if (Compare()(n->value.first, key)) {
+            NodePtr r = erase(n->right, key, removed);
+            return removed ? balance(n->value, n->left, r) : n;
+        }
+        removed = true;
+        if (!n->left)
+            return n->right;
+        if (!n->right)
+            return n->left;
+        const Node *min = n->right.get();
+        while (min->left)
+            min = min->left.get();
+        return balance(min->value, n->left, eraseMin(n->right));
+    }
+    template <typename ForwardIt>
+    static NodePtr buildSorted(ForwardIt& it, size_type n)
+    {
+        if (n == 0)
+            return NodePtr();
+        NodePtr l = buildSorted(it, n / 2);
+        value_type v(*it);
+        ++it;
+        NodePtr r = buildSorted(it, n - n / 2 - 1);
+        return makeNode(v, l, r);
+    }
+    // Descends towards key, keeping the path to the last node where we went
+    // left, which is the leftmost node with a key greater than (or equal to,
+    // unless strict) the searched one
+    const_iterator bound(const Key& key, bool strict) const
+    {
+        const_iterator it;
+        size_t depth = 0;
+        const Node *n = root_.get();
+        while (n) {
+            it.path_.push_back(n);
+            bool left = strict ? Compare()(key, n->value.first)
+                : !Compare()(n->value.first, key);
+            if (left) {
+                depth = it.path_.size();
+                n = n->left.get();
+            } else {
+                n = n->right.get();
+            }
+        }
+        it.path_.resize(depth);
+        return it;
+    }
+    const Node* lookup(const Key& key) const
+    {
+        const Node *n = root_.get();
+        while (n) {
+            if (Compare()(key, n->value.first))
+                n = n->left.get();
+            else if (Compare()(n->value.first, key))
+                n = n->right.get();
+            else
+                return n;
+        }
+        return nullptr;
+    }
+
+    NodePtr root_;
+    size_type size_;
+};
+
+//  Self test of this class
+void persistent_map_test (bool verbose);
+
+#endif
@@ -0,0 +1,426 @@
+/*  =========================================================================
+    poll_scheduler - Spreads the polls of the devices evenly over the polling interval
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    poll_scheduler - Spreads the polls of the devices evenly over the polling interval
+@discuss
+@end
+*/
+
+#include "poll_scheduler.h"
+#include <fty_log.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cmath>
+
+// FNV-1a, stable across builds and platforms unlike std::hash
+static uint64_t
+s_hash(const std::string& name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+PollScheduler::PollScheduler(int64_t interval_ms)
+    : interval_ms_(std::max<int64_t>(interval_ms, 1))
+    , min_ms_(0)
+    , max_ms_(0)
+    , budget_(0)
+    , rate_(0)
+    , reported_(0)
+{
+}
+
+void PollScheduler::setInterval(int64_t interval_ms, int64_t now)
+{
+    interval_ms = std::max<int64_t>(interval_ms, 1);
+    if (interval_ms == interval_ms_)
+        return;
+    interval_ms_ = interval_ms;
+    queue_.clear();
+    for (auto& device : devices_) {
+        device.second.interval_ms = 0;
+        device.second.deadline = slot(device.first, device.second, now);
+        queue_.emplace(device.second.deadline, device.first);
+    }
+    recomputeRate();
+}
+
+void PollScheduler::setBounds(int64_t min_ms, int64_t max_ms)
+{
+    min_ms_ = std::max<int64_t>(min_ms, 0);
+    max_ms_ = std::max<int64_t>(max_ms, 0);
+}
+
+void PollScheduler::setBudget(double polls_per_second)
+{
+    budget_ = std::max(polls_per_second, 0.0);
+}
+
+void PollScheduler::adapt(const std::string& name, Activity activity, int64_t now)
+{
+    auto found = devices_.find(name);
+    if (found == devices_.end())
+        return;
+    Device& device = found->second;
+    int64_t lower = min_ms_ ? std::min(min_ms_, interval_ms_) : interval_ms_;
+    int64_t upper = std::max(max_ms_, interval_ms_);
+    int64_t current = requested(device);
+    int64_t next;
+    switch (activity) {
+    case URGENT:
+        next = lower;
+        break;
+    case MOVING:
+        next = std::min(current, interval_ms_) / 2;
+        break;
+    default:
+        next = current < interval_ms_ ? current * 2 : current + current / 2;
+        if (current < interval_ms_)
+            next = std::min(next, interval_ms_);
+        break;
+    }
+    next = std::min(std::max(next, lower), upper);
+    if (next == current)
+        return;
+    int64_t before = effective(device);
+    rate_ += 1000.0 / next - 1000.0 / current;
+    device.interval_ms = next == interval_ms_ ? 0 : next;
+    int64_t after = effective(device);
+    // A device polled more often does not wait for its old deadline
+    if (after < before) {
+        int64_t deadline = slot(name, device, now);
+        if (deadline < device.deadline) {
+            queue_.erase(std::make_pair(device.deadline, name));
+            schedule(name, device, deadline);
+        }
+    }
+}
+
+int64_t PollScheduler::deviceInterval(const std::string& name) const
+{
+    auto device = devices_.find(name);
+    if (device == devices_.end())
+        return effective(Device());
+    return effective(device->second);
+}
+
+double PollScheduler::stretch() const
+{
+    if (budget_ <= 0 || rate_ <= budget_)
+        return 1.0;
+    return rate_ / budget_;
+}
+
+int64_t PollScheduler::requested(const Device& device) const
+{
+    return device.interval_ms ? device.interval_ms : interval_ms_;
+}
+
+int64_t PollScheduler::effective(const Device& device) const
+{
+    return std::max<int64_t>(std::llround(requested(device) * stretch()), 1);
+}
+
+void PollScheduler::recomputeRate()
+{
+    rate_ = 0;
+    for (const auto& device : devices_)
+        rate_ += 1000.0 / requested(device.second);
+}
+
+int64_t PollScheduler::phase(const std::string& name) const
+{
+    return s_hash(name) % interval_ms_;
+}
+
+int64_t PollScheduler::slot(const std::string& name, const Device& device, int64_t time) const
+{
+    int64_t interval = effective(device);
+    int64_t offset = (static_cast<int64_t>(s_hash(name) % interval) - time) % interval;
+    if (offset < 0)
+        offset += interval;
+    return time + offset;
+}
+
+void PollScheduler::schedule(const std::string& name, Device& device, int64_t deadline)
+{
+    device.deadline = deadline;
+    queue_.emplace(deadline, name);
+}
+
+void PollScheduler::add(const std::string& name, int64_t now)
+{
+    auto result = devices_.emplace(name, Device());
+    if (!result.second)
+        return;
+    rate_ += 1000.0 / interval_ms_;
+    schedule(name, result.first->second, slot(name, result.first->second, now));
+}
+
+void PollScheduler::remove(const std::string& name)
+{
+    auto device = devices_.find(name);
+    if (device == devices_.end())
+        return;
+    queue_.erase(std::make_pair(device->second.deadline, name));
+    rate_ -= 1000.0 / requested(device->second);
+    devices_.erase(device);
+}
+
+void PollScheduler::sync(const std::vector<std::string>& names, int64_t now)
+{
+    std::set<std::string> wanted(names.begin(), names.end());
+    for (auto device = devices_.begin(); device != devices_.end(); ) {
+        if (wanted.count(device->first)) {
+            ++device;
+            continue;
+        }
+        queue_.erase(std::make_pair(device->second.deadline, device->first));
+        device = devices_.erase(device);
+    }
+    for (const auto& name : wanted)
+        add(name, now);
+    recomputeRate();
+}
+
+void PollScheduler::due(int64_t now, std::vector<std::string>& names)
+{
+    while (!queue_.empty() && queue_.begin()->first <= now) {
+        std::string name = queue_.begin()->second;
+        queue_.erase(queue_.begin());
+        Device& device = devices_.at(name);
+        int64_t jitter = now - device.deadline;
+        Statistics& statistics = device.statistics;
+        statistics.polls++;
+        statistics.last_ms = jitter;
+        statistics.max_ms = std::max(statistics.max_ms, jitter);
+        statistics.total_ms += jitter;
+        schedule(name, device, slot(name, device, std::max(device.deadline + effective(device), now + 1)));
+        names.push_back(std::move(name));
+    }
+}
+
+int64_t PollScheduler::timeout(int64_t now) const
+{
+    if (queue_.empty())
+        return -1;
+    return std::max<int64_t>(queue_.begin()->first - now, 0);
+}
+
+const PollScheduler::Statistics* PollScheduler::statistics(const std::string& name) const
+{
+    auto device = devices_.find(name);
+    if (device == devices_.end())
+        return nullptr;
+    return &device->second.statistics;
+}
+
+PollScheduler::Statistics PollScheduler::summary() const
+{
+    Statistics result;
+    for (const auto& device : devices_) {
+        const Statistics& statistics = device.second.statistics;
+        result.polls += statistics.polls;
+        result.last_ms = std::max(result.last_ms, statistics.last_ms);
+        result.max_ms = std::max(result.max_ms, statistics.max_ms);
+        result.total_ms += statistics.total_ms;
+    }
+    return result;
+}
+
+void PollScheduler::report(const char *owner, int64_t now)
+{
+    if (now - reported_ < interval_ms_ || devices_.empty())
+        return;
+    reported_ = now;
+    Statistics total = summary();
+    log_debug("%s: %zu devices polled %" PRIu64 " times, poll jitter mean %.1f ms, max %" PRIi64 " ms",
+            owner, devices_.size(), total.polls, total.mean(), total.max_ms);
+    // Drop the rounding errors accumulated by adapt()
+    recomputeRate();
+    if (stretch() > 1.0) {
+        log_warning("%s: devices ask for %.1f polls/s over the budget of %.1f, intervals stretched by %.2f",
+                owner, rate_, budget_, stretch());
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+poll_scheduler_test (bool verbose)
+{
+    printf (" * poll_scheduler: ");
+
+    //  @selftest
+    {
+        // The phase depends on the name only
+        PollScheduler a(30000), b(30000);
+        assert(a.phase("ups-1") == b.phase("ups-1"));
+        assert(a.phase("ups-1") >= 0 && a.phase("ups-1") < 30000);
+        assert(a.phase("ups-1") != a.phase("ups-2"));
+        assert(a.timeout(0) == -1);
+    }
+    {
+        // Each device is due once per interval, in its own slot
+        const int64_t interval = 1000;
+        PollScheduler scheduler(interval);
+        int64_t start = 100000;
+        scheduler.add("ups-1", start);
+        scheduler.add("ups-2", start);
+        scheduler.add("ups-1", start);
+        assert(scheduler.size() == 2);
+        std::vector<std::string> due;
+        std::map<std::string, int> polls;
+        for (int64_t now = start; now < start + 3 * interval; now++) {
+            due.clear();
+            scheduler.due(now, due);
+            for (const auto& name : due) {
+                assert((now - scheduler.phase(name)) % interval == 0);
+                polls[name]++;
+            }
+        }
+        assert(polls["ups-1"] == 3 && polls["ups-2"] == 3);
+        assert(scheduler.statistics("ups-1")->polls == 3);
+        assert(scheduler.statistics("ups-1")->max_ms == 0);
+
+        // Late polls count as jitter, missed slots are skipped
+        int64_t now = start + 3 * interval;
+        int64_t wait = scheduler.timeout(now);
+        assert(wait >= 0 && wait < interval);
+        now += wait + 2 * interval + 7;
+        due.clear();
+        scheduler.due(now, due);
+        assert(due.size() >= 1);
+        const PollScheduler::Statistics *statistics = scheduler.statistics(due[0]);
+        assert(statistics->polls == 4);
+        assert(statistics->last_ms == 2 * interval + 7);
+        assert(statistics->max_ms == statistics->last_ms);
+        assert(scheduler.timeout(now) > 0);
+        assert(scheduler.summary().polls >= 7);
+
+        // Removed devices are not polled anymore
+        scheduler.sync({ "ups-2", "ups-3" }, now);
+        assert(!scheduler.contains("ups-1"));
+        assert(scheduler.contains("ups-3"));
+        assert(scheduler.statistics("ups-2")->polls >= 3);
+        scheduler.remove("ups-2");
+        scheduler.remove("ups-2");
+        due.clear();
+        scheduler.due(now + interval, due);
+        assert(due.size() == 1 && due[0] == "ups-3");
+
+        // A new interval moves the slots
+        scheduler.setInterval(50, now);
+        assert(scheduler.timeout(now) < 50);
+    }
+    {
+        // Adaptive intervals stay within the bounds
+        const int64_t interval = 30000;
+        PollScheduler scheduler(interval);
+        int64_t now = 0;
+        scheduler.add("ups-1", now);
+        scheduler.add("epdu-1", now);
+        // The default bounds keep the interval
+        scheduler.adapt("ups-1", PollScheduler::URGENT, now);
+        scheduler.adapt("ups-1", PollScheduler::IDLE, now);
+        assert(scheduler.deviceInterval("ups-1") == interval);
+
+        scheduler.setBounds(500, 120000);
+        scheduler.adapt("ups-1", PollScheduler::URGENT, now);
+        assert(scheduler.deviceInterval("ups-1") == 500);
+        // The device in trouble does not wait for its old slot
+        assert(scheduler.timeout(now) < 500);
+        scheduler.adapt("epdu-1", PollScheduler::MOVING, now);
+        assert(scheduler.deviceInterval("epdu-1") == interval / 2);
+        scheduler.adapt("epdu-1", PollScheduler::MOVING, now);
+        assert(scheduler.deviceInterval("epdu-1") == interval / 4);
+        scheduler.adapt("epdu-1", PollScheduler::IDLE, now);
+        scheduler.adapt("epdu-1", PollScheduler::IDLE, now);
+        assert(scheduler.deviceInterval("epdu-1") == interval);
+        scheduler.adapt("epdu-1", PollScheduler::IDLE, now);
+        assert(scheduler.deviceInterval("epdu-1") == interval * 3 / 2);
+        for (int i = 0; i < 10; i++)
+            scheduler.adapt("epdu-1", PollScheduler::IDLE, now);
+        assert(scheduler.deviceInterval("epdu-1") == 120000);
+        for (int i = 0; i < 10; i++)
+            scheduler.adapt("ups-1", PollScheduler::MOVING, now);
+        assert(scheduler.deviceInterval("ups-1") == 500);
+
+        // The urgent device is polled at its own pace
+        std::vector<std::string> due;
+        std::map<std::string, int> polls;
+        for (now = 0; now < 10000; now++) {
+            due.clear();
+            scheduler.due(now, due);
+            for (const auto& name : due)
+                polls[name]++;
+        }
+        assert(polls["ups-1"] >= 19 && polls["ups-1"] <= 21);
+        assert(polls["epdu-1"] <= 1);
+
+        // The budget stretches all intervals
+        assert(scheduler.stretch() == 1.0);
+        scheduler.setBudget(1.0);
+        assert(scheduler.stretch() > 2.0);
+        assert(scheduler.deviceInterval("ups-1") > 1000);
+        scheduler.setBudget(0);
+        assert(scheduler.deviceInterval("ups-1") == 500);
+
+        // A new polling interval resets the adaptive intervals
+        scheduler.setInterval(60000, now);
+        assert(scheduler.deviceInterval("ups-1") == 60000);
+        assert(scheduler.deviceInterval("epdu-1") == 60000);
+        scheduler.remove("ups-1");
+        scheduler.setBudget(1.0 / 120);
+        assert(std::fabs(scheduler.stretch() - 2.0) < 1e-9);
+    }
+    {
+        // The slots of many devices are spread evenly over the interval
+        const int64_t interval = 30000;
+        const int count = 3000, bins = 10;
+        PollScheduler scheduler(interval);
+        int histogram[bins] = { 0 };
+        for (int i = 0; i < count; i++) {
+            std::string name = "ups-" + std::to_string(i);
+            scheduler.add(name, 0);
+            histogram[scheduler.phase(name) * bins / interval]++;
+        }
+        for (int i = 0; i < bins; i++) {
+            if (verbose)
+                printf("\n   %d..%d ms: %d devices", i * 3000, (i + 1) * 3000, histogram[i]);
+            assert(histogram[i] > count / bins * 8 / 10);
+            assert(histogram[i] < count / bins * 12 / 10);
+        }
+        if (verbose)
+            printf("\n   ");
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,175 @@
+/*  =========================================================================
+    poll_scheduler - Spreads the polls of the devices evenly over the polling interval
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef POLL_SCHEDULER_H_INCLUDED
+#define POLL_SCHEDULER_H_INCLUDED
+
+/*
+ * Polling all devices back to back once per interval creates a burst of
+ * requests to upsd and of messages on the malamute streams. PollScheduler
+ * instead gives every device a slot of its own within the interval: the
+ * phase of a device is a hash of its name modulo the interval, so the slots
+ * are spread evenly and a device keeps its slot across restarts and changes
+ * of the device list. Each device has its own deadline, the owner asks for
+ * the devices whose slot has come and sleeps until the next one:
+ *
+ * PollScheduler scheduler(30000);
+ * scheduler.add("ups-1", zclock_mono());
+ * ...
+ * zpoller_wait(poller, scheduler.timeout(zclock_mono()));
+ * std::vector<std::string> due;
+ * scheduler.due(zclock_mono(), due);
+ * for (const auto& name : due) {
+ *     // poll the device
+ * }
+ *
+ * The delay between the slot of a device and the due() call returning it
+ * is recorded as the poll jitter of the device.
+ *
+ * The interval of each device can be adapted to its activity within the
+ * configured bounds: devices in trouble are polled at the lower bound,
+ * devices with values moving quickly more and more often, idle devices
+ * less and less often. A budget caps the total number of polls per
+ * second; if the devices would exceed it, all intervals are stretched by
+ * the same factor.
+ */
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+class PollScheduler {
+public:
+    struct Statistics {
+        // Number of polls
+        uint64_t polls = 0;
+        // Delay of the last poll and the largest one, in ms
+        int64_t last_ms = 0;
+        int64_t max_ms = 0;
+        // Sum of the delays of all polls, in ms
+        int64_t total_ms = 0;
+        double mean() const
+        {
+            return polls ? static_cast<double>(total_ms) / polls : 0.0;
+        }
+    };
+
+    // What a device did since its previous poll, see adapt()
+    enum Activity {
+        IDLE,
+        MOVING,
+        URGENT
+    };
+
+    explicit PollScheduler(int64_t interval_ms = 30000);
+    int64_t interval() const
+    {
+        return interval_ms_;
+    }
+    // Moves all devices to their slots within the new interval, which
+    // becomes the interval of every device again
+    void setInterval(int64_t interval_ms, int64_t now);
+    // Bounds of the intervals chosen by adapt(), they are widened to
+    // include interval(). The default bounds leave the intervals alone
+    void setBounds(int64_t min_ms, int64_t max_ms);
+    int64_t minInterval() const
+    {
+        return min_ms_;
+    }
+    int64_t maxInterval() const
+    {
+        return max_ms_;
+    }
+    // Largest number of polls per second, 0 for no limit
+    void setBudget(double polls_per_second);
+    double budget() const
+    {
+        return budget_;
+    }
+    // Adjusts the interval of a device after a poll. Urgent devices get
+    // the lower bound, moving ones half of their previous interval, idle
+    // ones double it until they are back at interval(), and grow it by
+    // half up to the upper bound from there
+    void adapt(const std::string& name, Activity activity, int64_t now);
+    // Effective interval of a device, after applying the budget
+    int64_t deviceInterval(const std::string& name) const;
+    // Factor by which the budget stretches the intervals, at least 1
+    double stretch() const;
+    // Schedules a device for its next slot, which may be right now. Does
+    // nothing if the device is already scheduled
+    void add(const std::string& name, int64_t now);
+    void remove(const std::string& name);
+    // Adds the missing devices and removes those not listed
+    void sync(const std::vector<std::string>& names, int64_t now);
+    bool contains(const std::string& name) const
+    {
+        return devices_.count(name) != 0;
+    }
+    size_t size() const
+    {
+        return devices_.size();
+    }
+    // Offset of the slots of a device from the start of an interval
+    int64_t phase(const std::string& name) const;
+    // Appends the devices whose slot has come and schedules them for their
+    // next slot. Slots missed entirely are skipped
+    void due(int64_t now, std::vector<std::string>& names);
+    // Time until the next slot, -1 if no device is scheduled
+    int64_t timeout(int64_t now) const;
+    // Returns the poll jitter of a device, nullptr if it is not scheduled
+    const Statistics* statistics(const std::string& name) const;
+    // Poll jitter over all devices, with last_ms the largest last delay
+    Statistics summary() const;
+    // Logs the summary at most once per interval
+    void report(const char *owner, int64_t now);
+private:
+    struct Device {
+        int64_t deadline = 0;
+        // Interval chosen by adapt(), 0 for interval()
+        int64_t interval_ms = 0;
+        Statistics statistics;
+    };
+    // Interval of the device before and after applying the budget
+    int64_t requested(const Device& device) const;
+    int64_t effective(const Device& device) const;
+    // First slot of the device at or after the given time
+    int64_t slot(const std::string& name, const Device& device, int64_t time) const;
+    void schedule(const std::string& name, Device& device, int64_t deadline);
+    void recomputeRate();
+    int64_t interval_ms_;
+    int64_t min_ms_;
+    int64_t max_ms_;
+    double budget_;
+    // Polls per second requested by all devices
+    double rate_;
+    int64_t reported_;
+    std::map<std::string, Device> devices_;
+    // Deadlines in ascending order
+    std::set<std::pair<int64_t, std::string>> queue_;
+};
+
+//  Self test of this class
+void poll_scheduler_test (bool verbose);
+
+#endif
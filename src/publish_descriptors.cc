@@ -0,0 +1,177 @@
+/*  =========================================================================
+    publish_descriptors - Subjects and units of the metrics, computed once per device
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    publish_descriptors - Subjects and units of the metrics, computed once per device
+@discuss
+@end
+*/
+
+#include "publish_descriptors.h"
+
+#include <cassert>
+#include <cstring>
+
+PublishDescriptors::PublishDescriptors(const std::map<std::string, std::string>& units)
+    : units_(units)
+{
+}
+
+const std::shared_ptr<PublishDescriptors::Device>& PublishDescriptors::device(const std::string& asset)
+{
+    auto i = devices_.find(asset);
+    if (i != devices_.end())
+        return i->second;
+    std::shared_ptr<Device>& device = devices_[asset];
+    device = std::make_shared<Device>();
+    device->asset = asset;
+    device->status = make(MetricNames::intern("status.ups"), "status@" + asset, "");
+    device->interval = make(MetricNames::intern("poll.interval"), "poll.interval@" + asset, "s");
+    return device;
+}
+
+const PublishDescriptors::Metric& PublishDescriptors::metric(Device& device, MetricNames::Id id)
+{
+    auto i = device.metrics.find(id);
+    if (i != device.metrics.end())
+        return i->second;
+    return device.metrics.emplace(id, make(id, MetricNames::name(id) + "@" + device.asset, units(id))).first->second;
+}
+
+MetricNames::Id PublishDescriptors::outlet(int number)
+{
+    assert(number > 0);
+    while (outlets_.size() < size_t(number))
+        outlets_.push_back(MetricNames::intern("status.outlet." + std::to_string(outlets_.size() + 1)));
+    return outlets_[number - 1];
+}
+
+void PublishDescriptors::forget(const std::string& asset)
+{
+    devices_.erase(asset);
+}
+
+void PublishDescriptors::retain(const std::set<std::string>& assets)
+{
+    for (auto i = devices_.begin(); i != devices_.end();) {
+        if (assets.count(i->first))
+            ++i;
+        else
+            i = devices_.erase(i);
+    }
+}
+
+void PublishDescriptors::clear()
+{
+    devices_.clear();
+}
+
+const char *PublishDescriptors::units(MetricNames::Id id)
+{
+    if (unitsById_.size() <= id)
+        unitsById_.resize(id + 1, nullptr);
+    if (!unitsById_[id]) {
+        const std::string& name = MetricNames::name(id);
+        auto i = units_.find(name.substr(0, name.find('.')));
+        unitsById_[id] = i == units_.end() ? "" : i->second.c_str();
+    }
+    return unitsById_[id];
+}
+
+PublishDescriptors::Metric PublishDescriptors::make(MetricNames::Id id, const std::string& subject,
+        const char *units) const
+{
+    Metric metric;
+    metric.id = id;
+    metric.quantity = &MetricNames::name(id);
+    metric.subject = subject;
+    metric.units = units;
+    return metric;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+publish_descriptors_test (bool verbose)
+{
+    printf (" * publish_descriptors: ");
+
+    //  @selftest
+    const std::map<std::string, std::string> units = {
+        { "realpower", "W" },
+        { "load", "%" },
+    };
+    PublishDescriptors descriptors(units);
+    PublishDescriptors::Device& ups = *descriptors.device("ups-1");
+    assert(descriptors.device("ups-1").get() == &ups);
+    assert(descriptors.size() == 1);
+    assert(ups.asset == "ups-1");
+    assert(ups.status.subject == "status@ups-1");
+    assert(*ups.status.quantity == "status.ups");
+    assert(strcmp(ups.status.units, "") == 0);
+    assert(ups.interval.subject == "poll.interval@ups-1");
+    assert(*ups.interval.quantity == "poll.interval");
+    assert(strcmp(ups.interval.units, "s") == 0);
+
+    // Computed once, the references stay valid while others are added
+    MetricNames::Id realpower = MetricNames::intern("realpower.default");
+    const PublishDescriptors::Metric& metric = descriptors.metric(ups, realpower);
+    assert(metric.id == realpower);
+    assert(metric.quantity == &MetricNames::name(realpower));
+    assert(metric.subject == "realpower.default@ups-1");
+    assert(strcmp(metric.units, "W") == 0);
+    for (int i = 1; i <= 100; i++)
+        descriptors.metric(ups, descriptors.outlet(i));
+    assert(&descriptors.metric(ups, realpower) == &metric);
+    assert(ups.metrics.size() == 101);
+
+    const PublishDescriptors::Metric& load = descriptors.metric(ups, MetricNames::intern("load.input.L1"));
+    assert(load.subject == "load.input.L1@ups-1");
+    assert(strcmp(load.units, "%") == 0);
+    const PublishDescriptors::Metric& status = descriptors.metric(ups, descriptors.outlet(12));
+    assert(*status.quantity == "status.outlet.12");
+    assert(status.subject == "status.outlet.12@ups-1");
+    assert(strcmp(status.units, "") == 0);
+    assert(descriptors.outlet(12) == MetricNames::find("status.outlet.12"));
+
+    // Each device has subjects of its own
+    PublishDescriptors::Device& epdu = *descriptors.device("epdu-1");
+    assert(descriptors.metric(epdu, realpower).subject == "realpower.default@epdu-1");
+    assert(descriptors.size() == 2);
+
+    // Dropped devices live on while shared
+    std::shared_ptr<const PublishDescriptors::Device> shared = descriptors.device("ups-1");
+    descriptors.device("epdu-2");
+    descriptors.forget("epdu-2");
+    assert(descriptors.size() == 2);
+    descriptors.retain({ "epdu-1", "epdu-2" });
+    assert(descriptors.size() == 1);
+    assert(descriptors.device("epdu-1")->metrics.size() == 1);
+    assert(shared->metrics.size() == 102);
+    assert(shared->metrics.at(realpower).subject == "realpower.default@ups-1");
+    assert(descriptors.device("ups-1").get() != shared.get());
+    descriptors.clear();
+    assert(descriptors.size() == 0);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,101 @@
+/*  =========================================================================
+    publish_descriptors - Subjects and units of the metrics, computed once per device
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef PUBLISH_DESCRIPTORS_H_INCLUDED
+#define PUBLISH_DESCRIPTORS_H_INCLUDED
+
+/*
+ * Every poll publishes the same metrics of the same devices again. Instead
+ * of building the subject "<quantity>@<asset>" and looking up the units of
+ * each metric every time, PublishDescriptors computes them at the first
+ * publication of a metric of a device and keeps them until the device
+ * goes away or the mapping changes:
+ *
+ * PublishDescriptors descriptors(units);
+ * PublishDescriptors::Device& device = descriptors.device("ups-1");
+ * const PublishDescriptors::Metric& metric = descriptors.metric(device, id);
+ * publish(*metric.quantity, metric.subject, value, metric.units);
+ *
+ * The units of a metric are those of its type, the part of its name before
+ * the first dot.
+ *
+ * A Device may be shared with another thread, e.g. by a snapshot queued for
+ * publication, which keeps it alive once dropped here. Descriptors are not
+ * changed once created, so that thread may read those it was handed while
+ * new ones are added; it must not look them up in Device::metrics.
+ */
+
+#include "metric_store.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class PublishDescriptors {
+public:
+    struct Metric {
+        MetricNames::Id id;
+        // Interned name of the metric
+        const std::string *quantity;
+        std::string subject;
+        const char *units;
+    };
+    struct Device {
+        std::string asset;
+        // Metrics the agent computes, whose subject or units differ from
+        // those of the metric of the same name
+        Metric status;      // status.ups, published as status@<asset>
+        Metric interval;    // poll.interval, in s
+        // The others, by ID; the references stay valid
+        std::unordered_map<MetricNames::Id, Metric> metrics;
+    };
+    // The units by type of metric must outlive the descriptors
+    explicit PublishDescriptors(const std::map<std::string, std::string>& units);
+    // Descriptors of the metrics of an asset, created at the first call
+    const std::shared_ptr<Device>& device(const std::string& asset);
+    const Metric& metric(Device& device, MetricNames::Id id);
+    // ID of status.outlet.<number>
+    MetricNames::Id outlet(int number);
+    // Drops an asset, or the assets not listed
+    void forget(const std::string& asset);
+    void retain(const std::set<std::string>& assets);
+    void clear();
+    size_t size() const
+    {
+        return devices_.size();
+    }
+private:
+    const char *units(MetricNames::Id id);
+    Metric make(MetricNames::Id id, const std::string& subject, const char *units) const;
+    const std::map<std::string, std::string>& units_;
+    // Units by metric ID, nullptr until looked up
+    std::vector<const char *> unitsById_;
+    std::vector<MetricNames::Id> outlets_;
+    std::unordered_map<std::string, std::shared_ptr<Device>> devices_;
+};
+
+//  Self test of this class
+void publish_descriptors_test (bool verbose);
+
+#endif
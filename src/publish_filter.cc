@@ -0,0 +1,206 @@
+/*  =========================================================================
+    publish_filter - Decides which metrics are significant enough to be published
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+
+/*
+@header
+    publish_filter - Decides which metrics are significant enough to be published
+@discuss
+@end
+*/
+
+#include "publish_filter.h"
+#include <fty_log.h>
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
+void PublishFilter::configure(const std::map<std::string, std::string>& deadbands)
+{
+    deadbands_.clear();
+    for (const auto& item : deadbands) {
+        const char *text = item.second.c_str();
+        char *end = nullptr;
+        Deadband deadband;
+        deadband.width = strtod(text, &end);
+        if (end != text && *end == '%') {
+            deadband.relative = true;
+            deadband.width /= 100;
+            end++;
+        }
+        if (end == text || *end != '\0' || !std::isfinite(deadband.width) || deadband.width < 0) {
+            log_warning("Invalid deadband '%s' of metric type '%s' ignored", text, item.first.c_str());
+            continue;
+        }
+        deadbands_[item.first] = deadband;
+    }
+    for (auto& asset : assets_) {
+        for (auto& metric : asset.second)
+            metric.second.deadband = deadband(metric.first);
+    }
+}
+
+PublishFilter::Deadband PublishFilter::deadband(const std::string& metric) const
+{
+    auto i = deadbands_.find(metric.substr(0, metric.find('.')));
+    return i == deadbands_.end() ? Deadband() : i->second;
+}
+
+bool PublishFilter::pass(const std::string& asset, const std::string& metric, double number,
+        const char *text, int64_t now, int64_t max_silence_ms)
+{
+    auto& metrics = assets_[asset];
+    auto i = metrics.find(metric);
+    if (i == metrics.end()) {
+        i = metrics.insert(std::make_pair(metric, Published())).first;
+        i->second.deadband = deadband(metric);
+    } else {
+        const Published& last = i->second;
+        bool significant;
+        if (std::isnan(number) || std::isnan(last.number)) {
+            significant = std::isnan(number) != std::isnan(last.number) || last.text != text;
+        } else {
+            double width = last.deadband.width;
+            if (last.deadband.relative)
+                width *= fabs(last.number);
+            significant = fabs(number - last.number) > width;
+        }
+        if (!significant && max_silence_ms > 0 && now - last.time < max_silence_ms) {
+            suppressed_++;
+            return false;
+        }
+    }
+    Published& published = i->second;
+    published.number = number;
+    published.text = text;
+    published.time = now;
+    passed_++;
+    return true;
+}
+
+void PublishFilter::forget(const std::string& asset, const std::string& metric)
+{
+    auto i = assets_.find(asset);
+    if (i != assets_.end())
+        i->second.erase(metric);
+}
+
+void PublishFilter::forget(const std::string& asset)
+{
+    assets_.erase(asset);
+}
+
+void PublishFilter::retain(const std::set<std::string>& assets)
+{
+    for (auto i = assets_.begin(); i != assets_.end(); ) {
+        if (assets.count(i->first))
+            ++i;
+        else
+            i = assets_.erase(i);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+publish_filter_test (bool verbose)
+{
+    printf (" * publish_filter: ");
+
+    //  @selftest
+    {
+        PublishFilter filter;
+        filter.configure({
+            { "voltage", "1%" },
+            { "temperature", "0.5" },
+            { "current", "-1" },
+            { "humidity", "5 %" },
+            { "load", "x" } });
+        assert(filter.deadband("voltage.input.L1-N").relative);
+        assert(filter.deadband("voltage.input.L1-N").width == 0.01);
+        assert(!filter.deadband("temperature").relative);
+        assert(filter.deadband("temperature").width == 0.5);
+        // invalid entries are ignored
+        assert(filter.deadband("current.input.L1").width == 0);
+        assert(filter.deadband("humidity").width == 0);
+        assert(filter.deadband("load.default").width == 0);
+
+        const int64_t silence = 300000;
+        // first values pass, then only those out of the deadband
+        assert(filter.pass("ups-1", "voltage.input.L1-N", 230, "230", 0, silence));
+        assert(!filter.pass("ups-1", "voltage.input.L1-N", 231, "231", 1000, silence));
+        assert(!filter.pass("ups-1", "voltage.input.L1-N", 227.8, "227.8", 2000, silence));
+        assert(filter.pass("ups-1", "voltage.input.L1-N", 232.5, "232.5", 3000, silence));
+        // the deadband is around the last published value
+        assert(!filter.pass("ups-1", "voltage.input.L1-N", 230.2, "230.2", 4000, silence));
+        assert(filter.pass("ups-1", "temperature.default", 25, "25", 0, silence));
+        assert(!filter.pass("ups-1", "temperature.default", 25.5, "25.5", 1000, silence));
+        assert(filter.pass("ups-1", "temperature.default", 25.6, "25.6", 2000, silence));
+        // without deadband every change passes
+        assert(filter.pass("ups-1", "realpower.default", 100, "100", 0, silence));
+        assert(!filter.pass("ups-1", "realpower.default", 100, "100", 1000, silence));
+        assert(filter.pass("ups-1", "realpower.default", 100.01, "100.01", 2000, silence));
+        // assets are independent
+        assert(filter.pass("ups-2", "realpower.default", 100.01, "100.01", 2000, silence));
+        // values that are not numbers
+        assert(filter.pass("ups-1", "status.ups", NAN, "OL", 0, silence));
+        assert(!filter.pass("ups-1", "status.ups", NAN, "OL", 1000, silence));
+        assert(filter.pass("ups-1", "status.ups", NAN, "OB", 2000, silence));
+        assert(filter.pass("ups-1", "status.ups", 0, "0", 3000, silence));
+        assert(filter.pass("ups-1", "status.ups", NAN, "0", 4000, silence));
+        assert(filter.passed() == 11);
+        assert(filter.suppressed() == 6);
+
+        // a silent metric is published again before it expires
+        assert(!filter.pass("ups-1", "realpower.default", 100.01, "100.01", 2000 + silence - 1, silence));
+        assert(filter.pass("ups-1", "realpower.default", 100.01, "100.01", 2000 + silence, silence));
+        assert(!filter.pass("ups-1", "realpower.default", 100.01, "100.01", 2001 + silence, silence));
+        // without heartbeat everything passes
+        assert(filter.pass("ups-1", "realpower.default", 100.01, "100.01", 2002 + silence, 0));
+
+        // a new configuration applies to the values already published
+        filter.configure({ { "realpower", "10" } });
+        assert(filter.deadband("voltage.input.L1-N").width == 0);
+        assert(!filter.pass("ups-1", "realpower.default", 105, "105", 2003 + silence, silence));
+        assert(filter.pass("ups-1", "voltage.input.L1-N", 232.6, "232.6", 5000, silence));
+
+        // a forgotten metric passes again, the others of the asset do not
+        assert(!filter.pass("ups-1", "voltage.input.L1-N", 232.6, "232.6", 6000, silence));
+        filter.forget("ups-1", "voltage.input.L1-N");
+        filter.forget("ups-3", "voltage.input.L1-N");
+        assert(filter.pass("ups-1", "voltage.input.L1-N", 232.6, "232.6", 7000, silence));
+        assert(!filter.pass("ups-1", "voltage.input.L1-N", 232.6, "232.6", 8000, silence));
+        assert(!filter.pass("ups-1", "realpower.default", 105, "105", 2004 + silence, silence));
+
+        // forgotten assets start over
+        filter.forget("ups-2");
+        assert(filter.pass("ups-2", "realpower.default", 100.01, "100.01", 2005, silence));
+        filter.retain({ "ups-2" });
+        assert(filter.pass("ups-1", "realpower.default", 100.01, "100.01", 2005 + silence, silence));
+        assert(!filter.pass("ups-2", "realpower.default", 100.01, "100.01", 2005, silence));
+        filter.clear();
+        assert(filter.pass("ups-2", "realpower.default", 100.01, "100.01", 2006, silence));
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,105 @@
+/*  =========================================================================
+    publish_filter - Decides which metrics are significant enough to be published
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef PUBLISH_FILTER_H_INCLUDED
+#define PUBLISH_FILTER_H_INCLUDED
+
+/*
+ * Most metrics barely move between two polls. PublishFilter remembers the
+ * last value published for each metric of each asset and lets a new value
+ * through only if it left the deadband around it, or if the metric has
+ * been silent for too long and would expire at its consumers otherwise:
+ *
+ * PublishFilter filter;
+ * filter.configure({ { "voltage", "1%" }, { "temperature", "0.5" } });
+ * if (filter.pass("ups-1", "voltage.input.L1-N", 230.4, "230.4", zclock_mono(), 300000)) {
+ *     // publish the value
+ * }
+ *
+ * The deadband of a metric is that of its type, the part of its name
+ * before the first dot, either absolute or relative to the last published
+ * value ("1%"). Types without a deadband pass every change. Values that
+ * are not numbers (NAN) pass whenever their text changes.
+ */
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+class PublishFilter {
+public:
+    struct Deadband {
+        double width = 0;
+        // width is a fraction of the last published value
+        bool relative = false;
+    };
+    // Sets the deadbands per metric type, like { "voltage": "1%" }.
+    // Invalid entries are logged and ignored
+    void configure(const std::map<std::string, std::string>& deadbands);
+    // Deadband of a metric
+    Deadband deadband(const std::string& metric) const;
+    // Returns true if the value is to be published: the metric of the
+    // asset was never published, its value left the deadband or it was
+    // last published at least max_silence_ms ago. The value is then
+    // remembered as published at now
+    bool pass(const std::string& asset, const std::string& metric, double number,
+            const char *text, int64_t now, int64_t max_silence_ms);
+    // Forgets the value published for a metric of an asset, the next one
+    // passes. For values that were passed but then not sent after all
+    void forget(const std::string& asset, const std::string& metric);
+    // Forgets all the values published for an asset
+    void forget(const std::string& asset);
+    // Forgets the assets not listed
+    void retain(const std::set<std::string>& assets);
+    // Forgets all published values, everything passes again
+    void clear()
+    {
+        assets_.clear();
+    }
+    // Numbers of values passed and suppressed so far
+    uint64_t passed() const
+    {
+        return passed_;
+    }
+    uint64_t suppressed() const
+    {
+        return suppressed_;
+    }
+private:
+    struct Published {
+        double number;
+        std::string text;
+        int64_t time;
+        Deadband deadband;
+    };
+    std::map<std::string, Deadband> deadbands_;
+    // Last published values by asset and metric
+    std::unordered_map<std::string, std::unordered_map<std::string, Published>> assets_;
+    uint64_t passed_ = 0;
+    uint64_t suppressed_ = 0;
+};
+
+//  Self test of this class
+void publish_filter_test (bool verbose);
+
+#endif
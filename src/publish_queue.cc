@@ -0,0 +1,414 @@
+/*  =========================================================================
+    publish_queue - Bounded queue of the metrics of the devices to publish
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    publish_queue - Bounded queue of the metrics of the devices to publish
+@discuss
+@end
+*/
+
+#include "publish_queue.h"
+#include <czmq.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <unordered_set>
+
+PublishQueue::Snapshot::Snapshot(std::shared_ptr<const PublishDescriptors::Device> device, int ttl,
+        uint64_t time, int64_t polled_ms)
+    : device_(std::move(device))
+    , ttl_(ttl)
+    , time_(time)
+    , polled_ms_(polled_ms)
+    , queued_ms_(polled_ms)
+{
+    assert(device_);
+}
+
+void PublishQueue::Snapshot::add(const PublishDescriptors::Metric& metric, const char *value)
+{
+    entries_.push_back(Entry { &metric, values_.size() });
+    values_.append(value).append(1, '\0');
+}
+
+void PublishQueue::Snapshot::merge(const Snapshot& older)
+{
+    std::unordered_set<const PublishDescriptors::Metric *> metrics;
+    for (const Entry& entry : entries_)
+        metrics.insert(entry.metric);
+    for (const Entry& entry : older.entries_) {
+        if (!metrics.count(entry.metric))
+            add(*entry.metric, older.values_.data() + entry.offset);
+    }
+    queued_ms_ = std::min(queued_ms_, older.queued_ms_);
+}
+
+PublishQueue::PublishQueue(size_t capacity, Overflow overflow)
+    : capacity_(std::max<size_t>(capacity, 1))
+    , overflow_(overflow)
+    , closed_(false)
+{
+}
+
+void PublishQueue::configure(size_t capacity, Overflow overflow)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = std::max<size_t>(capacity, 1);
+    overflow_ = overflow;
+}
+
+size_t PublishQueue::capacity() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_;
+}
+
+PublishQueue::Overflow PublishQueue::overflow() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return overflow_;
+}
+
+std::unique_ptr<PublishQueue::Snapshot> PublishQueue::push(std::unique_ptr<Snapshot> snapshot)
+{
+    snapshot->queued_ms_ = zclock_mono();
+    std::unique_ptr<Snapshot> lost;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_)
+            return nullptr;
+        stats_.pushed++;
+        if (overflow_ != DROP_OLDEST) {
+            // A device has at most one snapshot queued, there are few of them
+            auto queued = std::find_if(snapshots_.begin(), snapshots_.end(),
+                    [&](const std::unique_ptr<Snapshot>& s) { return s->device_ == snapshot->device_; });
+            if (queued != snapshots_.end()) {
+                if (overflow_ == COALESCE) {
+                    snapshot->merge(**queued);
+                    stats_.coalesced++;
+                } else {
+                    stats_.dropped++;
+                    lost = std::move(*queued);
+                }
+                // The device keeps its place in the queue
+                *queued = std::move(snapshot);
+                return lost;
+            }
+        }
+        if (snapshots_.size() >= capacity_)
+            lost = dropOldest();
+        snapshots_.push_back(std::move(snapshot));
+        stats_.max_depth = std::max(stats_.max_depth, snapshots_.size());
+    }
+    ready_.notify_one();
+    return lost;
+}
+
+std::unique_ptr<PublishQueue::Snapshot> PublishQueue::pop(int64_t timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait_for(lock, std::chrono::milliseconds(std::max<int64_t>(timeout_ms, 0)),
+            [this]() { return closed_ || !snapshots_.empty(); });
+    if (closed_ || snapshots_.empty())
+        return nullptr;
+    std::unique_ptr<Snapshot> snapshot = std::move(snapshots_.front());
+    snapshots_.pop_front();
+    return snapshot;
+}
+
+void PublishQueue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        snapshots_.clear();
+    }
+    ready_.notify_all();
+}
+
+void PublishQueue::open()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = false;
+}
+
+bool PublishQueue::closed() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+}
+
+size_t PublishQueue::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return snapshots_.size();
+}
+
+PublishQueue::Statistics PublishQueue::statistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+bool PublishQueue::parseOverflow(const char *name, Overflow& overflow)
+{
+    for (Overflow o : { COALESCE, LATEST, DROP_OLDEST }) {
+        if (strcmp(name, overflowName(o)) == 0) {
+            overflow = o;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *PublishQueue::overflowName(Overflow overflow)
+{
+    switch (overflow) {
+    case COALESCE:
+        return "coalesce";
+    case LATEST:
+        return "latest";
+    case DROP_OLDEST:
+        return "drop_oldest";
+    }
+    return "";
+}
+
+std::unique_ptr<PublishQueue::Snapshot> PublishQueue::dropOldest()
+{
+    std::unique_ptr<Snapshot> oldest = std::move(snapshots_.front());
+    snapshots_.pop_front();
+    stats_.dropped++;
+    return oldest;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+typedef std::map<std::string, std::string> Values;
+
+static Values
+s_values(const PublishQueue::Snapshot& snapshot)
+{
+    Values values;
+    snapshot.forEach([&](const PublishDescriptors::Metric& metric, const char *value) {
+        values[*metric.quantity] = value;
+    });
+    return values;
+}
+
+void
+publish_queue_test (bool verbose)
+{
+    printf (" * publish_queue: ");
+
+    //  @selftest
+    const std::map<std::string, std::string> units = { { "realpower", "W" } };
+    PublishDescriptors descriptors(units);
+    std::shared_ptr<PublishDescriptors::Device> ups = descriptors.device("ups-1");
+    std::shared_ptr<PublishDescriptors::Device> epdu = descriptors.device("epdu-1");
+    const PublishDescriptors::Metric& realpower = descriptors.metric(*ups, MetricNames::intern("realpower.default"));
+    const PublishDescriptors::Metric& voltage = descriptors.metric(*ups, MetricNames::intern("voltage.input.L1-N"));
+    const PublishDescriptors::Metric& outlet = descriptors.metric(*epdu, descriptors.outlet(1));
+
+    auto snapshot = [&](const std::shared_ptr<PublishDescriptors::Device>& device, int64_t polled,
+            const Values& values) -> std::unique_ptr<PublishQueue::Snapshot> {
+        std::unique_ptr<PublishQueue::Snapshot> s(new PublishQueue::Snapshot(device, 60, 1000 + polled, polled));
+        for (const auto& value : values)
+            s->add(descriptors.metric(*device, MetricNames::find(value.first)), value.second.c_str());
+        return s;
+    };
+    {
+        // Values are kept as given, in the order given
+        auto s = snapshot(ups, 1, { { "realpower.default", "100" } });
+        s->add(voltage, "230.4");
+        s->add(descriptors.device("ups-1")->status, "8");
+        assert(s->size() == 3);
+        assert(s->asset() == "ups-1");
+        assert(s->ttl() == 60 && s->time() == 1001 && s->polled() == 1);
+        std::vector<std::string> order;
+        s->forEach([&](const PublishDescriptors::Metric& metric, const char *value) {
+            order.push_back(metric.subject + "=" + value);
+        });
+        assert(order == std::vector<std::string>({ "realpower.default@ups-1=100", "voltage.input.L1-N@ups-1=230.4",
+                    "status@ups-1=8" }));
+        assert(&realpower == &descriptors.metric(*ups, realpower.id));
+        assert(strcmp(outlet.units, "") == 0);
+    }
+    {
+        // COALESCE: a device queued once, with the latest value of each metric
+        PublishQueue queue(4, PublishQueue::COALESCE);
+        assert(!queue.push(snapshot(ups, 1, { { "realpower.default", "100" }, { "voltage.input.L1-N", "230" } })));
+        assert(!queue.push(snapshot(epdu, 2, { { "status.outlet.1", "42" } })));
+        // nothing is lost
+        assert(!queue.push(snapshot(ups, 3, { { "realpower.default", "200" } })));
+        assert(queue.size() == 2);
+        auto s = queue.pop(0);
+        assert(s && s->asset() == "ups-1");
+        assert(s->polled() == 3 && s->time() == 1003);
+        assert(s_values(*s) == Values({ { "realpower.default", "200" }, { "voltage.input.L1-N", "230" } }));
+        s = queue.pop(0);
+        assert(s && s->asset() == "epdu-1");
+        assert(!queue.pop(0));
+        PublishQueue::Statistics stats = queue.statistics();
+        assert(stats.pushed == 3 && stats.coalesced == 1 && stats.dropped == 0 && stats.max_depth == 2);
+    }
+    {
+        // LATEST: the queued snapshot is replaced
+        PublishQueue queue(4, PublishQueue::LATEST);
+        assert(!queue.push(snapshot(ups, 1, { { "realpower.default", "100" }, { "voltage.input.L1-N", "230" } })));
+        // and handed back, its values are to be published again
+        auto replaced = queue.push(snapshot(ups, 2, { { "realpower.default", "200" } }));
+        assert(replaced && replaced->polled() == 1);
+        assert(s_values(*replaced) == Values({ { "realpower.default", "100" }, { "voltage.input.L1-N", "230" } }));
+        assert(queue.size() == 1);
+        assert(s_values(*queue.pop(0)) == Values({ { "realpower.default", "200" } }));
+        assert(queue.statistics().dropped == 1);
+
+        // and a full queue hands back its oldest snapshot
+        queue.configure(1, PublishQueue::LATEST);
+        assert(!queue.push(snapshot(ups, 3, { { "realpower.default", "300" } })));
+        auto dropped = queue.push(snapshot(epdu, 4, { { "status.outlet.1", "0" } }));
+        assert(dropped && dropped->asset() == "ups-1" && dropped->polled() == 3);
+        assert(queue.pop(0)->asset() == "epdu-1");
+        assert(queue.statistics().dropped == 2);
+    }
+    {
+        // DROP_OLDEST: everything is queued until the queue is full
+        PublishQueue queue(2, PublishQueue::DROP_OLDEST);
+        assert(!queue.push(snapshot(ups, 1, { { "realpower.default", "100" } })));
+        assert(!queue.push(snapshot(ups, 2, { { "realpower.default", "200" } })));
+        auto dropped = queue.push(snapshot(ups, 3, { { "realpower.default", "300" } }));
+        assert(dropped && dropped->polled() == 1);
+        assert(s_values(*dropped) == Values({ { "realpower.default", "100" } }));
+        assert(queue.size() == 2);
+        assert(queue.pop(0)->polled() == 2);
+        assert(queue.pop(0)->polled() == 3);
+        assert(queue.statistics().dropped == 1);
+
+        // A full queue drops the oldest with every policy
+        queue.configure(1, PublishQueue::COALESCE);
+        assert(queue.capacity() == 1 && queue.overflow() == PublishQueue::COALESCE);
+        assert(!queue.push(snapshot(ups, 4, { { "realpower.default", "400" } })));
+        dropped = queue.push(snapshot(epdu, 5, { { "status.outlet.1", "0" } }));
+        assert(dropped && dropped->polled() == 4);
+        assert(queue.size() == 1);
+        assert(queue.pop(0)->asset() == "epdu-1");
+        assert(queue.statistics().dropped == 2);
+
+        // Shrinking drops nothing, the queue drains down to the capacity
+        queue.configure(0, PublishQueue::DROP_OLDEST);
+        assert(queue.capacity() == 1);
+        queue.configure(3, PublishQueue::DROP_OLDEST);
+        for (int i = 0; i < 3; i++)
+            queue.push(snapshot(ups, 10 + i, {}));
+        queue.configure(2, PublishQueue::DROP_OLDEST);
+        assert(queue.size() == 3);
+        dropped = queue.push(snapshot(ups, 13, {}));
+        assert(dropped && dropped->polled() == 10);
+        assert(queue.size() == 3);
+        assert(queue.pop(0)->polled() == 11);
+        assert(queue.pop(0)->polled() == 12);
+        assert(!queue.push(snapshot(ups, 14, {})));
+        assert(queue.size() == 2);
+    }
+    {
+        // Descriptors dropped meanwhile live as long as the snapshot
+        PublishQueue queue;
+        std::shared_ptr<PublishDescriptors::Device> sts = descriptors.device("sts-1");
+        queue.push(snapshot(sts, 1, { { "realpower.default", "1" } }));
+        sts.reset();
+        descriptors.clear();
+        assert(s_values(*queue.pop(0)) == Values({ { "realpower.default", "1" } }));
+    }
+    {
+        // pop() waits, close() wakes it up for good until open()
+        PublishQueue queue;
+        int64_t start = zclock_mono();
+        assert(!queue.pop(50));
+        assert(zclock_mono() - start >= 40);
+        std::thread producer([&]() {
+            zclock_sleep(20);
+            queue.push(snapshot(ups, 1, { { "realpower.default", "100" } }));
+            zclock_sleep(20);
+            queue.close();
+        });
+        auto s = queue.pop(5000);
+        assert(s && s->polled() == 1);
+        assert(s->queued() >= s->polled());
+        start = zclock_mono();
+        assert(!queue.pop(5000));
+        assert(zclock_mono() - start < 4000);
+        assert(queue.closed());
+        producer.join();
+        queue.push(snapshot(ups, 2, {}));
+        assert(queue.size() == 0);
+        queue.open();
+        queue.push(snapshot(ups, 3, {}));
+        assert(queue.pop(0)->polled() == 3);
+
+        PublishQueue::Overflow overflow;
+        assert(PublishQueue::parseOverflow("latest", overflow) && overflow == PublishQueue::LATEST);
+        assert(PublishQueue::parseOverflow("drop_oldest", overflow) && overflow == PublishQueue::DROP_OLDEST);
+        assert(PublishQueue::parseOverflow("coalesce", overflow) && overflow == PublishQueue::COALESCE);
+        assert(!PublishQueue::parseOverflow("newest", overflow));
+    }
+    if (verbose) {
+        // Snapshots per second from a thread to another, with a consumer
+        // that keeps up and one that does not
+        const int devices = 50, count = 100000;
+        for (int64_t delay_us : { 0, 50 }) {
+            PublishQueue queue(PUBLISH_QUEUE_CAPACITY, PublishQueue::COALESCE);
+            std::vector<std::shared_ptr<PublishDescriptors::Device>> assets;
+            for (int d = 0; d < devices; d++)
+                assets.push_back(descriptors.device("epdu-" + std::to_string(d)));
+            size_t received = 0;
+            std::thread consumer([&]() {
+                while (auto s = queue.pop(1000)) {
+                    received++;
+                    if (delay_us)
+                        std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+                }
+            });
+            int64_t start = zclock_usecs();
+            for (int i = 0; i < count; i++)
+                queue.push(snapshot(assets[i % devices], i, { { "realpower.default", "100" } }));
+            int64_t elapsed = std::max<int64_t>(zclock_usecs() - start, 1);
+            while (queue.size())
+                zclock_sleep(10);
+            queue.close();
+            consumer.join();
+            PublishQueue::Statistics stats = queue.statistics();
+            printf("\n   consumer %s: %.0f pushes/s, %zu received, %" PRIu64 " coalesced, %" PRIu64 " dropped",
+                    delay_us ? "slow" : "fast", count * 1000000.0 / elapsed, received, stats.coalesced,
+                    stats.dropped);
+        }
+        printf("\n   ");
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,185 @@
+/*  =========================================================================
+    publish_queue - Bounded queue of the metrics of the devices to publish
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef PUBLISH_QUEUE_H_INCLUDED
+#define PUBLISH_QUEUE_H_INCLUDED
+
+/*
+ * PublishQueue passes the metrics read by a poll from the thread reading
+ * the devices to the thread publishing them. Each poll of a device gives
+ * one Snapshot, which is not changed once queued:
+ *
+ * // reading thread
+ * std::unique_ptr<PublishQueue::Snapshot> snapshot(
+ *         new PublishQueue::Snapshot(descriptors.device("ups-1"), ttl, time(NULL), polled));
+ * snapshot->add(descriptors.metric(*descriptors.device("ups-1"), id), "230.4");
+ * queue.push(std::move(snapshot));
+ * // publishing thread
+ * while (auto snapshot = queue.pop(1000)) {
+ *     snapshot->forEach([](const PublishDescriptors::Metric& metric, const char *value) { ... });
+ * }
+ *
+ * push() never blocks. When the publisher falls behind, the overflow policy
+ * decides what happens to a snapshot of a device that is still queued:
+ *
+ *   COALESCE     the queued snapshot takes the values of the new one and
+ *                keeps its own other values, so that nothing is lost
+ *   LATEST       the queued snapshot is replaced by the new one
+ *   DROP_OLDEST  the new one is queued as well
+ *
+ * and with all of them, the oldest snapshot is dropped when the queue is
+ * full. push() hands the snapshot replaced or dropped back to the caller,
+ * which has already taken its values as published (see PublishFilter) and
+ * is to publish them again.
+ */
+
+#include "publish_descriptors.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Default number of snapshots queued
+#define PUBLISH_QUEUE_CAPACITY 64
+
+class PublishQueue {
+public:
+    enum Overflow {
+        COALESCE,
+        LATEST,
+        DROP_OLDEST,
+    };
+    // Metrics of one device to publish after a poll
+    class Snapshot {
+    public:
+        // time is the time of the metrics, polled_ms the (monotonic) start
+        // of the poll
+        Snapshot(std::shared_ptr<const PublishDescriptors::Device> device, int ttl, uint64_t time,
+                int64_t polled_ms);
+        void add(const PublishDescriptors::Metric& metric, const char *value);
+        // Takes the metrics of an older snapshot of the device that this one
+        // does not have, and its time in the queue
+        void merge(const Snapshot& older);
+        // Calls f(const PublishDescriptors::Metric&, const char *value) for
+        // each metric
+        template <typename F>
+        void forEach(F f) const
+        {
+            for (const Entry& entry : entries_)
+                f(*entry.metric, values_.data() + entry.offset);
+        }
+        size_t size() const
+        {
+            return entries_.size();
+        }
+        bool empty() const
+        {
+            return entries_.empty();
+        }
+        const std::string& asset() const
+        {
+            return device_->asset;
+        }
+        int ttl() const
+        {
+            return ttl_;
+        }
+        uint64_t time() const
+        {
+            return time_;
+        }
+        int64_t polled() const
+        {
+            return polled_ms_;
+        }
+        // When it was pushed to the queue
+        int64_t queued() const
+        {
+            return queued_ms_;
+        }
+    private:
+        friend class PublishQueue;
+        struct Entry {
+            const PublishDescriptors::Metric *metric;
+            size_t offset;
+        };
+        // Keeps the descriptors alive
+        std::shared_ptr<const PublishDescriptors::Device> device_;
+        int ttl_;
+        uint64_t time_;
+        int64_t polled_ms_;
+        int64_t queued_ms_;
+        std::vector<Entry> entries_;
+        // The values, each one followed by a NUL
+        std::string values_;
+    };
+    struct Statistics {
+        uint64_t pushed = 0;
+        // Snapshots merged into one of the same device
+        uint64_t coalesced = 0;
+        // Snapshots replaced or dropped for lack of room
+        uint64_t dropped = 0;
+        size_t max_depth = 0;
+    };
+    explicit PublishQueue(size_t capacity = PUBLISH_QUEUE_CAPACITY, Overflow overflow = COALESCE);
+    PublishQueue(const PublishQueue&) = delete;
+    PublishQueue& operator=(const PublishQueue&) = delete;
+    // A capacity of 0 counts as 1. Nothing is dropped when the queue
+    // shrinks, it drains down to the new capacity
+    void configure(size_t capacity, Overflow overflow);
+    size_t capacity() const;
+    Overflow overflow() const;
+    // Producer side, never blocks. Returns the snapshot replaced (LATEST)
+    // or dropped to make room, if any, its values are not published
+    std::unique_ptr<Snapshot> push(std::unique_ptr<Snapshot> snapshot);
+    // Consumer side, waits at most timeout_ms for a snapshot. Returns
+    // nullptr on timeout or once the queue is closed
+    std::unique_ptr<Snapshot> pop(int64_t timeout_ms);
+    // Drops the snapshots queued, wakes up pop() and makes it return nullptr
+    // until open() is called
+    void close();
+    void open();
+    bool closed() const;
+    size_t size() const;
+    Statistics statistics() const;
+    // "coalesce", "latest" or "drop_oldest"
+    static bool parseOverflow(const char *name, Overflow& overflow);
+    static const char *overflowName(Overflow overflow);
+private:
+    // With the mutex held
+    std::unique_ptr<Snapshot> dropOldest();
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::unique_ptr<Snapshot>> snapshots_;
+    size_t capacity_;
+    Overflow overflow_;
+    bool closed_;
+    Statistics stats_;
+};
+
+//  Self test of this class
+void publish_queue_test (bool verbose);
+
+#endif
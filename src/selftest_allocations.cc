@@ -0,0 +1,59 @@
+/*  =========================================================================
+    selftest_allocations - Allocation counting for the verbose selftests
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    selftest_allocations - Allocation counting for the verbose selftests
+@discuss
+    Linked into fty_nut_selftest only (see Makemodule-local.am), never into
+    the library: it replaces the global operator new to count the
+    allocations of each thread.
+@end
+*/
+
+#include "selftest_allocations.h"
+
+#include <cstdlib>
+#include <new>
+
+static thread_local uint64_t s_allocations = 0;
+
+uint64_t
+selftest_allocations()
+{
+    return s_allocations;
+}
+
+void *
+operator new (size_t size)
+{
+    s_allocations++;
+    void *pointer = malloc (size ? size : 1);
+    if (!pointer)
+        throw std::bad_alloc ();
+    return pointer;
+}
+
+void
+operator delete (void *pointer) noexcept
+{
+    free (pointer);
+}
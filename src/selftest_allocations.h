@@ -0,0 +1,40 @@
+/*  =========================================================================
+    selftest_allocations - Allocation counting for the verbose selftests
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef SELFTEST_ALLOCATIONS_H_INCLUDED
+#define SELFTEST_ALLOCATIONS_H_INCLUDED
+
+#include <cstdint>
+
+// Number of allocations made by the current thread so far. Only defined by
+// fty_nut_selftest, which links selftest_allocations.cc; the library itself
+// merely holds a weak reference to it, which is null elsewhere
+uint64_t selftest_allocations() __attribute__((weak));
+
+// Number of allocations made by the current thread so far, or zero when they
+// are not counted
+inline uint64_t
+selftest_allocations_count()
+{
+    return selftest_allocations ? selftest_allocations() : 0;
+}
+
+#endif
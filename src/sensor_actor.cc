@@ -57,20 +57,23 @@ sensor_actor (zsock_t *pipe, void *args)
     zsock_signal (pipe, 0);
     log_debug ("sa: sensor actor started");
 
-    int64_t publishtime = zclock_mono();
     while (!zsys_interrupted) {
-        void *which = zpoller_wait (poller, polling);
-        if (which == NULL || zclock_mono() - publishtime > (int64_t)polling) {
-            log_debug ("sa: sensor update");
-            sensors.updateSensorList ();
-            sensors.updateFromNUT ();
-            sensors.publish (client, polling*2/1000);
-            publishtime = zclock_mono();
+        // Each sensor is published in its own slot of the polling interval,
+        // instead of all of them at once
+        int64_t timeout = sensors.pollTimeout (zclock_mono ());
+        if (timeout < 0 || timeout > static_cast<int64_t> (polling))
+            timeout = polling;
+        void *which = zpoller_wait (poller, static_cast<int> (timeout));
+        sensors.updateSensorList ();
+        sensors.poll (client, polling*2/1000, zclock_mono ());
+        if (which == NULL) {
+            continue;
         }
-        else if (which == pipe) {
+        if (which == pipe) {
             zmsg_t *msg = zmsg_recv (pipe);
             if (msg) {
                 int quit = alert_actor_commands (client, NULL, &msg, polling);
+                sensors.setPollingMs (polling);
                 zmsg_destroy (&msg);
                 if (quit) break;
             }
@@ -26,57 +26,57 @@
 #include <vector>
 #include <string>
 
-void Sensor::update (nut::TcpClient &conn)
+void Sensor::update (const NutSnapshot& snapshot)
 {
     log_debug ("sa: updating temperature and humidity from NUT device %s", _nutMaster.c_str());
-    auto nutDevice = conn.getDevice(_nutMaster);
-    if (! nutDevice.isOk()) {
+    if (! snapshot.find(_nutMaster)) {
         log_debug ("sa: NUT device %s is not ready", _nutMaster.c_str());
         return;
     }
-    try {
-        std::string prefix = nutPrefix();
-        log_debug ("sa: getting %stemperature from %s", prefix.c_str(), _nutMaster.c_str());
-        auto temperature = nutDevice.getVariableValue (prefix + "temperature");
-        if (temperature.empty ()) {
-            log_debug ("sa: %stemperature on %s is not present", prefix.c_str(), location().c_str ());
-        } else {
-            _temperature =  temperature[0];
-            log_debug ("sa: %stemperature on %s is %s", prefix.c_str (), location().c_str (), _temperature.c_str());
-        }
-
-        log_debug ("sa: getting %shumidity from %s", prefix.c_str(), _nutMaster.c_str());
-        auto humidity = nutDevice.getVariableValue (prefix + "humidity");
-        if (humidity.empty ()) {
-            log_debug ("sa: %shumidity on %s is not present", prefix.c_str(), location().c_str ());
-        } else {
-            _humidity =  humidity[0];
-            log_debug ("sa: %shumidity on %s is %s", prefix.c_str (), location().c_str (), _humidity.c_str());
-
-        }
-
-        _contacts.clear();
+    std::string prefix = nutPrefix();
+    log_debug ("sa: getting %stemperature from %s", prefix.c_str(), _nutMaster.c_str());
+    const std::string *temperature = snapshot.value (_nutMaster, prefix + "temperature");
+    if (! temperature) {
+        log_debug ("sa: %stemperature on %s is not present", prefix.c_str(), location().c_str ());
+    } else {
+        _temperature = *temperature;
+        log_debug ("sa: %stemperature on %s is %s", prefix.c_str (), location().c_str (), _temperature.c_str());
+    }
 
-        std::string state = nutDevice.getVariableValue (prefix + "contacts.1.status")[0];
-        if (state != "unknown" && state != "bad")
-            _contacts.push_back (state);
-        else
-            log_debug ("sa: %scontact.1.status state %s", prefix.c_str (), state.c_str ());
+    log_debug ("sa: getting %shumidity from %s", prefix.c_str(), _nutMaster.c_str());
+    const std::string *humidity = snapshot.value (_nutMaster, prefix + "humidity");
+    if (! humidity) {
+        log_debug ("sa: %shumidity on %s is not present", prefix.c_str(), location().c_str ());
+    } else {
+        _humidity = *humidity;
+        log_debug ("sa: %shumidity on %s is %s", prefix.c_str (), location().c_str (), _humidity.c_str());
 
-        state = nutDevice.getVariableValue (prefix + "contacts.2.status")[0];
-        if (state != "unknown" && state != "bad")
-            _contacts.push_back (state);
-        else
-            log_debug ("sa: %scontact.2.status state %s", prefix.c_str (), state.c_str ());
+    }
 
-        log_debug ("sa: %scontact.status on %s: contact.1 %s, contact.2 %s",
-                   prefix.c_str (),
-                   location().c_str (),
-                   nutDevice.getVariableValue (prefix + "contacts.1.status")[0].c_str (),
-                   nutDevice.getVariableValue (prefix + "contacts.2.status")[0].c_str ()
-        );
+    _contacts.clear();
 
-    } catch (...) {}
+    const std::string *contact1 = snapshot.value (_nutMaster, prefix + "contacts.1.status");
+    const std::string *contact2 = snapshot.value (_nutMaster, prefix + "contacts.2.status");
+    if (! contact1 || ! contact2) {
+        // Not an EMP001 with dry contacts
+        return;
+    }
+    if (*contact1 != "unknown" && *contact1 != "bad")
+        _contacts.push_back (*contact1);
+    else
+        log_debug ("sa: %scontact.1.status state %s", prefix.c_str (), contact1->c_str ());
+
+    if (*contact2 != "unknown" && *contact2 != "bad")
+        _contacts.push_back (*contact2);
+    else
+        log_debug ("sa: %scontact.2.status state %s", prefix.c_str (), contact2->c_str ());
+
+    log_debug ("sa: %scontact.status on %s: contact.1 %s, contact.2 %s",
+               prefix.c_str (),
+               location().c_str (),
+               contact1->c_str (),
+               contact2->c_str ()
+    );
 }
 
 std::string Sensor::topicSuffix () const
@@ -37,76 +37,114 @@ Sensors::Sensors (StateManager::Reader *reader)
 
 void Sensors::updateFromNUT ()
 {
-    try {
-        nut::TcpClient nutClient;
-        nutClient.connect ("localhost", 3493);
-        for (auto& it : _sensors) {
-            it.second.update (nutClient);
-        }
-        nutClient.disconnect();
-    } catch (std::exception& e) {
-        log_error ("reading data from NUT: %s", e.what ());
+    // The NUT actor reads the devices, take its last snapshot
+    std::shared_ptr<const NutSnapshot> snapshot = NutSnapshots.get ();
+    if (!snapshot)
+        return;
+    for (auto& it : _sensors) {
+        it.second.update (*snapshot);
     }
 }
 
 void Sensors::updateSensorList ()
 {
-    if (!_state_reader->refresh())
+    AssetState::ChangeSet changes;
+    if (!_state_reader->refresh(&changes))
         return;
     const AssetState& deviceState = _state_reader->getState();
     auto& devices = deviceState.getPowerDevices();
     auto& sensors = deviceState.getSensors();
 
-    log_debug("sa: updating device list");
+    log_debug("sa: updating sensor list (%zu added, %zu updated, %zu removed)",
+            changes.added.size(), changes.updated.size(), changes.removed.size());
+
+    // The sensors to rebuild are those that changed, those located on a
+    // changed asset (their parent device or daisy-chain master may have
+    // changed) and those the changed ones were or are now located on (their
+    // children changed)
+    std::set<std::string> dirty;
+    const std::set<std::string>* changed[] = { &changes.removed, &changes.added, &changes.updated };
+    for (auto names : changed) {
+        for (const auto& name : *names) {
+            dirty.insert(name);
+            auto located = _located.find(name);
+            if (located != _located.end())
+                dirty.insert(located->second.begin(), located->second.end());
+            auto old = _locations.find(name);
+            if (old != _locations.end()) {
+                dirty.insert(old->second);
+                located = _located.find(old->second);
+                located->second.erase(name);
+                if (located->second.empty())
+                    _located.erase(located);
+                _locations.erase(old);
+            }
+            auto sensor = sensors.find(name);
+            if (sensor != sensors.end() && !sensor->second->location().empty()) {
+                const std::string& location = sensor->second->location();
+                _locations[name] = location;
+                _located[location].insert(name);
+                dirty.insert(location);
+            }
+        }
+    }
 
-    log_debug ("sa: %zd sensors in assets", sensors.size());
-    _sensors.clear ();
-    for (auto i : sensors) {
-        const std::string& name = i.first;
-        const std::string& parent_name = i.second->location();
+    int64_t now = zclock_mono ();
+    for (const auto& name : dirty) {
+        _sensors.erase(name);
+        auto i = sensors.find(name);
+        if (i == sensors.end()) {
+            _scheduler.remove (name);
+            continue;
+        }
+        const std::string& parent_name = i->second->location();
         // do we know where is sensor connected?
         if (parent_name.empty()) {
             log_debug ("sa: sensor %s ignored (no location)", name.c_str());
+            _scheduler.remove (name);
             continue;
         }
 
-        // is it connected to UPS/epdu?
+        // is it connected to UPS/epdu? Otherwise it is read by its parent
+        // sensor, if any
         const auto parent_it = devices.find(parent_name);
         if (parent_it == devices.cend()) {
-            // Connected to a sensor?
-            if (sensors.count(parent_name)) {
-                // give parent his child
-                const std::string& port = i.second->port();
-                if (!port.empty()) {
-                    _sensors[parent_name].addChild (port, name);
-                }
-            }
-            else
+            if (!sensors.count(parent_name))
                 log_debug ("sa: sensor '%s' ignored (location is unknown/not a power device/not a sensor '%s')", name.c_str(), parent_name.c_str());
-
+            _scheduler.remove (name);
             continue;
         }
         const AssetState::Asset *parent = parent_it->second.get();
         const std::string& ip = parent->IP();
         int chain = parent->daisychain();
 
-        Sensor::ChildrenMap children = _sensors [name].getChildren ();
+        // give the sensor its children
+        Sensor::ChildrenMap children;
+        auto located = _located.find(name);
+        if (located != _located.end()) {
+            for (const auto& child_name : located->second) {
+                auto child = sensors.find(child_name);
+                if (child != sensors.end() && !child->second->port().empty())
+                    children.emplace(child->second->port(), child_name);
+            }
+        }
 
         if (chain <= 1) {
             // connected to standalone ups or chain master
-            _sensors[name] = Sensor(i.second.get(), parent, children);
+            _sensors[name] = Sensor(i->second.get(), parent, children);
         } else {
             // ugh, sensor connected to daisy chain device
             auto master = deviceState.ip2master(ip);
             if (master.empty()) {
                 log_error ("sa: daisychain host for %s not found", parent_name.c_str());
-            } else {
-                _sensors[name] = Sensor(i.second.get(), parent, children, master);
+                _scheduler.remove (name);
+                continue;
             }
+            _sensors[name] = Sensor(i->second.get(), parent, children, master);
         }
+        _scheduler.add (name, now);
     }
-    log_debug ("sa: loaded %zd nut sensors", _sensors.size());
-
+    log_debug ("sa: %zd nut sensors (%zd assets looked at)", _sensors.size(), dirty.size());
 }
 
 void Sensors::publish (mlm_client_t *client, int ttl)
@@ -116,6 +154,30 @@ void Sensors::publish (mlm_client_t *client, int ttl)
     }
 }
 
+void Sensors::poll (mlm_client_t *client, int ttl, int64_t now)
+{
+    std::vector<std::string> due;
+    _scheduler.due (now, due);
+    _scheduler.report ("sa", now);
+    if (due.empty ())
+        return;
+    std::shared_ptr<const NutSnapshot> snapshot = NutSnapshots.get ();
+    for (const auto& name : due) {
+        auto it = _sensors.find (name);
+        if (it == _sensors.end ())
+            continue;
+        if (snapshot)
+            it->second.update (*snapshot);
+        if (client)
+            it->second.publish (client, ttl);
+    }
+}
+
+void Sensors::setPollingMs (uint64_t polling_ms)
+{
+    _scheduler.setInterval (polling_ms, zclock_mono ());
+}
+
 
 //  --------------------------------------------------------------------------
 //  Self test of this class
@@ -198,6 +260,66 @@ sensor_list_test (bool verbose)
     assert (list._sensors["sensor-2"].sensorPrefix() == "device.2.ambient.21.");
     assert (list._sensors["sensor-2"].topicSuffix() == ".21@epdu-2");
 
+    // values come from the snapshot published by the NUT actor, the
+    // daisy-chained sensor is read from the master's NUT device
+    std::shared_ptr<NutSnapshot> snapshot = std::make_shared<NutSnapshot>();
+    snapshot->add("ups-1", {
+            { "ambient.temperature", { "21.5" } },
+            { "ambient.humidity", { "40" } } });
+    snapshot->add("epdu-1", {
+            { "device.2.ambient.21.temperature", { "30" } },
+            { "device.2.ambient.21.contacts.1.status", { "open" } },
+            { "device.2.ambient.21.contacts.2.status", { "unknown" } } });
+    NutSnapshots.publish(snapshot);
+    list.updateFromNUT ();
+    assert (list._sensors["sensor-1"]._temperature == "21.5");
+    assert (list._sensors["sensor-1"]._humidity == "40");
+    assert (list._sensors["sensor-1"]._contacts.empty());
+    assert (list._sensors["sensor-2"]._temperature == "30");
+    assert (list._sensors["sensor-2"]._humidity.empty());
+    assert (list._sensors["sensor-2"]._contacts.size() == 1);
+    assert (list._sensors["sensor-2"]._contacts[0] == "open");
+
+    // each sensor is updated in its own slot of the polling interval
+    list.setPollingMs (1000);
+    assert (list._scheduler.contains ("sensor-1"));
+    assert (list._scheduler.contains ("sensor-2"));
+    snapshot = std::make_shared<NutSnapshot>(NutSnapshots.get());
+    snapshot->add("ups-1", { { "ambient.temperature", { "22" } } });
+    NutSnapshots.publish(snapshot);
+    // within one interval, every slot has come
+    list.poll (nullptr, 60, zclock_mono () + 1000);
+    assert (list._sensors["sensor-1"]._temperature == "22");
+    assert (list._sensors["sensor-2"]._temperature == "30");
+    assert (list._scheduler.statistics ("sensor-1")->polls == 1);
+    assert (list.pollTimeout (zclock_mono ()) >= 0);
+
+    // only the sensors affected by a change are rebuilt: the others keep
+    // their values
+    assert (list._sensors["sensor-2"]._children.size () == 1);
+    asset = fty_proto_new (FTY_PROTO_ASSET);
+    fty_proto_set_name (asset, "sensor-1");
+    fty_proto_set_operation (asset, FTY_PROTO_ASSET_OP_DELETE);
+    writer.getState().updateFromProto(asset);
+    fty_proto_destroy(&asset);
+    writer.commit();
+    list.updateSensorList ();
+    assert (list._sensors.size() == 1);
+    assert (!list._scheduler.contains ("sensor-1"));
+    assert (list._sensors["sensor-2"]._temperature == "30");
+    // the parent of a removed sensor loses the child
+    asset = fty_proto_new (FTY_PROTO_ASSET);
+    fty_proto_set_name (asset, "sensorgpio-1");
+    fty_proto_set_operation (asset, FTY_PROTO_ASSET_OP_DELETE);
+    writer.getState().updateFromProto(asset);
+    fty_proto_destroy(&asset);
+    writer.commit();
+    list.updateSensorList ();
+    assert (list._sensors.size() == 1);
+    assert (list._sensors["sensor-2"]._children.empty ());
+    assert (list._scheduler.contains ("sensor-2"));
+    NutSnapshots.publish(nullptr);
+
     //  @end
     printf ("OK\n");
 }
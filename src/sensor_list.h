@@ -24,6 +24,8 @@
 
 #include "sensor_device.h"
 #include "state_manager.h"
+#include "nut_snapshot.h"
+#include "poll_scheduler.h"
 
 class Sensors {
  public:
@@ -31,13 +33,26 @@ class Sensors {
     void updateFromNUT ();
     void updateSensorList ();
     void publish (mlm_client_t *client, int ttl);
+    // Updates the sensors whose slot has come from the last NUT snapshot
+    // and publishes them
+    void poll (mlm_client_t *client, int ttl, int64_t now);
+    // Time until the next sensor is due, -1 if there are no sensors
+    int64_t pollTimeout (int64_t now) const {
+        return _scheduler.timeout (now);
+    }
+    void setPollingMs (uint64_t polling_ms);
 
     // friend function for unit-testing
     friend void sensor_list_test (bool verbose);
     friend void sensor_actor_test (bool verbose);
  protected:
     std::map <std::string, Sensor>  _sensors; // name | Sensor
+    // Location of each sensor at the last update, and the sensors located
+    // on each asset, to find the sensors affected by a change
+    std::map <std::string, std::string> _locations;
+    std::map <std::string, std::set<std::string>> _located;
     std::unique_ptr<StateManager::Reader> _state_reader;
+    PollScheduler _scheduler;
 };
 
 //  Self test of this class
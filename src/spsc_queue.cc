@@ -0,0 +1,89 @@
+/*  =========================================================================
+    spsc_queue - Unbounded single-producer single-consumer queue
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    spsc_queue - Unbounded single-producer single-consumer queue
+@discuss
+@end
+*/
+
+#include "spsc_queue.h"
+
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+spsc_queue_test (bool verbose)
+{
+    printf (" * spsc_queue: ");
+
+    //  @selftest
+    {
+        SpscQueue<std::string> queue;
+        std::string value;
+        assert(!queue.pop(value));
+        queue.push("a");
+        queue.push("b");
+        assert(queue.pop(value) && value == "a");
+        queue.push("c");
+        assert(queue.pop(value) && value == "b");
+        assert(queue.pop(value) && value == "c");
+        assert(!queue.pop(value));
+        // Values left in the queue are released with it
+        queue.push("d");
+    }
+    {
+        // Move-only values
+        SpscQueue<std::unique_ptr<int>> queue;
+        queue.push(std::unique_ptr<int>(new int(42)));
+        std::unique_ptr<int> value;
+        assert(queue.pop(value) && *value == 42);
+    }
+    {
+        // Order is kept across threads
+        const int count = 100000;
+        SpscQueue<int> queue;
+        std::thread producer([&]() {
+            for (int i = 0; i < count; i++)
+                queue.push(i);
+        });
+        int expected = 0, value;
+        while (expected < count) {
+            if (queue.pop(value)) {
+                assert(value == expected);
+                expected++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        producer.join();
+        assert(!queue.pop(value));
+    }
+    //  @end
+    printf ("OK\n");
+}
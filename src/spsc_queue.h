@@ -0,0 +1,94 @@
+/*  =========================================================================
+    spsc_queue - Unbounded single-producer single-consumer queue
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef SPSC_QUEUE_H_INCLUDED
+#define SPSC_QUEUE_H_INCLUDED
+
+/*
+ * SpscQueue passes values from one producer thread to one consumer thread
+ * without locks. It is a linked list of nodes, the consumer side starts
+ * with a dummy node and the producer only ever touches the last node.
+ * Neither push() nor pop() block, the consumer needs a separate way to
+ * learn that values are available (e.g. a pipe polled in its zpoller):
+ *
+ * SpscQueue<std::string> queue;
+ * // producer thread
+ * queue.push("value");
+ * // consumer thread
+ * std::string value;
+ * while (queue.pop(value)) { ... }
+ */
+
+#include <atomic>
+#include <utility>
+
+template <typename T>
+class SpscQueue {
+public:
+    SpscQueue()
+        : head_(new Node)
+        , tail_(head_)
+    {
+    }
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+    ~SpscQueue()
+    {
+        while (head_) {
+            Node *next = head_->next.load(std::memory_order_relaxed);
+            delete head_;
+            head_ = next;
+        }
+    }
+    // Producer side
+    void push(T value)
+    {
+        Node *node = new Node;
+        node->value = std::move(value);
+        tail_->next.store(node, std::memory_order_release);
+        tail_ = node;
+    }
+    // Consumer side, returns false if the queue is empty
+    bool pop(T& value)
+    {
+        Node *next = head_->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        value = std::move(next->value);
+        delete head_;
+        head_ = next;
+        return true;
+    }
+private:
+    struct Node {
+        std::atomic<Node *> next { nullptr };
+        T value;
+    };
+    // Dummy node, owned by the consumer
+    Node *head_;
+    // Last node, owned by the producer
+    Node *tail_;
+};
+
+//  Self test of this class
+void spsc_queue_test (bool verbose);
+
+#endif
@@ -60,10 +60,13 @@
 @end
 */
 
+#include <algorithm>
 #include <cassert>
+#include <map>
 #include <thread>
 
 #include "state_manager.h"
+#include <fty_log.h>
 
 StateManager::StateManager()
     : writer_(*this)
@@ -83,9 +86,63 @@ StateManager::~StateManager()
 
 StateManager::Writer::Writer(StateManager& manager)
     : manager_(manager)
+    , batch_max_messages_(STATE_BATCH_MAX_MESSAGES)
+    , batch_max_ms_(STATE_BATCH_MAX_MS)
+    , batch_messages_(0)
+    , batch_updates_(0)
+    , batch_start_(0)
 {
 }
 
+void StateManager::Writer::commit(size_t batch_size)
+{
+    int64_t start = zclock_usecs();
+    manager_.commit();
+    int64_t duration = zclock_usecs() - start;
+
+    stats_.commits++;
+    stats_.updates += batch_size;
+    stats_.last_batch_size = batch_size;
+    stats_.max_batch_size = std::max(stats_.max_batch_size, batch_size);
+    stats_.last_commit_us = duration;
+    stats_.max_commit_us = std::max(stats_.max_commit_us, duration);
+    stats_.total_commit_us += duration;
+}
+
+void StateManager::Writer::beginBatch()
+{
+    batch_messages_ = 0;
+    batch_updates_ = 0;
+    batch_start_ = zclock_mono();
+}
+
+void StateManager::Writer::batchAdd(bool changed)
+{
+    batch_messages_++;
+    if (changed)
+        batch_updates_++;
+}
+
+bool StateManager::Writer::batchFull() const
+{
+    return batch_messages_ >= batch_max_messages_ ||
+        zclock_mono() - batch_start_ >= batch_max_ms_;
+}
+
+bool StateManager::Writer::commitBatch()
+{
+    if (batch_updates_ == 0)
+        return false;
+    commit(batch_updates_);
+    log_debug("Committed %zu updates from %zu messages in %" PRIi64 " us "
+            "(%" PRIu64 " commits, %" PRIu64 " updates, largest batch %zu)",
+            batch_updates_, batch_messages_, stats_.last_commit_us,
+            stats_.commits, stats_.updates, stats_.max_batch_size);
+    batch_messages_ = 0;
+    batch_updates_ = 0;
+    return true;
+}
+
 StateManager::Reader::Reader(StateManager& manager)
     : manager_(manager)
     // Called with readers_mutex_ held
@@ -131,7 +188,8 @@ void StateManager::cleanup()
 }
 
 // Pushes uncommitted_ onto the back of the state queue, cleaning up as part
-// of the process
+// of the process. The asset maps are persistent, so the copy shares all the
+// unmodified assets with the previous states
 void StateManager::commit()
 {
     while (true) {
@@ -148,7 +206,9 @@ void StateManager::commit()
         else
             break;
     }
-    uncommitted_.recompute();
+    // Only the writer appends to or removes from the queue, so the last
+    // committed state can be accessed without locking
+    uncommitted_.computeChanges(states_.back());
     // For the Reader constructor, the update of the write_counter_ and the
     // queue must happen atomically. We could split the mutex into two, one
     // protecting the readers_ list and one ensuring this atomicity, but
@@ -158,17 +218,24 @@ void StateManager::commit()
     ++write_counter_;
 }
 
-// Updates current_view_ to refer to the most recent state
-bool StateManager::Reader::refresh()
+// Updates current_view_ to refer to the most recent state, merging the
+// change sets of the skipped states if requested
+bool StateManager::Reader::refresh(AssetState::ChangeSet *changes)
 {
     bool ret = first_refresh_;
-    first_refresh_ = false;
+    if (changes)
+        changes->clear();
     // Inv2
     while (read_counter_ != manager_.write_counter_) {
         ret = true;
         ++current_view_;
         ++read_counter_;
+        if (changes && !first_refresh_ && current_view_->getChanges())
+            changes->merge(*current_view_->getChanges());
     }
+    if (changes && first_refresh_)
+        current_view_->getAllAsAdded(*changes);
+    first_refresh_ = false;
     return ret;
 }
 
@@ -348,6 +415,219 @@ public:
             assert(reader2->getState().ip2master("192.0.2.3") == "ups-1");
             assert(reader2->getState().getSensors().empty());
         }
+        {
+            // License limit: only a prefix of the power devices is allowed
+            const char *names[] = { "epdu-2", "sts-3" };
+            for (auto name : names) {
+                fty_proto_t *msg = fty_proto_new(FTY_PROTO_ASSET);
+                assert(msg);
+                fty_proto_set_name(msg, "%s", name);
+                fty_proto_set_operation(msg, FTY_PROTO_ASSET_OP_CREATE);
+                fty_proto_aux_insert(msg, "type", "device");
+                fty_proto_aux_insert(msg, "subtype", "%s", std::string(name).substr(0, std::string(name).find('-')).c_str());
+                writer.getState().updateFromProto(msg);
+                fty_proto_destroy(&msg);
+            }
+            fty_proto_t *msg = fty_proto_new(FTY_PROTO_METRIC);
+            assert(msg);
+            fty_proto_set_name(msg, "rackcontroller-0");
+            fty_proto_set_type(msg, "power_nodes.max_active");
+            fty_proto_set_value(msg, "2");
+            assert(writer.getState().updateFromProto(msg));
+            fty_proto_destroy(&msg);
+            writer.commit();
+            assert(reader2->refresh());
+            auto& all2 = reader2->getState().getAllPowerDevices();
+            assert(all2.size() == 3);
+            auto& devs2 = reader2->getState().getPowerDevices();
+            assert(devs2.size() == 2);
+            assert(devs2.count("epdu-2") == 1);
+            assert(devs2.count("sts-3") == 1);
+            assert(devs2.count("ups-1") == 0);
+            // reader1 still sees its old snapshot
+            auto& devs1 = reader1->getState().getPowerDevices();
+            assert(devs1.size() == 1);
+            assert(devs1.at("ups-1")->IP() == "192.0.2.1");
+        }
+        {
+            // Coalesce several updates into a single commit
+            size_t states = manager.states_.size();
+            uint64_t commits = writer.getStatistics().commits;
+            writer.setBatchLimits(3, 60000);
+            writer.beginBatch();
+            assert(!writer.batchFull());
+            // An empty batch does not commit
+            assert(!writer.commitBatch());
+            assert(manager.states_.size() == states);
+            for (int i = 0; i < 3; i++) {
+                fty_proto_t *msg = fty_proto_new(FTY_PROTO_ASSET);
+                assert(msg);
+                fty_proto_set_name(msg, "sensor-%d", i);
+                fty_proto_set_operation(msg, FTY_PROTO_ASSET_OP_CREATE);
+                fty_proto_aux_insert(msg, "type", "device");
+                fty_proto_aux_insert(msg, "subtype", "sensor");
+                fty_proto_aux_insert(msg, "parent_name.1", "ups-1");
+                writer.batchAdd(writer.getState().updateFromProto(msg));
+                fty_proto_destroy(&msg);
+            }
+            assert(writer.batchFull());
+            assert(writer.commitBatch());
+            assert(manager.states_.size() == states + 1);
+            assert(writer.getStatistics().commits == commits + 1);
+            assert(writer.getStatistics().last_batch_size == 3);
+            assert(writer.getStatistics().max_batch_size >= 3);
+            assert(reader2->refresh());
+            assert(reader2->getState().getSensors().size() == 3);
+            writer.setBatchLimits(STATE_BATCH_MAX_MESSAGES, STATE_BATCH_MAX_MS);
+        }
+        {
+            // Change sets
+            StateManager manager3;
+            StateManager::Writer& writer3 = manager3.getWriter();
+            StateManager::Reader* reader5 = manager3.getReader();
+            AssetState::ChangeSet changes;
+            auto update = [&](const char *name, const char *op,
+                    const char *subtype, const char *ip, const char *chain) {
+                fty_proto_t *msg = fty_proto_new(FTY_PROTO_ASSET);
+                assert(msg);
+                fty_proto_set_name(msg, "%s", name);
+                fty_proto_set_operation(msg, "%s", op);
+                fty_proto_aux_insert(msg, "type", "device");
+                fty_proto_aux_insert(msg, "subtype", "%s", subtype);
+                fty_proto_ext_insert(msg, "ip.1", "%s", ip);
+                fty_proto_ext_insert(msg, "daisy_chain", "%s", chain);
+                writer3.getState().updateFromProto(msg);
+                fty_proto_destroy(&msg);
+            };
+            assert(reader5->refresh(&changes));
+            assert(changes.empty());
+            update("ups-1", FTY_PROTO_ASSET_OP_CREATE, "ups", "192.0.2.1", "0");
+            writer3.commit();
+            update("epdu-2", FTY_PROTO_ASSET_OP_CREATE, "epdu", "192.0.2.2", "1");
+            update("epdu-3", FTY_PROTO_ASSET_OP_CREATE, "epdu", "192.0.2.2", "2");
+            update("sensor-4", FTY_PROTO_ASSET_OP_CREATE, "sensor", "", "0");
+            writer3.commit();
+            // Two commits are merged
+            assert(reader5->refresh(&changes));
+            assert(changes.added.size() == 4);
+            assert(changes.removed.empty() && changes.updated.empty());
+            assert(reader5->refresh(&changes) == false);
+            assert(changes.empty());
+            // A new reader sees all assets as added
+            StateManager::Reader* reader6 = manager3.getReader();
+            assert(reader6->refresh(&changes));
+            assert(changes.added.size() == 4);
+            delete reader6;
+
+            update("ups-1", FTY_PROTO_ASSET_OP_UPDATE, "ups", "192.0.2.1", "0");
+            update("sensor-4", FTY_PROTO_ASSET_OP_DELETE, "sensor", "", "0");
+            update("ups-5", FTY_PROTO_ASSET_OP_CREATE, "ups", "192.0.2.5", "0");
+            writer3.commit();
+            update("ups-5", FTY_PROTO_ASSET_OP_DELETE, "ups", "", "0");
+            writer3.commit();
+            assert(reader5->refresh(&changes));
+            assert(changes.added.empty());
+            assert(changes.removed.size() == 1 && changes.removed.count("sensor-4"));
+            assert(changes.updated.size() == 1 && changes.updated.count("ups-1"));
+
+            // Moving the daisy-chain master also updates the slave
+            update("epdu-2", FTY_PROTO_ASSET_OP_UPDATE, "epdu", "192.0.2.2", "1");
+            writer3.commit();
+            assert(reader5->refresh(&changes));
+            assert(changes.updated.size() == 1 && changes.updated.count("epdu-2"));
+            update("epdu-2", FTY_PROTO_ASSET_OP_UPDATE, "epdu", "192.0.2.6", "1");
+            writer3.commit();
+            assert(reader5->refresh(&changes));
+            assert(changes.updated.size() == 2 && changes.updated.count("epdu-3"));
+
+            // The license limit hides assets
+            fty_proto_t *msg = fty_proto_new(FTY_PROTO_METRIC);
+            assert(msg);
+            fty_proto_set_name(msg, "rackcontroller-0");
+            fty_proto_set_type(msg, "power_nodes.max_active");
+            fty_proto_set_value(msg, "1");
+            writer3.getState().updateFromProto(msg);
+            fty_proto_destroy(&msg);
+            writer3.commit();
+            assert(reader5->refresh(&changes));
+            assert(changes.added.empty() && changes.updated.empty());
+            assert(changes.removed.size() == 2);
+            assert(changes.removed.count("epdu-3") && changes.removed.count("ups-1"));
+            // An asset outside of the license is not visible
+            update("ups-7", FTY_PROTO_ASSET_OP_CREATE, "ups", "192.0.2.7", "0");
+            writer3.commit();
+            assert(reader5->refresh(&changes));
+            assert(changes.empty());
+        }
+        {
+            // Random updates: the incrementally maintained license window,
+            // ip2master and change sets match a computation from scratch
+            StateManager manager4;
+            StateManager::Writer& writer4 = manager4.getWriter();
+            StateManager::Reader* reader7 = manager4.getReader();
+            AssetState::ChangeSet changes;
+            std::set<std::string> visible;
+            unsigned seed = 42;
+            auto rnd = [&](unsigned n) {
+                seed = seed * 1103515245 + 12345;
+                return (seed >> 16) % n;
+            };
+            for (int round = 0; round < 200; round++) {
+                for (int i = rnd(5); i >= 0; i--) {
+                    fty_proto_t *msg;
+                    if (rnd(10) == 0) {
+                        msg = fty_proto_new(FTY_PROTO_METRIC);
+                        assert(msg);
+                        fty_proto_set_name(msg, "rackcontroller-0");
+                        fty_proto_set_type(msg, "power_nodes.max_active");
+                        fty_proto_set_value(msg, "%d", int(rnd(12)) - 2);
+                    } else {
+                        msg = fty_proto_new(FTY_PROTO_ASSET);
+                        assert(msg);
+                        fty_proto_set_name(msg, "ups-%u", rnd(20));
+                        fty_proto_set_operation(msg, "%s", rnd(3) ?
+                                FTY_PROTO_ASSET_OP_UPDATE : FTY_PROTO_ASSET_OP_DELETE);
+                        fty_proto_aux_insert(msg, "type", "device");
+                        fty_proto_aux_insert(msg, "subtype", "ups");
+                        fty_proto_ext_insert(msg, "ip.1", "192.0.2.%u", rnd(4));
+                        fty_proto_ext_insert(msg, "daisy_chain", "%u", rnd(3));
+                    }
+                    writer4.getState().updateFromProto(msg);
+                    fty_proto_destroy(&msg);
+                }
+                writer4.commit();
+                reader7->refresh(&changes);
+                const AssetState& state = reader7->getState();
+                auto& all = state.getAllPowerDevices();
+                auto& allowed = state.getPowerDevices();
+                // The allowed devices are a prefix of all devices
+                auto it = all.begin();
+                for (auto& i : allowed) {
+                    assert(it != all.end() && it->first == i.first);
+                    assert(it->second == i.second);
+                    ++it;
+                }
+                assert(allowed.size() == all.size() || allowed.size() < 10);
+                std::map<std::string, std::string> ip2master;
+                for (auto& i : all) {
+                    if (i.second->daisychain() <= 1)
+                        ip2master[i.second->IP()] = i.first;
+                }
+                for (int i = 0; i < 4; i++) {
+                    std::string ip = "192.0.2." + std::to_string(i);
+                    assert(state.ip2master(ip) == ip2master[ip]);
+                }
+                for (auto& name : changes.removed)
+                    assert(visible.erase(name) == 1);
+                for (auto& name : changes.added)
+                    assert(visible.insert(name).second);
+                for (auto& name : changes.updated)
+                    assert(visible.count(name) == 1);
+                assert(visible.size() == allowed.size());
+                for (auto& i : allowed)
+                    assert(visible.count(i.first) == 1);
+            }
+        }
 	{
             // Special case: commit when no reader is connected
             StateManager manager2;
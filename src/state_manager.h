@@ -60,6 +60,16 @@
  *     }
  * }
  *
+ * Alternatively, a reader can ask for the names of the assets that changed
+ * since its previous refresh, to avoid walking all the assets:
+ *
+ * AssetState::ChangeSet changes;
+ * if (reader->refresh(&changes)) {
+ *     for (auto& name : changes.removed) ...
+ *     for (auto& name : changes.added) ...
+ *     for (auto& name : changes.updated) ...
+ * }
+ *
  * The returned Reader and Writer objects are only valid throughout the
  * lifetime of the StateManager instance, the easiest is therefore to create
  * the StateManager as a global object. The Reader poiners can be delete()d
@@ -68,6 +78,7 @@
  */
 
 #include <atomic>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <list>
@@ -75,6 +86,10 @@
 
 #include "asset_state.h"
 
+// Default limits for coalescing a burst of ASSETS messages into one commit
+#define STATE_BATCH_MAX_MESSAGES 1000
+#define STATE_BATCH_MAX_MS       50
+
 class StateManagerTest;
 
 class StateManager {
@@ -90,7 +105,12 @@ public:
         {
             manager_.putReader(this);
         }
-        bool refresh();
+        // Returns true if the state changed since the last call. If changes
+        // is not null, it is filled with the assets that were added, removed
+        // or updated in the meantime. The first call reports all assets as
+        // added. Note that the change set may be empty even if the state
+        // changed, e.g. when a change is not visible via the license
+        bool refresh(AssetState::ChangeSet *changes = nullptr);
         const AssetState& getState() const
         {
             return *current_view_;
@@ -106,18 +126,65 @@ public:
 
     class Writer {
     public:
+        // Counters describing the coalescing of updates into commits
+        struct Statistics {
+            // Number of commits and number of updates they carried
+            uint64_t commits = 0;
+            uint64_t updates = 0;
+            // Number of updates in the last and in the largest batch
+            size_t last_batch_size = 0;
+            size_t max_batch_size = 0;
+            // Time spent in commit(), in microseconds
+            int64_t last_commit_us = 0;
+            int64_t max_commit_us = 0;
+            int64_t total_commit_us = 0;
+        };
         Writer(const Writer&) = delete;
         void commit()
         {
-            manager_.commit();
+            commit(1);
         }
         AssetState& getState()
         {
             return manager_.getUncommittedAssets();
         }
+        // A burst of stream messages can be coalesced into a single commit
+        // as follows:
+        //
+        // writer.beginBatch();
+        // do {
+        //     writer.batchAdd(writer.getState().updateFromProto(msg));
+        // } while (!writer.batchFull() && (msg = next pending message));
+        // writer.commitBatch();
+        //
+        // The batch is bounded both by the number of messages and by the
+        // time elapsed since beginBatch(), so that a continuous stream of
+        // updates does not delay the readers indefinitely.
+        void beginBatch();
+        void batchAdd(bool changed);
+        bool batchFull() const;
+        // Commits the batch if any message changed the state. Returns true
+        // if a commit happened
+        bool commitBatch();
+        void setBatchLimits(size_t max_messages, int64_t max_ms)
+        {
+            batch_max_messages_ = max_messages;
+            batch_max_ms_ = max_ms;
+        }
+        const Statistics& getStatistics() const
+        {
+            return stats_;
+        }
     private:
         explicit Writer(StateManager& manager);
+        void commit(size_t batch_size);
         StateManager& manager_;
+        size_t batch_max_messages_;
+        int64_t batch_max_ms_;
+        size_t batch_messages_;
+        size_t batch_updates_;
+        int64_t batch_start_;
+        Statistics stats_;
         friend class StateManager;
     };
 
@@ -147,7 +214,25 @@ private:
 
 // fty_nut_server.cc
 extern StateManager NutStateManager;
-void get_initial_assets(StateManager::Writer& state_writer, mlm_client_t *client, bool query_licensing = false);
+// Tuning of the initial ASSET_DETAIL requests
+struct InitialAssetsOptions {
+    // Maximum number of requests in flight
+    size_t window = 32;
+    // Time to wait for a reply before resending a request
+    int timeout_ms = 5000;
+    // Number of times a request is resent before giving up
+    int retries = 3;
+    // Called after each commit of the received assets
+    std::function<void()> on_commit;
+    // Actor pipe watched while waiting for the replies, if any. Its messages
+    // are passed to on_pipe, which returns false to stop; without on_pipe,
+    // $TERM stops and the other messages are dropped
+    zsock_t *pipe = nullptr;
+    std::function<bool(zmsg_t **message)> on_pipe;
+};
+bool get_initial_assets(StateManager::Writer& state_writer, mlm_client_t *client,
+        bool query_licensing = false,
+        const InitialAssetsOptions& options = InitialAssetsOptions());
 
 //  Self test of this class
 void state_manager_test (bool verbose);